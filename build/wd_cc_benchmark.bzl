@@ -0,0 +1,24 @@
+"""wd_cc_benchmark definition"""
+
+def wd_cc_benchmark(
+        src,
+        deps = [],
+        tags = []):
+    """Wrapper for cc_binary that links a google-benchmark based benchmark.
+
+    Benchmarks are binaries rather than tests so that they don't run as part of `bazel test`;
+    run them with `bazel run -c opt //src/workerd/tests:bench-<name>`.
+    """
+    native.cc_binary(
+        name = src.removesuffix(".c++"),
+        srcs = [src],
+        deps = [
+            "@com_google_benchmark//:benchmark_main",
+        ] + deps,
+        linkopts = select({
+            "@//:use_dead_strip": ["-Wl,-dead_strip"],
+            "//conditions:default": [""],
+        }),
+        tags = ["benchmark"] + tags,
+        testonly = True,
+    )
@@ -82,6 +82,146 @@ KJ_TEST("we support deserializing up to v15") {
   }
 }
 
+KJ_TEST("compact storage encoding round trips") {
+  jsg::test::Evaluator<ActorStateContext, ActorStateIsolate> e(v8System);
+  ActorStateIsolate &actorStateIsolate = e.getIsolate();
+  jsg::V8StackScope stackScope;
+  ActorStateIsolate::Lock isolateLock(actorStateIsolate, stackScope);
+  auto* isolate = isolateLock.v8Isolate;
+  v8::HandleScope handleScope(isolate);
+  auto v8Context = isolateLock.newContext<ActorStateContext>().getHandle(isolate);
+  v8::Context::Scope contextScope(v8Context);
+
+  auto expectCompactRoundTrip = [&](v8::Local<v8::Value> value) {
+    auto buf = serializeV8Value(value, isolate, StorageValueEncoding::COMPACT);
+    KJ_EXPECT(buf[0] == 0xFE);
+    auto result = deserializeV8Value("some-key"_kj, buf, isolate);
+    KJ_EXPECT(result->SameValue(value));
+  };
+
+  expectCompactRoundTrip(v8::Integer::New(isolate, -12345));
+  expectCompactRoundTrip(v8::Integer::New(isolate, INT32_MIN));
+  expectCompactRoundTrip(v8::Integer::New(isolate, INT32_MAX));
+  expectCompactRoundTrip(v8::Number::New(isolate, 1.5));
+  expectCompactRoundTrip(v8::Number::New(isolate, -0.0));
+  expectCompactRoundTrip(jsg::v8Str(isolate, "hello"));
+  expectCompactRoundTrip(jsg::v8Str(isolate, "h\xc3\xa9llo \xe2\x98\x83"));
+  expectCompactRoundTrip(jsg::v8Str(isolate, ""));
+  expectCompactRoundTrip(v8::True(isolate));
+  expectCompactRoundTrip(v8::False(isolate));
+  expectCompactRoundTrip(v8::Null(isolate));
+
+  {
+    auto obj = v8::Object::New(isolate);
+    jsg::check(obj->Set(v8Context, jsg::v8Str(isolate, "a"), v8::Integer::New(isolate, 1)));
+    jsg::check(obj->Set(v8Context, jsg::v8Str(isolate, "b"), jsg::v8Str(isolate, "x")));
+    jsg::check(obj->Set(v8Context, jsg::v8Str(isolate, "c"), v8::Undefined(isolate)));
+    auto buf = serializeV8Value(obj, isolate, StorageValueEncoding::COMPACT);
+    KJ_EXPECT(buf[0] == 0xFE);
+
+    auto result = deserializeV8Value("some-key"_kj, buf, isolate);
+    KJ_ASSERT(result->IsObject());
+    auto names = jsg::check(result.As<v8::Object>()->GetOwnPropertyNames(v8Context));
+    KJ_EXPECT(names->Length() == 3);
+    auto get = [&](kj::StringPtr name) {
+      return jsg::check(result.As<v8::Object>()->Get(v8Context, jsg::v8Str(isolate, name)));
+    };
+    KJ_EXPECT(get("a")->StrictEquals(v8::Integer::New(isolate, 1)));
+    KJ_EXPECT(get("b")->StrictEquals(jsg::v8Str(isolate, "x")));
+    KJ_EXPECT(get("c")->IsUndefined());
+  }
+
+  {
+    // Values the compact encoding doesn't cover fall back to the V8 serializer.
+    auto nested = v8::Object::New(isolate);
+    jsg::check(nested->Set(v8Context, jsg::v8Str(isolate, "inner"), v8::Object::New(isolate)));
+    auto array = v8::Array::New(isolate, 2);
+    auto date = jsg::check(v8::Date::New(v8Context, 0));
+
+    for (v8::Local<v8::Value> value: { v8::Local<v8::Value>(nested), v8::Local<v8::Value>(array),
+                                       date }) {
+      auto buf = serializeV8Value(value, isolate, StorageValueEncoding::COMPACT);
+      KJ_EXPECT(buf[0] == 0xFF);
+      KJ_EXPECT(deserializeV8Value("some-key"_kj, buf, isolate)->IsObject());
+    }
+  }
+
+  {
+    // An object that refers back to itself is handed to the V8 serializer as is, so the reference
+    // survives the round trip.
+    auto obj = v8::Object::New(isolate);
+    jsg::check(obj->Set(v8Context, jsg::v8Str(isolate, "a"), v8::Integer::New(isolate, 1)));
+    jsg::check(obj->Set(v8Context, jsg::v8Str(isolate, "self"), obj));
+    auto buf = serializeV8Value(obj, isolate, StorageValueEncoding::COMPACT);
+    KJ_EXPECT(buf[0] == 0xFF);
+
+    auto result = deserializeV8Value("some-key"_kj, buf, isolate);
+    KJ_ASSERT(result->IsObject());
+    auto self = jsg::check(result.As<v8::Object>()->Get(v8Context, jsg::v8Str(isolate, "self")));
+    KJ_EXPECT(self->StrictEquals(result));
+  }
+
+  {
+    // Accessors also go to the V8 serializer, and their getters run only once.
+    uint getterCalls = 0;
+    auto getter = jsg::check(v8::Function::New(v8Context,
+        [](const v8::FunctionCallbackInfo<v8::Value>& info) {
+      ++*static_cast<uint*>(info.Data().As<v8::External>()->Value());
+      info.GetReturnValue().Set(v8::Integer::New(info.GetIsolate(), 7));
+    }, v8::External::New(isolate, &getterCalls)));
+    auto obj = v8::Object::New(isolate);
+    obj->SetAccessorProperty(jsg::v8Str(isolate, "x"), getter);
+    auto buf = serializeV8Value(obj, isolate, StorageValueEncoding::COMPACT);
+    KJ_EXPECT(buf[0] == 0xFF);
+    KJ_EXPECT(getterCalls == 1);
+
+    auto result = deserializeV8Value("some-key"_kj, buf, isolate);
+    KJ_ASSERT(result->IsObject());
+    auto x = jsg::check(result.As<v8::Object>()->Get(v8Context, jsg::v8Str(isolate, "x")));
+    KJ_EXPECT(x->StrictEquals(v8::Integer::New(isolate, 7)));
+  }
+
+  // Corrupt compact data is reported rather than misread.
+  KJ_EXPECT_THROW_MESSAGE("truncated compact storage value",
+      deserializeV8Value("some-key"_kj, kj::decodeHex("FE0106"_kj.asArray()), isolate));
+  KJ_EXPECT_THROW_MESSAGE("unknown compact storage value version",
+      deserializeV8Value("some-key"_kj, kj::decodeHex("FE0202"_kj.asArray()), isolate));
+}
+
+KJ_TEST("StorageValueCache only returns values decoded from identical bytes") {
+  jsg::test::Evaluator<ActorStateContext, ActorStateIsolate> e(v8System);
+  ActorStateIsolate &actorStateIsolate = e.getIsolate();
+  jsg::V8StackScope stackScope;
+  ActorStateIsolate::Lock isolateLock(actorStateIsolate, stackScope);
+  auto* isolate = isolateLock.v8Isolate;
+  v8::HandleScope handleScope(isolate);
+  auto v8Context = isolateLock.newContext<ActorStateContext>().getHandle(isolate);
+  v8::Context::Scope contextScope(v8Context);
+
+  auto cache = kj::refcounted<StorageValueCache>();
+  auto hello = serializeV8Value(jsg::v8Str(isolate, "hello"), isolate,
+                                StorageValueEncoding::COMPACT);
+  auto bye = serializeV8Value(jsg::v8Str(isolate, "bye"), isolate);
+
+  auto first = cache->deserialize(isolate, "k"_kj, hello);
+  auto second = cache->deserialize(isolate, "k"_kj, hello);
+  KJ_EXPECT(first == second);
+  KJ_EXPECT(cache->getHitCount() == 1);
+  KJ_EXPECT(cache->getMissCount() == 1);
+
+  auto third = cache->deserialize(isolate, "k"_kj, bye);
+  KJ_EXPECT(third->StrictEquals(jsg::v8Str(isolate, "bye")));
+  KJ_EXPECT(cache->getMissCount() == 2);
+
+  // Objects are mutable, so each read must produce a new one.
+  auto objBytes = serializeV8Value(v8::Object::New(isolate), isolate,
+                                   StorageValueEncoding::COMPACT);
+  auto obj1 = cache->deserialize(isolate, "o"_kj, objBytes);
+  auto obj2 = cache->deserialize(isolate, "o"_kj, objBytes);
+  KJ_EXPECT(obj1 != obj2);
+  KJ_EXPECT(cache->getHitCount() == 1);
+}
+
 // This is hacky, but we want to compare the old deserialization logic that's been in prod from when
 // actors went live through March 2022 to the new version of the deserialization logic and make sure
 // it works the same.
@@ -33,16 +33,6 @@ uint32_t billingUnits(size_t bytes, BillAtLeastOne billAtLeastOne = BillAtLeastO
   return bytes / BILLING_UNIT + (bytes % BILLING_UNIT != 0);
 }
 
-v8::Local<v8::Value> deserializeMaybeV8Value(
-    kj::ArrayPtr<const char> key, kj::Maybe<kj::ArrayPtr<const kj::byte>> buf,
-    v8::Isolate* isolate) {
-  KJ_IF_MAYBE(b, buf) {
-    return deserializeV8Value(key, *b, isolate);
-  } else {
-    return v8::Undefined(isolate);
-  }
-}
-
 template <typename T, typename Options, typename Func>
 auto transformCacheResult(
     v8::Isolate* isolate, kj::OneOf<T, kj::Promise<T>> input, const Options& options, Func&& func)
@@ -118,6 +108,22 @@ ActorObserver& currentActorMetrics() {
   return IoContext::current().getActorOrThrow().getMetrics();
 }
 
+StorageValueEncoding currentStorageValueEncoding() {
+  return IoContext::current().getWorker().getIsolate().getApiIsolate().getFeatureFlags()
+      .getDurableObjectStorageCompactEncoding()
+      ? StorageValueEncoding::COMPACT : StorageValueEncoding::V8;
+}
+
+v8::Local<v8::Value> deserializeMaybeCached(
+    kj::Maybe<kj::Own<StorageValueCache>>& valueCache, kj::StringPtr key,
+    kj::ArrayPtr<const kj::byte> buf, v8::Isolate* isolate) {
+  KJ_IF_MAYBE(c, valueCache) {
+    return (*c)->deserialize(isolate, key, buf);
+  } else {
+    return deserializeV8Value(key, buf, isolate);
+  }
+}
+
 jsg::Value listResultsToMap(v8::Isolate* isolate, ActorCacheOps::GetResultList value, bool completelyCached) {
   v8::HandleScope scope(isolate);
   auto context = isolate->GetCurrentContext();
@@ -155,8 +161,9 @@ jsg::Value listResultsToMap(v8::Isolate* isolate, ActorCacheOps::GetResultList v
 }
 
 kj::Function<jsg::Value(v8::Isolate*, ActorCacheOps::GetResultList)> getMultipleResultsToMap(
-    size_t numInputKeys) {
-  return [numInputKeys](v8::Isolate* isolate, ActorCacheOps::GetResultList value) mutable {
+    size_t numInputKeys, kj::Maybe<kj::Own<StorageValueCache>> valueCache) {
+  return [numInputKeys, valueCache = kj::mv(valueCache)]
+         (v8::Isolate* isolate, ActorCacheOps::GetResultList value) mutable {
     v8::HandleScope scope(isolate);
     auto context = isolate->GetCurrentContext();
 
@@ -168,7 +175,7 @@ kj::Function<jsg::Value(v8::Isolate*, ActorCacheOps::GetResultList)> getMultiple
                     ? cachedUnits : uncachedUnits;
       unitsRef += billingUnits(entry.key.size() + entry.value.size());
       jsg::check(map->Set(context, jsg::v8Str(isolate, entry.key),
-          deserializeV8Value(entry.key, entry.value, isolate)));
+          deserializeMaybeCached(valueCache, entry.key, entry.value, isolate)));
     }
     auto& actorMetrics = currentActorMetrics();
     actorMetrics.addCachedStorageReadUnits(cachedUnits);
@@ -193,120 +200,67 @@ kj::Function<jsg::Value(v8::Isolate*, ActorCacheOps::GetResultList)> getMultiple
   };
 }
 
-}  // namespace
-
-jsg::Promise<jsg::Value> DurableObjectStorageOperations::get(
-    kj::OneOf<kj::String, kj::Array<kj::String>> keys, jsg::Optional<GetOptions> maybeOptions,
-    v8::Isolate* isolate) {
-  auto options = configureOptions(kj::mv(maybeOptions).orDefault(GetOptions{}));
-  KJ_SWITCH_ONEOF(keys) {
-    KJ_CASE_ONEOF(s, kj::String) {
-      return getOne(kj::mv(s), options, isolate);
-    }
-    KJ_CASE_ONEOF(a, kj::Array<kj::String>) {
-      return getMultiple(kj::mv(a), options, isolate);
-    }
-  }
-  KJ_UNREACHABLE
-}
-
-jsg::Promise<jsg::Value> DurableObjectStorageOperations::getOne(
-    kj::String key, const GetOptions& options, v8::Isolate* isolate) {
-  ActorStorageLimits::checkMaxKeySize(key);
-
-  auto result = getCache(OP_GET).get(kj::str(key), options);
-  return transformCacheResultWithCacheStatus(isolate, kj::mv(result), options,
-      [key = kj::mv(key)](v8::Isolate* isolate, kj::Maybe<ActorCacheOps::Value> value, bool cached) {
-    uint32_t units = 1;
-    KJ_IF_MAYBE(v, value) {
-      units = billingUnits(v->size());
-    }
-    auto& actorMetrics = currentActorMetrics();
-    if (cached) {
-      actorMetrics.addCachedStorageReadUnits(units);
-    } else {
-      actorMetrics.addUncachedStorageReadUnits(units);
-    }
-    return jsg::Value { isolate, deserializeMaybeV8Value(key, value, isolate) };
-  });
-}
-
-jsg::Promise<kj::Maybe<double>> DurableObjectStorageOperations::getAlarm(
-    jsg::Optional<GetAlarmOptions> maybeOptions, v8::Isolate* isolate) {
-  // Even if we do not have an alarm handler, we might once have had one. It's fine to return
-  // whatever a previous alarm setting or a falsy result.
-  auto options = configureOptions(maybeOptions.map([](auto& o) {
-    return GetOptions {
-      .allowConcurrency = o.allowConcurrency,
-      .noCache = false
-    };
-  }).orDefault(GetOptions{}));
-  auto result = getCache(OP_GET_ALARM).getAlarm(options);
-
-  return transformCacheResult(isolate, kj::mv(result), options,
-      [](v8::Isolate* isolate, kj::Maybe<kj::Date> date) {
-    return date.map([](auto& date) {
-      return static_cast<double>((date - kj::UNIX_EPOCH) / kj::MILLISECONDS);
-    });
-  });
+kj::String keyAfter(kj::StringPtr key) {
+  // Returns the key immediately after `key`, by appending a NULL byte. This looks a little sketchy
+  // to be doing with strings rather than arrays, but kj::String explicitly allows for NULL bytes
+  // inside of strings.
+  auto result = kj::heapArray<char>(key.size() + 2);
+
+  // Copy over the original string.
+  memcpy(result.begin(), key.begin(), key.size());
+  // kj::String automatically reads the last NULL as string termination, so we need to add it twice
+  // to make it stick in the final string.
+  result[result.size() - 2] = '\0';
+  result[result.size() - 1] = '\0';
+  return kj::String(kj::mv(result));
 }
 
-jsg::Promise<jsg::Value> DurableObjectStorageOperations::list(
-    jsg::Optional<ListOptions> maybeOptions, v8::Isolate* isolate) {
+struct ListRange {
   kj::String start;
   kj::Maybe<kj::String> end;
   bool reverse = false;
   kj::Maybe<uint> limit;
+};
 
-  auto makeEmptyResult = [&]() {
-    return jsg::resolvedPromise(isolate, jsg::Value(isolate, v8::Map::New(isolate)));
-  };
+kj::Maybe<ListRange> listRangeFromOptions(
+    jsg::Optional<DurableObjectStorageOperations::ListOptions>& maybeOptions) {
+  // Resolves the key range options of list() into a range with an inclusive start and exclusive
+  // end, moving the keys out of `maybeOptions`. Returns null if the range is empty.
+  ListRange range;
 
   KJ_IF_MAYBE(o, maybeOptions) {
     KJ_IF_MAYBE(s, o->start) {
       KJ_IF_MAYBE(sa, o->startAfter) {
         KJ_FAIL_REQUIRE("jsg.TypeError: list() cannot be called with both start and startAfter values.");
       }
-      start = kj::mv(*s);
+      range.start = kj::mv(*s);
     }
     KJ_IF_MAYBE(sks, o->startAfter) {
       // Convert an exclusive startAfter into an inclusive start key here so that the implementation
-      // doesn't need to handle both. This can be done simply by adding two NULL bytes. One to the end of
-      // the startAfter and another to set the start key after startAfter.
-      auto startAfterKey = kj::heapArray<char>(sks->size() + 2);
-
-      // Copy over the original string.
-      memcpy(startAfterKey.begin(), sks->begin(), sks->size());
-      // Add one additional null byte to set the new start as the key immediately
-      // after startAfter. This looks a little sketchy to be doing with strings rather
-      // than arrays, but kj::String explicitly allows for NULL bytes inside of strings.
-      startAfterKey[startAfterKey.size()-2] = '\0';
-      // kj::String automatically reads the last NULL as string termination, so we need to add it twice
-      // to make it stick in the final string.
-      startAfterKey[startAfterKey.size()-1] = '\0';
-      start = kj::String(kj::mv(startAfterKey));
+      // doesn't need to handle both.
+      range.start = keyAfter(*sks);
     }
     KJ_IF_MAYBE(e, o->end) {
-      end = kj::mv(*e);
+      range.end = kj::mv(*e);
     }
     KJ_IF_MAYBE(r, o->reverse) {
-      reverse = *r;
+      range.reverse = *r;
     }
     KJ_IF_MAYBE(l, o->limit) {
       JSG_REQUIRE(*l > 0, TypeError, "List limit must be positive.");
-      limit = *l;
+      range.limit = *l;
     }
     KJ_IF_MAYBE(prefix, o->prefix) {
       // Let's clamp `start` and `end` to include only keys with the given prefix.
       if (prefix->size() > 0) {
-        if (start < *prefix) {
+        if (range.start < *prefix) {
           // `start` is before `prefix`, so listing should actually start at `prefix`.
-          start = kj::str(*prefix);
-        } else if (start.startsWith(*prefix)) {
+          range.start = kj::str(*prefix);
+        } else if (range.start.startsWith(*prefix)) {
           // `start` is within the prefix, so need not be modified.
         } else {
           // `start` comes after the last value with the prefix, so there's no overlap.
-          return makeEmptyResult();
+          return nullptr;
         }
 
         // Calculate the first key that sorts after all keys with the given prefix.
@@ -324,40 +278,115 @@ jsg::Promise<jsg::Value> DurableObjectStorageOperations::list(
           keyAfterPrefix.add('\0');
           auto keyAfterPrefixStr = kj::String(keyAfterPrefix.releaseAsArray());
 
-          KJ_IF_MAYBE(e, end) {
+          KJ_IF_MAYBE(e, range.end) {
             if (*e <= *prefix) {
               // No keys could possibly match both the end and the prefix.
-              return makeEmptyResult();
+              return nullptr;
             } else if (e->startsWith(*prefix)) {
               // `end` is within the prefix, so need not be modified.
             } else {
               // `end` comes after all keys with the prefix, so we should stop at the end of the
               // prefix.
-              end = kj::mv(keyAfterPrefixStr);
+              range.end = kj::mv(keyAfterPrefixStr);
             }
           } else {
             // We didn't have any end set, so use the end of the prefix range.
-            end = kj::mv(keyAfterPrefixStr);
+            range.end = kj::mv(keyAfterPrefixStr);
           }
         }
       }
     }
   }
 
-  KJ_IF_MAYBE(e, end) {
-    if (*e <= start) {
+  KJ_IF_MAYBE(e, range.end) {
+    if (*e <= range.start) {
       // Key range is empty.
-      return makeEmptyResult();
+      return nullptr;
     }
   }
 
-  auto options = configureOptions(kj::mv(maybeOptions).orDefault(ListOptions{}));
-  ActorCacheOps::ReadOptions readOptions = options;
+  return kj::mv(range);
+}
 
-  auto result = reverse
-      ? getCache(OP_LIST).listReverse(kj::mv(start), kj::mv(end), limit, readOptions)
-      : getCache(OP_LIST).list(kj::mv(start), kj::mv(end), limit, readOptions);
-  return transformCacheResultWithCacheStatus(isolate, kj::mv(result), options, &listResultsToMap);
+}  // namespace
+
+jsg::Promise<jsg::Value> DurableObjectStorageOperations::get(
+    kj::OneOf<kj::String, kj::Array<kj::String>> keys, jsg::Optional<GetOptions> maybeOptions,
+    v8::Isolate* isolate) {
+  auto options = configureOptions(kj::mv(maybeOptions).orDefault(GetOptions{}));
+  KJ_SWITCH_ONEOF(keys) {
+    KJ_CASE_ONEOF(s, kj::String) {
+      return getOne(kj::mv(s), options, isolate);
+    }
+    KJ_CASE_ONEOF(a, kj::Array<kj::String>) {
+      return getMultiple(kj::mv(a), options, isolate);
+    }
+  }
+  KJ_UNREACHABLE
+}
+
+jsg::Promise<jsg::Value> DurableObjectStorageOperations::getOne(
+    kj::String key, const GetOptions& options, v8::Isolate* isolate) {
+  ActorStorageLimits::checkMaxKeySize(key);
+
+  auto result = getCache(OP_GET).get(kj::str(key), options);
+  return transformCacheResultWithCacheStatus(isolate, kj::mv(result), options,
+      [key = kj::mv(key), valueCache = getValueCache()]
+      (v8::Isolate* isolate, kj::Maybe<ActorCacheOps::Value> value, bool cached) {
+    uint32_t units = 1;
+    KJ_IF_MAYBE(v, value) {
+      units = billingUnits(v->size());
+    }
+    auto& actorMetrics = currentActorMetrics();
+    if (cached) {
+      actorMetrics.addCachedStorageReadUnits(units);
+    } else {
+      actorMetrics.addUncachedStorageReadUnits(units);
+    }
+    KJ_IF_MAYBE(v, value) {
+      return jsg::Value { isolate, deserializeMaybeCached(valueCache, key, *v, isolate) };
+    } else {
+      return jsg::Value { isolate, v8::Undefined(isolate) };
+    }
+  });
+}
+
+jsg::Promise<kj::Maybe<double>> DurableObjectStorageOperations::getAlarm(
+    jsg::Optional<GetAlarmOptions> maybeOptions, v8::Isolate* isolate) {
+  // Even if we do not have an alarm handler, we might once have had one. It's fine to return
+  // whatever a previous alarm setting or a falsy result.
+  auto options = configureOptions(maybeOptions.map([](auto& o) {
+    return GetOptions {
+      .allowConcurrency = o.allowConcurrency,
+      .noCache = false
+    };
+  }).orDefault(GetOptions{}));
+  auto result = getCache(OP_GET_ALARM).getAlarm(options);
+
+  return transformCacheResult(isolate, kj::mv(result), options,
+      [](v8::Isolate* isolate, kj::Maybe<kj::Date> date) {
+    return date.map([](auto& date) {
+      return static_cast<double>((date - kj::UNIX_EPOCH) / kj::MILLISECONDS);
+    });
+  });
+}
+
+jsg::Promise<jsg::Value> DurableObjectStorageOperations::list(
+    jsg::Optional<ListOptions> maybeOptions, v8::Isolate* isolate) {
+  KJ_IF_MAYBE(range, listRangeFromOptions(maybeOptions)) {
+    auto options = configureOptions(kj::mv(maybeOptions).orDefault(ListOptions{}));
+    ActorCacheOps::ReadOptions readOptions = options;
+
+    auto result = range->reverse
+        ? getCache(OP_LIST).listReverse(kj::mv(range->start), kj::mv(range->end), range->limit,
+                                        readOptions)
+        : getCache(OP_LIST).list(kj::mv(range->start), kj::mv(range->end), range->limit,
+                                 readOptions);
+    return transformCacheResultWithCacheStatus(isolate, kj::mv(result), options,
+                                               &listResultsToMap);
+  } else {
+    return jsg::resolvedPromise(isolate, jsg::Value(isolate, v8::Map::New(isolate)));
+  }
 }
 
 jsg::Promise<void> DurableObjectStorageOperations::put(jsg::Lock& js,
@@ -438,7 +467,7 @@ jsg::Promise<void> DurableObjectStorageOperations::putOne(
     kj::String key, v8::Local<v8::Value> value, const PutOptions& options, v8::Isolate* isolate) {
   ActorStorageLimits::checkMaxKeySize(key);
 
-  kj::Array<byte> buffer = serializeV8Value(value, isolate);
+  kj::Array<byte> buffer = serializeV8Value(value, isolate, currentStorageValueEncoding());
   ActorStorageLimits::checkMaxValueSize(key, buffer);
 
   auto units = billingUnits(key.size() + buffer.size());
@@ -523,7 +552,7 @@ jsg::Promise<jsg::Value> DurableObjectStorageOperations::getMultiple(
   auto numKeys = keys.size();
 
   return transformCacheResult(isolate, getCache(OP_GET).get(kj::mv(keys), options),
-                              options, getMultipleResultsToMap(numKeys));
+                              options, getMultipleResultsToMap(numKeys, getValueCache()));
 }
 
 jsg::Promise<void> DurableObjectStorageOperations::putMultiple(
@@ -531,6 +560,7 @@ jsg::Promise<void> DurableObjectStorageOperations::putMultiple(
   kj::Vector<ActorCacheOps::KeyValuePair> kvs(entries.fields.size());
 
   uint32_t units = 0;
+  auto encoding = currentStorageValueEncoding();
   for (auto& field : entries.fields) {
     if (field.value->IsUndefined()) continue;
     // We silently drop fields with value=undefined in putMultiple. There aren't many good options here, as
@@ -539,7 +569,7 @@ jsg::Promise<void> DurableObjectStorageOperations::putMultiple(
 
     ActorStorageLimits::checkMaxKeySize(field.name);
 
-    kj::Array<byte> buffer = serializeV8Value(field.value, isolate);
+    kj::Array<byte> buffer = serializeV8Value(field.value, isolate, encoding);
     ActorStorageLimits::checkMaxValueSize(field.name, buffer);
 
     units += billingUnits(field.name.size() + buffer.size());
@@ -644,6 +674,7 @@ jsg::Value DurableObjectStorage::transactionSync(jsg::Lock& js, jsg::Function<js
       return kj::mv(result);
     }, [&](jsg::Value exception) -> jsg::Value {
       sqlite->run(SqliteDatabase::TRUSTED, kj::str("ROLLBACK TO _cf_sync_savepoint_", depth));
+      sqlite->notifyRollback();
       js.throwException(kj::mv(exception));
     });
   } else {
@@ -675,6 +706,91 @@ jsg::Ref<SqlStorage> DurableObjectStorage::getSql(jsg::Lock& js) {
   }
 }
 
+jsg::Ref<DurableObjectStorage::ListBatchesIterator> DurableObjectStorage::listBatches(
+    jsg::Lock& js, jsg::Optional<ListOptions> maybeOptions, jsg::Optional<int> maybeBatchSize) {
+  uint batchSize = DEFAULT_LIST_BATCH_SIZE;
+  KJ_IF_MAYBE(b, maybeBatchSize) {
+    JSG_REQUIRE(*b > 0, TypeError, "List batch size must be positive.");
+    batchSize = *b;
+  }
+
+  auto maybeRange = listRangeFromOptions(maybeOptions);
+  bool empty = maybeRange == nullptr;
+  auto range = kj::mv(maybeRange).orDefault(ListRange {});
+
+  return jsg::alloc<ListBatchesIterator>(ListBatchesState {
+    .storage = JSG_THIS,
+    .start = kj::mv(range.start),
+    .end = kj::mv(range.end),
+    .reverse = range.reverse,
+    .remaining = range.limit,
+    .batchSize = batchSize,
+    .options = configureOptions(kj::mv(maybeOptions).orDefault(ListOptions{})),
+    .done = empty,
+  });
+}
+
+jsg::Promise<kj::Maybe<jsg::Value>> DurableObjectStorage::listBatchesNext(
+    jsg::Lock& js, ListBatchesState& state) {
+  if (state.done) {
+    return js.resolvedPromise(kj::Maybe<jsg::Value>(nullptr));
+  }
+
+  uint count = state.batchSize;
+  KJ_IF_MAYBE(r, state.remaining) {
+    count = kj::min(count, *r);
+  }
+
+  auto& cache = state.storage->getCache(OP_LIST);
+  ActorCacheOps::ReadOptions readOptions = state.options;
+  auto end = state.end.map([](kj::String& e) { return kj::str(e); });
+  auto result = state.reverse
+      ? cache.listReverse(kj::str(state.start), kj::mv(end), count, readOptions)
+      : cache.list(kj::str(state.start), kj::mv(end), count, readOptions);
+
+  // The iterator won't call next() or return() again until this promise settles, so `state`
+  // outlives the continuation.
+  return transformCacheResultWithCacheStatus(js.v8Isolate, kj::mv(result), state.options,
+      [&state, count](v8::Isolate* isolate, ActorCacheOps::GetResultList batch, bool cached)
+      -> kj::Maybe<jsg::Value> {
+    size_t size = batch.size();
+    if (size < count) {
+      // A short batch means we've reached the end of the range.
+      state.done = true;
+    }
+    KJ_IF_MAYBE(r, state.remaining) {
+      *r -= size;
+      if (*r == 0) state.done = true;
+    }
+
+    if (!state.done) {
+      // Resume the next batch just past the last key returned.
+      kj::StringPtr lastKey;
+      for (auto entry: batch) {
+        lastKey = entry.key;
+      }
+      if (state.reverse) {
+        state.end = kj::str(lastKey);
+      } else {
+        state.start = keyAfter(lastKey);
+      }
+    }
+
+    // Every batch is billed like a list() of its own, including an empty final one.
+    auto map = listResultsToMap(isolate, kj::mv(batch), cached);
+    if (size == 0) {
+      return nullptr;
+    }
+    return kj::mv(map);
+  });
+}
+
+jsg::Promise<void> DurableObjectStorage::listBatchesReturn(
+    jsg::Lock& js, ListBatchesState& state, jsg::Optional<jsg::Value> value) {
+  state.done = true;
+  return js.resolvedPromise();
+}
+
 ActorCacheOps& DurableObjectTransaction::getCache(OpName op) {
   JSG_REQUIRE(!rolledBack, Error, kj::str("Cannot ", op, " on rolled back transaction"));
   auto& result = *JSG_REQUIRE_NONNULL(cacheTxn, Error,
@@ -830,7 +946,307 @@ kj::Array<jsg::Ref<api::WebSocket>> DurableObjectState::getWebSockets(
   return kj::Array<jsg::Ref<api::WebSocket>>();
 }
 
-kj::Array<kj::byte> serializeV8Value(v8::Local<v8::Value> value, v8::Isolate* isolate) {
+namespace {
+
+// The compact storage value encoding is:
+//
+//     COMPACT_VALUE_TAG, COMPACT_VALUE_VERSION, value
+//
+// where a value is a CompactType byte followed by its payload:
+//
+//     INT32:           zigzag varint
+//     DOUBLE:          8 bytes, host byte order
+//     ONE_BYTE_STRING: varint length, Latin-1 bytes
+//     TWO_BYTE_STRING: varint length in code units, UTF-16 code units in host byte order
+//     OBJECT:          varint property count, then (string, value) for each property, where the
+//                      values are never OBJECT themselves
+//
+// Byte order matches what the V8 serializer does for the same types.
+
+constexpr kj::byte COMPACT_VALUE_TAG = 0xFE;
+// The V8 serializer's output always starts with its 0xFF version tag or, for data written before
+// we wrote headers, with one of its ASCII type tags, so this can't collide with either.
+
+constexpr kj::byte COMPACT_VALUE_VERSION = 1;
+
+constexpr size_t MAX_COMPACT_OBJECT_PROPERTIES = 64;
+// Larger objects are rare enough as storage values that the V8 serializer is fine for them.
+
+enum class CompactType: kj::byte {
+  UNDEFINED,
+  NULL_,
+  TRUE_,
+  FALSE_,
+  INT32,
+  DOUBLE,
+  ONE_BYTE_STRING,
+  TWO_BYTE_STRING,
+  OBJECT,
+};
+
+class CompactValueWriter {
+public:
+  explicit CompactValueWriter(v8::Isolate* isolate): isolate(isolate) {
+    out.add(COMPACT_VALUE_TAG);
+    out.add(COMPACT_VALUE_VERSION);
+  }
+
+  kj::Maybe<kj::Array<kj::byte>> write(v8::Local<v8::Value> value) {
+    // Returns null if the value can't be represented in the compact encoding. No user code (such
+    // as getters) has been run in that case, so the caller can pass the same value to the V8
+    // serializer.
+
+    if (writePrimitive(value)) {
+      return out.releaseAsArray();
+    }
+    if (value->IsObject() && writeObject(value.As<v8::Object>())) {
+      return out.releaseAsArray();
+    }
+    return nullptr;
+  }
+
+private:
+  v8::Isolate* isolate;
+  kj::Vector<kj::byte> out;
+
+  void writeType(CompactType type) {
+    out.add(static_cast<kj::byte>(type));
+  }
+
+  void writeVarint(uint64_t value) {
+    while (value >= 0x80) {
+      out.add(static_cast<kj::byte>(value | 0x80));
+      value >>= 7;
+    }
+    out.add(static_cast<kj::byte>(value));
+  }
+
+  void writeString(v8::Local<v8::String> str) {
+    size_t length = str->Length();
+    if (str->IsOneByte()) {
+      writeType(CompactType::ONE_BYTE_STRING);
+      writeVarint(length);
+      size_t offset = out.size();
+      out.resize(offset + length);
+      str->WriteOneByte(isolate, out.begin() + offset, 0, length,
+          v8::String::NO_NULL_TERMINATION);
+    } else {
+      writeType(CompactType::TWO_BYTE_STRING);
+      writeVarint(length);
+      auto units = kj::heapArray<uint16_t>(length);
+      str->Write(isolate, units.begin(), 0, length, v8::String::NO_NULL_TERMINATION);
+      out.addAll(units.asBytes());
+    }
+  }
+
+  bool writePrimitive(v8::Local<v8::Value> value) {
+    if (value->IsString()) {
+      writeString(value.As<v8::String>());
+    } else if (value->IsInt32()) {
+      int32_t i = value.As<v8::Int32>()->Value();
+      writeType(CompactType::INT32);
+      writeVarint((static_cast<uint32_t>(i) << 1) ^ static_cast<uint32_t>(i >> 31));
+    } else if (value->IsNumber()) {
+      double d = value.As<v8::Number>()->Value();
+      writeType(CompactType::DOUBLE);
+      out.addAll(kj::arrayPtr(reinterpret_cast<const kj::byte*>(&d), sizeof(d)));
+    } else if (value->IsTrue()) {
+      writeType(CompactType::TRUE_);
+    } else if (value->IsFalse()) {
+      writeType(CompactType::FALSE_);
+    } else if (value->IsNull()) {
+      writeType(CompactType::NULL_);
+    } else if (value->IsUndefined()) {
+      writeType(CompactType::UNDEFINED);
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  bool isPlainObject(v8::Local<v8::Object> obj) {
+    // The checks after the prototype one catch exotic objects whose prototype has been replaced,
+    // which the V8 serializer would still serialize according to their real type.
+    auto objectPrototype = v8::Object::New(isolate)->GetPrototype();
+    return obj->GetPrototype()->StrictEquals(objectPrototype) &&
+        obj->InternalFieldCount() == 0 &&
+        !obj->IsProxy() && !obj->IsArray() && !obj->IsFunction() &&
+        !obj->IsDate() && !obj->IsRegExp() && !obj->IsNativeError() &&
+        !obj->IsMap() && !obj->IsSet() && !obj->IsWeakMap() && !obj->IsWeakSet() &&
+        !obj->IsArrayBuffer() && !obj->IsArrayBufferView() && !obj->IsSharedArrayBuffer() &&
+        !obj->IsStringObject() && !obj->IsNumberObject() && !obj->IsBooleanObject() &&
+        !obj->IsBigIntObject() && !obj->IsSymbolObject() && !obj->IsPromise();
+  }
+
+  bool writeObject(v8::Local<v8::Object> obj) {
+    if (!isPlainObject(obj)) return false;
+
+    auto context = isolate->GetCurrentContext();
+    auto names = jsg::check(obj->GetOwnPropertyNames(context,
+        static_cast<v8::PropertyFilter>(v8::ONLY_ENUMERABLE | v8::SKIP_SYMBOLS),
+        v8::KeyConversionMode::kKeepNumbers));
+    uint32_t count = names->Length();
+    if (count > MAX_COMPACT_OBJECT_PROPERTIES) return false;
+
+    auto keys = kj::heapArrayBuilder<v8::Local<v8::String>>(count);
+    for (auto i: kj::zeroTo(count)) {
+      auto key = jsg::check(names->Get(context, i));
+      // Index-like keys are stored as elements, which the V8 serializer orders and encodes
+      // differently.
+      if (!key->IsString()) return false;
+      keys.add(key.As<v8::String>());
+    }
+
+    // Only objects whose properties are all plain data properties take the compact path. Reading
+    // values out of their property descriptors runs no user code, whereas an accessor means we
+    // leave the object to the V8 serializer untouched, so that its getters run exactly once.
+    auto valueName = jsg::v8StrIntern(isolate, "value"_kj);
+    auto values = kj::heapArrayBuilder<v8::Local<v8::Value>>(count);
+    for (auto& key: keys) {
+      auto descriptor = jsg::check(obj->GetOwnPropertyDescriptor(context, key));
+      if (!descriptor->IsObject()) return false;
+      auto fields = descriptor.As<v8::Object>();
+      if (!jsg::check(fields->HasOwnProperty(context, valueName))) return false;
+      auto value = jsg::check(fields->Get(context, valueName));
+      if (value->IsObject() || value->IsSymbol() || value->IsBigInt()) return false;
+      values.add(value);
+    }
+
+    writeType(CompactType::OBJECT);
+    writeVarint(count);
+    for (auto i: kj::indices(keys)) {
+      writeString(keys[i]);
+      KJ_ASSERT(writePrimitive(values[i]));
+    }
+    return true;
+  }
+};
+
+class CompactValueReader {
+public:
+  CompactValueReader(v8::Isolate* isolate, kj::ArrayPtr<const char> key,
+                     kj::ArrayPtr<const kj::byte> buf)
+      : isolate(isolate), key(key), buf(buf), pos(buf.begin()) {}
+
+  v8::Local<v8::Value> read() {
+    KJ_ASSERT(buf.size() >= 2 && buf[0] == COMPACT_VALUE_TAG,
+        "not a compact storage value", key, buf.size());
+    KJ_ASSERT(buf[1] == COMPACT_VALUE_VERSION,
+        "unknown compact storage value version", key, buf.size(), buf[1]);
+    pos += 2;
+    auto value = readValue(true);
+    KJ_ASSERT(pos == buf.end(), "trailing bytes in compact storage value", key, buf.size());
+    return value;
+  }
+
+private:
+  v8::Isolate* isolate;
+  kj::ArrayPtr<const char> key;
+  kj::ArrayPtr<const kj::byte> buf;
+  const kj::byte* pos;
+
+  void require(size_t bytes) {
+    KJ_ASSERT(static_cast<size_t>(buf.end() - pos) >= bytes, "truncated compact storage value", key, buf.size());
+  }
+
+  uint64_t readVarint() {
+    uint64_t result = 0;
+    for (uint shift = 0; shift < 64; shift += 7) {
+      require(1);
+      kj::byte b = *pos++;
+      result |= static_cast<uint64_t>(b & 0x7f) << shift;
+      if ((b & 0x80) == 0) return result;
+    }
+    KJ_FAIL_ASSERT("malformed varint in compact storage value", key, buf.size());
+  }
+
+  v8::Local<v8::String> readString(CompactType type) {
+    auto length = readVarint();
+    switch (type) {
+      case CompactType::ONE_BYTE_STRING: {
+        require(length);
+        auto result = jsg::check(v8::String::NewFromOneByte(
+            isolate, pos, v8::NewStringType::kNormal, length));
+        pos += length;
+        return result;
+      }
+      case CompactType::TWO_BYTE_STRING: {
+        KJ_ASSERT(length <= SIZE_MAX / 2, "malformed compact storage value", key, buf.size());
+        require(length * 2);
+        auto units = kj::heapArray<uint16_t>(length);
+        memcpy(units.begin(), pos, length * 2);
+        pos += length * 2;
+        return jsg::check(v8::String::NewFromTwoByte(
+            isolate, units.begin(), v8::NewStringType::kNormal, length));
+      }
+      default:
+        KJ_FAIL_ASSERT("expected a string in compact storage value", key, buf.size());
+    }
+  }
+
+  CompactType readType() {
+    require(1);
+    return static_cast<CompactType>(*pos++);
+  }
+
+  v8::Local<v8::Value> readValue(bool allowObject) {
+    auto type = readType();
+    switch (type) {
+      case CompactType::UNDEFINED:
+        return v8::Undefined(isolate);
+      case CompactType::NULL_:
+        return v8::Null(isolate);
+      case CompactType::TRUE_:
+        return v8::True(isolate);
+      case CompactType::FALSE_:
+        return v8::False(isolate);
+      case CompactType::INT32: {
+        auto zigzag = readVarint();
+        KJ_ASSERT(zigzag <= UINT32_MAX,
+            "malformed compact storage value", key, buf.size());
+        uint32_t u = zigzag;
+        return v8::Integer::New(isolate, static_cast<int32_t>((u >> 1) ^ -(u & 1)));
+      }
+      case CompactType::DOUBLE: {
+        double d;
+        require(sizeof(d));
+        memcpy(&d, pos, sizeof(d));
+        pos += sizeof(d);
+        return v8::Number::New(isolate, d);
+      }
+      case CompactType::ONE_BYTE_STRING:
+      case CompactType::TWO_BYTE_STRING:
+        return readString(type);
+      case CompactType::OBJECT: {
+        KJ_ASSERT(allowObject, "nested object in compact storage value", key, buf.size());
+        auto count = readVarint();
+        KJ_ASSERT(count <= MAX_COMPACT_OBJECT_PROPERTIES,
+            "malformed compact storage value", key, buf.size());
+        auto context = isolate->GetCurrentContext();
+        auto obj = v8::Object::New(isolate);
+        for (auto i KJ_UNUSED: kj::zeroTo(count)) {
+          auto name = readString(readType());
+          jsg::check(obj->CreateDataProperty(context, name, readValue(false)));
+        }
+        return obj;
+      }
+    }
+    KJ_FAIL_ASSERT("unknown type in compact storage value", key, buf.size(),
+        static_cast<kj::byte>(type));
+  }
+};
+
+}  // namespace
+
+kj::Array<kj::byte> serializeV8Value(v8::Local<v8::Value> value, v8::Isolate* isolate,
+    StorageValueEncoding encoding) {
+  if (encoding == StorageValueEncoding::COMPACT) {
+    CompactValueWriter writer(isolate);
+    KJ_IF_MAYBE(compact, writer.write(value)) {
+      return kj::mv(*compact);
+    }
+  }
+
   jsg::Serializer serializer(isolate, jsg::Serializer::Options {
     .version = 15,
     .omitHeader = false,
@@ -876,6 +1292,10 @@ v8::Local<v8::Value> deserializeV8Value(
 
   KJ_ASSERT(buf.size() > 0, "unexpectedly empty value buffer", key);
 
+  if (buf[0] == COMPACT_VALUE_TAG) {
+    return CompactValueReader(isolate, key, buf).read();
+  }
+
   jsg::Deserializer::Options options {};
   if (buf[0] != 0xFF) {
     // When Durable Objects was first released, it did not properly write headers when serializing
@@ -898,4 +1318,32 @@ v8::Local<v8::Value> deserializeV8Value(
   return value;
 }
 
+v8::Local<v8::Value> StorageValueCache::deserialize(
+    v8::Isolate* isolate, kj::StringPtr key, kj::ArrayPtr<const kj::byte> buf) {
+  KJ_IF_MAYBE(entry, entries.find(key)) {
+    if (entry->bytes.asPtr() == buf) {
+      ++hitCount;
+      // Move the entry to the back of the LRU order.
+      auto value = entry->value.getHandle(isolate);
+      entries.insert(entries.release(*entry));
+      return value;
+    }
+    entries.erase(*entry);
+  }
+
+  ++missCount;
+  auto value = deserializeV8Value(key, buf, isolate);
+  if (buf.size() <= MAX_VALUE_SIZE && !value->IsObject()) {
+    if (entries.size() >= MAX_ENTRIES) {
+      entries.erase(*entries.ordered<kj::InsertionOrderIndex>().begin());
+    }
+    entries.insert(Entry {
+      .key = kj::str(key),
+      .bytes = kj::heapArray(buf),
+      .value = jsg::Value(isolate, value),
+    });
+  }
+  return value;
+}
+
 }  // namespace workerd::api
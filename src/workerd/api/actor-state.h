@@ -21,10 +21,62 @@ namespace workerd::api {
 class DurableObjectId;
 class WebSocket;
 
-kj::Array<kj::byte> serializeV8Value(v8::Local<v8::Value> value, v8::Isolate* isolate);
+enum class StorageValueEncoding {
+  V8,
+  // Always use the V8 serializer's wire format.
+
+  COMPACT,
+  // Use the compact encoding for primitives and flat plain objects, and the V8 serializer's wire
+  // format for everything else. See the durableObjectStorageCompactEncoding compatibility flag.
+};
+
+kj::Array<kj::byte> serializeV8Value(v8::Local<v8::Value> value, v8::Isolate* isolate,
+    StorageValueEncoding encoding = StorageValueEncoding::V8);
 
 v8::Local<v8::Value> deserializeV8Value(
     kj::ArrayPtr<const char> key, kj::ArrayPtr<const kj::byte> buf, v8::Isolate* isolate);
+// Reads values written in either encoding.
+
+class StorageValueCache final: public kj::Refcounted {
+  // A small cache of already-deserialized primitive values for hot keys, so that repeatedly
+  // reading the same key doesn't decode (and, for strings, allocate) the value every time.
+  //
+  // Entries are validated by comparing the stored bytes on every lookup instead of being
+  // invalidated on writes, so a stale value can never be returned no matter which path (cache,
+  // transaction, or direct I/O) produced the bytes. Objects are never cached since they are
+  // mutable, and each get() must return a fresh copy.
+
+public:
+  static constexpr size_t MAX_ENTRIES = 128;
+  static constexpr size_t MAX_VALUE_SIZE = 1024;
+
+  v8::Local<v8::Value> deserialize(
+      v8::Isolate* isolate, kj::StringPtr key, kj::ArrayPtr<const kj::byte> buf);
+  // Equivalent to deserializeV8Value(), but returns the cached value if `buf` matches the bytes it
+  // was decoded from.
+
+  uint64_t getHitCount() const { return hitCount; }
+  uint64_t getMissCount() const { return missCount; }
+
+private:
+  struct Entry {
+    kj::String key;
+    kj::Array<const kj::byte> bytes;
+    jsg::Value value;
+  };
+
+  struct EntryCallbacks {
+    inline kj::StringPtr keyForRow(const Entry& entry) const { return entry.key; }
+    inline bool matches(const Entry& entry, kj::StringPtr key) const { return entry.key == key; }
+    inline auto hashCode(kj::StringPtr key) const { return kj::hashCode(key); }
+  };
+
+  kj::Table<Entry, kj::HashIndex<EntryCallbacks>, kj::InsertionOrderIndex> entries;
+  // Insertion order is kept as LRU order by re-inserting entries on every hit.
+
+  uint64_t hitCount = 0;
+  uint64_t missCount = 0;
+};
 
 class DurableObjectStorageOperations {
   // Common implementation of DurableObjectStorage and DurableObjectTransaction. This class is
@@ -146,6 +198,9 @@ protected:
   virtual bool useDirectIo() = 0;
   // Whether to skip caching and allow concurrency on all operations.
 
+  virtual kj::Maybe<kj::Own<StorageValueCache>> getValueCache() { return nullptr; }
+  // Returns a new reference to the cache of deserialized values to read through, if any.
+
   template <typename T>
   T configureOptions(T&& options) {
     // Method that should be called at the start of each storage operation to override any of the
@@ -202,6 +257,43 @@ public:
 
   jsg::Ref<SqlStorage> getSql(jsg::Lock& js);
 
+private:
+  struct ListBatchesState {
+    jsg::Ref<DurableObjectStorage> storage;
+    kj::String start;
+    kj::Maybe<kj::String> end;
+    bool reverse;
+    kj::Maybe<uint> remaining;
+    uint batchSize;
+    ListOptions options;
+    // Only the read options are used; the key range has been moved out into the fields above.
+
+    bool done = false;
+
+    void visitForGc(jsg::GcVisitor& visitor) {
+      visitor.visit(storage);
+    }
+  };
+
+  static jsg::Promise<kj::Maybe<jsg::Value>> listBatchesNext(
+      jsg::Lock& js, ListBatchesState& state);
+  static jsg::Promise<void> listBatchesReturn(
+      jsg::Lock& js, ListBatchesState& state, jsg::Optional<jsg::Value> value);
+
+public:
+  static constexpr uint DEFAULT_LIST_BATCH_SIZE = 128;
+
+  JSG_ASYNC_ITERATOR_TYPE(ListBatchesIterator, jsg::Value, ListBatchesState,
+                          listBatchesNext, listBatchesReturn);
+
+  jsg::Ref<ListBatchesIterator> listBatches(jsg::Lock& js, jsg::Optional<ListOptions> options,
+                                            jsg::Optional<int> batchSize);
+  // Like list(), but yields the results as a series of Maps of at most `batchSize` entries each,
+  // so that iterating over an arbitrarily large range only ever holds one batch in memory. Each
+  // batch is read with its own bounded list() that resumes after the last key of the previous
+  // one, so writes made while iterating may or may not be observed by later batches, just as if
+  // the application had paged through the range with `startAfter` itself.
+
   JSG_RESOURCE_TYPE(DurableObjectStorage, CompatibilityFlags::Reader flags) {
     JSG_METHOD(get);
     JSG_METHOD(list);
@@ -217,6 +309,7 @@ public:
     if (flags.getWorkerdExperimental()) {
       JSG_LAZY_INSTANCE_PROPERTY(sql, getSql);
       JSG_METHOD(transactionSync);
+      JSG_METHOD(listBatches);
     }
 
     JSG_TS_OVERRIDE({
@@ -224,6 +317,7 @@ public:
       get<T = unknown>(keys: string[], options?: DurableObjectGetOptions): Promise<Map<string, T>>;
 
       list<T = unknown>(options?: DurableObjectListOptions): Promise<Map<string, T>>;
+      listBatches<T = unknown>(options?: DurableObjectListOptions, batchSize?: number): AsyncIterableIterator<Map<string, T>>;
 
       put<T>(key: string, value: T, options?: DurableObjectPutOptions): Promise<void>;
       put<T>(entries: Record<string, T>, options?: DurableObjectPutOptions): Promise<void>;
@@ -243,8 +337,13 @@ protected:
     return false;
   }
 
+  kj::Maybe<kj::Own<StorageValueCache>> getValueCache() override {
+    return kj::addRef(*valueCache);
+  }
+
 private:
   IoPtr<ActorCacheInterface> cache;
+  kj::Own<StorageValueCache> valueCache = kj::refcounted<StorageValueCache>();
   uint transactionSyncDepth = 0;
 };
 
@@ -423,6 +522,8 @@ private:
   api::DurableObjectState,                               \
   api::DurableObjectTransaction,                         \
   api::DurableObjectStorage,                             \
+  api::DurableObjectStorage::ListBatchesIterator,        \
+  api::DurableObjectStorage::ListBatchesIterator::Next,  \
   api::DurableObjectStorage::TransactionOptions,         \
   api::DurableObjectStorageOperations::ListOptions,      \
   api::DurableObjectStorageOperations::GetOptions,       \
@@ -120,6 +120,10 @@ void handleDefaultBotManagement(v8::Isolate* isolate, v8::Local<v8::Object> cf)
   }
 }
 
+constexpr size_t STRUCTURED_CLONE_EXTERNAL_BUFFER_THRESHOLD = 512;
+// structuredClone() never leaves the isolate, so it can use jsg::Serializer's out-of-band buffer
+// mode. Below this size, copying the bytes inline is cheaper than allocating a backing store.
+
 }  // namespace
 
 void ExecutionContext::waitUntil(kj::Promise<void> promise) {
@@ -642,7 +646,8 @@ v8::Local<v8::Value> ServiceWorkerGlobalScope::structuredClone(
       return transfer.asPtr();
     });
   }
-  return jsg::structuredClone(value, isolate, transfers);
+  return jsg::structuredClone(value, isolate, transfers,
+      STRUCTURED_CLONE_EXTERNAL_BUFFER_THRESHOLD);
 }
 
 TimeoutId::NumberType ServiceWorkerGlobalScope::setTimeoutInternal(
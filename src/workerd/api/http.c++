@@ -116,6 +116,7 @@ Headers::Headers(jsg::Dict<jsg::ByteString, jsg::ByteString> dict)
 
 Headers::Headers(const Headers& other)
     : guard(Guard::NONE) {
+  AllocationCategoryScope allocationScope(AllocationCategory::HEADERS);
   for (auto& header: other.headers) {
     Header copy {
       jsg::ByteString(kj::str(header.second.key)),
@@ -129,6 +130,7 @@ Headers::Headers(const Headers& other)
 
 Headers::Headers(const kj::HttpHeaders& other, Guard guard)
     : guard(Guard::NONE) {
+  AllocationCategoryScope allocationScope(AllocationCategory::HEADERS);
   other.forEach([this](auto name, auto value) {
     append(jsg::ByteString(kj::str(name)), jsg::ByteString(kj::str(value)));
   });
@@ -282,6 +284,7 @@ bool Headers::has(jsg::ByteString name) {
 
 void Headers::set(jsg::ByteString name, jsg::ByteString value) {
   checkGuard();
+  AllocationCategoryScope allocationScope(AllocationCategory::HEADERS);
   requireValidHeaderName(name);
   auto key = toLower(name);
   value = normalizeHeaderValue(kj::mv(value));
@@ -296,6 +299,7 @@ void Headers::set(jsg::ByteString name, jsg::ByteString value) {
 
 void Headers::append(jsg::ByteString name, jsg::ByteString value) {
   checkGuard();
+  AllocationCategoryScope allocationScope(AllocationCategory::HEADERS);
   requireValidHeaderName(name);
   auto key = toLower(name);
   value = normalizeHeaderValue(kj::mv(value));
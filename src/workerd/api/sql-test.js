@@ -437,6 +437,40 @@ async function test(storage) {
     });
     assert.equal(getI(), 2);
   }
+
+  // Test listBatches()
+  {
+    for (let i = 0; i < 7; i++) {
+      storage.put("batch" + i, i);
+    }
+    storage.put("other", 0);
+
+    let collect = async (options, batchSize) => {
+      let batches = [];
+      for await (let batch of storage.listBatches(options, batchSize)) {
+        batches.push([...batch.keys()]);
+      }
+      return batches;
+    };
+
+    assert.deepEqual(await collect({prefix: "batch"}, 3), [
+      ["batch0", "batch1", "batch2"], ["batch3", "batch4", "batch5"], ["batch6"]
+    ]);
+    assert.deepEqual(await collect({prefix: "batch", reverse: true, limit: 5}, 2), [
+      ["batch6", "batch5"], ["batch4", "batch3"], ["batch2"]
+    ]);
+    assert.deepEqual(await collect({prefix: "batch", startAfter: "batch4"}, 2), [
+      ["batch5", "batch6"]
+    ]);
+    assert.deepEqual(await collect({prefix: "nothing"}, 2), []);
+
+    // Stopping early doesn't read any further batches.
+    for await (let batch of storage.listBatches({prefix: "batch"}, 4)) {
+      assert.equal(batch.size, 4);
+      assert.equal(batch.get("batch3"), 3);
+      break;
+    }
+  }
 }
 
 export class DurableObjectExample {
@@ -9,6 +9,7 @@
 #include <kj/list.h>
 #include "io-gate.h"
 #include <kj/thread.h>
+#include <kj/timer.h>
 #include <kj/source-location.h>
 #include <workerd/util/capnp-mock.h>
 
@@ -197,6 +198,21 @@ struct ActorCacheTestOptions {
   size_t maxKeysPerRpc = 128;
   bool noCache = false;
   bool neverFlush = false;
+  size_t maxBytesPerRpc = 0;
+  uint maxFlushRpcsInFlight = 0;
+  kj::Duration flushBatchingWindow = 0 * kj::SECONDS;
+  uint prefetchLimit = 0;
+  uint lockTimingInterval = 64;
+};
+
+struct MockTimerGateHooks final: public OutputGate::Hooks {
+  // Implements the output gate's batching delay with a timer that tests advance by hand.
+
+  kj::TimerImpl timer { kj::origin<kj::TimePoint>() };
+
+  kj::Promise<void> makeDelayPromise(kj::Duration delay) override {
+    return timer.afterDelay(delay);
+  }
 };
 
 struct ActorCacheTest: public ActorCacheConvenienceWrappers {
@@ -207,6 +223,7 @@ struct ActorCacheTest: public ActorCacheConvenienceWrappers {
   kj::Own<MockServer> mockStorage;
 
   ActorCache::SharedLru lru;
+  MockTimerGateHooks gateHooks;
   OutputGate gate;
   ActorCache cache;
 
@@ -221,7 +238,10 @@ struct ActorCacheTest: public ActorCacheConvenienceWrappers {
         ws(loop), mockStorage(kj::mv(mockPair.mock)),
         lru({options.softLimit, options.hardLimit,
              options.staleTimeout, options.dirtyListByteLimit, options.maxKeysPerRpc,
-             options.noCache, options.neverFlush}),
+             options.noCache, options.neverFlush, options.maxBytesPerRpc,
+             options.maxFlushRpcsInFlight, options.flushBatchingWindow, options.prefetchLimit,
+             options.lockTimingInterval}),
+        gate(gateHooks),
         cache(kj::mv(mockPair.client), lru, gate),
         gateBrokenPromise(options.monitorOutputGate
             ? eagerlyReportExceptions(gate.onBroken())
@@ -309,6 +329,52 @@ KJ_TEST("ActorCache single-key basics") {
   }
 }
 
+KJ_TEST("ActorCache concurrent get()s of one key share a read") {
+  ActorCacheTest test;
+  auto& ws = test.ws;
+  auto& mockStorage = test.mockStorage;
+
+  {
+    auto promise1 = expectUncached(test.get("foo"));
+    auto promise2 = expectUncached(test.get("foo"));
+    auto promise3 = expectUncached(test.get("foo"));
+
+    auto mockGet = mockStorage->expectCall("get", ws)
+        .withParams(CAPNP(key = "foo"));
+
+    // Canceling the first get() doesn't cancel the read the others are waiting on.
+    { auto drop = kj::mv(promise1); }
+
+    kj::mv(mockGet).thenReturn(CAPNP(value = "bar"));
+
+    KJ_EXPECT(KJ_ASSERT_NONNULL(promise2.wait(ws)) == "bar");
+    KJ_EXPECT(KJ_ASSERT_NONNULL(promise3.wait(ws)) == "bar");
+  }
+
+  KJ_EXPECT(test.lru.getStats().coalescedReads == 2);
+  KJ_EXPECT(KJ_ASSERT_NONNULL(expectCached(test.get("foo"))) == "bar");
+
+  // Once the read completes, a get() that misses cache reads again, even if others are still
+  // waiting on the completed read.
+  {
+    auto promise1 = expectUncached(test.get("baz", {.noCache = true}));
+    auto promise2 = expectUncached(test.get("baz", {.noCache = true}));
+    mockStorage->expectCall("get", ws)
+        .withParams(CAPNP(key = "baz"))
+        .thenReturn(CAPNP(value = "qux"));
+    KJ_EXPECT(KJ_ASSERT_NONNULL(promise1.wait(ws)) == "qux");
+
+    auto promise3 = expectUncached(test.get("baz", {.noCache = true}));
+    mockStorage->expectCall("get", ws)
+        .withParams(CAPNP(key = "baz"))
+        .thenReturn(CAPNP(value = "corge"));
+    KJ_EXPECT(KJ_ASSERT_NONNULL(promise3.wait(ws)) == "corge");
+    KJ_EXPECT(KJ_ASSERT_NONNULL(promise2.wait(ws)) == "qux");
+  }
+
+  KJ_EXPECT(test.lru.getStats().coalescedReads == 3);
+}
+
 KJ_TEST("ActorCache multi-key basics") {
   ActorCacheTest test;
   auto& ws = test.ws;
@@ -678,6 +744,104 @@ KJ_TEST("ActorCache batching due to maxKeysPerRpc") {
   KJ_EXPECT(deleteProm3.wait(ws) == 2);
 }
 
+KJ_TEST("ActorCache flush pipelines size-bounded batches") {
+  // Each of these puts takes a few dozen bytes, so each gets its own batch.
+  ActorCacheTest test({.maxBytesPerRpc = 40, .maxFlushRpcsInFlight = 2});
+  auto& ws = test.ws;
+  auto& mockStorage = test.mockStorage;
+
+  test.put("a", "1");
+  test.put("b", "2");
+  test.put("c", "3");
+
+  auto mockTxn = mockStorage->expectCall("txn", ws).returnMock("transaction");
+  auto put1 = mockTxn->expectCall("put", ws)
+      .withParams(CAPNP(entries = [(key = "a", value = "1")]));
+  auto put2 = mockTxn->expectCall("put", ws)
+      .withParams(CAPNP(entries = [(key = "b", value = "2")]));
+
+  // The third batch isn't sent until one of the first two completes.
+  mockTxn->expectNoActivity(ws);
+  kj::mv(put1).thenReturn(CAPNP());
+
+  mockTxn->expectCall("put", ws)
+      .withParams(CAPNP(entries = [(key = "c", value = "3")]))
+      .thenReturn(CAPNP());
+
+  // The commit follows right after the last batch is sent, without waiting for the others.
+  auto commit = mockTxn->expectCall("commit", ws);
+  kj::mv(put2).thenReturn(CAPNP());
+  kj::mv(commit).thenReturn(CAPNP());
+  mockTxn->expectDropped(ws);
+
+  test.loop.run();
+  auto flushDuration = test.lru.getStats().flushDuration;
+  KJ_EXPECT(flushDuration.count == 1);
+  KJ_EXPECT(flushDuration.sum > 0 * kj::NANOSECONDS);
+
+  KJ_ASSERT(KJ_ASSERT_NONNULL(expectCached(test.get("c"))) == "3");
+}
+
+KJ_TEST("ActorCache flush counts counted deletes against the in-flight limit") {
+  ActorCacheTest test({.maxFlushRpcsInFlight = 1});
+  auto& ws = test.ws;
+  auto& mockStorage = test.mockStorage;
+
+  auto deleteProm = expectUncached(test.delete_({"a"_kj}));
+  test.put("b", "2");
+
+  auto mockTxn = mockStorage->expectCall("txn", ws).returnMock("transaction");
+  auto del = mockTxn->expectCall("delete", ws)
+      .withParams(CAPNP(keys = ["a"]));
+
+  // The put isn't sent until the counted delete completes.
+  mockTxn->expectNoActivity(ws);
+  kj::mv(del).thenReturn(CAPNP(numDeleted = 1));
+
+  mockTxn->expectCall("put", ws)
+      .withParams(CAPNP(entries = [(key = "b", value = "2")]))
+      .thenReturn(CAPNP());
+  mockTxn->expectCall("commit", ws).thenReturn(CAPNP());
+  mockTxn->expectDropped(ws);
+
+  KJ_EXPECT(deleteProm.wait(ws) == 1);
+}
+
+KJ_TEST("ActorCache batches back-to-back flushes within flushBatchingWindow") {
+  ActorCacheTest test({.flushBatchingWindow = 1 * kj::HOURS});
+  auto& ws = test.ws;
+  auto& mockStorage = test.mockStorage;
+
+  // Nothing has been flushed yet, so there's nothing to batch with: the flush isn't delayed.
+  test.put("foo", "1");
+  {
+    auto mockTxn = mockStorage->expectCall("txn", ws).returnMock("transaction");
+    mockTxn->expectCall("put", ws)
+        .withParams(CAPNP(entries = [(key = "foo", value = "1")]))
+        .thenReturn(CAPNP());
+    mockTxn->expectCall("commit", ws).thenReturn(CAPNP());
+    mockTxn->expectDropped(ws);
+  }
+  test.gate.wait().wait(ws);
+
+  // That flush's output lock was just released, so the next flush waits out the window, and a put
+  // made meanwhile joins it.
+  test.put("bar", "2");
+  mockStorage->expectNoActivity(ws);
+  test.put("baz", "3");
+  mockStorage->expectNoActivity(ws);
+
+  test.gateHooks.timer.advanceTo(test.gateHooks.timer.now() + 1 * kj::HOURS);
+  {
+    auto mockTxn = mockStorage->expectCall("txn", ws).returnMock("transaction");
+    mockTxn->expectCall("put", ws)
+        .withParams(CAPNP(entries = [(key = "bar", value = "2"), (key = "baz", value = "3")]))
+        .thenReturn(CAPNP());
+    mockTxn->expectCall("commit", ws).thenReturn(CAPNP());
+    mockTxn->expectDropped(ws);
+  }
+}
+
 KJ_TEST("ActorCache batching due to max storage RPC words") {
   ActorCacheTest test({.hardLimit = 128 * 1024 * 1024});
   auto& ws = test.ws;
@@ -1746,6 +1910,74 @@ KJ_TEST("ActorCache list() with limit") {
       kvs({{"bar", "456"}, {"baz", "789"}, {"foo", "123"}, {"garply", "54321"}}));
 }
 
+KJ_TEST("ActorCache list() reads ahead of sequential pages") {
+  ActorCacheTest test({.prefetchLimit = 3});
+  auto& ws = test.ws;
+  auto& mockStorage = test.mockStorage;
+
+  // The first page is just a list with a limit.
+  {
+    auto promise = expectUncached(test.list("a", "z", 2));
+
+    mockStorage->expectCall("list", ws)
+        .withParams(CAPNP(start = "a", end = "z", limit = 2), "stream"_kj)
+        .useCallback("stream", [&](MockClient stream) {
+      stream.call("values", CAPNP(list = [(key = "a", value = "1"), (key = "b", value = "2")]))
+          .expectReturns(CAPNP(), ws);
+      stream.call("end", CAPNP()).expectReturns(CAPNP(), ws);
+    }).expectCanceled();
+
+    KJ_ASSERT(promise.wait(ws) == kvs({{"a", "1"}, {"b", "2"}}));
+  }
+
+  // The second page picks up where the first left off, so we read ahead of it.
+  {
+    auto promise = expectUncached(test.list("b\0"_kj, "z", 2));
+
+    mockStorage->expectCall("list", ws)
+        .withParams(CAPNP(start = "b\0", end = "z", limit = 2), "stream"_kj)
+        .useCallback("stream", [&](MockClient stream) {
+      stream.call("values", CAPNP(list = [(key = "c", value = "3"), (key = "d", value = "4")]))
+          .expectReturns(CAPNP(), ws);
+      stream.call("end", CAPNP()).expectReturns(CAPNP(), ws);
+    }).expectCanceled();
+
+    KJ_ASSERT(promise.wait(ws) == kvs({{"c", "3"}, {"d", "4"}}));
+
+    mockStorage->expectCall("list", ws)
+        .withParams(CAPNP(start = "d\0", end = "z", limit = 3), "stream"_kj)
+        .useCallback("stream", [&](MockClient stream) {
+      stream.call("values", CAPNP(list = [(key = "e", value = "5"), (key = "f", value = "6"),
+                                          (key = "g", value = "7")]))
+          .expectReturns(CAPNP(), ws);
+      stream.call("end", CAPNP()).expectReturns(CAPNP(), ws);
+    }).expectCanceled();
+    test.loop.run();
+  }
+
+  // The third page was read ahead, and reading it reads ahead again. Only one key is missing.
+  {
+    KJ_ASSERT(expectCached(test.list("d\0"_kj, "z", 2)) == kvs({{"e", "5"}, {"f", "6"}}));
+
+    mockStorage->expectCall("list", ws)
+        .withParams(CAPNP(start = "g\0", end = "z", limit = 2), "stream"_kj)
+        .useCallback("stream", [&](MockClient stream) {
+      stream.call("values", CAPNP(list = [(key = "h", value = "8")]))
+          .expectReturns(CAPNP(), ws);
+      stream.call("end", CAPNP()).expectReturns(CAPNP(), ws);
+    }).expectCanceled();
+    test.loop.run();
+  }
+
+  // The rest of the range is now cached, so there's nothing left to read ahead.
+  KJ_ASSERT(expectCached(test.list("f\0"_kj, "z", 2)) == kvs({{"g", "7"}, {"h", "8"}}));
+  KJ_ASSERT(expectCached(test.list("h\0"_kj, "z", 2)) == kvs({}));
+
+  auto stats = test.lru.getStats();
+  KJ_EXPECT(stats.prefetches == 2);
+  KJ_EXPECT(stats.prefetchHits == 2);
+}
+
 KJ_TEST("ActorCache list() with limit around negative entries") {
   // This checks for a bug where the initial scan through cache for list() applies the limit to
   // the total number of entries seen (positive or negative), when it really needs to apply only
@@ -3561,6 +3793,55 @@ KJ_TEST("ActorCache LRU purge ordering") {
   KJ_ASSERT(KJ_ASSERT_NONNULL(expectCached(test.get("yyy"))) == "bbb");
 }
 
+KJ_TEST("ActorCache LRU evicts list() results before entries read by get()") {
+  ActorCacheTest test({.softLimit = 200});  // big enough for one entry plus a little
+  auto& ws = test.ws;
+  auto& mockStorage = test.mockStorage;
+
+  {
+    auto promise = expectUncached(test.get("foo"));
+    mockStorage->expectCall("get", ws)
+        .withParams(CAPNP(key = "foo"))
+        .thenReturn(CAPNP(value = "123"));
+    KJ_ASSERT(KJ_ASSERT_NONNULL(promise.wait(ws)) == "123");
+  }
+
+  // "bar" is newer than "foo", but was only read by a list(), so it's evicted first.
+  {
+    auto promise = expectUncached(test.list("bar", "baz"));
+    mockStorage->expectCall("list", ws)
+        .withParams(CAPNP(start = "bar", end = "baz"), "stream"_kj)
+        .useCallback("stream", [&](MockClient stream) {
+      stream.call("values", CAPNP(list = [(key = "bar", value = "456")]))
+          .expectReturns(CAPNP(), ws);
+      stream.call("end", CAPNP()).expectReturns(CAPNP(), ws);
+    }).expectCanceled();
+    KJ_ASSERT(promise.wait(ws) == kvs({{"bar", "456"}}));
+  }
+
+  KJ_ASSERT(KJ_ASSERT_NONNULL(expectCached(test.get("foo"))) == "123");
+
+  auto stats = test.lru.getStats();
+  KJ_EXPECT(stats.hits == 1);
+  KJ_EXPECT(stats.evictions == 1);
+
+  expectUncached(test.get("bar"));
+}
+
+KJ_TEST("ActorCache LRU lock timing can be disabled") {
+  ActorCacheTest test({.neverFlush = true, .lockTimingInterval = 0});
+
+  KJ_EXPECT(test.put("foo", "123") == nullptr);
+  auto hitsBefore = test.lru.getStats().hits;
+  for (uint i = 0; i < 100; i++) {
+    KJ_ASSERT(KJ_ASSERT_NONNULL(expectCached(test.get("foo"))) == "123");
+  }
+
+  auto stats = test.lru.getStats();
+  KJ_EXPECT(stats.hits - hitsBefore == 100);
+  KJ_EXPECT(stats.lockWait == 0 * kj::NANOSECONDS);
+}
+
 KJ_TEST("ActorCache LRU purge larger") {
   ActorCacheTest test({.softLimit = 4096});
   auto& ws = test.ws;
@@ -3699,7 +3980,7 @@ KJ_TEST("ActorCache evict on timeout") {
 }
 
 KJ_TEST("ActorCache backpressure due to dirtyPressureThreshold") {
-  // Each Entry below ends up being about ~126 bytes, so a limit of 256 allows for 2 entries.
+  // Each Entry below ends up being about ~111 bytes, so a limit of 256 allows for 2 entries.
   ActorCacheTest test({.dirtyListByteLimit = 256});
   auto& ws = test.ws;
   auto& mockStorage = test.mockStorage;
@@ -3754,7 +4035,7 @@ KJ_TEST("ActorCache backpressure due to dirtyPressureThreshold") {
 }
 
 KJ_TEST("ActorCache lru evict entry with known-empty gaps") {
-  ActorCacheTest test({.softLimit = 700});  // just big enough for the first list results
+  ActorCacheTest test({.softLimit = 600});  // just big enough for the first list results
   auto& ws = test.ws;
   auto& mockStorage = test.mockStorage;
 
@@ -3807,7 +4088,7 @@ KJ_TEST("ActorCache lru evict entry with known-empty gaps") {
 }
 
 KJ_TEST("ActorCache lru evict entry with trailing known-empty gap (followed by END_GAP)") {
-  ActorCacheTest test({.softLimit = 700});  // just big enough for the first list results
+  ActorCacheTest test({.softLimit = 600});  // just big enough for the first list results
   auto& ws = test.ws;
   auto& mockStorage = test.mockStorage;
 
@@ -3859,7 +4140,7 @@ KJ_TEST("ActorCache lru evict entry with trailing known-empty gap (followed by E
 }
 
 KJ_TEST("ActorCache timeout entry with known-empty gaps") {
-  ActorCacheTest test({.softLimit = 700});  // just big enough for the first list results
+  ActorCacheTest test({.softLimit = 600});  // just big enough for the first list results
   auto& ws = test.ws;
   auto& mockStorage = test.mockStorage;
 
@@ -5,6 +5,7 @@
 #include "actor-cache.h"
 
 #include <algorithm>
+#include <string.h>
 
 #include <kj/debug.h>
 
@@ -32,11 +33,15 @@ ActorCache::Hooks ActorCache::Hooks::DEFAULT;
 ActorCache::ActorCache(rpc::ActorStorage::Stage::Client storage, const SharedLru& lru,
                        OutputGate& gate, Hooks& hooks)
     : storage(kj::mv(storage)), lru(lru), gate(gate), hooks(hooks),
-      currentValues(lru.cleanList.lockExclusive()) {}
+      currentValues(lru.lock()) {}
 
 ActorCache::~ActorCache() noexcept(false) {
+  for (auto& read: inFlightGets) {
+    read.value->cache = nullptr;
+  }
+
   // Need to remove all entries from any lists they might be in.
-  auto lock = lru.cleanList.lockExclusive();
+  auto lock = lru.lock();
   clear(lock);
 }
 
@@ -66,21 +71,55 @@ void ActorCache::clear(Lock& lock) {
 }
 
 kj::Own<ActorCache::Entry> ActorCache::makeEntry(
-    Lock& lock, EntryState state, Key key, kj::Maybe<Value> value) {
-  auto result = kj::atomicRefcounted<Entry>(
-    kj::Badge<ActorCache>(), *this, kj::mv(key), kj::mv(value), state);
+    Lock& lock, EntryState state, KeyPtr key, kj::Maybe<ValuePtr> value) {
+  auto result = Entry::make(*this, key, value, state);
 
   lru.size.fetch_add(result->size(), std::memory_order_relaxed);
 
   return result;
 }
 
-ActorCache::Entry::Entry(kj::Badge<ActorCache>,ActorCache& cache, Key keyParam,
-                         kj::Maybe<Value> valueParam, EntryState state)
-    : cache(cache), key(kj::mv(keyParam)), value(kj::mv(valueParam)), state(state) {}
+kj::Own<ActorCache::Entry> ActorCache::Entry::make(
+    kj::Maybe<ActorCache&> cache, KeyPtr key, kj::Maybe<ValuePtr> value, EntryState state) {
+  size_t size = sizeof(Entry) + key.size() + 1;
+  KJ_IF_MAYBE(v, value) {
+    size += v->size();
+  }
 
-ActorCache::Entry::Entry(kj::Badge<GetResultList>, Key keyParam, kj::Maybe<Value> valueParam)
-    : key(kj::mv(keyParam)), value(kj::mv(valueParam)), state(NOT_IN_CACHE) {}
+  // The constructor copies `key` and `value` into the space after the entry. The new entry's
+  // refcount starts at one, for the returned reference.
+  Entry* entry = new (::operator new(size)) Entry(cache, key, value, state);
+  return kj::Own<Entry>(entry, *entry);
+}
+
+kj::Own<ActorCache::Entry> ActorCache::Entry::addRef() {
+  refcount.fetch_add(1, std::memory_order_relaxed);
+  return kj::Own<Entry>(this, *this);
+}
+
+void ActorCache::Entry::disposeImpl(void* pointer) const {
+  if (refcount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    auto self = const_cast<Entry*>(this);
+    KJ_DEFER(::operator delete(self));
+    self->~Entry();
+  }
+}
+
+ActorCache::Entry::Entry(kj::Maybe<ActorCache&> cache, KeyPtr keyParam,
+                         kj::Maybe<ValuePtr> valueParam, EntryState state)
+    : cache(cache),
+      key([&]() {
+        char* bytes = reinterpret_cast<char*>(this + 1);
+        memcpy(bytes, keyParam.begin(), keyParam.size());
+        bytes[keyParam.size()] = '\0';
+        return KeyPtr(bytes, keyParam.size());
+      }()),
+      value(valueParam.map([&](ValuePtr v) {
+        byte* bytes = reinterpret_cast<byte*>(this + 1) + keyParam.size() + 1;
+        if (v.size() > 0) memcpy(bytes, v.begin(), v.size());
+        return ValuePtr(bytes, v.size());
+      })),
+      state(state) {}
 
 ActorCache::Entry::~Entry() noexcept(false) {
   KJ_IF_MAYBE(c, cache) {
@@ -110,6 +149,62 @@ ActorCache::SharedLru::~SharedLru() noexcept(false) {
   }
 }
 
+ActorCache::SharedLru::Stats ActorCache::SharedLru::getStats() const {
+  return {
+    .hits = hits.load(std::memory_order_relaxed),
+    .evictions = evictions.load(std::memory_order_relaxed),
+    .lockWait = lockWaitNs.load(std::memory_order_relaxed) * kj::NANOSECONDS,
+    .prefetches = prefetches.load(std::memory_order_relaxed),
+    .prefetchHits = prefetchHits.load(std::memory_order_relaxed),
+    .coalescedReads = coalescedReads.load(std::memory_order_relaxed),
+    .flushDuration = flushDuration.snapshot(),
+  };
+}
+
+void ActorCache::SharedLru::addExternalSize(size_t bytes) const {
+  size.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void ActorCache::SharedLru::removeExternalSize(size_t bytes) const {
+  size_t before = size.fetch_sub(bytes, std::memory_order_relaxed);
+  if (KJ_UNLIKELY(before < bytes)) {
+    // underflow -- shouldn't happen, but just in case, let's fix
+    KJ_LOG(ERROR, "SharedLru size tracking inconsistency detected",
+          before, bytes, kj::getStackTrace());
+    size.store(0, std::memory_order_relaxed);
+  }
+}
+
+ActorCache::Lock ActorCache::SharedLru::lock() const {
+  // Counted per thread rather than per LRU, so that deciding whether to sample doesn't touch a
+  // shared cache line.
+  static thread_local uint locksUntilTiming = 0;
+
+  uint interval = options.lockTimingInterval;
+  if (interval == 0) {
+    return cleanList.lockExclusive();
+  } else if (locksUntilTiming > 0) {
+    --locksUntilTiming;
+    return cleanList.lockExclusive();
+  }
+  locksUntilTiming = interval - 1;
+
+  auto& clock = kj::systemPreciseMonotonicClock();
+  auto start = clock.now();
+  auto result = cleanList.lockExclusive();
+  lockWaitNs.fetch_add((clock.now() - start) / kj::NANOSECONDS * interval,
+                       std::memory_order_relaxed);
+  return result;
+}
+
+void ActorCache::SharedLru::makeRoom() const {
+  if (!isOverSoftLimit()) return;
+
+  auto lock = this->lock();
+  // If only dirty entries are left, the caller makes up the difference by evicting its own.
+  KJ_UNUSED bool overHardLimit = evictIfNeeded(lock);
+}
+
 kj::Maybe<kj::Promise<void>> ActorCache::evictStale(kj::Date now) {
   int64_t nowNs = (now - kj::UNIX_EPOCH) / kj::NANOSECONDS;
   int64_t oldValue = lru.nextStaleCheckNs.load(std::memory_order_relaxed);
@@ -117,11 +212,12 @@ kj::Maybe<kj::Promise<void>> ActorCache::evictStale(kj::Date now) {
   if (nowNs >= oldValue) {
     int64_t newValue = nowNs + lru.options.staleTimeout / kj::NANOSECONDS;
     if (lru.nextStaleCheckNs.compare_exchange_strong(oldValue, newValue)) {
-      auto lock = lru.cleanList.lockExclusive();
+      auto lock = lru.lock();
       for (auto& entry: *lock) {
         if (entry.state == STALE) {
           entry.state = NOT_IN_CACHE;
           lock->remove(entry);
+          lru.evictions.fetch_add(1, std::memory_order_relaxed);
           KJ_ASSERT_NONNULL(entry.cache).evictEntry(lock, entry);
         } else {
           KJ_ASSERT(entry.state == CLEAN);
@@ -265,18 +361,29 @@ bool ActorCache::SharedLru::evictIfNeeded(Lock& lock) const {
     }
 
     Entry& entry = lock->front();
-    entry.state = NOT_IN_CACHE;
     lock->remove(entry);
+    if (entry.referenced) {
+      // Read since we last swept past it; give it a second chance. This terminates because each
+      // entry can only be skipped once per sweep.
+      entry.referenced = false;
+      lock->add(entry);
+      continue;
+    }
+
+    entry.state = NOT_IN_CACHE;
+    evictions.fetch_add(1, std::memory_order_relaxed);
     KJ_ASSERT_NONNULL(entry.cache).evictEntry(lock, entry);
   }
 }
 
-void ActorCache::touchEntry(Lock& lock, Entry& entry, const ReadOptions& options) {
+void ActorCache::touchEntry(Lock& lock, Entry& entry, const ReadOptions& options, ReadKind kind) {
+  lru.hits.fetch_add(1, std::memory_order_relaxed);
   if (!options.noCache) {
     if (entry.state == CLEAN || entry.state == STALE) {
       entry.state = CLEAN;
-      lock->remove(entry);
-      lock->add(entry);
+      if (kind == ReadKind::POINT) {
+        entry.referenced = true;
+      }
     }
 
     // If this is a dirty entry previously marked no-cache, remove that mark. This results in the
@@ -329,7 +436,7 @@ void ActorCache::evictEntry(Lock& lock, Entry& entry) {
 }
 
 void ActorCache::verifyConsistencyForTest() {
-  auto lock = lru.cleanList.lockExclusive();
+  auto lock = lru.lock();
   currentValues.get(lock).verify();  // verify the table's BTreeIndex
   bool prevGapIsKnownEmpty = false;
   kj::Maybe<kj::StringPtr> prevKey = nullptr;
@@ -374,31 +481,69 @@ kj::OneOf<kj::Maybe<ActorCache::Value>, kj::Promise<kj::Maybe<ActorCache::Value>
   options.noCache = options.noCache || lru.options.noCache;
   requireNotTerminal();
 
-  auto lock = lru.cleanList.lockExclusive();
+  auto lock = lru.lock();
   KJ_IF_MAYBE(entry, findInCache(lock, key, options)) {
     return entry->get()->value.map([&](ValuePtr value) {
       return value.attach(kj::mv(*entry));
     });
-  } else {
-    return scheduleStorageRead([key=KeyPtr(key)](rpc::ActorStorage::Operations::Client client) {
-      auto req = client.getRequest(
-          capnp::MessageSize { 4 + key.size() / sizeof(capnp::word), 0 });
-      req.setKey(key.asBytes());
-      return req.send().dropPipeline();
-    }).then([this,key=kj::mv(key),options]
-            (capnp::Response<rpc::ActorStorage::Operations::GetResults> response) mutable
-          -> kj::Maybe<ActorCache::Value> {
-      kj::Maybe<capnp::Data::Reader> value;
-      if (response.hasValue()) {
-        value = response.getValue();
-      }
-      auto lock = lru.cleanList.lockExclusive();
-      auto entry = addReadResultToCache(lock, kj::mv(key), value, options);
-      evictOrOomIfNeeded(lock);
-      return entry->value.map([&](ValuePtr value) {
-        return value.attach(kj::mv(entry));
-      });
+  }
+
+  // If another get() is already reading this key, wait for its result rather than reading it
+  // again. This can't return a value older than we'd read ourselves: a write to the key since that
+  // read started would be in cache now, since flushes wait for past reads to complete.
+  KJ_IF_MAYBE(inFlight, inFlightGets.find(key)) {
+    auto& read = **inFlight;
+    if (!read.done && read.noCache == options.noCache) {
+      lru.coalescedReads.fetch_add(1, std::memory_order_relaxed);
+      return waitForInFlightGet(kj::addRef(read));
+    }
+    // The read finished and the key has since been evicted, or its options don't match ours.
+    // Replace it with our own.
+    inFlightGets.erase(key);
+  }
+
+  auto read = kj::refcounted<InFlightGet>(*this, kj::mv(key), options.noCache);
+  read->promise = scheduleStorageRead(
+      [key=KeyPtr(read->key)](rpc::ActorStorage::Operations::Client client) {
+    auto req = client.getRequest(
+        capnp::MessageSize { 4 + key.size() / sizeof(capnp::word), 0 });
+    req.setKey(key.asBytes());
+    return req.send().dropPipeline();
+  }).then([this,&read=*read,options]
+          (capnp::Response<rpc::ActorStorage::Operations::GetResults> response) mutable {
+    read.done = true;
+    kj::Maybe<capnp::Data::Reader> value;
+    if (response.hasValue()) {
+      value = response.getValue();
+    }
+    auto lock = lru.lock();
+    auto entry = addReadResultToCache(lock, cloneKey(read.key), value, options, ReadKind::POINT);
+    evictOrOomIfNeeded(lock);
+    return entry;
+  }, [&read=*read](kj::Exception&& e) -> kj::Own<Entry> {
+    read.done = true;
+    kj::throwFatalException(kj::mv(e));
+  }).fork();
+  inFlightGets.insert(read->key, read.get());
+  return waitForInFlightGet(kj::mv(read));
+}
+
+kj::Promise<kj::Maybe<ActorCache::Value>> ActorCache::waitForInFlightGet(
+    kj::Own<InFlightGet> read) {
+  return read->promise.addBranch().then([](kj::Own<Entry> entry) -> kj::Maybe<ActorCache::Value> {
+    return entry->value.map([&](ValuePtr value) {
+      return value.attach(kj::mv(entry));
     });
+  }).attach(kj::mv(read));
+}
+
+ActorCache::InFlightGet::~InFlightGet() noexcept(false) {
+  KJ_IF_MAYBE(c, cache) {
+    KJ_IF_MAYBE(slot, c->inFlightGets.find(key)) {
+      if (*slot == this) {
+        c->inFlightGets.erase(key);
+      }
+    }
   }
 }
 
@@ -420,7 +565,7 @@ public:
       return KJ_EXCEPTION(DISCONNECTED, "canceled");
     }
 
-    auto lock = cache.lru.cleanList.lockExclusive();
+    auto lock = cache.lru.lock();
     auto params = context.getParams();
     kj::String prevKey = nullptr;
     for (auto kv: params.getList()) {
@@ -441,14 +586,15 @@ public:
           break;
         } else if (key == *nextExpectedKey) {
           fetchedEntries.add(cache.addReadResultToCache(
-              lock, kj::mv(*nextExpectedKey), kv.getValue(), options));
+              lock, kj::mv(*nextExpectedKey), kv.getValue(), options, ReadKind::POINT));
           ++nextExpectedKey;
           break;
         }
 
         // It seems the list results have moved past `nextExpectedKey`, meaning it wasn't present
         // on disk. Write a negative cache entry.
-        cache.addReadResultToCache(lock, kj::mv(*nextExpectedKey), nullptr, options);
+        cache.addReadResultToCache(
+            lock, kj::mv(*nextExpectedKey), nullptr, options, ReadKind::POINT);
         ++nextExpectedKey;
       }
 
@@ -470,9 +616,10 @@ public:
 
     if (nextExpectedKey < keysToFetch.end()) {
       // Some trailing keys weren't seen, better mark them as not present.
-      auto lock = cache.lru.cleanList.lockExclusive();
+      auto lock = cache.lru.lock();
       while (nextExpectedKey < keysToFetch.end()) {
-        cache.addReadResultToCache(lock, kj::mv(*nextExpectedKey++), nullptr, options);
+        cache.addReadResultToCache(
+            lock, kj::mv(*nextExpectedKey++), nullptr, options, ReadKind::POINT);
       }
       cache.evictOrOomIfNeeded(lock);
     }
@@ -541,7 +688,7 @@ kj::OneOf<ActorCache::GetResultList, kj::Promise<ActorCache::GetResultList>>
   capnp::MessageSize sizeHint { 4, 1 };
 
   {
-    auto lock = lru.cleanList.lockExclusive();
+    auto lock = lru.lock();
     for (auto& key: keys) {
       KJ_IF_MAYBE(entry, findInCache(lock, key, options)) {
         cachedEntries.add(kj::mv(*entry));
@@ -718,7 +865,7 @@ public:
     }
 
     {
-      auto lock = cache.lru.cleanList.lockExclusive();
+      auto lock = cache.lru.lock();
       auto list = context.getParams().getList();
 
       bool insertedAny = false;
@@ -744,14 +891,15 @@ public:
         }
 
         KJ_ASSERT(kv.hasValue());  // values that don't exist aren't listed!
-        auto entry = cache.addReadResultToCache(lock, kj::mv(key), kv.getValue(), options);
+        auto entry = cache.addReadResultToCache(
+            lock, kj::mv(key), kv.getValue(), options, ReadKind::RANGE);
         fetchedEntries.add(kj::mv(entry));
         insertedAny = true;
       }
 
       if (insertedAny) {
         // Update `gapIsKnownEmpty` on the whole range.
-        cache.markGapsEmpty(lock, beginKey, fetchedEntries.back()->key.asPtr(), options);
+        cache.markGapsEmpty(lock, beginKey, fetchedEntries.back()->key, options);
         beginKey = cloneKey(fetchedEntries.back()->key);
         beginKeyIsKnown = true;
       }
@@ -776,7 +924,7 @@ public:
 
     // Mark the rest of the range as empty.
     {
-      auto lock = cache.lru.cleanList.lockExclusive();
+      auto lock = cache.lru.lock();
 
       if (!beginKeyIsKnown) {
         // We received no results at all, so the start of the list is definitely not in storage.
@@ -811,7 +959,7 @@ public:
     //    so the insertion of a new null entry is ignored for being redundant. This case is
     //    fine too, as the gap is already marked. Our markGapsEmpty() call will start with the
     //    following entry.
-    cache.addReadResultToCache(lock, cloneKey(beginKey), nullptr, options);
+    cache.addReadResultToCache(lock, cloneKey(beginKey), nullptr, options, ReadKind::RANGE);
   }
 
   void cancel() {
@@ -862,6 +1010,107 @@ public:
 kj::OneOf<ActorCache::GetResultList, kj::Promise<ActorCache::GetResultList>>
     ActorCache::list(Key beginKey, kj::Maybe<Key> endKey,
                      kj::Maybe<uint> limit, ReadOptions options) {
+  uint pageLimit;
+  KJ_IF_MAYBE(l, limit) {
+    pageLimit = *l;
+  } else {
+    // Without a limit the app isn't paginating, so there's nothing to read ahead of.
+    return listImpl(kj::mv(beginKey), kj::mv(endKey), limit, options);
+  }
+  if (lru.options.prefetchLimit == 0 || pageLimit == 0) {
+    return listImpl(kj::mv(beginKey), kj::mv(endKey), limit, options);
+  }
+
+  // Pagination either resumes at the last key returned (if the app filters it out itself) or
+  // right after it.
+  bool sequential = false;
+  bool prefetched = false;
+  KJ_IF_MAYBE(page, lastPage) {
+    bool sameEnd;
+    KJ_IF_MAYBE(e, endKey) {
+      KJ_IF_MAYBE(pe, page->endKey) {
+        sameEnd = *e == *pe;
+      } else {
+        sameEnd = false;
+      }
+    } else {
+      sameEnd = page->endKey == nullptr;
+    }
+    bool resumes = beginKey == page->lastKey ||
+        (beginKey.size() == page->lastKey.size() + 1 &&
+         beginKey.startsWith(page->lastKey) && beginKey.endsWith(kj::StringPtr("\0", 1)));
+    sequential = sameEnd && resumes;
+    prefetched = sequential && page->prefetched;
+  }
+
+  auto endCopy = endKey.map([](const Key& k) { return cloneKey(k); });
+  auto result = listImpl(kj::mv(beginKey), kj::mv(endKey), limit, options);
+  KJ_SWITCH_ONEOF(result) {
+    KJ_CASE_ONEOF(page, GetResultList) {
+      if (prefetched) {
+        lru.prefetchHits.fetch_add(1, std::memory_order_relaxed);
+      }
+      pageListed(page, kj::mv(endCopy), pageLimit, sequential, options);
+    }
+    KJ_CASE_ONEOF(promise, kj::Promise<GetResultList>) {
+      return promise.then([this, endCopy = kj::mv(endCopy), pageLimit, sequential, options]
+                          (GetResultList page) mutable {
+        pageListed(page, kj::mv(endCopy), pageLimit, sequential, options);
+        return kj::mv(page);
+      });
+    }
+  }
+  return kj::mv(result);
+}
+
+void ActorCache::pageListed(const GetResultList& page, kj::Maybe<Key> end, uint limit,
+                            bool sequential, const ReadOptions& options) {
+  if (page.size() < limit) {
+    // The range is exhausted; the app won't ask for another page of it.
+    lastPage = nullptr;
+    return;
+  }
+
+  KeyPtr lastKey = page.entries.back()->key;
+  bool prefetched = false;
+  if (sequential && !prefetchInFlight && !options.noCache && !lru.options.noCache &&
+      lru.currentSize() < lru.options.softLimit / 2) {
+    // Only read ahead once the app has asked for a second page, and only when there's plenty of
+    // room in cache, so that we don't evict anything to make room for what may never be read.
+    prefetched = startPrefetch(lastKey, end, options);
+  }
+
+  lastPage = LastPage { cloneKey(lastKey), kj::mv(end), prefetched };
+}
+
+bool ActorCache::startPrefetch(KeyPtr after, const kj::Maybe<Key>& end,
+                               const ReadOptions& options) {
+  // The listing starts at `after` itself, which is already in cache, so ask for one more key
+  // than we mean to read ahead.
+  auto result = listImpl(cloneKey(after),
+      end.map([](const Key& k) { return cloneKey(k); }),
+      lru.options.prefetchLimit + 1, options);
+
+  KJ_IF_MAYBE(promise, result.tryGet<kj::Promise<GetResultList>>()) {
+    lru.prefetches.fetch_add(1, std::memory_order_relaxed);
+    prefetchInFlight = true;
+    prefetchTask = promise->then([this](GetResultList) {
+      prefetchInFlight = false;
+    }, [this](kj::Exception&&) {
+      // Read-ahead is only an optimization. If it failed, the app's own read will retry it and
+      // see the error.
+      prefetchInFlight = false;
+    }).eagerlyEvaluate(nullptr);
+    return true;
+  } else {
+    // Everything was cached already.
+    return false;
+  }
+}
+
+kj::OneOf<ActorCache::GetResultList, kj::Promise<ActorCache::GetResultList>>
+    ActorCache::listImpl(Key beginKey, kj::Maybe<Key> endKey,
+                         kj::Maybe<uint> limit, ReadOptions options) {
   options.noCache = options.noCache || lru.options.noCache;
   requireNotTerminal();
 
@@ -884,7 +1133,7 @@ kj::OneOf<ActorCache::GetResultList, kj::Promise<ActorCache::GetResultList>>
   // negative entries in the range, since each of those negative entries could potentially negate a
   // positive entry read from disk.
 
-  auto lock = lru.cleanList.lockExclusive();
+  auto lock = lru.lock();
   auto& map = currentValues.get(lock);
   auto ordered = map.ordered();
 
@@ -953,11 +1202,11 @@ kj::OneOf<ActorCache::GetResultList, kj::Promise<ActorCache::GetResultList>>
       case STALE:
       case DIRTY:
       case FLUSHING:
-        touchEntry(lock, entry, options);
+        touchEntry(lock, entry, options, ReadKind::RANGE);
 
         // Note that we need to add even negative entries to `cachedEntries` so that they override
         // whatever we read from storage later. However, they should not count against the limit.
-        cachedEntries.add(kj::atomicAddRef(entry));
+        cachedEntries.add(entry.addRef());
         if (entry.value == nullptr) {
           if (storageListStart != nullptr && (entry.state == DIRTY || entry.state == FLUSHING)) {
             // This negative entry could negate something read from storage later, so we need to
@@ -1086,7 +1335,7 @@ public:
     }
 
     {
-      auto lock = cache.lru.cleanList.lockExclusive();
+      auto lock = cache.lru.lock();
       auto list = context.getParams().getList();
 
       bool insertedAny = false;
@@ -1102,7 +1351,8 @@ public:
         }
 
         KJ_ASSERT(kv.hasValue());  // values that don't exist aren't listed!
-        auto entry = cache.addReadResultToCache(lock, kj::mv(key), kv.getValue(), options);
+        auto entry = cache.addReadResultToCache(
+            lock, kj::mv(key), kv.getValue(), options, ReadKind::RANGE);
         fetchedEntries.add(kj::mv(entry));
         insertedAny = true;
       }
@@ -1134,7 +1384,7 @@ public:
 
     // Mark the rest of the range as empty.
     {
-      auto lock = cache.lru.cleanList.lockExclusive();
+      auto lock = cache.lru.lock();
 
       if (fetchedEntries.size() < adjustedLimit.orDefault(kj::maxValue)) {
         // We didn't reach the limit, so the rest of the range must be empty.
@@ -1142,7 +1392,8 @@ public:
         // We may need to insert a negative entry at the beginning of the list range, since we
         // didn't see it, implying it's not present on disk. addResultToCache() will conveniently
         // avoid adding anything if it turns out this is already in a known-empty gap.
-        auto beginEntry = cache.addReadResultToCache(lock, cloneKey(beginKey), nullptr, options);
+        auto beginEntry = cache.addReadResultToCache(
+            lock, cloneKey(beginKey), nullptr, options, ReadKind::RANGE);
 
         // And we need to mark gaps empty from there to the final entry we actually saw.
         cache.markGapsEmpty(lock, beginEntry->key, endKey, options);
@@ -1222,7 +1473,7 @@ kj::OneOf<ActorCache::GetResultList, kj::Promise<ActorCache::GetResultList>>
   // negative entries in the range, since each of those negative entries could potentially negate a
   // positive entry read from disk.
 
-  auto lock = lru.cleanList.lockExclusive();
+  auto lock = lru.lock();
   auto& map = currentValues.get(lock);
   auto ordered = map.ordered();
 
@@ -1273,11 +1524,11 @@ kj::OneOf<ActorCache::GetResultList, kj::Promise<ActorCache::GetResultList>>
       case STALE:
       case DIRTY:
       case FLUSHING:
-        touchEntry(lock, entry, options);
+        touchEntry(lock, entry, options, ReadKind::RANGE);
 
         // Note that we need to add even negative entries to `cachedEntries` so that they override
         // whatever we read from storage later. However, they should not count against the limit.
-        cachedEntries.add(kj::atomicAddRef(entry));
+        cachedEntries.add(entry.addRef());
         if (entry.value == nullptr) {
           if (storageListEnd != nullptr && (entry.state == DIRTY || entry.state == FLUSHING)) {
             // This negative entry could negate something read from storage later, so we need to
@@ -1400,8 +1651,8 @@ kj::Maybe<kj::Own<ActorCache::Entry>> ActorCache::findInCache(
       case STALE:
       case DIRTY:
       case FLUSHING:
-        touchEntry(lock, entry, options);
-        return kj::atomicAddRef(entry);
+        touchEntry(lock, entry, options, ReadKind::POINT);
+        return entry.addRef();
 
       case END_GAP:
         return nullptr;
@@ -1418,7 +1669,7 @@ kj::Maybe<kj::Own<ActorCache::Entry>> ActorCache::findInCache(
       if (prev.gapIsKnownEmpty) {
         // A previous list() operation covered this section of the key space and did not find this
         // key, so we know it's not present. Return a dummy entry saying this.
-        return makeEntry(lock, CLEAN, cloneKey(key), nullptr);
+        return makeEntry(lock, CLEAN, key, nullptr);
       }
     }
 
@@ -1428,9 +1679,10 @@ kj::Maybe<kj::Own<ActorCache::Entry>> ActorCache::findInCache(
 }
 
 kj::Own<ActorCache::Entry> ActorCache::addReadResultToCache(
-    Lock& lock, Key key, kj::Maybe<capnp::Data::Reader> value, const ReadOptions& options) {
-  kj::Own<Entry> entry = makeEntry(lock, CLEAN, kj::mv(key),
-      value.map([](capnp::Data::Reader reader) { return kj::heapArray(reader); }));
+    Lock& lock, Key key, kj::Maybe<capnp::Data::Reader> value, const ReadOptions& options,
+    ReadKind kind) {
+  kj::Own<Entry> entry = makeEntry(lock, CLEAN, key,
+      value.map([](capnp::Data::Reader reader) -> ValuePtr { return reader; }));
 
   if (options.noCache) {
     // We don't actually want to add this to the cache, just return the entry.
@@ -1479,7 +1731,7 @@ kj::Own<ActorCache::Entry> ActorCache::addReadResultToCache(
     //    the caching logic.
     //
     // Because of this, we know it is correct to leave `gapIsKnownEmpty = false` on our new entry.
-    return kj::atomicAddRef(*entry);
+    return entry->addRef();
   });
 
   if (slot.get() != entry.get()) {
@@ -1489,7 +1741,7 @@ kj::Own<ActorCache::Entry> ActorCache::addReadResultToCache(
       // the same slot.
       KJ_ASSERT(!slot->gapIsKnownEmpty);  // END_GAP entry should never have gapIsKnownEmpty.
       slot->state = NOT_IN_CACHE;
-      slot = kj::atomicAddRef(*entry);
+      slot = entry->addRef();
     } else {
       // The entry that's already in the map must be at least as fresh as the one we just created.
       // If it was created by a put() or delete(), then it is actually fresher. If it was created
@@ -1513,6 +1765,9 @@ kj::Own<ActorCache::Entry> ActorCache::addReadResultToCache(
   }
 
   if (entry->state == CLEAN) {
+    // The read that fetched the entry counts as a reference, so that it isn't the first thing
+    // evicted if the cache is full.
+    entry->referenced = kind == ReadKind::POINT;
     lock->add(*entry);
   }
 
@@ -1580,7 +1835,7 @@ void ActorCache::markGapsEmpty(Lock& lock, KeyPtr beginKey, kj::Maybe<KeyPtr> en
       } else {
         // We must insert an END_GAP entry to cap our range.
         KJ_IF_MAYBE(k, endKey) {
-          map.insert(makeEntry(lock, END_GAP, cloneKey(*k), nullptr));
+          map.insert(makeEntry(lock, END_GAP, *k, nullptr));
         } else {
           // No END_GAP needed since the end is actually the end of the key space.
         }
@@ -1676,11 +1931,20 @@ ActorCache::GetResultList::GetResultList(kj::Vector<KeyValuePair> contents)
   // TODO(perf): Allocating an `Entry` object for every key/value pair is lame but to avoid it
   //   we'd have to make the common case worse...
   for (auto& kv: contents) {
-    entries.add(kj::heap<Entry>(kj::Badge<GetResultList>(), kj::mv(kv.key), kj::mv(kv.value)));
+    entries.add(Entry::make(nullptr, kv.key, kv.value.asPtr(), ActorCache::NOT_IN_CACHE));
     cacheStatuses.add(CacheStatus::UNCACHED);
   }
 }
 
+ActorCache::GetResultList::GetResultList(
+    kj::Vector<KeyValuePair> contents, kj::Vector<CacheStatus> statuses)
+    : entries(contents.size()), cacheStatuses(kj::mv(statuses)) {
+  KJ_REQUIRE(cacheStatuses.size() == contents.size());
+  for (auto& kv: contents) {
+    entries.add(Entry::make(nullptr, kv.key, kv.value.asPtr(), ActorCache::NOT_IN_CACHE));
+  }
+}
+
 ActorCache::GetResultList::GetResultList(
     kj::Vector<kj::Own<Entry>> cachedEntries, kj::Vector<kj::Own<Entry>> fetchedEntries,
     Order order, kj::Maybe<uint> maybeLimit) {
@@ -1799,7 +2063,7 @@ kj::Maybe<kj::Promise<void>> ActorCache::put(Key key, Value value, WriteOptions
   options.noCache = options.noCache || lru.options.noCache;
   requireNotTerminal();
   {
-    auto lock = lru.cleanList.lockExclusive();
+    auto lock = lru.lock();
     putImpl(lock, kj::mv(key), kj::mv(value), options, nullptr);
     evictOrOomIfNeeded(lock);
   }
@@ -1810,7 +2074,7 @@ kj::Maybe<kj::Promise<void>> ActorCache::put(kj::Array<KeyValuePair> pairs, Writ
   options.noCache = options.noCache || lru.options.noCache;
   requireNotTerminal();
   {
-    auto lock = lru.cleanList.lockExclusive();
+    auto lock = lru.lock();
     for (auto& pair: pairs) {
       putImpl(lock, kj::mv(pair.key), kj::mv(pair.value), options, nullptr);
     }
@@ -1856,7 +2120,7 @@ kj::OneOf<bool, kj::Promise<bool>> ActorCache::delete_(Key key, WriteOptions opt
 
   auto countedDelete = kj::refcounted<CountedDelete>();
   {
-    auto lock = lru.cleanList.lockExclusive();
+    auto lock = lru.lock();
     putImpl(lock, kj::mv(key), nullptr, options, *countedDelete);
     evictOrOomIfNeeded(lock);
   }
@@ -1893,7 +2157,7 @@ kj::OneOf<uint, kj::Promise<uint>> ActorCache::delete_(kj::Array<Key> keys, Writ
 
   auto countedDelete = kj::refcounted<CountedDelete>();
   {
-    auto lock = lru.cleanList.lockExclusive();
+    auto lock = lru.lock();
     for (auto& key: keys) {
       putImpl(lock, kj::mv(key), nullptr, options, *countedDelete);
     }
@@ -1945,7 +2209,7 @@ ActorCache::DeleteAllResults ActorCache::deleteAll(WriteOptions options) {
   kj::Promise<uint> result { (uint)0 };
 
   {
-    auto lock = lru.cleanList.lockExclusive();
+    auto lock = lru.lock();
     auto& map = currentValues.get(lock);
 
     kj::Vector<kj::Own<Entry>> deletedDirty;
@@ -1977,7 +2241,7 @@ ActorCache::DeleteAllResults ActorCache::deleteAll(WriteOptions options) {
     // Insert a dummy entry with an empty key and gapIsKnownEmpty = true to indicate that
     // everything is empty.
     map.findOrCreate(Key(nullptr), [&]() {
-      auto entry = makeEntry(lock, CLEAN, Key(nullptr), nullptr);
+      auto entry = makeEntry(lock, CLEAN, KeyPtr(), nullptr);
       lock->add(*entry);
       entry->gapIsKnownEmpty = true;
       return entry;
@@ -2013,7 +2277,8 @@ ActorCache::DeleteAllResults ActorCache::deleteAll(WriteOptions options) {
 void ActorCache::putImpl(Lock& lock, Key key, kj::Maybe<Value> value,
                          const WriteOptions& options, kj::Maybe<CountedDelete&> countedDelete) {
   // Use NOT_IN_CACHE state until the entry is actually inserted into the map.
-  return putImpl(lock, makeEntry(lock, NOT_IN_CACHE, kj::mv(key), kj::mv(value)),
+  return putImpl(lock, makeEntry(lock, NOT_IN_CACHE, key,
+                                 value.map([](ValuePtr v) { return v; })),
                  options, countedDelete);
 }
 
@@ -2144,16 +2409,25 @@ void ActorCache::ensureFlushScheduled(const WriteOptions& options) {
 
   if (!flushScheduled) {
     flushScheduled = true;
-    auto flushPromise = lastFlush.addBranch().attach(kj::defer([this]() {
+    auto scheduledTime = kj::systemPreciseMonotonicClock().now();
+    auto previousFlush = lastFlush.addBranch();
+    if (lru.options.flushBatchingWindow > 0 * kj::SECONDS) {
+      previousFlush = previousFlush.then([this]() {
+        return gate.batchingDelay(lru.options.flushBatchingWindow);
+      });
+    }
+    auto flushPromise = previousFlush.attach(kj::defer([this]() {
       flushScheduled = false;
       flushScheduledWithOutputGate = false;
-    })).then([this]() {
+    })).then([this, scheduledTime]() {
       ++flushesEnqueued;
       return kj::evalNow([this](){
         // `flushImpl()` can throw, so we need to wrap it in `evalNow()` to observe all pathways.
         return flushImpl();
-      }).attach(kj::defer([this](){
+      }).attach(kj::defer([this, scheduledTime](){
         --flushesEnqueued;
+
+        lru.flushDuration.record(kj::systemPreciseMonotonicClock().now() - scheduledTime);
       }));
     });
 
@@ -2291,11 +2565,10 @@ kj::Promise<void> ActorCache::flushImpl(uint retryCount) {
   // muted deletes, we go ahead and construct batches of no more than 128 keys. They all end up
   // being part of the same transaction in the end, though.
   //
-  // TODO(perf): Currently we send all the batches at the same time. If the batches are large,
-  //   it could be worth spacing them out a bit so we don't saturate the connection. However, we
-  //   still need to make sure that the whole transaction represents a consistent snapshot in time,
-  //   so getting this right, without making a copy of everything upfront, could get complicated.
-  //   Punting for now.
+  // By default we send all the batches at the same time. If the batches are large, that can
+  // saturate the connection, so `maxFlushRpcsInFlight` can limit how many are outstanding at once.
+  // The RPC messages are still all constructed upfront, since the whole transaction must represent
+  // a consistent snapshot in time.
 
   PutFlush putFlush;
   MutedDeleteFlush mutedDeleteFlush;
@@ -2308,7 +2581,9 @@ kj::Promise<void> ActorCache::flushImpl(uint retryCount) {
       batches.add(FlushBatch{});
     } else if (auto& tailBatch = batches.back();
         tailBatch.pairCount >= lru.options.maxKeysPerRpc
-        || ((tailBatch.wordCount + words) > MAX_ACTOR_STORAGE_RPC_WORDS)) {
+        || ((tailBatch.wordCount + words) > MAX_ACTOR_STORAGE_RPC_WORDS)
+        || (lru.options.maxBytesPerRpc > 0 &&
+            (tailBatch.wordCount + words) * sizeof(capnp::word) > lru.options.maxBytesPerRpc)) {
       // We've filled this batch, add a new one.
       batches.add(FlushBatch{});
     }
@@ -2487,7 +2762,7 @@ kj::Promise<void> ActorCache::flushImpl(uint retryCount) {
       return flushImplDeleteAll();
     }
 
-    auto lock = lru.cleanList.lockExclusive();
+    auto lock = lru.lock();
 
     KJ_IF_MAYBE(r, requestedDeleteAll) {
       // It would appear that all dirty entries were moved into `requestedDeleteAll` during the
@@ -2805,36 +3080,79 @@ kj::Promise<void> ActorCache::flushImplUsingTxn(
   // if we were to include those new writes we'd potentially have to wait on past reads again.
   // Similarly, we have to copy the data into our RPC structs prior to waiting instead of after to
   // avoid the data changing out from under us while we wait.
-  co_await waitForPastReads();
+  //
+  // Nothing below is awaited before the final joinPromises(): if an exception escaped the
+  // coroutine early, it would drop `txnProm` before it's added to `promises`, cancelling the
+  // catch_ branch that triggers our autoReconnect logic on storage failures. Instead, each request
+  // is sent by a link of `sendChain`, which starts once past reads are done.
+  kj::Promise<void> sendChain = waitForPastReads();
+
+  // Send all the RPCs, strictly in order. It's important that counted deletes are sent first since
+  // they can overlap with puts. Specifically this can happen if someone does a delete() immediately
+  // followed by a put() on the same key. These two writes may have been coalesced into a single
+  // flush. Unfortunately, we can't just skip the delete because we still need to count it. So we
+  // issue a delete, followed by a put, in the same transaction. The commit must come last of all.
+  //
+  // If limited, each batch beyond the first `maxInFlight` waits for an earlier one to complete
+  // before it is sent. Batches usually complete in order, so we wait for the oldest.
+  size_t maxInFlight = lru.options.maxFlushRpcsInFlight;
+  size_t batchCount = rpcMutedDeletes.size() + rpcPuts.size();
+  for (auto& rpcCountedDelete: rpcCountedDeletes) {
+    batchCount += rpcCountedDelete.rpcDeletes.size();
+  }
+  kj::Vector<kj::Promise<void>> batchPromises(batchCount);
+  auto takeSlot = [&]() -> kj::Promise<void> {
+    if (maxInFlight == 0 || batchPromises.size() < maxInFlight) return kj::READY_NOW;
+    auto& oldest = batchPromises[batchPromises.size() - maxInFlight];
+    auto result = kj::mv(oldest);
+    oldest = kj::READY_NOW;
+    return kj::mv(result);
+  };
+  auto sendInOrder = [&](kj::Promise<void> slot, auto send) {
+    // Calls `send()` once every earlier request has been sent and `slot` has resolved, and returns
+    // the promise it returns.
+    auto paf = kj::newPromiseAndFulfiller<decltype(send())>();
+    auto& fulfiller = *paf.fulfiller;
+    sendChain = sendChain.then([slot = kj::mv(slot)]() mutable { return kj::mv(slot); })
+        .then([&fulfiller, send = kj::mv(send)]() mutable {
+      fulfiller.fulfill(send());
+    }, [&fulfiller](kj::Exception&& e) {
+      // Fail the request with the same exception, so that a disconnect is still seen as one.
+      fulfiller.reject(kj::cp(e));
+      kj::throwFatalException(kj::mv(e));
+    }).attach(kj::mv(paf.fulfiller));
+    return kj::mv(paf.promise);
+  };
 
-  // Send all the RPCs. It's important that counted deletes are sent first since they can overlap
-  // with puts. Specifically this can happen if someone does a delete() immediately followed by a
-  // put() on the same key. These two writes may have been coalesced into a single flush.
-  // Unfortunately, we can't just skip the delete because we still need to count it. So we issue
-  // a delete, followed by a put, in the same transaction.
   // The constant extra 2 promises are those added outside of the rpc batches, currently one
   // to work around a bug in capnp::autoreconnect, and one to actually commit the flush txn
   // A 3rd promise may be added to write the alarm time if necessary.
   auto promises = kj::heapArrayBuilder<kj::Promise<void>>(
-      rpcPuts.size() + rpcMutedDeletes.size() + rpcCountedDeletes.size()
-      + 2 + !maybeAlarmChange.is<CleanAlarm>());
-
-  auto joinCountedDelete = [](RpcCountedDelete& rpcCountedDelete) -> kj::Promise<void> {
-    auto promises = KJ_MAP(request, rpcCountedDelete.rpcDeletes) {
-      return request.send().then(
-          [](capnp::Response<rpc::ActorStorage::Operations::DeleteResults>&& response) mutable
-          -> uint {
-        return response.getNumDeleted();
-      });
-    };
+      batchCount + rpcCountedDeletes.size() + 2 + !maybeAlarmChange.is<CleanAlarm>());
 
-    for (auto& promise : promises) {
+  auto joinCountedDelete = [](CountedDelete& countedDelete, kj::Array<kj::Promise<uint>> counts)
+      -> kj::Promise<void> {
+    for (auto& count: counts) {
       // Reuse `countDeleted` since it's already in a state object anyway.
-      rpcCountedDelete.countedDelete->countDeleted += co_await promise;
+      countedDelete.countDeleted += co_await count;
     }
   };
   for (auto& rpcCountedDelete: rpcCountedDeletes) {
-    promises.add(joinCountedDelete(rpcCountedDelete).then(
+    auto counts = kj::heapArrayBuilder<kj::Promise<uint>>(rpcCountedDelete.rpcDeletes.size());
+    for (auto& request: rpcCountedDelete.rpcDeletes) {
+      auto count = sendInOrder(takeSlot(), [req = kj::mv(request)]() mutable {
+        return req.send().then(
+            [](capnp::Response<rpc::ActorStorage::Operations::DeleteResults>&& response) -> uint {
+          return response.getNumDeleted();
+        });
+      }).fork();
+      // The branch in `batchPromises` only paces later batches. Failures are handled below, as
+      // part of the counted delete's result.
+      batchPromises.add(count.addBranch().ignoreResult().catch_([](kj::Exception&&) {}));
+      counts.add(count.addBranch());
+    }
+
+    promises.add(joinCountedDelete(*rpcCountedDelete.countedDelete, counts.finish()).then(
         [&countedDelete = *rpcCountedDelete.countedDelete]() mutable {
       // Note that it's OK to trust the delete count even if the transaction ultimately gets rolled
       // back, because:
@@ -2855,11 +3173,19 @@ kj::Promise<void> ActorCache::flushImplUsingTxn(
   }
 
   for (auto& request: rpcMutedDeletes) {
-    promises.add(request.send().ignoreResult());
+    batchPromises.add(sendInOrder(takeSlot(), [req = kj::mv(request)]() mutable {
+      return req.send().ignoreResult();
+    }));
   }
 
   for (auto& request: rpcPuts) {
-    promises.add(request.send().ignoreResult());
+    batchPromises.add(sendInOrder(takeSlot(), [req = kj::mv(request)]() mutable {
+      return req.send().ignoreResult();
+    }));
+  }
+
+  for (auto& promise: batchPromises) {
+    promises.add(kj::mv(promise));
   }
 
   KJ_SWITCH_ONEOF(maybeAlarmChange) {
@@ -2867,24 +3193,28 @@ kj::Promise<void> ActorCache::flushImplUsingTxn(
       KJ_IF_MAYBE(newTime, dirty.newTime) {
         auto req = txn.setAlarmRequest();
         req.setScheduledTimeMs((*newTime - kj::UNIX_EPOCH) / kj::MILLISECONDS);
-        promises.add(req.send().ignoreResult());
+        promises.add(sendInOrder(kj::READY_NOW, [req = kj::mv(req)]() mutable {
+          return req.send().ignoreResult();
+        }));
       } else {
         auto req = txn.deleteAlarmRequest();
         KJ_IF_MAYBE(deferredDelete, currentAlarmTime.tryGet<DeferredAlarmDelete>()) {
           if (deferredDelete->status == DeferredAlarmDelete::Status::FLUSHING) {
             req.setTimeToDeleteMs((deferredDelete->timeToDelete - kj::UNIX_EPOCH) / kj::MILLISECONDS);
-            auto prom = req.send().then([this](auto response) {
-              KJ_IF_MAYBE(deferredDelete, currentAlarmTime.tryGet<DeferredAlarmDelete>()) {
-                if (deferredDelete->status == DeferredAlarmDelete::Status::FLUSHING) {
-                  // We always update wasDeleted regardless of whether or not it is true
-                  // because this continuation can succeed even if the greater transaction fails,
-                  // and so we want to make sure we end up with the correct value if the first
-                  // attempt succeeds to delete, the txn fails, and the retry fails to delete.
-                  // The early update is OK because we don't actually use the incorrect state until
-                  // the transaction succeeds in the .then() below.
-                  deferredDelete->wasDeleted = response.getDeleted();
+            auto prom = sendInOrder(kj::READY_NOW, [this, req = kj::mv(req)]() mutable {
+              return req.send().then([this](auto response) {
+                KJ_IF_MAYBE(deferredDelete, currentAlarmTime.tryGet<DeferredAlarmDelete>()) {
+                  if (deferredDelete->status == DeferredAlarmDelete::Status::FLUSHING) {
+                    // We always update wasDeleted regardless of whether or not it is true
+                    // because this continuation can succeed even if the greater transaction
+                    // fails, and so we want to make sure we end up with the correct value if the
+                    // first attempt succeeds to delete, the txn fails, and the retry fails to
+                    // delete. The early update is OK because we don't actually use the incorrect
+                    // state until the transaction succeeds in the .then() below.
+                    deferredDelete->wasDeleted = response.getDeleted();
+                  }
                 }
-              }
+              });
             });
             promises.add(kj::mv(prom));
           }
@@ -2893,7 +3223,9 @@ kj::Promise<void> ActorCache::flushImplUsingTxn(
           // and READY is set when the run completes -- only FLUSHING indicates we actually
           // need to send a request.
         } else {
-          promises.add(req.send().ignoreResult());
+          promises.add(sendInOrder(kj::READY_NOW, [req = kj::mv(req)]() mutable {
+            return req.send().ignoreResult();
+          }));
         }
       }
     }
@@ -2906,7 +3238,9 @@ kj::Promise<void> ActorCache::flushImplUsingTxn(
   // if the promise is dropped but the pipeline stays alive.
   promises.add(txnProm.ignoreResult());
 
-  promises.add(txn.commitRequest(capnp::MessageSize { 4, 0 }).send().ignoreResult());
+  promises.add(sendChain.then([txn = kj::mv(txn)]() mutable {
+    return txn.commitRequest(capnp::MessageSize { 4, 0 }).send().ignoreResult();
+  }));
 
   co_await kj::joinPromises(promises.finish());
 }
@@ -2931,7 +3265,7 @@ kj::Promise<void> ActorCache::flushImplDeleteAll(uint retryCount) {
     requestedDeleteAll = nullptr;
 
     {
-      auto lock = lru.cleanList.lockExclusive();
+      auto lock = lru.lock();
       evictOrOomIfNeeded(lock);
     }
 
@@ -2971,7 +3305,7 @@ ActorCache::Transaction::~Transaction() noexcept(false) {
 
 kj::Maybe<kj::Promise<void>> ActorCache::Transaction::commit() {
   {
-    auto lock = cache.lru.cleanList.lockExclusive();
+    auto lock = cache.lru.lock();
     for (auto& change: entriesToWrite) {
       cache.putImpl(lock, kj::mv(change.entry), change.options, nullptr);
     }
@@ -3001,7 +3335,7 @@ kj::OneOf<kj::Maybe<ActorCache::Value>, kj::Promise<kj::Maybe<ActorCache::Value>
   options.noCache = options.noCache || cache.lru.options.noCache;
   KJ_IF_MAYBE(change, entriesToWrite.find(key)) {
     return change->entry->value.map([&](ValuePtr value) {
-      return value.attach(kj::atomicAddRef(*change->entry));
+      return value.attach(change->entry->addRef());
     });
   } else {
     return cache.get(kj::mv(key), options);
@@ -3017,7 +3351,7 @@ kj::OneOf<ActorCache::GetResultList, kj::Promise<ActorCache::GetResultList>>
 
   for (auto& key: keys) {
     KJ_IF_MAYBE(change, entriesToWrite.find(key)) {
-      changedEntries.add(kj::atomicAddRef(*change->entry));
+      changedEntries.add(change->entry->addRef());
     } else {
       keysToFetch.add(kj::mv(key));
     }
@@ -3054,7 +3388,7 @@ kj::OneOf<ActorCache::GetResultList, kj::Promise<ActorCache::GetResultList>>
   uint positiveCount = 0;
   // TODO(cleanup): Add `iterRange()` to KJ's public interface.
   for (auto& change: kj::_::iterRange(beginIter, endIter)) {
-    changedEntries.add(kj::atomicAddRef(*change.entry));
+    changedEntries.add(change.entry->addRef());
     if (change.entry->value != nullptr) {
       ++positiveCount;
     }
@@ -3083,7 +3417,7 @@ kj::OneOf<ActorCache::GetResultList, kj::Promise<ActorCache::GetResultList>>
   uint positiveCount = 0;
   for (auto iter = endIter; iter != beginIter;) {
     --iter;
-    changedEntries.add(kj::atomicAddRef(*iter->entry));
+    changedEntries.add(iter->entry->addRef());
     if (iter->entry->value != nullptr) {
       ++positiveCount;
     }
@@ -3124,7 +3458,7 @@ kj::OneOf<ActorCache::GetResultList, kj::Promise<ActorCache::GetResultList>>
 kj::Maybe<kj::Promise<void>> ActorCache::Transaction::put(
     Key key, Value value, WriteOptions options) {
   options.noCache = options.noCache || cache.lru.options.noCache;
-  auto lock = cache.lru.cleanList.lockExclusive();
+  auto lock = cache.lru.lock();
   putImpl(lock, kj::mv(key), kj::mv(value), options);
 
   // Don't apply backpressure because transactions can't be flushed anyway.
@@ -3134,7 +3468,7 @@ kj::Maybe<kj::Promise<void>> ActorCache::Transaction::put(
 kj::Maybe<kj::Promise<void>> ActorCache::Transaction::put(
     kj::Array<KeyValuePair> pairs, WriteOptions options) {
   options.noCache = options.noCache || cache.lru.options.noCache;
-  auto lock = cache.lru.cleanList.lockExclusive();
+  auto lock = cache.lru.lock();
 
   for (auto& pair: pairs) {
     putImpl(lock, kj::mv(pair.key), kj::mv(pair.value), options);
@@ -3160,7 +3494,7 @@ kj::OneOf<bool, kj::Promise<bool>> ActorCache::Transaction::delete_(
   kj::Maybe<KeyPtr> keyToCount;
 
   {
-    auto lock = cache.lru.cleanList.lockExclusive();
+    auto lock = cache.lru.lock();
     keyToCount = putImpl(lock, kj::mv(key), nullptr, options, count);
   }
 
@@ -3198,7 +3532,7 @@ kj::OneOf<uint, kj::Promise<uint>> ActorCache::Transaction::delete_(
   auto currentBatch = startNewBatch();
 
   {
-    auto lock = cache.lru.cleanList.lockExclusive();
+    auto lock = cache.lru.lock();
     for (auto& key: keys) {
       KJ_IF_MAYBE(keyToCount, putImpl(lock, kj::mv(key), nullptr, options, count)) {
         if (currentBatch->size() >= cache.lru.options.maxKeysPerRpc) {
@@ -3254,7 +3588,7 @@ kj::Maybe<ActorCache::KeyPtr> ActorCache::Transaction::putImpl(
     kj::Maybe<uint&> count) {
   // Use NOT_IN_CACHE state because this entry is not in the cache map yet.
   Change change {
-    cache.makeEntry(lock, NOT_IN_CACHE, kj::mv(key), kj::mv(value)),
+    cache.makeEntry(lock, NOT_IN_CACHE, key, value.map([](ValuePtr v) { return v; })),
     options
   };
   bool replaced = false;
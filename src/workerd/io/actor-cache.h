@@ -6,6 +6,7 @@
 
 #include <kj/async.h>
 #include <workerd/io/actor-storage.h>
+#include <workerd/util/histogram.h>
 #include <kj/one-of.h>
 #include <kj/map.h>
 #include <kj/list.h>
@@ -367,7 +368,7 @@ private:
 
   struct CountedDelete;
 
-  struct Entry: public kj::AtomicRefcounted {
+  struct Entry final: private kj::Disposer {
     // A cache entry.
     //
     // Entries are refcounted so that an operation which cares about a particular entry can keep
@@ -379,26 +380,34 @@ private:
     // The mutable content of an `Entry` is protected by the same mutex that protects
     // `lru.cleanList`. `key` and `value` are declared `const` so that they can safely be used
     // without a lock.
-
-    Entry(kj::Badge<ActorCache>, ActorCache& cache, Key keyParam,
-          kj::Maybe<Value> valueParam, EntryState state);
-    // Use makeEntry() to construct! (The Badge<> is a reminder, though obviously doesn't enforce
-    // anything since Entry is already private to ActorCache.)
-
-    Entry(kj::Badge<GetResultList>, Key keyParam, kj::Maybe<Value> valueParam);
-    // Makes an entry not tied to a cache. Used by GetResultList<kj::Vector<KeyValuePair>>
+    //
+    // Each entry is a single allocation: the `Entry` itself followed by copies of its key and
+    // value bytes. Actors with many small keys would otherwise pay for three allocations per
+    // entry, and every key comparison while searching `currentValues` would chase one more
+    // pointer. kj::AtomicRefcounted can't allocate objects with trailing storage, so entries
+    // count their own references, with the same semantics.
+
+    static kj::Own<Entry> make(kj::Maybe<ActorCache&> cache, KeyPtr key,
+                               kj::Maybe<ValuePtr> value, EntryState state);
+    // Allocates an entry holding copies of `key` and `value`. Entries belonging to a cache must
+    // be made with ActorCache::makeEntry(), which accounts for their size. A null `cache` makes
+    // an entry not tied to a cache, as used by the GetResultList(kj::Vector<KeyValuePair>)
     // constructor.
 
-    ~Entry() noexcept(false);
     KJ_DISALLOW_COPY_AND_MOVE(Entry);
 
+    kj::Own<Entry> addRef();
+    // Returns a new reference to this entry, like kj::atomicAddRef(). May be called from any
+    // thread.
+
     kj::Maybe<ActorCache&> cache;
-    const Key key;
+    const KeyPtr key;
+    // Points into this entry's own allocation.
 
-    const kj::Maybe<Value> value;
-    // The value associated with this key. null means the key is known not to be set -- except in
-    // the END_GAP state, where `value` is always null, and this doesn't indicate any knowledge
-    // about what's on disk.
+    const kj::Maybe<ValuePtr> value;
+    // The value associated with this key, pointing into this entry's own allocation. null means
+    // the key is known not to be set -- except in the END_GAP state, where `value` is always
+    // null, and this doesn't indicate any knowledge about what's on disk.
     //
     // `value` cannot change after the `Entry` is constructed. When a key is overwritten, the
     // existing `Entry` is removed from the map and replaced with a new one, so that `value` does
@@ -419,6 +428,11 @@ private:
     // The entry still needs to reside in cache while DIRTY/FLUSHING since we need to store it
     // somewhere, and so we might as well serve cache hits based on it in the meantime.
 
+    bool referenced = false;
+    // Set when a get() reads the entry, and cleared when an eviction sweep passes over it. A
+    // referenced entry at the front of the SharedLru's `cleanList` gets a second chance: it is
+    // moved to the back instead of being evicted.
+
     kj::Maybe<kj::Own<CountedDelete>> countedDelete;
     // In the DIRTY or FLUSHING state, if this entry was originally created as the result of a
     // `delete()` call, and as such the caller needs to receive a count of deletions, then this
@@ -440,10 +454,21 @@ private:
     // If DIRTY or FLUSHING, the entry will be in `dirtyList`.
 
     size_t size() const {
-      size_t result = sizeof(*this) + key.size();
+      // The size of the whole allocation, including the key's NUL terminator.
+      size_t result = sizeof(*this) + key.size() + 1;
       KJ_IF_MAYBE(v, value) result += v->size();
       return result;
     }
+
+  private:
+    mutable std::atomic<uint> refcount = 1;
+
+    Entry(kj::Maybe<ActorCache&> cache, KeyPtr keyParam, kj::Maybe<ValuePtr> valueParam,
+          EntryState state);
+    ~Entry() noexcept(false);
+
+    void disposeImpl(void* pointer) const override;
+    // Drops a reference, destroying and freeing the entry if it was the last.
   };
 
   class EntryTableCallbacks {
@@ -553,6 +578,32 @@ private:
   kj::Own<ReadCompletionChain> readCompletionChain = kj::refcounted<ReadCompletionChain>();
   // Used to implement waitForPastReads(). See that function to understand how it works...
 
+  struct InFlightGet: public kj::Refcounted {
+    // A storage read of a single key on behalf of get(). Further get()s of the same key that miss
+    // cache while it's outstanding wait on it rather than issuing their own read. Each waiter
+    // holds a reference; if they all go away, the read is canceled.
+
+    InFlightGet(ActorCache& cache, Key key, bool noCache)
+        : cache(cache), key(kj::mv(key)), noCache(noCache) {}
+    ~InFlightGet() noexcept(false);
+    KJ_DISALLOW_COPY_AND_MOVE(InFlightGet);
+
+    kj::Maybe<ActorCache&> cache;
+    // Null if the cache was destroyed first.
+
+    const Key key;
+    bool noCache;
+    bool done = false;
+    // Set once the read has completed. Its result is in cache by then (unless `noCache`), so
+    // later get()s shouldn't wait on it.
+
+    kj::ForkedPromise<kj::Own<Entry>> promise = nullptr;
+  };
+  kj::HashMap<KeyPtr, InFlightGet*> inFlightGets;
+  // Outstanding reads started by get(), by key. Entries are removed by ~InFlightGet().
+
+  kj::Promise<kj::Maybe<Value>> waitForInFlightGet(kj::Own<InFlightGet> read);
+
   bool flushScheduled = false;
   // True if ensureFlushScheduled() has been called but the flush has not started yet.
 
@@ -592,14 +643,38 @@ private:
   kj::Canceler oomCanceler;
   // Will be canceled if and when `oomException` becomes non-null.
 
+  struct LastPage {
+    Key lastKey;
+    kj::Maybe<Key> endKey;
+    bool prefetched;
+  };
+
+  kj::Maybe<LastPage> lastPage;
+  // The last key returned by the most recent forward list() that filled its limit, so that the
+  // next page of the same range can be recognized, and whether we read ahead past it.
+
+  kj::Maybe<kj::Promise<void>> prefetchTask;
+  bool prefetchInFlight = false;
+  // The read-ahead started by the last page, if any. We only read ahead one page at a time.
+
   typedef kj::Locked<kj::List<Entry, &Entry::link>> Lock;
   // Type of a lock on `SharedLru::cleanList`. We use the same lock to protect `currentValues`.
 
-  kj::Own<Entry> makeEntry(Lock& lock, EntryState state, Key keyParam, kj::Maybe<Value> valueParam);
+  kj::Own<Entry> makeEntry(Lock& lock, EntryState state, KeyPtr key, kj::Maybe<ValuePtr> value);
+
+  enum class ReadKind {
+    POINT,
+    // A get() of specific keys.
+
+    RANGE,
+    // A list(). Range reads don't mark entries referenced, so that one large list() can't push
+    // the working set of point reads out of the cache.
+  };
 
-  void touchEntry(Lock& lock, Entry& entry, const ReadOptions& options);
-  // Indicate that an entry was observed by a read operation and so should be moved to the end of
-  // the LRU queue (unless the options say otherwise).
+  void touchEntry(Lock& lock, Entry& entry, const ReadOptions& options, ReadKind kind);
+  // Indicate that an entry was observed by a read operation and so should not be evicted soon
+  // (unless the options say otherwise). This only sets flags on the entry; it doesn't reorder
+  // the LRU queue.
 
   kj::Maybe<kj::Own<Entry>> findInCache(Lock& lock, KeyPtr key, const ReadOptions& options);
   // Look for a key in cache, returning a strong reference on the matching entry.
@@ -614,7 +689,7 @@ private:
   // the calling code doesn't need to think about this case.
 
   kj::Own<Entry> addReadResultToCache(Lock& lock, Key key, kj::Maybe<capnp::Data::Reader> value,
-                                      const ReadOptions& readOptions);
+                                      const ReadOptions& readOptions, ReadKind kind);
   // Add an entry to the cache, where the entry was the result of reading from storage. If another
   // entry with the same key has been inserted in the meantime, then the new entry will not be
   // inserted and will instead immediately have state NOT_IN_CACHE.
@@ -624,6 +699,19 @@ private:
   void markGapsEmpty(Lock& lock, KeyPtr begin, kj::Maybe<KeyPtr> end, const ReadOptions& options);
   // Mark all gaps empty between the begin and end key.
 
+  kj::OneOf<GetResultList, kj::Promise<GetResultList>> listImpl(
+      Key begin, kj::Maybe<Key> end, kj::Maybe<uint> limit, ReadOptions options);
+  // Implements list(), without read-ahead.
+
+  void pageListed(const GetResultList& page, kj::Maybe<Key> end, uint limit, bool sequential,
+                  const ReadOptions& options);
+  // Called with the results of each forward list() with a limit, when read-ahead is enabled.
+  // `sequential` is true if the list began where `lastPage` ended.
+
+  bool startPrefetch(KeyPtr after, const kj::Maybe<Key>& end, const ReadOptions& options);
+  // Reads the keys following `after` into cache in the background. Returns false if there was
+  // nothing to read, because they were cached already.
+
   void putImpl(Lock& lock, Key key, kj::Maybe<Value> value,
                const WriteOptions& options, kj::Maybe<CountedDelete&> counted);
   void putImpl(Lock& lock, kj::Own<Entry> newEntry,
@@ -746,6 +834,9 @@ public:
   explicit GetResultList(kj::Vector<KeyValuePair> contents);
   // Construct a simple GetResultList from key-value pairs.
 
+  GetResultList(kj::Vector<KeyValuePair> contents, kj::Vector<CacheStatus> statuses);
+  // Like above, but with the cache status of each pair given, rather than all UNCACHED.
+
 private:
   kj::Vector<kj::Own<Entry>> entries;
   kj::Vector<CacheStatus> cacheStatuses;
@@ -803,6 +894,31 @@ struct ActorCacheSharedLruOptions {
   bool neverFlush = false;
   // If true, don't actually flush anything. This is used in preview sessions, since they keep
   // state strictly in memory.
+
+  size_t maxBytesPerRpc = 0;
+  // If non-zero, a flush also splits RPC messages once they'd exceed this many bytes, even if they
+  // have fewer than `maxKeysPerRpc` keys. Otherwise only the storage RPC size limit applies.
+
+  uint maxFlushRpcsInFlight = 0;
+  // If non-zero, a flush with more put and delete messages than this sends them as a pipeline,
+  // sending each further message only once an earlier one has completed, rather than all at once.
+  // They are still written as one transaction, committed after the last is sent.
+
+  kj::Duration flushBatchingWindow = 0 * kj::SECONDS;
+  // If non-zero, a flush that follows another within this window first waits for the window to
+  // pass, so that writes made meanwhile join it and are confirmed by one commit. See
+  // OutputGate::batchingDelay().
+
+  uint prefetchLimit = 0;
+  // When a forward list() with a limit begins right where the previous one ended -- i.e. the app
+  // is paginating -- read up to this many keys of the following page from storage into cache in
+  // the background, so that the app's next request for it doesn't wait on storage. Zero disables
+  // read-ahead.
+
+  uint lockTimingInterval = 64;
+  // Time one in this many acquisitions of the LRU's lock on each thread, and extrapolate
+  // `Stats::lockWait` from those. Each timing reads the precise monotonic clock twice, which would
+  // otherwise be a noticeable part of a cache hit. 1 times every acquisition; zero disables timing.
 };
 
 class ActorCache::SharedLru {
@@ -817,21 +933,81 @@ public:
   size_t currentSize() const { return size.load(std::memory_order_relaxed); }
   // Mostly for testing.
 
+  struct Stats {
+    uint64_t hits;
+    // Entries served from cache to read operations, including entries recording that a key is
+    // known not to exist.
+
+    uint64_t evictions;
+    // Clean entries evicted, whether to stay under `softLimit` or because they went stale.
+
+    kj::Duration lockWait;
+    // Total time spent acquiring the lock on `cleanList`, which every operation on every cache
+    // sharing this LRU takes. Estimated from a sample of acquisitions; see
+    // `Options::lockTimingInterval`.
+
+    uint64_t prefetches;
+    // Pages read ahead from storage for paginated list()s. See `Options::prefetchLimit`.
+
+    uint64_t prefetchHits;
+    // Pages of paginated list()s that were read ahead and then served entirely from cache.
+
+    uint64_t coalescedReads;
+    // Cache misses in get() that waited on another get()'s in-flight storage read of the same
+    // key, rather than making their own.
+
+    DurationHistogram::Snapshot flushDuration;
+    // Time from when each flush was scheduled until it completed or failed, for every cache
+    // sharing this LRU. A flush that was retried counts once. A flush scheduled by a write that
+    // didn't set `allowUnconfirmed` holds the output gate for all of this time.
+  };
+
+  Stats getStats() const;
+
+  void addExternalSize(size_t bytes) const;
+  void removeExternalSize(size_t bytes) const;
+  // Accounts memory held by other caches sharing this LRU's budget, such as ActorSqlite's read
+  // cache. The other cache should call `makeRoom()` after growing, and only then evict its own
+  // entries while still `isOverSoftLimit()`.
+
+  void makeRoom() const;
+  // Evicts clean ActorCache entries, in the same CLOCK order as ActorCache's own growth does, until
+  // back under `softLimit` or there are none left. Without this, a cache sharing the budget would
+  // have to evict its own entries -- typically all of them -- whenever ActorCaches had filled it.
+
+  bool isOverSoftLimit() const { return currentSize() > options.softLimit; }
+
+  bool isNoCache() const { return options.noCache; }
+
 private:
   Options options;
 
   kj::MutexGuarded<kj::List<Entry, &Entry::link>> cleanList;
-  // List of clean values, across all caches, ordered from least-recently-used to
-  // most-recently-used. Note that due to the ordering, all STALE entries will appear before all
-  // CLEAN entries.
+  // List of clean values, across all caches, evicted CLOCK-style from the front: an entry that
+  // has been `referenced` since it was last swept is moved to the back instead of being evicted.
+  // Reads never reorder the list; they only set the entry's `referenced` flag. New entries are
+  // added at the back.
 
   mutable std::atomic<size_t> size = 0;
   // Total byte size of everything that is cached, including dirty values that are not in `list`.
 
+  mutable std::atomic<uint64_t> hits = 0;
+  mutable std::atomic<uint64_t> evictions = 0;
+  mutable std::atomic<int64_t> lockWaitNs = 0;
+  mutable std::atomic<uint64_t> prefetches = 0;
+  mutable std::atomic<uint64_t> prefetchHits = 0;
+  mutable std::atomic<uint64_t> coalescedReads = 0;
+  DurationHistogram flushDuration;
+  // See Stats.
+
   mutable std::atomic<int64_t> nextStaleCheckNs = 0;
   // TimePoint when we should next evict stale entries. Represented as an int64_t of nanoseconds
   // instead of kj::TimePoint to allow for atomic operations.
 
+  Lock lock() const;
+  // Locks `cleanList`, recording the time spent waiting for the lock if this acquisition is
+  // sampled.
+
   bool evictIfNeeded(Lock& lock) const KJ_WARN_UNUSED_RESULT;
   // Evict cache entries as needed according to the cache limits. Returns true if the hard limit
   // is exceeded and nothing can be evicted, in which case the caller should fail out in the
@@ -0,0 +1,352 @@
+// Copyright (c) 2023 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#include "actor-sqlite.h"
+#include "io-gate.h"
+#include <workerd/util/capnp-mock.h>
+#include <kj/test.h>
+
+namespace workerd {
+namespace {
+
+struct ActorSqliteTest {
+  kj::EventLoop loop;
+  kj::WaitScope ws;
+  kj::Own<kj::Directory> dir;
+  SqliteDatabase::Vfs vfs;
+  OutputGate gate;
+  ActorCache::SharedLru lru;
+  ActorSqlite actor;
+
+  explicit ActorSqliteTest(size_t softLimit = 1 << 20)
+      : ws(loop),
+        dir(kj::newInMemoryDirectory(kj::nullClock())),
+        vfs(*dir),
+        lru({
+          .softLimit = softLimit,
+          .hardLimit = 1 << 30,
+          .staleTimeout = 30 * kj::SECONDS,
+          .dirtyListByteLimit = 1 << 20,
+          .maxKeysPerRpc = 128,
+        }),
+        actor(kj::heap<SqliteDatabase>(vfs, kj::Path({"foo"}),
+                                       kj::WriteMode::CREATE | kj::WriteMode::MODIFY),
+              gate, []() -> kj::Promise<void> { return kj::READY_NOW; },
+              ActorSqlite::Hooks::DEFAULT, lru) {}
+
+  void put(kj::StringPtr key, kj::StringPtr value) {
+    actor.put(kj::str(key), kj::heapArray(value.asBytes()), {});
+  }
+
+  kj::Maybe<kj::String> get(kj::StringPtr key, ActorCacheOps::ReadOptions options = {}) {
+    return actor.get(kj::str(key), options).get<kj::Maybe<ActorCacheOps::Value>>()
+        .map([](ActorCacheOps::Value& value) { return kj::str(value.asChars()); });
+  }
+};
+
+KJ_TEST("ActorSqlite read cache serves repeated reads and sees writes") {
+  ActorSqliteTest test;
+
+  test.put("foo", "abc");
+  test.loop.run();
+
+  KJ_EXPECT(KJ_ASSERT_NONNULL(test.get("foo")) == "abc");
+  KJ_EXPECT(KJ_ASSERT_NONNULL(test.get("foo")) == "abc");
+  KJ_EXPECT(test.get("bar") == nullptr);
+  KJ_EXPECT(test.get("bar") == nullptr);
+  auto stats = test.actor.getReadCacheStats();
+  KJ_EXPECT(stats.hits == 2);
+  KJ_EXPECT(stats.misses == 2);
+  KJ_EXPECT(test.lru.currentSize() > 0);
+
+  // noCache reads bypass the cache entirely.
+  KJ_EXPECT(KJ_ASSERT_NONNULL(test.get("foo", { .noCache = true })) == "abc");
+  KJ_EXPECT(test.actor.getReadCacheStats().hits == 2);
+
+  test.put("foo", "def");
+  test.put("bar", "ghi");
+  KJ_EXPECT(KJ_ASSERT_NONNULL(test.get("foo")) == "def");
+  KJ_EXPECT(KJ_ASSERT_NONNULL(test.get("bar")) == "ghi");
+
+  KJ_EXPECT(test.actor.delete_(kj::str("foo"), {}).get<bool>());
+  KJ_EXPECT(test.get("foo") == nullptr);
+  test.loop.run();
+
+  test.actor.deleteAll({});
+  KJ_EXPECT(test.get("bar") == nullptr);
+  test.loop.run();
+}
+
+KJ_TEST("ActorSqlite read cache reports multi-key hits as cached") {
+  ActorSqliteTest test;
+
+  test.put("a", "1");
+  test.put("b", "2");
+  test.put("c", "3");
+  test.loop.run();
+
+  KJ_EXPECT(KJ_ASSERT_NONNULL(test.get("b")) == "2");
+  KJ_EXPECT(test.get("d") == nullptr);
+
+  auto keys = kj::heapArray<kj::String>({
+      kj::str("d"), kj::str("c"), kj::str("b"), kj::str("a"), kj::str("b")});
+  auto result = test.actor.get(kj::mv(keys), {}).get<ActorCacheOps::GetResultList>();
+
+  kj::Vector<kj::String> entries;
+  for (auto entry: result) {
+    entries.add(kj::str(entry.key, "=", entry.value.asChars(),
+        entry.status == ActorCacheOps::CacheStatus::CACHED ? " (cached)" : ""));
+  }
+  KJ_EXPECT(kj::strArray(entries, ", ") == "a=1, b=2 (cached), c=3", entries);
+
+  // The keys just read are now cached too.
+  auto stats = test.actor.getReadCacheStats();
+  KJ_EXPECT(KJ_ASSERT_NONNULL(test.get("a")) == "1");
+  KJ_EXPECT(KJ_ASSERT_NONNULL(test.get("c")) == "3");
+  KJ_EXPECT(test.actor.getReadCacheStats().hits == stats.hits + 2);
+}
+
+KJ_TEST("ActorSqlite read cache is cleared by rollback") {
+  ActorSqliteTest test;
+
+  test.put("foo", "abc");
+  test.loop.run();
+  KJ_EXPECT(KJ_ASSERT_NONNULL(test.get("foo")) == "abc");
+
+  {
+    auto txn = test.actor.startTransaction();
+    txn->put(kj::str("foo"), kj::heapArray("def"_kj.asBytes()), {});
+    KJ_EXPECT(KJ_ASSERT_NONNULL(
+        txn->get(kj::str("foo"), {}).get<kj::Maybe<ActorCacheOps::Value>>()).asChars() == "def");
+    txn->rollback().wait(test.ws);
+  }
+
+  KJ_EXPECT(KJ_ASSERT_NONNULL(test.get("foo")) == "abc");
+  test.loop.run();
+}
+
+KJ_TEST("ActorSqlite read cache stays within the shared LRU's budget") {
+  ActorSqliteTest test(1000);
+
+  for (uint i = 0; i < 100; i++) {
+    test.put(kj::str("key", i), "a value of moderate size, repeated for every key");
+  }
+  test.loop.run();
+
+  for (uint i = 0; i < 100; i++) {
+    KJ_EXPECT(test.get(kj::str("key", i)) != nullptr);
+    KJ_EXPECT(test.lru.currentSize() <= 1000);
+  }
+  KJ_EXPECT(test.lru.currentSize() > 0);
+
+  // The most recently read key survived; the first did not.
+  auto stats = test.actor.getReadCacheStats();
+  test.get("key99");
+  test.get("key0");
+  KJ_EXPECT(test.actor.getReadCacheStats().hits == stats.hits + 1);
+  KJ_EXPECT(test.actor.getReadCacheStats().misses == stats.misses + 1);
+}
+
+KJ_TEST("ActorSqlite read cache takes room from clean ActorCache entries in a full LRU") {
+  ActorSqliteTest test(2000);
+
+  for (uint i = 0; i < 4; i++) {
+    test.put(kj::str("key", i), "value");
+  }
+  test.loop.run();
+
+  // Another actor's ActorCache fills the shared LRU with clean entries before this actor reads
+  // anything.
+  auto mockPair = MockServer::make<rpc::ActorStorage::Stage>();
+  auto& mockStorage = *mockPair.mock;
+  OutputGate otherGate;
+  ActorCache other(kj::mv(mockPair.client), test.lru, otherGate);
+  for (uint i = 0; i < 30; i++) {
+    auto key = kj::str("other", i);
+    auto promise = other.get(kj::str(key), {})
+        .get<kj::Promise<kj::Maybe<ActorCacheOps::Value>>>();
+    mockStorage.expectCall("get", test.ws)
+        .withParams(kj::str("(key = \"", key, "\")"))
+        .thenReturn("(value = \"a value of moderate size, repeated for every key\")");
+    KJ_ASSERT(promise.wait(test.ws) != nullptr);
+  }
+  auto evictionsBefore = test.lru.getStats().evictions;
+  KJ_ASSERT(evictionsBefore > 0, "the LRU should have filled up");
+
+  for (uint i = 0; i < 4; i++) {
+    KJ_EXPECT(KJ_ASSERT_NONNULL(test.get(kj::str("key", i))) == "value");
+  }
+
+  // Every key read stayed cached, and the ActorCache gave up entries to make room for them.
+  auto stats = test.actor.getReadCacheStats();
+  for (uint i = 0; i < 4; i++) {
+    test.get(kj::str("key", i));
+  }
+  KJ_EXPECT(test.actor.getReadCacheStats().hits == stats.hits + 4);
+  KJ_EXPECT(test.lru.getStats().evictions > evictionsBefore);
+  KJ_EXPECT(test.lru.currentSize() <= 2000);
+}
+
+struct ShardedActorSqliteTest {
+  kj::EventLoop loop;
+  kj::WaitScope ws;
+  kj::Own<kj::Directory> dir;
+  SqliteDatabase::Vfs vfs;
+  OutputGate gateA;
+  OutputGate gateB;
+  kj::Own<ActorSqliteShard> shard;
+  uint commitsA = 0;
+  uint commitsB = 0;
+  ActorSqlite a;
+  ActorSqlite b;
+
+  ShardedActorSqliteTest()
+      : ws(loop),
+        dir(kj::newInMemoryDirectory(kj::nullClock())),
+        vfs(*dir),
+        shard(kj::refcounted<ActorSqliteShard>(kj::heap<SqliteDatabase>(vfs,
+            kj::Path({"shard"}), kj::WriteMode::CREATE | kj::WriteMode::MODIFY))),
+        a(*shard, "a", gateA, [this]() -> kj::Promise<void> { ++commitsA; return kj::READY_NOW; }),
+        b(*shard, "b", gateB, [this]() -> kj::Promise<void> { ++commitsB; return kj::READY_NOW; }) {}
+};
+
+void put(ActorCacheOps& ops, kj::StringPtr key, kj::StringPtr value) {
+  ops.put(kj::str(key), kj::heapArray(value.asBytes()), {});
+}
+
+kj::Maybe<kj::String> get(ActorCacheOps& ops, kj::StringPtr key) {
+  return ops.get(kj::str(key), {}).get<kj::Maybe<ActorCacheOps::Value>>()
+      .map([](ActorCacheOps::Value& value) { return kj::str(value.asChars()); });
+}
+
+kj::String list(ActorCacheOps& ops, kj::Maybe<uint> limit = nullptr, bool reverse = false) {
+  auto result = reverse
+      ? ops.listReverse(kj::str(), nullptr, limit, {}).get<ActorCacheOps::GetResultList>()
+      : ops.list(kj::str(), nullptr, limit, {}).get<ActorCacheOps::GetResultList>();
+  kj::Vector<kj::String> entries;
+  for (auto entry: result) {
+    entries.add(kj::str(entry.key, "=", entry.value.asChars()));
+  }
+  return kj::strArray(entries, ", ");
+}
+
+KJ_TEST("sharded ActorSqlite keeps each actor's keys apart") {
+  ShardedActorSqliteTest test;
+
+  put(test.a, "foo", "1");
+  put(test.b, "foo", "2");
+  put(test.a, "bar", "3");
+  test.loop.run();
+
+  KJ_EXPECT(KJ_ASSERT_NONNULL(get(test.a, "foo")) == "1");
+  KJ_EXPECT(KJ_ASSERT_NONNULL(get(test.b, "foo")) == "2");
+  KJ_EXPECT(get(test.b, "bar") == nullptr);
+  KJ_EXPECT(list(test.a) == "bar=3, foo=1");
+  KJ_EXPECT(list(test.b) == "foo=2");
+
+  KJ_EXPECT(test.b.deleteAll({}).count == 1);
+  KJ_EXPECT(list(test.b) == "");
+  KJ_EXPECT(list(test.a) == "bar=3, foo=1");
+  test.loop.run();
+
+  // The database holds other actors' data, so it can't be exposed.
+  KJ_EXPECT(test.a.getSqliteDatabase() == nullptr);
+}
+
+KJ_TEST("sharded ActorSqlite commits all actors' writes together") {
+  ShardedActorSqliteTest test;
+
+  put(test.a, "foo", "1");
+  put(test.a, "bar", "2");
+  put(test.b, "foo", "3");
+  KJ_EXPECT(test.a.isCommitScheduled());
+  KJ_EXPECT(test.b.isCommitScheduled());
+
+  test.gateA.wait().wait(test.ws);
+  test.gateB.wait().wait(test.ws);
+  KJ_EXPECT(test.commitsA == 1);
+  KJ_EXPECT(test.commitsB == 1);
+  KJ_EXPECT(!test.a.isCommitScheduled());
+
+  // Only the actor that writes waits for the next commit.
+  put(test.a, "baz", "4");
+  KJ_EXPECT(test.a.isCommitScheduled());
+  KJ_EXPECT(!test.b.isCommitScheduled());
+  test.loop.run();
+  KJ_EXPECT(test.commitsA == 2);
+  KJ_EXPECT(test.commitsB == 1);
+}
+
+KJ_TEST("sharded ActorSqlite transactions buffer writes until commit") {
+  ShardedActorSqliteTest test;
+
+  put(test.a, "a", "1");
+  put(test.a, "c", "3");
+  put(test.a, "e", "5");
+  test.loop.run();
+
+  auto txn = test.a.startTransaction();
+  put(*txn, "b", "2");
+  KJ_EXPECT(txn->delete_(kj::str("c"), {}).get<bool>());
+  KJ_EXPECT(!txn->delete_(kj::str("z"), {}).get<bool>());
+
+  KJ_EXPECT(KJ_ASSERT_NONNULL(get(*txn, "b")) == "2");
+  KJ_EXPECT(get(*txn, "c") == nullptr);
+  KJ_EXPECT(get(test.a, "b") == nullptr);
+  KJ_EXPECT(KJ_ASSERT_NONNULL(get(test.a, "c")) == "3");
+
+  KJ_EXPECT(list(*txn) == "a=1, b=2, e=5");
+  KJ_EXPECT(list(*txn, 2u) == "a=1, b=2");
+  KJ_EXPECT(list(*txn, 2u, true) == "e=5, b=2");
+  {
+    auto keys = kj::heapArray<kj::String>({
+        kj::str("z"), kj::str("c"), kj::str("b"), kj::str("a")});
+    auto result = txn->get(kj::mv(keys), {}).get<ActorCacheOps::GetResultList>();
+    kj::Vector<kj::String> entries;
+    for (auto entry: result) {
+      entries.add(kj::str(entry.key, "=", entry.value.asChars()));
+    }
+    KJ_EXPECT(kj::strArray(entries, ", ") == "a=1, b=2");
+  }
+
+  // Nested transactions see their parent's writes, and only pass theirs on if committed.
+  {
+    auto child = test.a.startTransaction();
+    put(*child, "f", "6");
+    KJ_EXPECT(list(*child) == "a=1, b=2, e=5, f=6");
+    child->rollback().wait(test.ws);
+  }
+  {
+    auto child = test.a.startTransaction();
+    put(*child, "g", "7");
+    child->commit();
+  }
+  KJ_EXPECT(list(*txn) == "a=1, b=2, e=5, g=7");
+  KJ_EXPECT(list(test.a) == "a=1, c=3, e=5");
+
+  txn->commit();
+  txn = nullptr;
+  KJ_EXPECT(list(test.a) == "a=1, b=2, e=5, g=7");
+  KJ_EXPECT(test.a.isCommitScheduled());
+  test.loop.run();
+
+  {
+    auto rolledBack = test.a.startTransaction();
+    put(*rolledBack, "x", "8");
+    rolledBack->rollback().wait(test.ws);
+  }
+  KJ_EXPECT(list(test.a) == "a=1, b=2, e=5, g=7");
+  KJ_EXPECT(list(test.b) == "");
+}
+
+KJ_TEST("ActorSqliteShard::shardFor() never changes") {
+  // Stored data would be lost if these changed.
+  KJ_EXPECT(ActorSqliteShard::shardFor("abc", 16) == 11);
+  KJ_EXPECT(ActorSqliteShard::shardFor("0123456789abcdef", 16) == 13);
+  KJ_EXPECT(ActorSqliteShard::shardFor("", 7) == 2);
+  KJ_EXPECT(ActorSqliteShard::shardFor("abc", 1) == 0);
+}
+
+}  // namespace
+}  // namespace workerd
@@ -9,18 +9,187 @@
 
 namespace workerd {
 
+ActorSqliteShard::ActorSqliteShard(kj::Own<SqliteDatabase> dbParam)
+    : db(kj::mv(dbParam)), kv(*db) {}
+
+uint ActorSqliteShard::shardFor(kj::StringPtr actorId, uint shardCount) {
+  KJ_REQUIRE(shardCount > 0);
+
+  // 64-bit FNV-1a. We can't use kj::hashCode() since nothing promises it stays the same.
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (char c: actorId) {
+    hash ^= kj::byte(c);
+    hash *= 0x100000001b3ull;
+  }
+  return hash % shardCount;
+}
+
+kj::Promise<void> ActorSqliteShard::joinTxn() {
+  if (!txnOpen) {
+    beginTxn.run();
+    txnOpen = true;
+    ++txnCount;
+
+    txnCommitted = kj::evalLater([this]() {
+      txnOpen = false;
+      try {
+        commitTxn.run();
+      } catch (...) {
+        // Make sure the next write can begin a new transaction. Every actor that wrote in this
+        // one will see its output gate broken.
+        auto exception = kj::getCaughtExceptionAsKj();
+        try {
+          db->run("ROLLBACK TRANSACTION");
+        } catch (...) {
+          // SQLite may already have rolled back.
+        }
+        kj::throwFatalException(kj::mv(exception));
+      }
+    }).fork();
+  }
+
+  return KJ_ASSERT_NONNULL(txnCommitted).addBranch();
+}
+
 ActorSqlite::ActorSqlite(kj::Own<SqliteDatabase> dbParam, OutputGate& outputGate,
                          kj::Function<kj::Promise<void>()> commitCallback,
-                         Hooks& hooks)
-    : db(kj::mv(dbParam)), outputGate(outputGate), commitCallback(kj::mv(commitCallback)),
-      hooks(hooks), kv(*db), commitTasks(*this) {
-  db->onWrite(KJ_BIND_METHOD(*this, onWrite));
+                         Hooks& hooks, kj::Maybe<const ActorCache::SharedLru&> readCacheLru)
+    : ownDb(kj::mv(dbParam)), db(*ownDb), outputGate(outputGate),
+      commitCallback(kj::mv(commitCallback)), hooks(hooks), kv(db),
+      beginTxn(db.prepare("BEGIN TRANSACTION")), commitTxn(db.prepare("COMMIT TRANSACTION")),
+      commitTasks(*this) {
+  db.onWrite(KJ_BIND_METHOD(*this, onWrite));
+
+  KJ_IF_MAYBE(lru, readCacheLru) {
+    if (!lru->isNoCache()) {
+      readCache.emplace(*lru);
+      db.onRollback([this]() {
+        KJ_IF_MAYBE(c, readCache) {
+          c->clear();
+        }
+      });
+    }
+  }
+}
+
+ActorSqlite::ActorSqlite(ActorSqliteShard& shardParam, kj::StringPtr actorId,
+                         OutputGate& outputGate,
+                         kj::Function<kj::Promise<void>()> commitCallback,
+                         Hooks& hooks, kj::Maybe<const ActorCache::SharedLru&> readCacheLru)
+    : db(*shardParam.db), shard(shardParam), outputGate(outputGate),
+      commitCallback(kj::mv(commitCallback)), hooks(hooks),
+      kv(shardParam.kv, kj::str(actorId, '/')), commitTasks(*this) {
+  KJ_REQUIRE(actorId.findFirst('/') == nullptr, "sharded actor IDs can't contain '/'", actorId);
+
+  // The shard's database is shared, so we can't register onWrite() or onRollback() callbacks
+  // with it. Writes are reported by beforeWrite() instead, and the only rollback is of a failed
+  // commit, which breaks this object anyway.
+  KJ_IF_MAYBE(lru, readCacheLru) {
+    if (!lru->isNoCache()) {
+      readCache.emplace(*lru);
+    }
+  }
+}
+
+bool ActorSqlite::isCommitScheduled() {
+  KJ_IF_MAYBE(s, shard) {
+    return s->txnOpen && joinedShardTxn == s->txnCount;
+  }
+  return !currentTxn.is<NoTxn>();
+}
+
+ActorSqlite::ReadCacheStats ActorSqlite::getReadCacheStats() const {
+  KJ_IF_MAYBE(c, readCache) {
+    return c->stats;
+  } else {
+    return {0, 0};
+  }
+}
+
+size_t ActorSqlite::ReadCache::Entry::size() const {
+  size_t result = sizeof(Entry) + key.size();
+  KJ_IF_MAYBE(v, value) {
+    result += sizeof(CachedValue) + v->get()->bytes.size();
+  }
+  return result;
+}
+
+ActorSqlite::ReadCache::~ReadCache() noexcept(false) {
+  clear();
+}
+
+kj::Maybe<ActorCacheOps::Value> ActorSqlite::ReadCache::share(
+    kj::Maybe<kj::Own<CachedValue>>& value) {
+  return value.map([](kj::Own<CachedValue>& v) -> Value {
+    return v->bytes.asPtr().attach(kj::addRef(*v));
+  });
+}
+
+kj::Maybe<kj::Maybe<ActorCacheOps::Value>> ActorSqlite::ReadCache::get(KeyPtr key) {
+  KJ_IF_MAYBE(entry, entries.find(key)) {
+    ++stats.hits;
+
+    // Move the entry to the back of the LRU order.
+    auto& moved = entries.insert(entries.release(*entry));
+    return share(moved.value);
+  } else {
+    ++stats.misses;
+    return nullptr;
+  }
+}
+
+kj::Maybe<ActorCacheOps::Value> ActorSqlite::ReadCache::add(
+    KeyPtr key, kj::Maybe<ValuePtr> value) {
+  invalidate(key);
+
+  auto& entry = entries.insert(Entry {
+    .key = kj::str(key),
+    .value = value.map([](ValuePtr bytes) {
+      auto result = kj::refcounted<CachedValue>();
+      result->bytes = kj::heapArray(bytes);
+      return result;
+    }),
+  });
+  auto result = share(entry.value);
+
+  size_t size = entry.size();
+  totalSize += size;
+  lru.addExternalSize(size);
+
+  // Take room from clean ActorCache entries first, then evict our own least-recently-read entries
+  // while still over budget. This may include the one just added, if it's bigger than everything
+  // else.
+  lru.makeRoom();
+  while (lru.isOverSoftLimit() && entries.size() > 0) {
+    auto& oldest = *entries.ordered<kj::InsertionOrderIndex>().begin();
+    size_t oldestSize = oldest.size();
+    entries.erase(oldest);
+    totalSize -= oldestSize;
+    lru.removeExternalSize(oldestSize);
+  }
+
+  return result;
+}
+
+void ActorSqlite::ReadCache::invalidate(KeyPtr key) {
+  KJ_IF_MAYBE(entry, entries.find(key)) {
+    size_t size = entry->size();
+    entries.erase(*entry);
+    totalSize -= size;
+    lru.removeExternalSize(size);
+  }
+}
+
+void ActorSqlite::ReadCache::clear() {
+  entries.clear();
+  lru.removeExternalSize(totalSize);
+  totalSize = 0;
 }
 
 ActorSqlite::ImplicitTxn::ImplicitTxn(ActorSqlite& parent)
     : parent(parent) {
   KJ_REQUIRE(parent.currentTxn.is<NoTxn>());
-  parent.beginTxn.run();
+  KJ_ASSERT_NONNULL(parent.beginTxn).run();
   parent.currentTxn = this;
 }
 ActorSqlite::ImplicitTxn::~ImplicitTxn() noexcept(false) {
@@ -34,14 +203,15 @@ ActorSqlite::ImplicitTxn::~ImplicitTxn() noexcept(false) {
     //
     // This should only happen in cases of catastrophic error. Since this is rarely actually
     // executed, we don't prepare a statement for it.
-    parent.db->run("ROLLBACK TRANSACTION");
+    parent.db.run("ROLLBACK TRANSACTION");
+    parent.db.notifyRollback();
   }
 }
 
 void ActorSqlite::ImplicitTxn::commit() {
   // Ignore redundant commit()s.
   if (!committed) {
-    parent.commitTxn.run();
+    KJ_ASSERT_NONNULL(parent.commitTxn).run();
     committed = true;
   }
 }
@@ -64,6 +234,9 @@ ActorSqlite::ExplicitTxn::ExplicitTxn(ActorSqlite& actorSqlite)
       exp->hasChild = true;
       depth = exp->depth + 1;
     }
+    KJ_CASE_ONEOF(_, BufferedTxn*) {
+      KJ_FAIL_ASSERT("sharded actors don't use savepoints");
+    }
   }
   actorSqlite.currentTxn = this;
 
@@ -71,7 +244,7 @@ ActorSqlite::ExplicitTxn::ExplicitTxn(ActorSqlite& actorSqlite)
   // Unfortunately this means we cannot prepare the statement, unless we prepare a series of
   // statements for each depth. (Actually, it could be reasonable to prepare statements for
   // depth 0 specifically, but I'm not going to try it for now.)
-  actorSqlite.db->run(SqliteDatabase::TRUSTED,
+  actorSqlite.db.run(SqliteDatabase::TRUSTED,
       kj::str("SAVEPOINT _cf_savepoint_", depth));
 }
 ActorSqlite::ExplicitTxn::~ExplicitTxn() noexcept(false) {
@@ -99,7 +272,7 @@ kj::Maybe<kj::Promise<void>> ActorSqlite::ExplicitTxn::commit() {
   KJ_REQUIRE(!hasChild, "critical sections should have prevented committing transaction while "
       "nested txn is outstanding");
 
-  actorSqlite.db->run(SqliteDatabase::TRUSTED,
+  actorSqlite.db.run(SqliteDatabase::TRUSTED,
       kj::str("RELEASE _cf_savepoint_", depth));
   committed = true;
 
@@ -125,10 +298,11 @@ kj::Promise<void> ActorSqlite::ExplicitTxn::rollback() {
 }
 
 void ActorSqlite::ExplicitTxn::rollbackImpl() noexcept(false) {
-  actorSqlite.db->run(SqliteDatabase::TRUSTED,
+  actorSqlite.db.run(SqliteDatabase::TRUSTED,
       kj::str("ROLLBACK TO _cf_savepoint_", depth));
-  actorSqlite.db->run(SqliteDatabase::TRUSTED,
+  actorSqlite.db.run(SqliteDatabase::TRUSTED,
       kj::str("RELEASE _cf_savepoint_", depth));
+  actorSqlite.db.notifyRollback();
 }
 
 void ActorSqlite::onWrite() {
@@ -162,6 +336,24 @@ void ActorSqlite::onWrite() {
   }
 }
 
+void ActorSqlite::beforeWrite() {
+  KJ_IF_MAYBE(s, shard) {
+    if (s->txnOpen && joinedShardTxn == s->txnCount) {
+      // Our output gate is already waiting for this transaction.
+      return;
+    }
+
+    auto committed = s->joinTxn();
+    joinedShardTxn = s->txnCount;
+
+    // Unlike in onWrite(), a shutdown can't stop the commit, since it includes other actors'
+    // writes.
+    commitTasks.add(outputGate.lockWhile(committed.then([this]() {
+      return commitCallback();
+    })));
+  }
+}
+
 void ActorSqlite::taskFailed(kj::Exception&& exception) {
   // The output gate should already have been broken since it wraps all commits tasks. So, we
   // don't have to report anything here, the exception will already propagate elsewhere. We
@@ -171,6 +363,15 @@ void ActorSqlite::taskFailed(kj::Exception&& exception) {
   }
 }
 
+kj::Maybe<ActorSqlite::ReadCache&> ActorSqlite::readCacheFor(const ReadOptions& options) {
+  if (!options.noCache) {
+    KJ_IF_MAYBE(c, readCache) {
+      return *c;
+    }
+  }
+  return nullptr;
+}
+
 void ActorSqlite::requireNotBroken() {
   KJ_IF_MAYBE(e, broken) {
     kj::throwFatalException(kj::cp(*e));
@@ -185,6 +386,21 @@ kj::OneOf<kj::Maybe<ActorCacheOps::Value>,
     ActorSqlite::get(Key key, ReadOptions options) {
   requireNotBroken();
 
+  KJ_IF_MAYBE(cache, readCacheFor(options)) {
+    KJ_IF_MAYBE(cached, cache->get(key)) {
+      return kj::mv(*cached);
+    }
+
+    kj::Maybe<ActorCacheOps::Value> result;
+    kv.get(key, [&](ValuePtr value) {
+      result = cache->add(key, value);
+    });
+    if (result == nullptr) {
+      cache->add(key, nullptr);
+    }
+    return result;
+  }
+
   kj::Maybe<ActorCacheOps::Value> result;
   kv.get(key, [&](ValuePtr value) {
     result = kj::heapArray(value);
@@ -196,17 +412,70 @@ kj::OneOf<ActorCacheOps::GetResultList, kj::Promise<ActorCacheOps::GetResultList
     ActorSqlite::get(kj::Array<Key> keys, ReadOptions options) {
   requireNotBroken();
 
-  kj::Vector<KeyValuePair> results;
-  for (auto& key: keys) {
-    kv.get(key, [&](ValuePtr value) {
-      results.add(KeyValuePair { kj::mv(key), kj::heapArray(value) });
-    });
+  KJ_IF_MAYBE(cache, readCacheFor(options)) {
+    return getMultipleCached(*cache, kj::mv(keys));
   }
+
+  kj::Vector<KeyValuePair> results;
+  kv.getMultiple(keys, [&](KeyPtr key, ValuePtr value) {
+    results.add(KeyValuePair { kj::str(key), kj::heapArray(value) });
+  });
   std::sort(results.begin(), results.end(),
       [](auto& a, auto& b) { return a.key < b.key; });
   return GetResultList(kj::mv(results));
 }
 
+ActorCacheOps::GetResultList ActorSqlite::getMultipleCached(
+    ReadCache& cache, kj::Array<Key> keys) {
+  std::sort(keys.begin(), keys.end());
+  auto keysEnd = std::unique(keys.begin(), keys.end());
+
+  kj::Vector<KeyValuePair> hits;
+  kj::Vector<KeyPtr> misses;
+  for (auto key = keys.begin(); key != keysEnd; ++key) {
+    KJ_IF_MAYBE(cached, cache.get(*key)) {
+      KJ_IF_MAYBE(value, *cached) {
+        hits.add(KeyValuePair { kj::mv(*key), kj::mv(*value) });
+      }
+    } else {
+      misses.add(*key);
+    }
+  }
+
+  kj::Vector<KeyValuePair> fetched;
+  kv.getMultiple(misses, [&](KeyPtr key, ValuePtr value) {
+    fetched.add(KeyValuePair { kj::str(key), KJ_ASSERT_NONNULL(cache.add(key, value)) });
+  });
+  std::sort(fetched.begin(), fetched.end(),
+      [](auto& a, auto& b) { return a.key < b.key; });
+
+  // Remember which of the missed keys don't exist. Both lists are sorted.
+  auto found = fetched.begin();
+  for (auto key: misses) {
+    if (found != fetched.end() && found->key == key) {
+      ++found;
+    } else {
+      cache.add(key, nullptr);
+    }
+  }
+
+  // Merge the two sorted lists.
+  kj::Vector<KeyValuePair> results(hits.size() + fetched.size());
+  kj::Vector<CacheStatus> statuses(hits.size() + fetched.size());
+  auto hit = hits.begin();
+  auto fetch = fetched.begin();
+  while (hit != hits.end() || fetch != fetched.end()) {
+    if (fetch == fetched.end() || (hit != hits.end() && hit->key < fetch->key)) {
+      results.add(kj::mv(*hit++));
+      statuses.add(CacheStatus::CACHED);
+    } else {
+      results.add(kj::mv(*fetch++));
+      statuses.add(CacheStatus::UNCACHED);
+    }
+  }
+  return GetResultList(kj::mv(results), kj::mv(statuses));
+}
+
 kj::OneOf<kj::Maybe<kj::Date>, kj::Promise<kj::Maybe<kj::Date>>> ActorSqlite::getAlarm(
     ReadOptions options) {
   requireNotBroken();
@@ -244,6 +513,10 @@ kj::OneOf<ActorCacheOps::GetResultList, kj::Promise<ActorCacheOps::GetResultList
 kj::Maybe<kj::Promise<void>> ActorSqlite::put(Key key, Value value, WriteOptions options) {
   requireNotBroken();
 
+  KJ_IF_MAYBE(c, readCache) {
+    c->invalidate(key);
+  }
+  beforeWrite();
   kv.put(key, value);
   return nullptr;
 }
@@ -252,15 +525,23 @@ kj::Maybe<kj::Promise<void>> ActorSqlite::put(
     kj::Array<KeyValuePair> pairs, WriteOptions options) {
   requireNotBroken();
 
-  for (auto& pair: pairs) {
-    kv.put(pair.key, pair.value);
+  KJ_IF_MAYBE(c, readCache) {
+    for (auto& pair: pairs) {
+      c->invalidate(pair.key);
+    }
   }
+  beforeWrite();
+  kv.putMultiple(pairs);
   return nullptr;
 }
 
 kj::OneOf<bool, kj::Promise<bool>> ActorSqlite::delete_(Key key, WriteOptions options) {
   requireNotBroken();
 
+  KJ_IF_MAYBE(c, readCache) {
+    c->invalidate(key);
+  }
+  beforeWrite();
   return kv.delete_(key);
 }
 
@@ -268,11 +549,13 @@ kj::OneOf<uint, kj::Promise<uint>> ActorSqlite::delete_(
     kj::Array<Key> keys, WriteOptions options) {
   requireNotBroken();
 
-  uint count = 0;
-  for (auto& key: keys) {
-    count += kv.delete_(key);
+  KJ_IF_MAYBE(c, readCache) {
+    for (auto& key: keys) {
+      c->invalidate(key);
+    }
   }
-  return count;
+  beforeWrite();
+  return kv.deleteMultiple(keys);
 }
 
 kj::Maybe<kj::Promise<void>> ActorSqlite::setAlarm(
@@ -285,12 +568,19 @@ kj::Maybe<kj::Promise<void>> ActorSqlite::setAlarm(
 kj::Own<ActorCacheInterface::Transaction> ActorSqlite::startTransaction() {
   requireNotBroken();
 
+  if (shard != nullptr) {
+    return kj::refcounted<BufferedTxn>(*this);
+  }
   return kj::refcounted<ExplicitTxn>(*this);
 }
 
 ActorCacheInterface::DeleteAllResults ActorSqlite::deleteAll(WriteOptions options) {
   requireNotBroken();
 
+  KJ_IF_MAYBE(c, readCache) {
+    c->clear();
+  }
+  beforeWrite();
   uint count = kv.deleteAll();
   return {
     .backpressure = nullptr,
@@ -418,4 +708,238 @@ kj::Maybe<kj::Promise<void>> ActorSqlite::ExplicitTxn::setAlarm(
   return actorSqlite.setAlarm(newAlarmTime, options);
 }
 
+// =======================================================================================
+// BufferedTxn
+
+ActorSqlite::BufferedTxn::BufferedTxn(ActorSqlite& actorSqlite)
+    : actorSqlite(actorSqlite) {
+  KJ_IF_MAYBE(outer, actorSqlite.currentTxn.tryGet<BufferedTxn*>()) {
+    KJ_REQUIRE(!(*outer)->hasChild,
+        "critical section should have blocked creation of more than one child at a time");
+    parent = kj::addRef(**outer);
+    (*outer)->hasChild = true;
+  } else {
+    KJ_REQUIRE(actorSqlite.currentTxn.is<NoTxn>());
+  }
+  actorSqlite.currentTxn = this;
+}
+
+ActorSqlite::BufferedTxn::~BufferedTxn() noexcept(false) {
+  [&]() noexcept {
+    // We'd better crash if any of this state update fails, otherwise dangling pointers.
+
+    KJ_ASSERT(!hasChild);
+    auto cur = KJ_ASSERT_NONNULL(actorSqlite.currentTxn.tryGet<BufferedTxn*>());
+    KJ_ASSERT(cur == this);
+    KJ_IF_MAYBE(p, parent) {
+      p->get()->hasChild = false;
+      actorSqlite.currentTxn = p->get();
+    } else {
+      actorSqlite.currentTxn.init<NoTxn>();
+    }
+  }();
+
+  // If not committed, there's nothing to roll back; the changes are just dropped.
+}
+
+kj::Maybe<kj::Promise<void>> ActorSqlite::BufferedTxn::commit() {
+  KJ_REQUIRE(!hasChild, "critical sections should have prevented committing transaction while "
+      "nested txn is outstanding");
+
+  KJ_IF_MAYBE(p, parent) {
+    for (auto& change: changes) {
+      p->get()->change(kj::mv(change.key), kj::mv(change.value));
+    }
+  } else {
+    // Apply everything at once, so that it all lands in the same shard transaction.
+    kj::Vector<KeyValuePair> puts;
+    kj::Vector<Key> deletes;
+    for (auto& change: changes) {
+      KJ_IF_MAYBE(value, change.value) {
+        puts.add(KeyValuePair { kj::mv(change.key), kj::mv(*value) });
+      } else {
+        deletes.add(kj::mv(change.key));
+      }
+    }
+    if (deletes.size() > 0) {
+      actorSqlite.delete_(deletes.releaseAsArray(), {});
+    }
+    if (puts.size() > 0) {
+      actorSqlite.put(puts.releaseAsArray(), {});
+    }
+  }
+  changes.clear();
+  committed = true;
+
+  // No backpressure for SQLite.
+  return nullptr;
+}
+
+kj::Promise<void> ActorSqlite::BufferedTxn::rollback() {
+  JSG_REQUIRE(!hasChild, Error,
+      "Cannot roll back an outer transaction while a nested transaction is still running.");
+  changes.clear();
+  committed = true;
+  return kj::READY_NOW;
+}
+
+ActorCacheOps& ActorSqlite::BufferedTxn::base() {
+  KJ_IF_MAYBE(p, parent) {
+    return **p;
+  } else {
+    return actorSqlite;
+  }
+}
+
+void ActorSqlite::BufferedTxn::change(Key key, kj::Maybe<Value> value) {
+  actorSqlite.requireNotBroken();
+  changes.upsert(Change { kj::mv(key), kj::mv(value) }, [](Change& existing, Change&& update) {
+    existing.value = kj::mv(update.value);
+  });
+}
+
+kj::OneOf<kj::Maybe<ActorCacheOps::Value>, kj::Promise<kj::Maybe<ActorCacheOps::Value>>>
+    ActorSqlite::BufferedTxn::get(Key key, ReadOptions options) {
+  KJ_IF_MAYBE(change, changes.find(key)) {
+    return change->value.map([](Value& value) -> Value { return kj::heapArray(value.asPtr()); });
+  }
+  return base().get(kj::mv(key), options);
+}
+
+kj::OneOf<ActorCacheOps::GetResultList, kj::Promise<ActorCacheOps::GetResultList>>
+    ActorSqlite::BufferedTxn::get(kj::Array<Key> keys, ReadOptions options) {
+  std::sort(keys.begin(), keys.end());
+  auto keysEnd = std::unique(keys.begin(), keys.end());
+
+  kj::Vector<KeyValuePair> results;
+  kj::Vector<Key> unchanged;
+  for (auto key = keys.begin(); key != keysEnd; ++key) {
+    KJ_IF_MAYBE(change, changes.find(*key)) {
+      KJ_IF_MAYBE(value, change->value) {
+        results.add(KeyValuePair { kj::mv(*key), kj::heapArray(value->asPtr()) });
+      }
+    } else {
+      unchanged.add(kj::mv(*key));
+    }
+  }
+
+  // ActorSqlite (and so every transaction on it) always returns results immediately.
+  auto stored = base().get(unchanged.releaseAsArray(), options).get<GetResultList>();
+  for (auto entry: stored) {
+    results.add(KeyValuePair { kj::str(entry.key), kj::heapArray(entry.value) });
+  }
+  std::sort(results.begin(), results.end(),
+      [](auto& a, auto& b) { return a.key < b.key; });
+  return GetResultList(kj::mv(results));
+}
+
+kj::OneOf<kj::Maybe<kj::Date>, kj::Promise<kj::Maybe<kj::Date>>>
+    ActorSqlite::BufferedTxn::getAlarm(ReadOptions options) {
+  return actorSqlite.getAlarm(options);
+}
+
+kj::OneOf<ActorCacheOps::GetResultList, kj::Promise<ActorCacheOps::GetResultList>>
+    ActorSqlite::BufferedTxn::list(
+        Key begin, kj::Maybe<Key> end, kj::Maybe<uint> limit, ReadOptions options) {
+  return listImpl(kj::mv(begin), kj::mv(end), limit, options, false);
+}
+
+kj::OneOf<ActorCacheOps::GetResultList, kj::Promise<ActorCacheOps::GetResultList>>
+    ActorSqlite::BufferedTxn::listReverse(
+        Key begin, kj::Maybe<Key> end, kj::Maybe<uint> limit, ReadOptions options) {
+  return listImpl(kj::mv(begin), kj::mv(end), limit, options, true);
+}
+
+ActorCacheOps::GetResultList ActorSqlite::BufferedTxn::listImpl(
+    Key begin, kj::Maybe<Key> end, kj::Maybe<uint> limit, ReadOptions options, bool reverse) {
+  // Our changes within the range, in the order we're listing.
+  kj::Vector<Change*> changed;
+  for (auto iter = changes.seek(begin); iter != changes.ordered().end(); ++iter) {
+    KJ_IF_MAYBE(e, end) {
+      if (iter->key >= *e) break;
+    }
+    changed.add(&*iter);
+  }
+  if (reverse) {
+    std::reverse(changed.begin(), changed.end());
+  }
+
+  // Each change hides at most one stored key, so reading this many more stored keys guarantees
+  // that the first `limit` results of the merge are right.
+  auto storedLimit = limit.map([&](uint n) { return n + kj::implicitCast<uint>(changed.size()); });
+  auto stored = (reverse
+      ? base().listReverse(kj::mv(begin), kj::mv(end), storedLimit, options)
+      : base().list(kj::mv(begin), kj::mv(end), storedLimit, options)).get<GetResultList>();
+
+  kj::Vector<KeyValuePair> results;
+  auto comesFirst = [&](KeyPtr a, KeyPtr b) { return reverse ? b < a : a < b; };
+  auto addChange = [&](Change& change) {
+    KJ_IF_MAYBE(value, change.value) {
+      results.add(KeyValuePair { kj::str(change.key), kj::heapArray(value->asPtr()) });
+    }
+  };
+
+  auto nextChange = changed.begin();
+  for (auto entry: stored) {
+    while (nextChange != changed.end() && comesFirst((*nextChange)->key, entry.key)) {
+      addChange(**nextChange++);
+    }
+    if (nextChange != changed.end() && (*nextChange)->key == entry.key) {
+      addChange(**nextChange++);
+    } else {
+      results.add(KeyValuePair { kj::str(entry.key), kj::heapArray(entry.value) });
+    }
+  }
+  while (nextChange != changed.end()) {
+    addChange(**nextChange++);
+  }
+
+  KJ_IF_MAYBE(l, limit) {
+    if (results.size() > *l) {
+      results.truncate(*l);
+    }
+  }
+  return GetResultList(kj::mv(results));
+}
+
+kj::Maybe<kj::Promise<void>> ActorSqlite::BufferedTxn::put(
+    Key key, Value value, WriteOptions options) {
+  change(kj::mv(key), kj::mv(value));
+  return nullptr;
+}
+
+kj::Maybe<kj::Promise<void>> ActorSqlite::BufferedTxn::put(
+    kj::Array<KeyValuePair> pairs, WriteOptions options) {
+  for (auto& pair: pairs) {
+    change(kj::mv(pair.key), kj::mv(pair.value));
+  }
+  return nullptr;
+}
+
+kj::OneOf<bool, kj::Promise<bool>> ActorSqlite::BufferedTxn::delete_(
+    Key key, WriteOptions options) {
+  bool existed;
+  KJ_IF_MAYBE(c, changes.find(key)) {
+    existed = c->value != nullptr;
+  } else {
+    existed = base().get(kj::str(key), {}).get<kj::Maybe<Value>>() != nullptr;
+  }
+  change(kj::mv(key), nullptr);
+  return existed;
+}
+
+kj::OneOf<uint, kj::Promise<uint>> ActorSqlite::BufferedTxn::delete_(
+    kj::Array<Key> keys, WriteOptions options) {
+  uint count = 0;
+  for (auto& key: keys) {
+    count += delete_(kj::mv(key), options).get<bool>();
+  }
+  return count;
+}
+
+kj::Maybe<kj::Promise<void>> ActorSqlite::BufferedTxn::setAlarm(
+    kj::Maybe<kj::Date> newAlarmTime, WriteOptions options) {
+  return actorSqlite.setAlarm(newAlarmTime, options);
+}
+
 }  // namespace workerd
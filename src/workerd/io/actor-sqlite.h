@@ -6,9 +6,46 @@
 
 #include "actor-cache.h"
 #include <workerd/util/sqlite-kv.h>
+#include <kj/table.h>
 
 namespace workerd {
 
+class ActorSqliteShard final: public kj::Refcounted {
+  // A database holding the storage of many actors, for when a file per actor would cost too much
+  // in file descriptors, page caches, and opening time. Each ActorSqlite constructed on the shard
+  // keeps its keys in the shard's `_cf_KV` table under a prefix of its own. Writes by any of the
+  // shard's actors which occur without any `await`s in between are committed in one transaction,
+  // and the output gate of every actor that wrote waits for it.
+
+public:
+  explicit ActorSqliteShard(kj::Own<SqliteDatabase> db);
+  KJ_DISALLOW_COPY_AND_MOVE(ActorSqliteShard);
+
+  static uint shardFor(kj::StringPtr actorId, uint shardCount);
+  // Which of `shardCount` shards holds the actor `actorId`. This depends only on the arguments,
+  // and must never change, since an actor's data has to be found in the same shard every time.
+
+private:
+  kj::Own<SqliteDatabase> db;
+  SqliteKv kv;
+  // Never used directly; each actor uses a view of it.
+
+  SqliteDatabase::Statement beginTxn = db->prepare("BEGIN TRANSACTION");
+  SqliteDatabase::Statement commitTxn = db->prepare("COMMIT TRANSACTION");
+
+  bool txnOpen = false;
+  uint64_t txnCount = 0;
+  // Number of transactions begun so far, identifying the current one.
+
+  kj::Maybe<kj::ForkedPromise<void>> txnCommitted;
+  // Resolves when the most recently begun transaction commits.
+
+  kj::Promise<void> joinTxn();
+  // Begins a transaction unless one is open, and returns a promise for its commit.
+
+  friend class ActorSqlite;
+};
+
 class ActorSqlite final: public ActorCacheInterface, private kj::TaskSet::ErrorHandler {
   // An implementation of ActorCacheOps that is backed by SqliteKv.
   //
@@ -34,7 +71,8 @@ public:
 
   explicit ActorSqlite(kj::Own<SqliteDatabase> dbParam, OutputGate& outputGate,
                        kj::Function<kj::Promise<void>()> commitCallback,
-                       Hooks& hooks = Hooks::DEFAULT);
+                       Hooks& hooks = Hooks::DEFAULT,
+                       kj::Maybe<const ActorCache::SharedLru&> readCacheLru = nullptr);
   // Constructs ActorSqlite, arranging to honor the output gate, that is, any writes to the
   // database which occur without any `await`s in between will automatically be combined into a
   // single atomic write. This is accomplished using transactions. In addition to ensuring
@@ -44,10 +82,38 @@ public:
   // `commitCallback` will be invoked after committing a transaction. The output gate will block on
   // the returned promise. This can be used e.g. when the database needs to be replicated to other
   // machines before being considered durable.
+  //
+  // If `readCacheLru` is given, values read by key are kept in a read cache so that reading them
+  // again doesn't need to query the database. The cache's memory counts against the shared LRU's
+  // limits, and it evicts its least-recently-read entries while the LRU is over its soft limit.
+
+  ActorSqlite(ActorSqliteShard& shard, kj::StringPtr actorId, OutputGate& outputGate,
+              kj::Function<kj::Promise<void>()> commitCallback,
+              Hooks& hooks = Hooks::DEFAULT,
+              kj::Maybe<const ActorCache::SharedLru&> readCacheLru = nullptr);
+  // Constructs ActorSqlite storing the keys of actor `actorId`, which must not contain '/', in
+  // `shard`. The shard must outlive this object. This behaves like the above except that:
+  // - Writes are committed along with those of the shard's other actors. `commitCallback` is
+  //   invoked after each commit which includes this actor's writes.
+  // - Explicit transactions keep their writes in memory until they commit, because other actors'
+  //   writes keep committing while they are open.
+  // - getSqliteDatabase() returns null, since the database holds other actors' data too.
+
+  struct ReadCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+  };
+
+  ReadCacheStats getReadCacheStats() const;
+  // Counts of single- and multi-key reads that did and didn't find their key in the read cache.
+  // Always zero if the read cache is disabled.
 
-  bool isCommitScheduled() { return !currentTxn.is<NoTxn>(); }
+  bool isCommitScheduled();
 
-  kj::Maybe<SqliteDatabase&> getSqliteDatabase() override { return *db; }
+  kj::Maybe<SqliteDatabase&> getSqliteDatabase() override {
+    if (shard != nullptr) return nullptr;
+    return db;
+  }
 
   kj::OneOf<kj::Maybe<Value>, kj::Promise<kj::Maybe<Value>>> get(
       Key key, ReadOptions options) override;
@@ -76,14 +142,78 @@ public:
   // See ActorCacheInterface
 
 private:
-  kj::Own<SqliteDatabase> db;
+  class ReadCache {
+    // Values recently read by key, and keys recently found not to exist. Entries are discarded
+    // when their key is written and the whole cache is cleared by any rollback, so the cache
+    // never disagrees with the database.
+
+  public:
+    explicit ReadCache(const ActorCache::SharedLru& lru): lru(lru) {}
+    ~ReadCache() noexcept(false);
+    KJ_DISALLOW_COPY_AND_MOVE(ReadCache);
+
+    kj::Maybe<kj::Maybe<Value>> get(KeyPtr key);
+    // Returns null if `key` isn't cached, otherwise its value, or null if it doesn't exist. The
+    // returned value shares the cache's buffer.
+
+    kj::Maybe<Value> add(KeyPtr key, kj::Maybe<ValuePtr> value);
+    // Caches the value just read for `key`, evicting other entries as needed, and returns a copy
+    // of `value` sharing the cache's buffer.
+
+    void invalidate(KeyPtr key);
+    void clear();
+
+    ReadCacheStats stats = {0, 0};
+
+  private:
+    struct CachedValue: public kj::Refcounted {
+      kj::Array<const byte> bytes;
+    };
+
+    struct Entry {
+      kj::String key;
+      kj::Maybe<kj::Own<CachedValue>> value;
+      // Null if the key is known not to exist.
+
+      size_t size() const;
+      // Bytes accounted to the LRU for this entry.
+    };
+
+    struct EntryCallbacks {
+      inline kj::StringPtr keyForRow(const Entry& entry) const { return entry.key; }
+      inline bool matches(const Entry& entry, kj::StringPtr key) const { return entry.key == key; }
+      inline auto hashCode(kj::StringPtr key) const { return kj::hashCode(key); }
+    };
+
+    const ActorCache::SharedLru& lru;
+
+    kj::Table<Entry, kj::HashIndex<EntryCallbacks>, kj::InsertionOrderIndex> entries;
+    // Insertion order is kept as LRU order by re-inserting entries on every hit.
+
+    size_t totalSize = 0;
+    // Sum of `size()` of all entries, all of which is accounted to `lru`.
+
+    static kj::Maybe<Value> share(kj::Maybe<kj::Own<CachedValue>>& value);
+  };
+
+  kj::Own<SqliteDatabase> ownDb;
+  // Null if this actor is stored in a shard.
+
+  SqliteDatabase& db;
+  kj::Maybe<ActorSqliteShard&> shard;
   OutputGate& outputGate;
   kj::Function<kj::Promise<void>()> commitCallback;
   Hooks& hooks;
   SqliteKv kv;
 
-  SqliteDatabase::Statement beginTxn = db->prepare("BEGIN TRANSACTION");
-  SqliteDatabase::Statement commitTxn = db->prepare("COMMIT TRANSACTION");
+  kj::Maybe<ReadCache> readCache;
+
+  kj::Maybe<SqliteDatabase::Statement> beginTxn;
+  kj::Maybe<SqliteDatabase::Statement> commitTxn;
+  // Null if this actor is stored in a shard, which runs transactions itself.
+
+  uint64_t joinedShardTxn = 0;
+  // The shard transaction most recently written to. See ActorSqliteShard::txnCount.
 
   kj::Maybe<kj::Exception> broken;
 
@@ -141,7 +271,69 @@ private:
     void rollbackImpl();
   };
 
-  kj::OneOf<NoTxn, ImplicitTxn*, ExplicitTxn*> currentTxn = NoTxn();
+  class BufferedTxn: public ActorCacheInterface::Transaction, public kj::Refcounted {
+    // An explicit transaction of an actor stored in a shard. Other actors' writes keep committing
+    // while it's open, so rather than holding a savepoint open, it keeps its writes in memory and
+    // applies them all when it commits, much like ActorCache::Transaction.
+
+  public:
+    explicit BufferedTxn(ActorSqlite& actorSqlite);
+    ~BufferedTxn() noexcept(false);
+    KJ_DISALLOW_COPY_AND_MOVE(BufferedTxn);
+
+    kj::Maybe<kj::Promise<void>> commit() override;
+    kj::Promise<void> rollback() override;
+    // Implements ActorCacheInterface::Transaction.
+
+    kj::OneOf<kj::Maybe<Value>, kj::Promise<kj::Maybe<Value>>> get(
+        Key key, ReadOptions options) override;
+    kj::OneOf<GetResultList, kj::Promise<GetResultList>> get(
+        kj::Array<Key> keys, ReadOptions options) override;
+    kj::OneOf<kj::Maybe<kj::Date>, kj::Promise<kj::Maybe<kj::Date>>> getAlarm(
+        ReadOptions options) override;
+    kj::OneOf<GetResultList, kj::Promise<GetResultList>> list(
+        Key begin, kj::Maybe<Key> end, kj::Maybe<uint> limit, ReadOptions options) override;
+    kj::OneOf<GetResultList, kj::Promise<GetResultList>> listReverse(
+        Key begin, kj::Maybe<Key> end, kj::Maybe<uint> limit, ReadOptions options) override;
+    kj::Maybe<kj::Promise<void>> put(Key key, Value value, WriteOptions options) override;
+    kj::Maybe<kj::Promise<void>> put(kj::Array<KeyValuePair> pairs, WriteOptions options) override;
+    kj::OneOf<bool, kj::Promise<bool>> delete_(Key key, WriteOptions options) override;
+    kj::OneOf<uint, kj::Promise<uint>> delete_(kj::Array<Key> keys, WriteOptions options) override;
+    kj::Maybe<kj::Promise<void>> setAlarm(
+        kj::Maybe<kj::Date> newAlarmTime, WriteOptions options) override;
+    // Implements ActorCacheOps. Reads see the transaction's own writes, then its parent's, then
+    // the database. Alarm operations forward to the ActorSqlite instance.
+
+  private:
+    struct Change {
+      Key key;
+      kj::Maybe<Value> value;
+      // Null if the key is deleted.
+    };
+
+    struct ChangeCallbacks {
+      inline KeyPtr keyForRow(const Change& row) const { return row.key; }
+      inline bool isBefore(const Change& row, KeyPtr key) const { return row.key < key; }
+      inline bool matches(const Change& row, KeyPtr key) const { return row.key == key; }
+    };
+
+    ActorSqlite& actorSqlite;
+    kj::Maybe<kj::Own<BufferedTxn>> parent;
+    bool hasChild = false;
+    bool committed = false;
+
+    kj::Table<Change, kj::TreeIndex<ChangeCallbacks>> changes;
+
+    ActorCacheOps& base();
+    // Where reads of keys this transaction hasn't written go: its parent, or else the database.
+
+    void change(Key key, kj::Maybe<Value> value);
+
+    GetResultList listImpl(Key begin, kj::Maybe<Key> end, kj::Maybe<uint> limit,
+                           ReadOptions options, bool reverse);
+  };
+
+  kj::OneOf<NoTxn, ImplicitTxn*, ExplicitTxn*, BufferedTxn*> currentTxn = NoTxn();
   // When set to NoTxn, there is no transaction outstanding.
   //
   // When set to `ImplicitTxn*`, an implicit transaction is currently open, owned by `commitTasks`.
@@ -150,11 +342,23 @@ private:
   //
   // When set to `ExplicitTxn*`, an explicit transaction is currently open, so no implicit
   // transactions should be used in the meantime.
+  //
+  // `BufferedTxn*` takes the place of `ExplicitTxn*` for actors stored in a shard, which never
+  // use implicit transactions of their own.
 
   kj::TaskSet commitTasks;
 
   void onWrite();
 
+  void beforeWrite();
+  // Called before each write. An unsharded database reports writes to onWrite() itself, but a
+  // shard's can't tell which actor is writing, so this joins the shard's transaction instead.
+
+  kj::Maybe<ReadCache&> readCacheFor(const ReadOptions& options);
+  // The read cache to go through for a read with `options`, if any.
+
+  GetResultList getMultipleCached(ReadCache& cache, kj::Array<Key> keys);
+
   void taskFailed(kj::Exception&& exception) override;
 
   void requireNotBroken();
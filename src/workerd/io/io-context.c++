@@ -4,6 +4,7 @@
 
 #include "io-context.h"
 #include <workerd/io/io-gate.h>
+#include <workerd/io/subrequest-timing.h>
 #include <workerd/io/worker.h>
 #include <kj/threadlocal.h>
 #include <kj/debug.h>
@@ -284,6 +285,9 @@ IoContext::IncomingRequest::~IoContext_IncomingRequest() noexcept(false) {
     a->getMetrics().endRequest();
   }
   context->worker->getIsolate().completedRequest();
+  if (ALLOCATION_PROFILING_ENABLED) {
+    metrics->reportAllocations(allocationStats);
+  }
   metrics->jsDone();
 }
 
@@ -838,6 +842,11 @@ kj::Own<WorkerInterface> IoContext::getSubrequestNoChecks(
     ret = metrics.wrapSubrequestClient(kj::mv(ret));
     ret = worker->getIsolate().wrapSubrequestClient(
         kj::mv(ret), getHeaderIds().contentEncoding, metrics);
+    kj::Maybe<kj::Own<WorkerTracer>> tracer;
+    KJ_IF_MAYBE(t, getWorkerTracer()) {
+      tracer = kj::addRef(*t);
+    }
+    ret = newTimedSubrequestClient(kj::mv(ret), kj::addRef(metrics), kj::mv(tracer), now());
   }
 
   if (span.isObserved()) {
@@ -1064,7 +1073,10 @@ class IoContext::ThreadScope {
 
 public:
   ThreadScope(IoContext& context)
-      : previousRequest(threadLocalRequest) {
+      : previousRequest(threadLocalRequest),
+        allocationStatsScope(context.incomingRequests.empty()
+            ? kj::Maybe<AllocationStats&>(nullptr)
+            : context.incomingRequests.front().allocationStats) {
     KJ_REQUIRE(context.threadId == getThreadId(), "IoContext cannot switch threads");
     threadLocalRequest = &context;
   }
@@ -1081,6 +1093,9 @@ private:
   // the pipeline. We can't delay destruction to a future turn of the event loop because it's
   // common for child objects to contain pointers back to stuff owned by the parent that could
   // then be dangling.
+
+  AllocationStatsScope allocationStatsScope;
+  // Attributes allocations to the context's current request while it is current.
 };
 
 class IoContext::Scope {
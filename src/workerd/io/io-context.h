@@ -19,6 +19,7 @@
 #include <capnp/dynamic.h>
 #include <workerd/io/limit-enforcer.h>
 #include <workerd/io/io-channels.h>
+#include <workerd/util/alloc-profiler.h>
 
 namespace capnp { class HttpOverCapnpFactory; }
 
@@ -261,6 +262,10 @@ private:
   kj::ListLink<IoContext_IncomingRequest> link;
   // Used by IoContext::incomingRequests.
 
+  AllocationStats allocationStats;
+  // Allocations made while this was the current request, reported to `metrics` at the end.
+  // Only counted in builds with allocation profiling enabled.
+
   friend class IoContext;
 };
 
@@ -1292,6 +1297,7 @@ template <bool addIoOwn, typename T, typename InputLockOrMaybeCriticalSection>
 jsg::Promise<IoContext::MaybeIoOwn<addIoOwn, T>> IoContext::awaitIoImpl(
     kj::Promise<T> promise, InputLockOrMaybeCriticalSection ilOrCs) {
   requireCurrent();
+  AllocationCategoryScope allocationScope(AllocationCategory::PROMISE);
 
   typedef MaybeIoOwn<addIoOwn, T> Result;
 
@@ -1359,6 +1365,7 @@ jsg::Promise<IoContext::MaybeIoOwn<addIoOwn, T>> IoContext::awaitIoImpl(
 
 template <typename T>
 kj::_::ReducePromises<RemoveIoOwn<T>> IoContext::awaitJs(jsg::Promise<T> jsPromise) {
+  AllocationCategoryScope allocationScope(AllocationCategory::PROMISE);
   auto paf = kj::newPromiseAndFulfiller<RemoveIoOwn<T>>();
   struct RefcountedFulfiller: public IoContext::Finalizeable, public kj::Refcounted {
     kj::Own<kj::PromiseFulfiller<RemoveIoOwn<T>>> fulfiller;
@@ -1446,6 +1453,7 @@ inline IoOwn<T> IoContext::addObject(kj::Own<T> obj) {
 template <typename T>
 inline IoOwn<T> IoContext::DeleteQueue::addObject(
     kj::Own<T> obj, OwnedObjectList& ownedObjects) {
+  AllocationCategoryScope allocationScope(AllocationCategory::IO_OWNED_OBJECT);
   auto& ref = *obj;
 
   // HACK: We need an Own<OwnedObject>, but we actually need to allocate it as the subclass
@@ -4,6 +4,7 @@
 
 #include "io-gate.h"
 #include <kj/test.h>
+#include <kj/vector.h>
 
 namespace workerd {
 namespace {
@@ -570,5 +571,96 @@ KJ_TEST("OutputGate canceled") {
   KJ_EXPECT_THROW_MESSAGE("output lock was canceled before completion", onBroken.wait(ws));
 }
 
+struct RecordingHooks final: public InputGate::Hooks, public OutputGate::Hooks {
+  kj::Vector<kj::Duration> inputWaits;
+  kj::Vector<kj::Duration> outputWaits;
+  kj::Vector<kj::Duration> delays;
+  kj::Maybe<kj::Own<kj::PromiseFulfiller<void>>> delayFulfiller;
+
+  void inputGateWaited(kj::Duration waitTime) override { inputWaits.add(waitTime); }
+  void outputGateWaited(kj::Duration waitTime) override { outputWaits.add(waitTime); }
+  kj::Promise<void> makeDelayPromise(kj::Duration delay) override {
+    delays.add(delay);
+    auto paf = kj::newPromiseAndFulfiller<void>();
+    delayFulfiller = kj::mv(paf.fulfiller);
+    return kj::mv(paf.promise);
+  }
+};
+
+KJ_TEST("InputGate reports wait times") {
+  kj::EventLoop loop;
+  kj::WaitScope ws(loop);
+
+  RecordingHooks hooks;
+  InputGate gate(hooks);
+
+  auto lock = gate.wait().wait(ws);
+  KJ_ASSERT(hooks.inputWaits.size() == 1);
+  KJ_EXPECT(hooks.inputWaits[0] == 0 * kj::NANOSECONDS);
+
+  auto promise1 = gate.wait();
+  auto promise2 = gate.wait();
+  KJ_EXPECT(!promise1.poll(ws));
+  KJ_EXPECT(hooks.inputWaits.size() == 1);
+
+  { auto drop = kj::mv(lock); }
+  auto lock1 = promise1.wait(ws);
+  KJ_EXPECT(hooks.inputWaits.size() == 2);
+
+  // Canceled waits aren't reported.
+  { auto drop = kj::mv(promise2); }
+  { auto drop = kj::mv(lock1); }
+  KJ_EXPECT(hooks.inputWaits.size() == 2);
+}
+
+KJ_TEST("OutputGate reports wait times") {
+  kj::EventLoop loop;
+  kj::WaitScope ws(loop);
+
+  RecordingHooks hooks;
+  OutputGate gate(hooks);
+
+  gate.wait().wait(ws);
+  KJ_EXPECT(hooks.outputWaits.size() == 1);
+
+  auto paf = kj::newPromiseAndFulfiller<void>();
+  auto blocker = gate.lockWhile(kj::mv(paf.promise));
+  auto promise = gate.wait();
+  KJ_EXPECT(!promise.poll(ws));
+  KJ_EXPECT(hooks.outputWaits.size() == 1);
+
+  paf.fulfiller->fulfill();
+  blocker.wait(ws);
+  promise.wait(ws);
+  KJ_EXPECT(hooks.outputWaits.size() == 2);
+}
+
+KJ_TEST("OutputGate batching delay only applies to back-to-back locks") {
+  kj::EventLoop loop;
+  kj::WaitScope ws(loop);
+
+  RecordingHooks hooks;
+  OutputGate gate(hooks);
+
+  // Nothing has been committed yet, so there's nothing to batch with.
+  KJ_EXPECT(gate.batchingDelay(1 * kj::HOURS).poll(ws));
+  KJ_EXPECT(hooks.delays.size() == 0);
+
+  gate.lockWhile(kj::Promise<void>(kj::READY_NOW)).wait(ws);
+
+  // A lock was just released, so the next commit waits for the window.
+  auto delay = gate.batchingDelay(1 * kj::HOURS);
+  KJ_ASSERT(hooks.delays.size() == 1);
+  KJ_EXPECT(hooks.delays[0] == 1 * kj::HOURS);
+  KJ_EXPECT(!delay.poll(ws));
+  KJ_ASSERT_NONNULL(hooks.delayFulfiller)->fulfill();
+  KJ_EXPECT(delay.poll(ws));
+  delay.wait(ws);
+
+  // But not if the window has passed.
+  KJ_EXPECT(gate.batchingDelay(0 * kj::NANOSECONDS).poll(ws));
+  KJ_EXPECT(hooks.delays.size() == 1);
+}
+
 }  // namespace
 }  // namespace workerd
@@ -25,7 +25,8 @@ InputGate::~InputGate() noexcept {
 
 InputGate::Waiter::Waiter(
     kj::PromiseFulfiller<Lock>& fulfiller, InputGate& gate, bool isChildWaiter)
-    : fulfiller(fulfiller), gate(&gate), isChildWaiter(isChildWaiter) {
+    : fulfiller(fulfiller), gate(&gate), isChildWaiter(isChildWaiter),
+      since(kj::systemPreciseMonotonicClock().now()) {
   gate.hooks.inputGateWaiterAdded();
   if (isChildWaiter) {
     gate.waitingChildren.add(*this);
@@ -48,6 +49,7 @@ kj::Promise<InputGate::Lock> InputGate::wait() {
   KJ_IF_MAYBE(e, brokenState.tryGet<kj::Exception>()) {
     return kj::cp(*e);
   } else if (lockCount == 0) {
+    hooks.inputGateWaited(0 * kj::NANOSECONDS);
     return Lock(*this);
   } else {
     return kj::newAdaptedPromise<Lock, Waiter>(*this, false);
@@ -103,17 +105,23 @@ void InputGate::releaseLock() {
   if (lockCount == 0) {
     hooks.inputGateReleased();
     if (!waitingChildren.empty()) {
-      auto& waiter = waitingChildren.front();
-      waitingChildren.remove(waiter);
-      waiter.fulfiller.fulfill(Lock(*this));
+      grantLock(waitingChildren.front());
     } else if (!waiters.empty()) {
-      auto& waiter = waiters.front();
-      waiters.remove(waiter);
-      waiter.fulfiller.fulfill(Lock(*this));
+      grantLock(waiters.front());
     }
   }
 }
 
+void InputGate::grantLock(Waiter& waiter) {
+  if (waiter.isChildWaiter) {
+    waitingChildren.remove(waiter);
+  } else {
+    waiters.remove(waiter);
+  }
+  hooks.inputGateWaited(kj::systemPreciseMonotonicClock().now() - waiter.since);
+  waiter.fulfiller.fulfill(Lock(*this));
+}
+
 kj::Own<InputGate::CriticalSection> InputGate::Lock::startCriticalSection() {
   return kj::refcounted<CriticalSection>(*gate);
 }
@@ -312,13 +320,30 @@ kj::Own<kj::PromiseFulfiller<void>> OutputGate::lock() {
   return kj::mv(paf.fulfiller);
 }
 
+void OutputGate::lockReleased() {
+  hooks.outputGateReleased();
+  lastReleaseTime = kj::systemPreciseMonotonicClock().now();
+}
+
 kj::Promise<void> OutputGate::wait() {
   hooks.outputGateWaiterAdded();
-  return pastLocksPromise.addBranch().attach(kj::defer([this]() {
+  auto start = kj::systemPreciseMonotonicClock().now();
+  return pastLocksPromise.addBranch().then([this, start]() {
+    hooks.outputGateWaited(kj::systemPreciseMonotonicClock().now() - start);
+  }).attach(kj::defer([this]() {
     hooks.outputGateWaiterRemoved();
   }));
 }
 
+kj::Promise<void> OutputGate::batchingDelay(kj::Duration window) {
+  KJ_IF_MAYBE(t, lastReleaseTime) {
+    if (kj::systemPreciseMonotonicClock().now() - *t < window) {
+      return hooks.makeDelayPromise(window);
+    }
+  }
+  return kj::READY_NOW;
+}
+
 kj::Promise<void> OutputGate::onBroken() {
   KJ_REQUIRE(!brokenState.is<kj::Own<kj::PromiseFulfiller<void>>>(),
       "onBroken() can only be called once");
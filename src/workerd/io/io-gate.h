@@ -23,6 +23,7 @@
 #include <kj/async.h>
 #include <kj/one-of.h>
 #include <kj/list.h>
+#include <kj/time.h>
 #include <workerd/jsg/jsg.h>
 
 #include <type_traits>
@@ -52,6 +53,10 @@ public:
     // Optionally track metrics. In practice these are implemented by MetricsCollector::Actor, but
     // we don't want to depend on that class from here.
 
+    virtual void inputGateWaited(kj::Duration waitTime) {}
+    // Called each time wait() produces a lock, with how long it waited for it -- zero if the gate
+    // wasn't locked. Waits that are canceled or broken aren't reported.
+
     static Hooks DEFAULT;
   };
 
@@ -123,6 +128,7 @@ private:
     kj::PromiseFulfiller<Lock>& fulfiller;
     InputGate* gate;
     bool isChildWaiter;
+    kj::TimePoint since;
     kj::ListLink<Waiter> link;
   };
 
@@ -138,6 +144,9 @@ private:
 
   void releaseLock();
 
+  void grantLock(Waiter& waiter);
+  // Removes `waiter` from its list and fulfills it with a new lock.
+
   void setBroken(const kj::Exception& e);
   // Called when a critical section fails. All future waiters will throw this exception.
 
@@ -239,6 +248,14 @@ public:
     // Optionally track metrics. In practice these are implemented by MetricsCollector::Actor, but
     // we don't want to depend on that class from here.
 
+    virtual void outputGateWaited(kj::Duration waitTime) {}
+    // Called each time a wait() completes, with how long it waited for past locks to be released.
+    // Waits that are canceled or broken aren't reported.
+
+    virtual kj::Promise<void> makeDelayPromise(kj::Duration delay) { return kj::READY_NOW; }
+    // Make a promise that resolves after `delay`. Used by batchingDelay(); without a timer to
+    // implement this, batching is disabled.
+
     static Hooks DEFAULT;
   };
 
@@ -263,17 +280,29 @@ public:
 
   bool isBroken();
 
+  kj::Promise<void> batchingDelay(kj::Duration window);
+  // Adaptive batching of write confirmations, for callers that hold the gate while committing
+  // writes. If a lock was released less than `window` ago -- i.e. commits are arriving back to
+  // back -- returns a promise for `window` from now, which the caller should wait on before
+  // committing, so that further writes made meanwhile join the same commit and are confirmed
+  // together. Otherwise, returns an immediately-ready promise, so that an isolated write isn't
+  // delayed.
+
 private:
   Hooks& hooks;
 
   kj::ForkedPromise<void> pastLocksPromise;
 
+  kj::Maybe<kj::TimePoint> lastReleaseTime;
+  // When a lockWhile() last completed or was canceled.
+
   kj::OneOf<kj::Own<kj::PromiseFulfiller<void>>, kj::Exception> brokenState;
   // A fulfiller for onBroken(), or an exception if already broken.
 
   void setBroken(const kj::Exception& e);
 
   kj::Own<kj::PromiseFulfiller<void>> lock();
+  void lockReleased();
   static kj::Exception makeUnfulfilledException();
 };
 
@@ -293,7 +322,7 @@ kj::Promise<T> OutputGate::lockWhile(kj::Promise<T> promise) {
 
   hooks.outputGateLocked();
   auto rejectIfCanceled = kj::defer([this, &fulfiller](){
-    hooks.outputGateReleased();
+    lockReleased();
     if (fulfiller->isWaiting()) {
       auto e = makeUnfulfilledException();
       setBroken(e);
@@ -12,6 +12,8 @@ namespace workerd {
 struct ActorCacheSharedLruOptions;
 class IoContext;
 
+namespace jsg { struct CppHeapOptions; }
+
 class IsolateLimitEnforcer {
   // Interface for an object that enforces resource limits on an Isolate level.
   //
@@ -21,6 +23,9 @@ public:
   virtual v8::Isolate::CreateParams getCreateParams() = 0;
   // Get CreateParams to pass when constructing a new isolate.
 
+  virtual jsg::CppHeapOptions getCppHeapOptions() = 0;
+  // Get options for the new isolate's cppgc heap.
+
   virtual void customizeIsolate(v8::Isolate* isolate) = 0;
   // Further customize the isolate immediately after startup.
 
@@ -12,6 +12,7 @@
 #include <kj/time.h>
 #include <kj/compat/http.h>
 #include <workerd/io/trace.h>
+#include <workerd/util/alloc-profiler.h>
 
 namespace workerd {
 
@@ -62,6 +63,10 @@ public:
     return kj::mv(client);
   }
 
+  virtual void reportSubrequestTiming(const SubrequestTiming& timing) {}
+  // Called when an HTTP subrequest made through a client from IoContext::getSubrequest() completes
+  // or is canceled, with the time it spent in each phase. In-house subrequests are not reported.
+
   virtual SpanParent getSpan() { return nullptr; }
 
   virtual void addedContextTask() {}
@@ -70,6 +75,10 @@ public:
   virtual void finishedWaitUntilTask() {}
 
   virtual void setFailedOpen(bool value) {}
+
+  virtual void reportAllocations(const AllocationStats& stats) {}
+  // Called when the request is done, with the allocations made while running its code. Only
+  // called in builds with allocation profiling enabled; see alloc-profiler.h.
 };
 
 class IsolateObserver: public kj::AtomicRefcounted {
@@ -170,6 +179,25 @@ public:
     // The presence of `lockTiming` determines whether or not we need to record timing data. If
     // we have no `lockTiming`, then this LockRecord wrapper is just a big nothingburger.
   };
+
+  struct HeapUsage {
+    // A sample of an isolate's memory usage, in bytes.
+
+    size_t usedHeapSize = 0;
+    size_t totalHeapSize = 0;
+    size_t heapSizeLimit = 0;
+    // The JavaScript heap, as reported by v8::HeapStatistics.
+
+    size_t externalMemory = 0;
+    // Memory owned by JavaScript objects but allocated outside the heap, mostly ArrayBuffer
+    // backing stores.
+
+    size_t cppgcUsedSize = 0;
+    // The cppgc heap holding C++ objects wrapped for JavaScript.
+  };
+
+  virtual void reportHeapUsage(const HeapUsage& usage) {}
+  // Called by the IsolateLimitEnforcer's reportMetrics(), if it samples heap usage.
 };
 
 class WorkerObserver: public kj::AtomicRefcounted {
@@ -221,6 +249,9 @@ public:
   virtual void outputGateReleased() {}
   virtual void outputGateWaiterAdded() {}
   virtual void outputGateWaiterRemoved() {}
+  virtual void inputGateWaited(kj::Duration waitTime) {}
+  virtual void outputGateWaited(kj::Duration waitTime) {}
+  // How long an event waited for the input gate, or an outgoing message for the output gate.
 
   virtual void shutdown(uint16_t reasonCode, LimitEnforcer& limitEnforcer) {}
 };
@@ -0,0 +1,283 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#include "subrequest-timing.h"
+#include <workerd/io/trace.h>
+#include <kj/compat/http.h>
+#include <kj/debug.h>
+#include <kj/test.h>
+#include <kj/timer.h>
+#include <kj/vector.h>
+
+namespace workerd {
+namespace {
+
+class MockNetwork final: public kj::Network {
+  // A network whose lookups and connections each take a turn of the event loop. Every connection
+  // is answered with one canned HTTP response, whatever the request was.
+
+public:
+  uint lookups = 0;
+  uint connections = 0;
+
+  kj::Promise<kj::Own<kj::NetworkAddress>> parseAddress(
+      kj::StringPtr addr, uint portHint) override {
+    ++lookups;
+    return kj::evalLater([this, addr = kj::str(addr)]() -> kj::Own<kj::NetworkAddress> {
+      return kj::heap<Address>(*this, kj::str(addr));
+    });
+  }
+
+  kj::Own<kj::NetworkAddress> getSockaddr(const void* sockaddr, uint len) override {
+    KJ_UNIMPLEMENTED("not used");
+  }
+
+  kj::Own<kj::Network> restrictPeers(
+      kj::ArrayPtr<const kj::StringPtr> allow,
+      kj::ArrayPtr<const kj::StringPtr> deny) override {
+    KJ_UNIMPLEMENTED("not used");
+  }
+
+private:
+  kj::Vector<kj::Promise<void>> servers;
+
+  class Address final: public kj::NetworkAddress {
+  public:
+    Address(MockNetwork& network, kj::String name): network(network), name(kj::mv(name)) {}
+
+    kj::Promise<kj::Own<kj::AsyncIoStream>> connect() override {
+      ++network.connections;
+      return kj::evalLater([this]() -> kj::Own<kj::AsyncIoStream> {
+        auto pipe = kj::newTwoWayPipe();
+        network.servers.add(serve(kj::mv(pipe.ends[1])));
+        return kj::mv(pipe.ends[0]);
+      });
+    }
+
+    kj::Own<kj::ConnectionReceiver> listen() override { KJ_UNIMPLEMENTED("not used"); }
+    kj::Own<kj::NetworkAddress> clone() override {
+      return kj::heap<Address>(network, kj::str(name));
+    }
+    kj::String toString() override { return kj::str(name); }
+
+  private:
+    MockNetwork& network;
+    kj::String name;
+  };
+
+  static kj::Promise<void> serve(kj::Own<kj::AsyncIoStream> stream) {
+    static constexpr kj::StringPtr RESPONSE = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nhi"_kj;
+    auto buffer = kj::heapArray<kj::byte>(4096);
+    auto& streamRef = *stream;
+    return streamRef.tryRead(buffer.begin(), 1, buffer.size())
+        .then([&streamRef](size_t) {
+      return streamRef.write(RESPONSE.begin(), RESPONSE.size());
+    }).attach(kj::mv(stream), kj::mv(buffer)).eagerlyEvaluate(nullptr);
+  }
+};
+
+class MockTlsNetwork final: public kj::Network {
+  // Stands in for a TLS wrapper: connecting first connects the inner network, then spends another
+  // turn of the event loop "handshaking".
+
+public:
+  explicit MockTlsNetwork(kj::Network& inner): inner(inner) {}
+
+  kj::Promise<kj::Own<kj::NetworkAddress>> parseAddress(
+      kj::StringPtr addr, uint portHint) override {
+    return inner.parseAddress(addr, portHint)
+        .then([](kj::Own<kj::NetworkAddress> address) -> kj::Own<kj::NetworkAddress> {
+      return kj::heap<Address>(kj::mv(address));
+    });
+  }
+
+  kj::Own<kj::NetworkAddress> getSockaddr(const void* sockaddr, uint len) override {
+    KJ_UNIMPLEMENTED("not used");
+  }
+
+  kj::Own<kj::Network> restrictPeers(
+      kj::ArrayPtr<const kj::StringPtr> allow,
+      kj::ArrayPtr<const kj::StringPtr> deny) override {
+    KJ_UNIMPLEMENTED("not used");
+  }
+
+private:
+  kj::Network& inner;
+
+  class Address final: public kj::NetworkAddress {
+  public:
+    explicit Address(kj::Own<kj::NetworkAddress> inner): inner(kj::mv(inner)) {}
+
+    kj::Promise<kj::Own<kj::AsyncIoStream>> connect() override {
+      return inner->connect().then([](kj::Own<kj::AsyncIoStream> stream) {
+        return kj::evalLater([stream = kj::mv(stream)]() mutable { return kj::mv(stream); });
+      });
+    }
+
+    kj::Own<kj::ConnectionReceiver> listen() override { KJ_UNIMPLEMENTED("not used"); }
+    kj::Own<kj::NetworkAddress> clone() override { return kj::heap<Address>(inner->clone()); }
+    kj::String toString() override { return inner->toString(); }
+
+  private:
+    kj::Own<kj::NetworkAddress> inner;
+  };
+};
+
+class HttpServiceWorker final: public WorkerInterface {
+  // Presents an HTTP service as a WorkerInterface, as network services do.
+
+public:
+  explicit HttpServiceWorker(kj::HttpService& service): service(service) {}
+
+  kj::Promise<void> request(
+      kj::HttpMethod method, kj::StringPtr url, const kj::HttpHeaders& headers,
+      kj::AsyncInputStream& requestBody, kj::HttpService::Response& response) override {
+    return service.request(method, url, headers, requestBody, response);
+  }
+
+  kj::Promise<void> connect(
+      kj::StringPtr host, const kj::HttpHeaders& headers, kj::AsyncIoStream& connection,
+      ConnectResponse& response, kj::HttpConnectSettings settings) override {
+    KJ_UNIMPLEMENTED("not used");
+  }
+
+  void prewarm(kj::StringPtr url) override {}
+
+  kj::Promise<ScheduledResult> runScheduled(kj::Date scheduledTime, kj::StringPtr cron) override {
+    KJ_UNIMPLEMENTED("not used");
+  }
+
+  kj::Promise<AlarmResult> runAlarm(kj::Date scheduledTime) override {
+    KJ_UNIMPLEMENTED("not used");
+  }
+
+  kj::Promise<CustomEvent::Result> customEvent(kj::Own<CustomEvent> event) override {
+    KJ_UNIMPLEMENTED("not used");
+  }
+
+private:
+  kj::HttpService& service;
+};
+
+class RecordingObserver final: public RequestObserver {
+public:
+  kj::Vector<SubrequestTiming> timings;
+
+  void reportSubrequestTiming(const SubrequestTiming& timing) override {
+    timings.add(timing);
+  }
+};
+
+SubrequestTimer* currentTimer() {
+  auto timer = SubrequestTimer::current();
+  KJ_IF_MAYBE(t, timer) {
+    return t->get();
+  }
+  return nullptr;
+}
+
+KJ_TEST("SubrequestTimer::Scope nests and restores the current timer") {
+  auto outer = kj::refcounted<SubrequestTimer>();
+  auto inner = kj::refcounted<SubrequestTimer>();
+
+  KJ_EXPECT(currentTimer() == nullptr);
+  {
+    SubrequestTimer::Scope outerScope(*outer);
+    KJ_EXPECT(currentTimer() == outer.get());
+    {
+      SubrequestTimer::Scope innerScope(*inner);
+      KJ_EXPECT(currentTimer() == inner.get());
+    }
+    KJ_EXPECT(currentTimer() == outer.get());
+  }
+  KJ_EXPECT(currentTimer() == nullptr);
+}
+
+KJ_TEST("timed network charges a connection to the subrequest that looked up its address") {
+  kj::EventLoop loop;
+  kj::WaitScope ws(loop);
+
+  MockNetwork mock;
+  auto network = newTimedNetwork({ &mock, kj::NullDisposer::instance }, NetworkLayer::TCP);
+
+  auto lookupTimer = kj::refcounted<SubrequestTimer>();
+  kj::Promise<kj::Own<kj::NetworkAddress>> promise = nullptr;
+  {
+    SubrequestTimer::Scope scope(*lookupTimer);
+    promise = network->parseAddress("example.com", 80);
+  }
+  auto address = promise.wait(ws);
+  KJ_EXPECT(lookupTimer->timing.dnsLookup != nullptr);
+  KJ_EXPECT(lookupTimer->timing.connect == nullptr);
+
+  // The connection pool connects once the lookup completes, after the subrequest has left the
+  // thread-local scope. The lookup's timer is handed over through the address.
+  address->connect().wait(ws);
+  KJ_EXPECT(lookupTimer->timing.connect != nullptr);
+
+  // The hand-over happens once: a later connection through the same address belongs to whichever
+  // subrequest is current when it's opened.
+  auto laterTimer = kj::refcounted<SubrequestTimer>();
+  {
+    SubrequestTimer::Scope scope(*laterTimer);
+    address->connect().wait(ws);
+  }
+  KJ_EXPECT(laterTimer->timing.connect != nullptr);
+  KJ_EXPECT(laterTimer->timing.dnsLookup == nullptr);
+
+  // With no current subrequest, nothing is recorded anywhere.
+  auto connectTime = KJ_ASSERT_NONNULL(lookupTimer->timing.connect);
+  address->connect().wait(ws);
+  KJ_EXPECT(KJ_ASSERT_NONNULL(lookupTimer->timing.connect) == connectTime);
+  KJ_EXPECT(mock.connections == 3);
+}
+
+KJ_TEST("network service subrequest records DNS lookup, connect and TLS handshake") {
+  kj::EventLoop loop;
+  kj::WaitScope ws(loop);
+  kj::TimerImpl timer(kj::origin<kj::TimePoint>());
+  kj::HttpHeaderTable headerTable;
+
+  // Layered the way Server::makeNetworkService() layers a network and its TLS wrapper.
+  MockNetwork mock;
+  auto network = newTimedNetwork({ &mock, kj::NullDisposer::instance }, NetworkLayer::TCP);
+  auto tlsNetwork = newTimedNetwork(kj::heap<MockTlsNetwork>(*network), NetworkLayer::TLS);
+
+  auto httpClient = kj::newHttpClient(timer, headerTable, *network, *tlsNetwork);
+  auto serviceAdapter = kj::newHttpService(*httpClient);
+  auto observer = kj::refcounted<RecordingObserver>();
+
+  {
+    auto worker = newTimedSubrequestClient(
+        kj::heap<HttpServiceWorker>(*serviceAdapter), kj::addRef(*observer), nullptr,
+        kj::UNIX_EPOCH);
+    auto client = kj::newHttpClient(*worker);
+
+    kj::HttpHeaders headers(headerTable);
+    auto request = client->request(
+        kj::HttpMethod::GET, "https://example.com/", headers, uint64_t(0));
+    auto response = request.response.wait(ws);
+    KJ_EXPECT(response.statusCode == 200);
+    KJ_EXPECT(response.body->readAllText().wait(ws) == "hi");
+  }
+
+  KJ_ASSERT(observer->timings.size() == 1);
+  auto& timing = observer->timings[0];
+  KJ_EXPECT(timing.dnsLookup != nullptr);
+  KJ_EXPECT(timing.connect != nullptr);
+  KJ_EXPECT(timing.tlsHandshake != nullptr);
+  KJ_EXPECT(timing.timeToFirstByte != nullptr);
+  KJ_EXPECT(timing.bodyTransfer != nullptr);
+  KJ_EXPECT(mock.lookups == 1);
+  KJ_EXPECT(mock.connections == 1);
+
+  // The TLS phase excludes the TCP connect it's layered on, and neither can exceed the whole
+  // time to first byte.
+  auto ttfb = KJ_ASSERT_NONNULL(timing.timeToFirstByte);
+  KJ_EXPECT(KJ_ASSERT_NONNULL(timing.connect) <= ttfb);
+  KJ_EXPECT(KJ_ASSERT_NONNULL(timing.tlsHandshake) <= ttfb);
+}
+
+}  // namespace
+}  // namespace workerd
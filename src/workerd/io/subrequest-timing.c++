@@ -0,0 +1,271 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#include "subrequest-timing.h"
+#include <workerd/io/trace.h>
+#include <kj/debug.h>
+
+namespace workerd {
+
+namespace {
+
+thread_local SubrequestTimer* currentTimer = nullptr;
+
+kj::TimePoint now() {
+  return kj::systemPreciseMonotonicClock().now();
+}
+
+class TimedSubrequestClient final: public WorkerInterface, private kj::HttpService::Response {
+public:
+  TimedSubrequestClient(kj::Own<WorkerInterface> inner, kj::Own<RequestObserver> observer,
+                        kj::Maybe<kj::Own<WorkerTracer>> tracer, kj::Date timestamp)
+      : inner(kj::mv(inner)), observer(kj::mv(observer)), tracer(kj::mv(tracer)),
+        timestamp(timestamp), timer(kj::refcounted<SubrequestTimer>()) {}
+
+  kj::Promise<void> request(
+      kj::HttpMethod method, kj::StringPtr url, const kj::HttpHeaders& headers,
+      kj::AsyncInputStream& requestBody, kj::HttpService::Response& response) override {
+    KJ_REQUIRE(wrappedResponse == nullptr, "object should only receive one request");
+    wrappedResponse = response;
+    requestMethod = method;
+    requestUrl = kj::str(url);
+    startTime = now();
+
+    kj::Promise<void> promise = nullptr;
+    {
+      SubrequestTimer::Scope scope(*timer);
+      promise = kj::evalNow([&]() {
+        return inner->request(method, url, headers, requestBody, *this);
+      });
+    }
+    return promise.attach(kj::defer([this]() { report(); }));
+  }
+
+  kj::Promise<void> connect(
+      kj::StringPtr host, const kj::HttpHeaders& headers, kj::AsyncIoStream& connection,
+      ConnectResponse& response, kj::HttpConnectSettings settings) override {
+    return inner->connect(host, headers, connection, response, kj::mv(settings));
+  }
+
+  void prewarm(kj::StringPtr url) override {
+    inner->prewarm(url);
+  }
+
+  kj::Promise<ScheduledResult> runScheduled(kj::Date scheduledTime, kj::StringPtr cron) override {
+    return inner->runScheduled(scheduledTime, cron);
+  }
+
+  kj::Promise<AlarmResult> runAlarm(kj::Date scheduledTime) override {
+    return inner->runAlarm(scheduledTime);
+  }
+
+  kj::Promise<bool> test() override {
+    return inner->test();
+  }
+
+  kj::Promise<CustomEvent::Result> customEvent(kj::Own<CustomEvent> event) override {
+    return inner->customEvent(kj::mv(event));
+  }
+
+private:
+  kj::Own<WorkerInterface> inner;
+  kj::Own<RequestObserver> observer;
+  kj::Maybe<kj::Own<WorkerTracer>> tracer;
+  kj::Date timestamp;
+  kj::Own<SubrequestTimer> timer;
+
+  kj::Maybe<kj::HttpService::Response&> wrappedResponse;
+  kj::HttpMethod requestMethod = kj::HttpMethod::GET;
+  kj::String requestUrl;
+  uint16_t responseStatus = 0;
+  bool isWebSocket = false;
+  kj::TimePoint startTime = kj::origin<kj::TimePoint>();
+  kj::Maybe<kj::TimePoint> responseTime;
+
+  kj::Own<kj::AsyncOutputStream> send(
+      uint statusCode, kj::StringPtr statusText, const kj::HttpHeaders& headers,
+      kj::Maybe<uint64_t> expectedBodySize) override {
+    responseTime = now();
+    responseStatus = statusCode;
+    return KJ_ASSERT_NONNULL(wrappedResponse).send(
+        statusCode, statusText, headers, expectedBodySize);
+  }
+
+  kj::Own<kj::WebSocket> acceptWebSocket(const kj::HttpHeaders& headers) override {
+    responseTime = now();
+    responseStatus = 101;
+    isWebSocket = true;
+    return KJ_ASSERT_NONNULL(wrappedResponse).acceptWebSocket(headers);
+  }
+
+  void report() {
+    auto endTime = now();
+    auto& timing = timer->timing;
+    KJ_IF_MAYBE(r, responseTime) {
+      timing.timeToFirstByte = *r - startTime;
+      if (!isWebSocket) {
+        // A WebSocket's "body" lasts as long as the connection, which says nothing about the
+        // upstream's performance.
+        timing.bodyTransfer = endTime - *r;
+      }
+    }
+
+    observer->reportSubrequestTiming(timing);
+    KJ_IF_MAYBE(t, tracer) {
+      (*t)->addSubrequest(Trace::Subrequest(
+          timestamp, requestMethod, kj::mv(requestUrl), responseStatus, timing));
+    }
+  }
+};
+
+void recordConnect(SubrequestTimer& timer, NetworkLayer layer, kj::Duration elapsed) {
+  switch (layer) {
+    case NetworkLayer::TCP:
+      timer.timing.connect = elapsed;
+      return;
+    case NetworkLayer::TLS:
+      // The TLS layer's connect() includes the TCP layer's, which completed first.
+      KJ_IF_MAYBE(tcp, timer.timing.connect) {
+        elapsed = elapsed > *tcp ? elapsed - *tcp : 0 * kj::NANOSECONDS;
+      }
+      timer.timing.tlsHandshake = elapsed;
+      return;
+  }
+  KJ_UNREACHABLE;
+}
+
+class TimedNetworkAddress final: public kj::NetworkAddress {
+public:
+  TimedNetworkAddress(kj::Own<kj::NetworkAddress> inner, NetworkLayer layer,
+                      kj::Maybe<kj::Own<SubrequestTimer>> lookupTimer = nullptr)
+      : inner(kj::mv(inner)), layer(layer), lookupTimer(kj::mv(lookupTimer)) {}
+
+  kj::Promise<kj::Own<kj::AsyncIoStream>> connect() override {
+    KJ_IF_MAYBE(timer, takeTimer()) {
+      auto start = now();
+      return inner->connect().then(
+          [timer = kj::mv(*timer), layer = layer, start]
+          (kj::Own<kj::AsyncIoStream> stream) mutable {
+        recordConnect(*timer, layer, now() - start);
+        return kj::mv(stream);
+      });
+    }
+    return inner->connect();
+  }
+
+  kj::Promise<kj::AuthenticatedStream> connectAuthenticated() override {
+    KJ_IF_MAYBE(timer, takeTimer()) {
+      auto start = now();
+      return inner->connectAuthenticated().then(
+          [timer = kj::mv(*timer), layer = layer, start]
+          (kj::AuthenticatedStream stream) mutable {
+        recordConnect(*timer, layer, now() - start);
+        return kj::mv(stream);
+      });
+    }
+    return inner->connectAuthenticated();
+  }
+
+  kj::Own<kj::ConnectionReceiver> listen() override {
+    return inner->listen();
+  }
+
+  kj::Own<kj::DatagramPort> bindDatagramPort() override {
+    return inner->bindDatagramPort();
+  }
+
+  kj::Own<kj::NetworkAddress> clone() override {
+    return kj::heap<TimedNetworkAddress>(inner->clone(), layer);
+  }
+
+  kj::String toString() override {
+    return inner->toString();
+  }
+
+private:
+  kj::Own<kj::NetworkAddress> inner;
+  NetworkLayer layer;
+  kj::Maybe<kj::Own<SubrequestTimer>> lookupTimer;
+  // The subrequest that looked this address up. The connection pool can only connect once the
+  // lookup completes, by which time that subrequest is no longer the current one.
+
+  kj::Maybe<kj::Own<SubrequestTimer>> takeTimer() {
+    auto result = SubrequestTimer::current();
+    if (result == nullptr) {
+      result = kj::mv(lookupTimer);
+    }
+    lookupTimer = nullptr;
+    return result;
+  }
+};
+
+class TimedNetwork final: public kj::Network {
+public:
+  TimedNetwork(kj::Own<kj::Network> inner, NetworkLayer layer)
+      : inner(kj::mv(inner)), layer(layer) {}
+
+  kj::Promise<kj::Own<kj::NetworkAddress>> parseAddress(
+      kj::StringPtr addr, uint portHint) override {
+    auto timer = SubrequestTimer::current();
+    auto start = now();
+    return inner->parseAddress(addr, portHint).then(
+        [layer = layer, timer = kj::mv(timer), start]
+        (kj::Own<kj::NetworkAddress> address) mutable -> kj::Own<kj::NetworkAddress> {
+      KJ_IF_MAYBE(t, timer) {
+        if (layer == NetworkLayer::TCP) {
+          (*t)->timing.dnsLookup = now() - start;
+        }
+      }
+      return kj::heap<TimedNetworkAddress>(kj::mv(address), layer, kj::mv(timer));
+    });
+  }
+
+  kj::Own<kj::NetworkAddress> getSockaddr(const void* sockaddr, uint len) override {
+    return kj::heap<TimedNetworkAddress>(inner->getSockaddr(sockaddr, len), layer);
+  }
+
+  kj::Own<kj::Network> restrictPeers(
+      kj::ArrayPtr<const kj::StringPtr> allow,
+      kj::ArrayPtr<const kj::StringPtr> deny) override {
+    return kj::heap<TimedNetwork>(inner->restrictPeers(allow, deny), layer);
+  }
+
+private:
+  kj::Own<kj::Network> inner;
+  NetworkLayer layer;
+};
+
+}  // namespace
+
+SubrequestTimer::Scope::Scope(SubrequestTimer& timer)
+    : previous(currentTimer) {
+  currentTimer = &timer;
+}
+
+SubrequestTimer::Scope::~Scope() noexcept(false) {
+  currentTimer = previous;
+}
+
+kj::Maybe<kj::Own<SubrequestTimer>> SubrequestTimer::current() {
+  if (currentTimer == nullptr) return nullptr;
+  return kj::addRef(*currentTimer);
+}
+
+kj::Own<WorkerInterface> newTimedSubrequestClient(
+    kj::Own<WorkerInterface> inner, kj::Own<RequestObserver> observer,
+    kj::Maybe<kj::Own<WorkerTracer>> tracer, kj::Date timestamp) {
+  return kj::heap<TimedSubrequestClient>(
+      kj::mv(inner), kj::mv(observer), kj::mv(tracer), timestamp);
+}
+
+kj::Own<kj::Network> newTimedNetwork(kj::Own<kj::Network> inner, NetworkLayer layer) {
+  return kj::heap<TimedNetwork>(kj::mv(inner), layer);
+}
+
+kj::Own<kj::NetworkAddress> newTimedNetworkAddress(
+    kj::Own<kj::NetworkAddress> inner, NetworkLayer layer) {
+  return kj::heap<TimedNetworkAddress>(kj::mv(inner), layer);
+}
+
+}  // namespace workerd
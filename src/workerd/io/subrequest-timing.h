@@ -0,0 +1,69 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#pragma once
+// Breaks the time spent on outgoing subrequests down into DNS lookup, connecting, TLS handshake,
+// time to first byte and body transfer.
+//
+// IoContext wraps each subrequest client it hands out with `newTimedSubrequestClient()`, which
+// measures time to first byte and body transfer for any target and reports the result when the
+// request completes. The network-level phases are only visible to the code that opens
+// connections, which is hidden behind kj::HttpClient's connection pool. Networks wrapped with
+// `newTimedNetwork()` attribute those phases to the subrequest being issued on the current thread
+// when the connection is requested, or, if the connection had to wait for an address lookup, to
+// the subrequest that triggered the lookup.
+
+#include <workerd/io/observer.h>
+#include <workerd/io/worker-interface.h>
+#include <kj/async-io.h>
+
+namespace workerd {
+
+class WorkerTracer;
+
+class SubrequestTimer final: public kj::Refcounted {
+  // Collects the timing of one subrequest as its phases complete.
+
+public:
+  SubrequestTiming timing;
+
+  class Scope {
+    // Makes `timer` the current timer on this thread for as long as this is on the stack.
+
+  public:
+    explicit Scope(SubrequestTimer& timer);
+    ~Scope() noexcept(false);
+    KJ_DISALLOW_COPY_AND_MOVE(Scope);
+
+  private:
+    SubrequestTimer* previous;
+  };
+
+  static kj::Maybe<kj::Own<SubrequestTimer>> current();
+  // The timer of the subrequest being issued on this thread, if any.
+};
+
+kj::Own<WorkerInterface> newTimedSubrequestClient(
+    kj::Own<WorkerInterface> inner, kj::Own<RequestObserver> observer,
+    kj::Maybe<kj::Own<WorkerTracer>> tracer, kj::Date timestamp);
+// Wraps `inner` so that its HTTP request is timed and reported to `observer` and, if non-null,
+// `tracer` once it completes or is canceled. `timestamp` is when the subrequest was issued, as
+// recorded in the trace. Other events pass through untimed.
+
+enum class NetworkLayer {
+  TCP,
+  // Records address lookups and connecting.
+
+  TLS,
+  // Records TLS handshakes. Must wrap a TLS network (or address) that itself wraps a TCP-layer
+  // timed one, since the handshake is what remains after subtracting the TCP connect time.
+};
+
+kj::Own<kj::Network> newTimedNetwork(kj::Own<kj::Network> inner, NetworkLayer layer);
+kj::Own<kj::NetworkAddress> newTimedNetworkAddress(
+    kj::Own<kj::NetworkAddress> inner, NetworkLayer layer);
+// Wrap a network or address so that connections opened through it record their phases into the
+// current `SubrequestTimer`.
+
+}  // namespace workerd
@@ -22,6 +22,19 @@ static kj::HttpMethod validateMethod(capnp::HttpMethod method) {
   return static_cast<kj::HttpMethod>(method);
 }
 
+static int64_t phaseToNs(kj::Maybe<kj::Duration> phase) {
+  KJ_IF_MAYBE(p, phase) {
+    return *p / kj::NANOSECONDS;
+  } else {
+    return -1;
+  }
+}
+
+static kj::Maybe<kj::Duration> phaseFromNs(int64_t ns) {
+  if (ns < 0) return nullptr;
+  return ns * kj::NANOSECONDS;
+}
+
 } // namespace
 
 Trace::FetchEventInfo::FetchEventInfo(kj::HttpMethod method, kj::String url, kj::String cfJson,
@@ -116,6 +129,36 @@ void Trace::FetchResponseInfo::copyTo(rpc::Trace::FetchResponseInfo::Builder bui
   builder.setStatusCode(statusCode);
 }
 
+Trace::Subrequest::Subrequest(kj::Date timestamp, kj::HttpMethod method, kj::String url,
+                              uint16_t statusCode, SubrequestTiming timing)
+    : timestamp(timestamp), method(method), url(kj::mv(url)), statusCode(statusCode),
+      timing(kj::mv(timing)) {}
+
+Trace::Subrequest::Subrequest(rpc::Trace::Subrequest::Reader reader)
+    : timestamp(kj::UNIX_EPOCH + reader.getTimestampNs() * kj::NANOSECONDS),
+      method(validateMethod(reader.getMethod())),
+      url(kj::str(reader.getUrl())),
+      statusCode(reader.getStatusCode()),
+      timing({
+        .dnsLookup = phaseFromNs(reader.getDnsLookupNs()),
+        .connect = phaseFromNs(reader.getConnectNs()),
+        .tlsHandshake = phaseFromNs(reader.getTlsHandshakeNs()),
+        .timeToFirstByte = phaseFromNs(reader.getTimeToFirstByteNs()),
+        .bodyTransfer = phaseFromNs(reader.getBodyTransferNs()),
+      }) {}
+
+void Trace::Subrequest::copyTo(rpc::Trace::Subrequest::Builder builder) {
+  builder.setTimestampNs((timestamp - kj::UNIX_EPOCH) / kj::NANOSECONDS);
+  builder.setMethod(static_cast<capnp::HttpMethod>(method));
+  builder.setUrl(url);
+  builder.setStatusCode(statusCode);
+  builder.setDnsLookupNs(phaseToNs(timing.dnsLookup));
+  builder.setConnectNs(phaseToNs(timing.connect));
+  builder.setTlsHandshakeNs(phaseToNs(timing.tlsHandshake));
+  builder.setTimeToFirstByteNs(phaseToNs(timing.timeToFirstByte));
+  builder.setBodyTransferNs(phaseToNs(timing.bodyTransfer));
+}
+
 Trace::Log::Log(kj::Date timestamp, LogLevel logLevel, kj::String message)
     : timestamp(timestamp),
       logLevel(logLevel),
@@ -151,6 +194,13 @@ void Trace::copyTo(rpc::Trace::Builder builder) {
     }
   }
 
+  {
+    auto list = builder.initSubrequests(subrequests.size());
+    for (auto i: kj::indices(subrequests)) {
+      subrequests[i].copyTo(list[i]);
+    }
+  }
+
   builder.setOutcome(outcome);
   builder.setCpuTime(cpuTime / kj::MILLISECONDS);
   builder.setWallTime(wallTime / kj::MILLISECONDS);
@@ -224,6 +274,7 @@ void Trace::mergeFrom(rpc::Trace::Reader reader, PipelineLogLevel pipelineLogLev
   if (pipelineLogLevel != PipelineLogLevel::NONE) {
     logs.addAll(reader.getLogs());
     exceptions.addAll(reader.getExceptions());
+    subrequests.addAll(reader.getSubrequests());
   }
 
   outcome = reader.getOutcome();
@@ -422,6 +473,22 @@ void WorkerTracer::addException(kj::Date timestamp, kj::String name, kj::String
   trace->exceptions.add(timestamp, kj::mv(name), kj::mv(message));
 }
 
+void WorkerTracer::addSubrequest(Trace::Subrequest&& subrequest) {
+  if (trace->exceededSubrequestLimit) {
+    return;
+  }
+  if (pipelineLogLevel == PipelineLogLevel::NONE) {
+    return;
+  }
+  size_t newSize = trace->bytesUsed + sizeof(Trace::Subrequest) + subrequest.url.size();
+  if (newSize > MAX_TRACE_BYTES) {
+    trace->exceededSubrequestLimit = true;
+    return;
+  }
+  trace->bytesUsed = newSize;
+  trace->subrequests.add(kj::mv(subrequest));
+}
+
 void WorkerTracer::setEventInfo(kj::Date timestamp, Trace::EventInfo&& info) {
   KJ_ASSERT(trace->eventInfo == nullptr, "tracer can only be used for a single event");
 
@@ -33,6 +33,21 @@ enum class PipelineLogLevel {
   NONE, FULL
 };
 
+struct SubrequestTiming {
+  // Time spent in each phase of one outgoing subrequest. Phases that did not happen, e.g.
+  // connecting when a pooled connection was reused, or that the subrequest's target cannot
+  // observe, e.g. connecting to another Worker, are null.
+
+  kj::Maybe<kj::Duration> dnsLookup;
+  kj::Maybe<kj::Duration> connect;
+  // Establishing the TCP connection, once the address is known.
+  kj::Maybe<kj::Duration> tlsHandshake;
+  kj::Maybe<kj::Duration> timeToFirstByte;
+  // From issuing the request until the response headers arrived, including all of the above.
+  kj::Maybe<kj::Duration> bodyTransfer;
+  // From the response headers arriving until the response was complete.
+};
+
 // TODO(someday): See if we can merge similar code concepts...  Trace fills a role similar to
 // MetricsCollector::Reporter::StageEvent, and Tracer fills a role similar to
 // MetricsCollector::Request.  Currently, the major differences are:
@@ -178,6 +193,29 @@ public:
     void copyTo(rpc::Trace::Exception::Builder builder);
   };
 
+  class Subrequest {
+  public:
+    explicit Subrequest(kj::Date timestamp, kj::HttpMethod method, kj::String url,
+                        uint16_t statusCode, SubrequestTiming timing);
+    Subrequest(rpc::Trace::Subrequest::Reader reader);
+    Subrequest(Subrequest&&) = default;
+    KJ_DISALLOW_COPY(Subrequest);
+    ~Subrequest() noexcept(false) = default;
+
+    kj::Date timestamp;
+    // When the subrequest was issued. Only as accurate as Worker's Date.now(), for Spectre
+    // mitigation.
+
+    kj::HttpMethod method;
+    kj::String url;
+    uint16_t statusCode;
+    // Zero if no response was received.
+
+    SubrequestTiming timing;
+
+    void copyTo(rpc::Trace::Subrequest::Builder builder);
+  };
+
   kj::Maybe<kj::String> stableId;
   // Empty for toplevel worker.
 
@@ -198,6 +236,7 @@ public:
   kj::Vector<Log> logs;
   kj::Vector<Exception> exceptions;
   // A request's trace can have multiple exceptions due to separate request/waitUntil tasks.
+  kj::Vector<Subrequest> subrequests;
 
   EventOutcome outcome = EventOutcome::UNKNOWN;
 
@@ -208,6 +247,7 @@ public:
 
   bool exceededLogLimit = false;
   bool exceededExceptionLimit = false;
+  bool exceededSubrequestLimit = false;
   size_t bytesUsed = 0;
   // Trace data is recorded outside of the JS heap.  To avoid DoS, we keep an estimate of trace
   // data size, and we stop recording if too much is used.
@@ -285,6 +325,9 @@ public:
 
   void addException(kj::Date timestamp, kj::String name, kj::String message);
 
+  void addSubrequest(Trace::Subrequest&& subrequest);
+  // Records a completed subrequest and its timing.
+
   void setEventInfo(kj::Date timestamp, Trace::EventInfo&&);
   // Adds info about the event that triggered the trace.  Must not be called more than once.
 
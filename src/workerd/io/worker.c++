@@ -432,6 +432,22 @@ uint64_t getCurrentThreadId() {
 #endif
 }
 
+kj::Duration getCurrentThreadCpuTime() {
+#if _WIN32
+  FILETIME creation, exit, kernel, user;
+  KJ_WIN32(GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user));
+  auto ticks = [](const FILETIME& t) {
+    return (uint64_t(t.dwHighDateTime) << 32) | t.dwLowDateTime;
+  };
+  // FILETIME counts 100ns ticks.
+  return (ticks(kernel) + ticks(user)) * 100 * kj::NANOSECONDS;
+#else
+  struct timespec ts;
+  KJ_SYSCALL(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts));
+  return ts.tv_sec * kj::SECONDS + ts.tv_nsec * kj::NANOSECONDS;
+#endif
+}
+
 }  // namespace
 
 class Worker::InspectorClient: public v8_inspector::V8InspectorClient {
@@ -545,6 +561,12 @@ struct Worker::Isolate::Impl {
   // attempt. This allows watchdogs to see evidence of forward progress in other threads, even if
   // their own thread has blocked waiting for the lock for a long time.
 
+  uint schedulingWeight = 1;
+  // See Worker::Isolate::setSchedulingWeight().
+
+  mutable uint64_t asyncLockCpuNanos = 0;
+  // Atomically incremented when an AsyncLock on this isolate is released.
+
   class Lock {
     // Wrapper around JsgWorkerIsolate::Lock and various RAII objects which help us report metrics,
     // measure instantaneous load, avoid spurious watchdog kills, and defer context destruction.
@@ -1775,6 +1797,108 @@ void Worker::Lock::validateHandlers(ValidationErrorReporter& errorReporter) {
 
 thread_local Worker::AsyncWaiter* Worker::AsyncWaiter::threadCurrentWaiter = nullptr;
 
+class Worker::AsyncWaiter::OtherIsolateLockQueue {
+  // Per-thread queue of attempts to lock an isolate while the thread already holds, or is waiting
+  // for, a different isolate's async lock.
+  //
+  // When the thread's current lock is released, the turn goes to the queued attempts of a single
+  // isolate: the one that has used the least CPU time under its lock relative to its scheduling
+  // weight. This is start-time fair queuing: each attempt is tagged with its isolate's virtual
+  // time when it joins the queue, but never less than the tag of the last attempt granted, so an
+  // isolate returning from idle doesn't get to monopolize the thread to "catch up". All queued
+  // attempts for the chosen isolate are granted together so they can coalesce into one lock.
+  //
+  // Previously every queued attempt woke up on release and raced for the lock, so whichever
+  // isolate had the most attempts queued tended to win.
+
+public:
+  class Ticket {
+  public:
+    Ticket(OtherIsolateLockQueue& queue, const Worker::Isolate& isolate)
+        : queue(queue), isolate(isolate),
+          tag(kj::max(isolate.getLockVirtualTime(), queue.virtualClock)),
+          seq(queue.nextSeq++) {
+      auto paf = kj::newPromiseAndFulfiller<void>();
+      promise = kj::mv(paf.promise);
+      fulfiller = kj::mv(paf.fulfiller);
+      queue.tickets.add(this);
+    }
+
+    ~Ticket() noexcept(false) {
+      if (!granted) {
+        queue.remove(*this);
+      } else if (!resumed && threadCurrentWaiter == nullptr) {
+        // We were given the turn but got canceled before using it. Pass it on.
+        queue.grantNext();
+      }
+    }
+    KJ_DISALLOW_COPY_AND_MOVE(Ticket);
+
+    kj::Promise<void> wait() {
+      return kj::mv(promise).then([this]() { resumed = true; });
+    }
+
+  private:
+    OtherIsolateLockQueue& queue;
+    const Worker::Isolate& isolate;
+
+    uint64_t tag;
+    uint64_t seq;
+    // Ties (e.g. all isolates idle so far) are broken in arrival order.
+
+    kj::Promise<void> promise = nullptr;
+    kj::Own<kj::PromiseFulfiller<void>> fulfiller;
+    bool granted = false;
+    bool resumed = false;
+
+    friend class OtherIsolateLockQueue;
+  };
+
+  void grantNext() {
+    // Called when the thread no longer holds or waits for any async lock.
+    if (tickets.empty()) return;
+
+    Ticket* winner = tickets[0];
+    for (auto t: tickets) {
+      if (t->tag < winner->tag || (t->tag == winner->tag && t->seq < winner->seq)) winner = t;
+    }
+    virtualClock = winner->tag;
+
+    const Worker::Isolate* isolate = &winner->isolate;
+    for (size_t i = 0; i < tickets.size();) {
+      Ticket& t = *tickets[i];
+      if (&t.isolate == isolate) {
+        t.granted = true;
+        t.fulfiller->fulfill();
+        tickets[i] = tickets.back();
+        tickets.removeLast();
+      } else {
+        ++i;
+      }
+    }
+  }
+
+  static OtherIsolateLockQueue& current() {
+    static thread_local OtherIsolateLockQueue queue;
+    return queue;
+  }
+
+private:
+  kj::Vector<Ticket*> tickets;
+  uint64_t virtualClock = 0;
+  uint64_t nextSeq = 0;
+
+  void remove(Ticket& ticket) {
+    for (auto& t: tickets) {
+      if (t == &ticket) {
+        t = tickets.back();
+        tickets.removeLast();
+        return;
+      }
+    }
+  }
+};
+
 Worker::Isolate::AsyncWaiterList::~AsyncWaiterList() noexcept {
   // It should be impossible for this list to be non-empty since each member of the list holds a
   // strong reference back to us. But if the list is non-empty, we'd better crash here, to avoid
@@ -1814,6 +1938,7 @@ kj::Promise<Worker::AsyncLock> Worker::Isolate::takeAsyncLockImpl(
       }
       auto newWaiter = kj::refcounted<AsyncWaiter>(kj::atomicAddRef(*this));
       co_await newWaiter->readyPromise.addBranch();
+      newWaiter->grantedCpuTime = getCurrentThreadCpuTime();
       co_return AsyncLock(kj::mv(newWaiter), kj::mv(lockTiming));
     } else if (waiter->isolate == this) {
       // Thread is waiting on a lock already, and it's for the same isolate. We can coalesce the
@@ -1827,14 +1952,15 @@ kj::Promise<Worker::AsyncLock> Worker::Isolate::takeAsyncLockImpl(
       co_await newWaiterRef->readyPromise.addBranch();
       co_return AsyncLock(kj::mv(newWaiterRef), kj::mv(lockTiming));
     } else {
-      // Thread is already waiting for or holding a different isolate lock. Wait for that one to
-      // be released before we try to lock a different isolate.
-      // TODO(perf): Use of ForkedPromise leads to thundering herd here. Should be minor in practice,
-      //   but we could consider creating another linked list instead...
+      // Thread is already waiting for or holding a different isolate lock. Wait for our turn,
+      // which comes after that one is released, according to the weighted fair ordering
+      // implemented by OtherIsolateLockQueue.
       KJ_IF_MAYBE(lt, lockTiming) {
         lt->get()->waitingForOtherIsolate(waiter->isolate->getId());
       }
-      co_await waiter->releasePromise.addBranch();
+      AsyncWaiter::OtherIsolateLockQueue::Ticket ticket(
+          AsyncWaiter::OtherIsolateLockQueue::current(), *this);
+      co_await ticket.wait();
     }
   }
 }
@@ -1908,6 +2034,19 @@ Worker::AsyncWaiter::~AsyncWaiter() noexcept {
 
   KJ_ASSERT(threadCurrentWaiter == this);
   threadCurrentWaiter = nullptr;
+
+  KJ_IF_MAYBE(t, grantedCpuTime) {
+    // We charge the thread's CPU time rather than wall time: an isolate that holds its lock
+    // across a slow I/O wait isn't using the thread, so it shouldn't lose its turn for it. This
+    // includes any non-JavaScript work the thread did meanwhile, which is usually the isolate's
+    // own I/O handling. Waiters are always released on the thread that was granted the lock.
+    auto used = getCurrentThreadCpuTime() - *t;
+    __atomic_add_fetch(&isolate->impl->asyncLockCpuNanos, used / kj::NANOSECONDS,
+                       __ATOMIC_RELAXED);
+  }
+
+  // The thread is free to lock another isolate now.
+  OtherIsolateLockQueue::current().grantNext();
 }
 
 kj::Promise<void> Worker::AsyncLock::whenThreadIdle() {
@@ -2585,6 +2724,7 @@ struct Worker::Actor::Impl final: public kj::TaskSet::ErrorHandler {
     void inputGateReleased() override { metrics.inputGateReleased(); }
     void inputGateWaiterAdded() override { metrics.inputGateWaiterAdded(); }
     void inputGateWaiterRemoved() override { metrics.inputGateWaiterRemoved(); }
+    void inputGateWaited(kj::Duration waitTime) override { metrics.inputGateWaited(waitTime); }
     // Implements InputGate::Hooks.
 
     kj::Promise<void> makeTimeoutPromise() override {
@@ -2600,6 +2740,10 @@ struct Worker::Actor::Impl final: public kj::TaskSet::ErrorHandler {
     void outputGateReleased() override { metrics.outputGateReleased(); }
     void outputGateWaiterAdded() override { metrics.outputGateWaiterAdded(); }
     void outputGateWaiterRemoved() override { metrics.outputGateWaiterRemoved(); }
+    void outputGateWaited(kj::Duration waitTime) override { metrics.outputGateWaited(waitTime); }
+    kj::Promise<void> makeDelayPromise(kj::Duration delay) override {
+      return timerChannel.afterLimitTimeout(delay);
+    }
     // Implements OutputGate::Hooks.
 
     void updateAlarmInMemory(kj::Maybe<kj::Date> newAlarmTime) override;
@@ -3112,6 +3256,23 @@ uint Worker::Isolate::getLockSuccessCount() const {
   return __atomic_load_n(&impl->lockSuccessCount, __ATOMIC_RELAXED);
 }
 
+ActorCache::SharedLru::Stats Worker::Isolate::getActorCacheStats() const {
+  return impl->actorCacheLru.getStats();
+}
+
+void Worker::Isolate::setSchedulingWeight(uint weight) {
+  KJ_REQUIRE(weight > 0, "scheduling weight must be positive");
+  impl->schedulingWeight = weight;
+}
+
+kj::Duration Worker::Isolate::getAsyncLockCpuTime() const {
+  return __atomic_load_n(&impl->asyncLockCpuNanos, __ATOMIC_RELAXED) * kj::NANOSECONDS;
+}
+
+uint64_t Worker::Isolate::getLockVirtualTime() const {
+  return __atomic_load_n(&impl->asyncLockCpuNanos, __ATOMIC_RELAXED) / impl->schedulingWeight;
+}
+
 kj::Own<const Worker::Script> Worker::Isolate::newScript(
     kj::StringPtr scriptId, Script::Source source,
     IsolateObserver::StartType startType, bool logNewScript,
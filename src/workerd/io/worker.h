@@ -281,6 +281,22 @@ public:
   uint getLockSuccessCount() const;
   // Returns a count that is incremented upon every successful lock.
 
+  ActorCache::SharedLru::Stats getActorCacheStats() const;
+  // Statistics of the cache memory shared by all of this isolate's actors.
+
+  void setSchedulingWeight(uint weight);
+  // Sets this isolate's share of a thread when its async lock attempts compete with other
+  // isolates' on that thread. An isolate with weight 2 gets about twice the CPU time under its
+  // lock of an isolate with weight 1 when both have work queued. Defaults to 1. Must be called
+  // before the isolate is used.
+
+  kj::Duration getAsyncLockCpuTime() const;
+  // Total thread CPU time used while this isolate's async lock was held, across all threads.
+
+  uint64_t getLockVirtualTime() const;
+  // getAsyncLockCpuTime() in nanoseconds, divided by the scheduling weight. Used to order
+  // competing lock attempts; see takeAsyncLockImpl().
+
   kj::Promise<void> attachInspector(
       kj::Timer& timer,
       kj::Duration timerOffset,
@@ -819,6 +835,11 @@ private:
   // Promise/fulfiller to fire when the waiter reaches the front of the list for the corresponding
   // isolate.
 
+  kj::Maybe<kj::Duration> grantedCpuTime;
+  // The thread's CPU time when the waiter reached the front of the list, so the CPU time used
+  // while holding the lock can be charged to the isolate on release. Null if the waiter never got
+  // the lock.
+
   kj::ForkedPromise<void> releasePromise = nullptr;
   kj::Own<kj::PromiseFulfiller<void>> releaseFulfiller;
   // Promise/fulfiller to fire when the AsyncLock is finally released. This is used when a thread
@@ -834,6 +855,8 @@ private:
 
   static thread_local AsyncWaiter* threadCurrentWaiter;
 
+  class OtherIsolateLockQueue;
+
   friend class Worker::Isolate;
   friend class Worker::AsyncLock;
 };
@@ -18,6 +18,7 @@
 #include "wrappable.h"
 
 #include <workerd/jsg/exception.h>
+#include <workerd/util/alloc-profiler.h>
 
 
 namespace workerd::jsg {
@@ -1106,6 +1107,7 @@ private:
 
 template <typename T, typename... Params>
 Ref<T> alloc(Params&&... params) {
+  AllocationCategoryScope allocationScope(AllocationCategory::JSG_WRAPPER);
   return Ref<T>(kj::refcounted<T>(kj::fwd<Params>(params)...));
 }
 
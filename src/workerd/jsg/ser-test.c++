@@ -0,0 +1,82 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#include "jsg-test.h"
+#include "ser.h"
+
+namespace workerd::jsg::test {
+namespace {
+
+V8System v8System;
+
+struct SerContext: public Object {
+  v8::Local<v8::Value> cloneExternal(v8::Local<v8::Value> value,
+      jsg::Optional<kj::Array<jsg::Value>> transfer, v8::Isolate* isolate) {
+    // Buffers of at least 16 bytes go out-of-band, smaller ones are written inline.
+    kj::Maybe<kj::ArrayPtr<jsg::Value>> transfers;
+    KJ_IF_MAYBE(t, transfer) {
+      transfers = t->asPtr();
+    }
+    return structuredClone(value, isolate, transfers, size_t(16));
+  }
+
+  JSG_RESOURCE_TYPE(SerContext) {
+    JSG_METHOD(cloneExternal);
+  }
+};
+JSG_DECLARE_ISOLATE_TYPE(SerIsolate, SerContext);
+
+KJ_TEST("structuredClone with external buffers copies contents") {
+  Evaluator<SerContext, SerIsolate> e(v8System);
+
+  e.expectEval(
+      "const src = new Uint8Array(64); src[5] = 7;\n"
+      "const out = cloneExternal(src); src[5] = 9;\n"
+      "out instanceof Uint8Array && out.buffer !== src.buffer && out[5]",
+      "number", "7");
+
+  e.expectEval(
+      "const out = cloneExternal(new Float64Array([1.5, 2.5]));\n"
+      "out instanceof Float64Array && out.join(',')",
+      "string", "1.5,2.5");
+
+  e.expectEval(
+      "const out = cloneExternal(new Uint16Array([1, 2, 3]));\n"
+      "out instanceof Uint16Array && out.join(',')",
+      "string", "1,2,3");
+}
+
+KJ_TEST("structuredClone with external buffers preserves buffer identity") {
+  Evaluator<SerContext, SerIsolate> e(v8System);
+
+  for (auto size: { 8, 64 }) {
+    e.expectEval(kj::str(
+        "const buf = new ArrayBuffer(", size, ");\n"
+        "const out = cloneExternal({ a: new Uint8Array(buf, 2, 4), b: new DataView(buf), c: buf });\n"
+        "[out.a.buffer === out.b.buffer, out.c === out.a.buffer,\n"
+        " out.a.byteOffset, out.a.length, out.b.byteLength].join(',')"),
+        "string", kj::str("true,true,2,4,", size));
+
+    // The same, but with the buffer referenced directly before any view over it.
+    e.expectEval(kj::str(
+        "const buf = new ArrayBuffer(", size, ");\n"
+        "const out = cloneExternal({ c: buf, a: new Uint8Array(buf, 2, 4), b: new DataView(buf) });\n"
+        "[out.a.buffer === out.b.buffer, out.c === out.a.buffer,\n"
+        " out.a.byteOffset, out.a.length, out.b.byteLength].join(',')"),
+        "string", kj::str("true,true,2,4,", size));
+  }
+}
+
+KJ_TEST("structuredClone with external buffers transfers without copying") {
+  Evaluator<SerContext, SerIsolate> e(v8System);
+
+  e.expectEval(
+      "const src = new Uint8Array(new ArrayBuffer(64), 8, 16); src[0] = 3;\n"
+      "const out = cloneExternal(src, [src.buffer]);\n"
+      "[src.byteLength, out.byteOffset, out.length, out[0]].join(',')",
+      "string", "0,8,16,3");
+}
+
+}  // namespace
+}  // namespace workerd::jsg::test
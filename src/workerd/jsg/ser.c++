@@ -6,6 +6,58 @@
 
 namespace workerd::jsg {
 
+namespace {
+
+// When Serializer::Options::externalBufferThreshold is set, V8 hands every ArrayBufferView to
+// the delegate as a host object. We write each one as:
+//
+//     uint32 ViewType, uint64 byteOffset, uint64 byteLength, uint32 ViewedBuffer
+//
+// followed, for ViewedBuffer::EXTERNAL only, by a uint32 index into Released::externalBuffers,
+// and then by the viewed ArrayBuffer itself, written through V8 as a nested value. Going through
+// V8 for the buffer means its object identity map is shared with the rest of the value graph, so
+// a buffer reached both directly and through one or more views clones to a single buffer no
+// matter which reference comes first.
+
+#define JSG_SER_VIEW_TYPES(V) \
+  V(Uint8Array, 1) \
+  V(Uint8ClampedArray, 1) \
+  V(Int8Array, 1) \
+  V(Uint16Array, 2) \
+  V(Int16Array, 2) \
+  V(Uint32Array, 4) \
+  V(Int32Array, 4) \
+  V(Float32Array, 4) \
+  V(Float64Array, 8) \
+  V(BigInt64Array, 8) \
+  V(BigUint64Array, 8) \
+  V(DataView, 1)
+
+enum class ViewType: uint32_t {
+#define V(name, size) name,
+  JSG_SER_VIEW_TYPES(V)
+#undef V
+};
+
+enum class ViewedBuffer: uint32_t {
+  IN_BAND,   // The buffer is written by V8: inline, as a transfer, or as a back-reference.
+  EXTERNAL,  // The buffer was snapshotted into Released::externalBuffers.
+};
+
+constexpr uint32_t EXTERNAL_BUFFER_TRANSFER_ID_BASE = 1u << 31;
+// External buffers are registered with V8 as transferred, so that it writes only a transfer ID
+// for them. These IDs are offset so they can't collide with those of genuinely transferred
+// buffers.
+
+ViewType getViewType(v8::Local<v8::ArrayBufferView> view) {
+#define V(name, size) if (view->Is##name()) return ViewType::name;
+  JSG_SER_VIEW_TYPES(V)
+#undef V
+  KJ_UNREACHABLE;
+}
+
+}  // namespace
+
 Serializer::Serializer(v8::Isolate* isolate, kj::Maybe<Options> maybeOptions)
     : isolate(isolate),
       ser(isolate, this) {
@@ -17,6 +69,10 @@ Serializer::Serializer(v8::Isolate* isolate, kj::Maybe<Options> maybeOptions)
   if (!options.omitHeader) {
     ser.WriteHeader();
   }
+  externalBufferThreshold = options.externalBufferThreshold;
+  if (externalBufferThreshold != nullptr) {
+    ser.SetTreatArrayBufferViewsAsHostObjects(true);
+  }
 }
 
 v8::Maybe<uint32_t> Serializer::GetSharedArrayBufferId(
@@ -39,16 +95,71 @@ void Serializer::ThrowDataCloneError(v8::Local<v8::String> message) {
   isolate->ThrowException(makeDOMException(isolate, message, "DataCloneError"));
 }
 
+v8::Maybe<bool> Serializer::WriteHostObject(
+    v8::Isolate* isolate,
+    v8::Local<v8::Object> object) {
+  if (!object->IsArrayBufferView()) {
+    // The default implementation throws the usual DataCloneError.
+    return v8::ValueSerializer::Delegate::WriteHostObject(isolate, object);
+  }
+
+  auto view = object.As<v8::ArrayBufferView>();
+  auto buffer = view->Buffer();
+  ser.WriteUint32(static_cast<uint32_t>(getViewType(view)));
+  ser.WriteUint64(view->ByteOffset());
+  ser.WriteUint64(view->ByteLength());
+
+  if (buffer->ByteLength() >= KJ_ASSERT_NONNULL(externalBufferThreshold) &&
+      !contains(arrayBuffers, buffer) && !contains(externalArrayBuffers, buffer)) {
+    // We must still take a snapshot, since the application is free to modify the buffer after
+    // we return, but this is the only copy: the deserializer adopts the backing store as-is.
+    //
+    // If V8 has already written this buffer because it was referenced directly earlier in the
+    // value graph, it writes a back-reference below and the snapshot goes unused. That case is
+    // rare enough that it isn't worth tracking V8's identity map ourselves.
+    auto size = buffer->ByteLength();
+    std::shared_ptr<v8::BackingStore> backing =
+        v8::ArrayBuffer::NewBackingStore(isolate, size);
+    memcpy(backing->Data(), buffer->Data(), size);
+    uint32_t index = externalBackingStores.size();
+    ser.WriteUint32(static_cast<uint32_t>(ViewedBuffer::EXTERNAL));
+    ser.WriteUint32(index);
+    ser.TransferArrayBuffer(EXTERNAL_BUFFER_TRANSFER_ID_BASE + index, buffer);
+    externalArrayBuffers.add(jsg::V8Ref(isolate, buffer));
+    externalBackingStores.add(kj::mv(backing));
+  } else {
+    ser.WriteUint32(static_cast<uint32_t>(ViewedBuffer::IN_BAND));
+  }
+  return ser.WriteValue(isolate->GetCurrentContext(), buffer);
+}
+
+bool Serializer::contains(
+    kj::ArrayPtr<V8Ref<v8::ArrayBuffer>> arrayBuffers,
+    v8::Local<v8::ArrayBuffer> arrayBuffer) {
+  for (auto& ref: arrayBuffers) {
+    if (ref.getHandle(isolate) == arrayBuffer) return true;
+  }
+  return false;
+}
+
 Serializer::Released Serializer::release() {
   KJ_ASSERT(!released, "The data has already been released.");
   released = true;
+  if (externalBufferThreshold != nullptr) {
+    // See transfer().
+    for (auto& arrayBuffer: arrayBuffers) {
+      check(arrayBuffer.getHandle(isolate)->Detach(v8::Local<v8::Value>()));
+    }
+  }
   sharedArrayBuffers.clear();
   arrayBuffers.clear();
+  externalArrayBuffers.clear();
   auto pair = ser.Release();
   return Released {
     .data = kj::Array(pair.first, pair.second, jsg::SERIALIZED_BUFFER_DISPOSER),
     .sharedArrayBuffers = sharedBackingStores.releaseAsArray(),
     .transferedArrayBuffers = backingStores.releaseAsArray(),
+    .externalBuffers = externalBackingStores.releaseAsArray(),
   };
 }
 
@@ -64,7 +175,11 @@ void Serializer::transfer(v8::Local<v8::ArrayBuffer> arrayBuffer) {
 
   arrayBuffers.add(jsg::V8Ref(isolate, arrayBuffer));
   backingStores.add(arrayBuffer->GetBackingStore());
-  check(arrayBuffer->Detach(v8::Local<v8::Value>()));
+  if (externalBufferThreshold == nullptr) {
+    check(arrayBuffer->Detach(v8::Local<v8::Value>()));
+  }
+  // Otherwise, views are written by WriteHostObject(), which needs their byte offset and length,
+  // and these read as zero once the buffer is detached. We detach in release() instead.
   ser.TransferArrayBuffer(n, arrayBuffer);
 }
 
@@ -90,6 +205,17 @@ void Deserializer::init(
           v8::ArrayBuffer::New(isolate, kj::mv((*arrayBuffers)[n])));
     }
   }
+  externalBackingStores = options.externalBuffers;
+}
+
+kj::Maybe<Deserializer::Options> Deserializer::withExternalBuffers(
+    Serializer::Released& released, kj::Maybe<Options> maybeOptions) {
+  if (released.externalBuffers.size() == 0) {
+    return kj::mv(maybeOptions);
+  }
+  auto options = maybeOptions.orDefault({});
+  options.externalBuffers = released.externalBuffers.asPtr();
+  return options;
 }
 
 v8::Local<v8::Value> Deserializer::readValue() {
@@ -106,6 +232,66 @@ v8::MaybeLocal<v8::SharedArrayBuffer> Deserializer::GetSharedArrayBufferFromId(
   return v8::MaybeLocal<v8::SharedArrayBuffer>();
 }
 
+v8::MaybeLocal<v8::Object> Deserializer::ReadHostObject(v8::Isolate* isolate) {
+  auto fail = [&]() {
+    isolate->ThrowException(makeDOMException(isolate,
+        v8StrIntern(isolate, "Unable to deserialize cloned data."), "DataCloneError"));
+    return v8::MaybeLocal<v8::Object>();
+  };
+
+  uint32_t viewType;
+  uint64_t byteOffset;
+  uint64_t byteLength;
+  uint32_t kind;
+  if (!deser.ReadUint32(&viewType) ||
+      !deser.ReadUint64(&byteOffset) ||
+      !deser.ReadUint64(&byteLength) ||
+      !deser.ReadUint32(&kind)) {
+    return fail();
+  }
+
+  switch (static_cast<ViewedBuffer>(kind)) {
+    case ViewedBuffer::IN_BAND:
+      break;
+    case ViewedBuffer::EXTERNAL: {
+      uint32_t index;
+      if (!deser.ReadUint32(&index)) return fail();
+      KJ_IF_MAYBE(backingStores, externalBackingStores) {
+        if (index >= backingStores->size()) return fail();
+        deser.TransferArrayBuffer(EXTERNAL_BUFFER_TRANSFER_ID_BASE + index,
+            v8::ArrayBuffer::New(isolate, (*backingStores)[index]));
+      } else {
+        return fail();
+      }
+      break;
+    }
+    default:
+      return fail();
+  }
+
+  v8::Local<v8::Value> value;
+  if (!deser.ReadValue(isolate->GetCurrentContext()).ToLocal(&value)) {
+    // V8 has already thrown.
+    return v8::MaybeLocal<v8::Object>();
+  }
+  if (!value->IsArrayBuffer()) return fail();
+  auto buffer = value.As<v8::ArrayBuffer>();
+
+  if (byteOffset > buffer->ByteLength() || byteLength > buffer->ByteLength() - byteOffset) {
+    return fail();
+  }
+
+  switch (static_cast<ViewType>(viewType)) {
+#define V(name, size) \
+    case ViewType::name: \
+      if (byteLength % size != 0) return fail(); \
+      return v8::name::New(buffer, byteOffset, byteLength / size);
+    JSG_SER_VIEW_TYPES(V)
+#undef V
+  }
+  return fail();
+}
+
 void SerializedBufferDisposer::disposeImpl(
     void* firstElement,
     size_t elementSize,
@@ -118,8 +304,11 @@ void SerializedBufferDisposer::disposeImpl(
 v8::Local<v8::Value> structuredClone(
     v8::Local<v8::Value> value,
     v8::Isolate* isolate,
-    kj::Maybe<kj::ArrayPtr<jsg::Value>> maybeTransfer) {
-  Serializer ser(isolate, nullptr);
+    kj::Maybe<kj::ArrayPtr<jsg::Value>> maybeTransfer,
+    kj::Maybe<size_t> externalBufferThreshold) {
+  Serializer ser(isolate, Serializer::Options {
+    .externalBufferThreshold = externalBufferThreshold,
+  });
   KJ_IF_MAYBE(transfers, maybeTransfer) {
     for (auto& item : *transfers) {
       auto val = item.getHandle(isolate);
@@ -17,12 +17,23 @@ public:
     // When set, overrides the default wire format version with the one provided.
     bool omitHeader = false;
     // When set to true, the serialization header is not written to the output buffer.
+    kj::Maybe<size_t> externalBufferThreshold;
+    // When set, the contents of ArrayBuffers viewed by an ArrayBufferView whose byte length is at
+    // least this many bytes are not copied into `data`. Instead, each one is snapshotted once into
+    // a standalone backing store that is returned in `Released::externalBuffers`, and `data`
+    // holds only its index. Views over transferred ArrayBuffers are never copied at all.
+    //
+    // The resulting data is NOT in V8's wire format: it can only be read by a Deserializer that is
+    // given the same Released, so this must not be used for anything that gets persisted or sent
+    // to another process.
   };
 
   struct Released {
     kj::Array<kj::byte> data;
     kj::Array<std::shared_ptr<v8::BackingStore>> sharedArrayBuffers;
     kj::Array<std::shared_ptr<v8::BackingStore>> transferedArrayBuffers;
+    kj::Array<std::shared_ptr<v8::BackingStore>> externalBuffers;
+    // Out-of-band buffer contents, only populated when Options::externalBufferThreshold is set.
   };
 
   explicit Serializer(v8::Isolate* isolate, kj::Maybe<Options> maybeOptions = nullptr);
@@ -48,10 +59,20 @@ private:
       v8::Isolate* isolate,
       v8::Local<v8::SharedArrayBuffer> sab) override;
 
+  v8::Maybe<bool> WriteHostObject(v8::Isolate* isolate, v8::Local<v8::Object> object) override;
+  // Only called when externalBufferThreshold is set, in which case V8 treats every
+  // ArrayBufferView as a host object.
+
+  bool contains(kj::ArrayPtr<V8Ref<v8::ArrayBuffer>> arrayBuffers,
+                v8::Local<v8::ArrayBuffer> arrayBuffer);
+
   kj::Vector<V8Ref<v8::SharedArrayBuffer>> sharedArrayBuffers;
   kj::Vector<V8Ref<v8::ArrayBuffer>> arrayBuffers;
+  kj::Vector<V8Ref<v8::ArrayBuffer>> externalArrayBuffers;
   kj::Vector<std::shared_ptr<v8::BackingStore>> sharedBackingStores;
   kj::Vector<std::shared_ptr<v8::BackingStore>> backingStores;
+  kj::Vector<std::shared_ptr<v8::BackingStore>> externalBackingStores;
+  kj::Maybe<size_t> externalBufferThreshold;
   v8::Isolate* isolate;
   v8::ValueSerializer ser;
   bool released = false;
@@ -62,6 +83,9 @@ public:
   struct Options {
     kj::Maybe<uint32_t> version;
     bool readHeader = true;
+    kj::Maybe<kj::ArrayPtr<std::shared_ptr<v8::BackingStore>>> externalBuffers;
+    // Serializer::Released::externalBuffers, if the data was written with
+    // Serializer::Options::externalBufferThreshold set.
   };
 
   inline explicit Deserializer(
@@ -85,7 +109,7 @@ public:
           released.data.asPtr(),
           released.transferedArrayBuffers.asPtr(),
           released.sharedArrayBuffers.asPtr(),
-          kj::mv(maybeOptions)) {}
+          withExternalBuffers(released, kj::mv(maybeOptions))) {}
 
   ~Deserializer() noexcept(true) {}  // noexcept(true) because Delegate's is noexcept
 
@@ -98,13 +122,19 @@ private:
       kj::Maybe<kj::ArrayPtr<std::shared_ptr<v8::BackingStore>>> transferedArrayBuffers = nullptr,
       kj::Maybe<Options> maybeOptions = nullptr);
 
+  static kj::Maybe<Options> withExternalBuffers(
+      Serializer::Released& released, kj::Maybe<Options> maybeOptions);
+
   v8::MaybeLocal<v8::SharedArrayBuffer> GetSharedArrayBufferFromId(
       v8::Isolate* isolate,
       uint32_t clone_id) override;
 
+  v8::MaybeLocal<v8::Object> ReadHostObject(v8::Isolate* isolate) override;
+
   v8::Isolate* isolate;
   v8::ValueDeserializer deser;
   kj::Maybe<kj::ArrayPtr<std::shared_ptr<v8::BackingStore>>> sharedBackingStores;
+  kj::Maybe<kj::ArrayPtr<std::shared_ptr<v8::BackingStore>>> externalBackingStores;
 };
 
 class SerializedBufferDisposer: public kj::ArrayDisposer {
@@ -118,6 +148,9 @@ constexpr SerializedBufferDisposer SERIALIZED_BUFFER_DISPOSER;
 v8::Local<v8::Value> structuredClone(
     v8::Local<v8::Value> value,
     v8::Isolate* isolate,
-    kj::Maybe<kj::ArrayPtr<jsg::Value>> maybeTransfer = nullptr);
+    kj::Maybe<kj::ArrayPtr<jsg::Value>> maybeTransfer = nullptr,
+    kj::Maybe<size_t> externalBufferThreshold = nullptr);
+// If `externalBufferThreshold` is given, the clone is performed with
+// Serializer::Options::externalBufferThreshold set, so large buffers are copied exactly once.
 
 }  // namespace workerd::jsg
@@ -156,6 +156,10 @@ void IsolateBase::terminateExecution() const {
   ptr->TerminateExecution();
 }
 
+void IsolateBase::cancelTerminateExecution() const {
+  ptr->CancelTerminateExecution();
+}
+
 void IsolateBase::clearDestructionQueue() {
   // Safe to destroy the popped batch outside of the lock because the lock is only actually used to
   // guard the push buffer.
@@ -253,7 +257,8 @@ namespace {
   }
 }
 
-IsolateBase::IsolateBase(const V8System& system, v8::Isolate::CreateParams&& createParams)
+IsolateBase::IsolateBase(const V8System& system, v8::Isolate::CreateParams&& createParams,
+                         CppHeapOptions cppHeapOptions)
     : system(system),
       ptr(newIsolate(kj::mv(createParams))),
       heapTracer(ptr) {
@@ -267,18 +272,27 @@ IsolateBase::IsolateBase(const V8System& system, v8::Isolate::CreateParams&& cre
         Wrappable::WRAPPABLE_TAG)
   };
 
-  params.marking_support = cppgc::Heap::MarkingType::kAtomic;
+  switch (cppHeapOptions.marking) {
+    case CppHeapOptions::Marking::ATOMIC:
+      params.marking_support = cppgc::Heap::MarkingType::kAtomic;
+      break;
+    case CppHeapOptions::Marking::INCREMENTAL:
+      params.marking_support = cppgc::Heap::MarkingType::kIncremental;
+      break;
+    case CppHeapOptions::Marking::INCREMENTAL_AND_CONCURRENT:
+      params.marking_support = cppgc::Heap::MarkingType::kIncrementalAndConcurrent;
+      break;
+  }
   params.sweeping_support = cppgc::Heap::SweepingType::kAtomic;
-  // We currently don't attempt to support incremental marking or sweeping. We probably could
-  // support them, but it will take some careful investigation and testing. It's not clear if
-  // this would be a win anyway, since Worker heaps are relatively small and therefore doing a
-  // full atomic mark-sweep usually doesn't require much of a pause.
+  // By default we don't use incremental marking or sweeping. Worker heaps are usually small, so
+  // a full atomic mark-sweep rarely requires much of a pause. Embedders running workers with
+  // large heaps can opt into incremental marking via `cppHeapOptions`; sweeping stays atomic
+  // since our wrapper destructors are not prepared to run interleaved with JavaScript.
   //
-  // We probably won't ever support concurrent marking or sweeping because concurrent GC is only
-  // expected to be a win if there are idle CPU cores available. Workers normally run on servers
-  // that are handling many requests at once, thus it's expected CPU cores will be fully
-  // utilized. This differs from browser environments, where a user is typically doing only one
-  // thing at a time and thus likely has CPU cores to spare.
+  // Concurrent marking is only expected to be a win if there are idle CPU cores available.
+  // Workers normally run on servers that are handling many requests at once, thus it's expected
+  // CPU cores will be fully utilized. This differs from browser environments, where a user is
+  // typically doing only one thing at a time and thus likely has CPU cores to spare.
 
   // const_cast here because V8's `Platform` interface doesn't use constness for thread-safety and
   // V8 wants a non-const pointer here, but the object is in fact thread-safe.
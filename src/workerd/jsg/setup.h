@@ -60,6 +60,26 @@ private:
   explicit V8System(kj::Own<v8::Platform>, kj::ArrayPtr<const kj::StringPtr>);
 };
 
+struct CppHeapOptions {
+  // Tuning for the cppgc heap, i.e. the heap that holds the C++ objects wrapped for JavaScript.
+
+  enum class Marking {
+    ATOMIC,
+    // Mark the whole heap in one stop-the-world pause. This is the default; see the comment in
+    // IsolateBase's constructor for why.
+
+    INCREMENTAL,
+    // Interleave marking with JavaScript execution, in step with V8's own incremental marking of
+    // the JavaScript heap. Trades a little throughput for shorter pauses on large heaps.
+
+    INCREMENTAL_AND_CONCURRENT
+    // Like INCREMENTAL, but also allow marking work to run on V8's background threads. Only a win
+    // when there are idle cores to spare.
+  };
+
+  Marking marking = Marking::ATOMIC;
+};
+
 class IsolateBase {
   // Base class of Isolate<T> containing parts that don't need to be templated, to avoid code
   // bloat.
@@ -79,6 +99,10 @@ public:
   // Immediately cancels JavaScript execution in this isolate, causing an uncatchable exception to
   // be thrown. Safe to call across threads, without holding the lock.
 
+  void cancelTerminateExecution() const;
+  // Undoes terminateExecution(), including one that hasn't been delivered yet because no
+  // JavaScript is running. Safe to call across threads, without holding the lock.
+
   using Logger = Lock::Logger;
   inline void setLoggerCallback(kj::Badge<Lock>, kj::Function<Logger>&& logger) {
     maybeLogger = kj::mv(logger);
@@ -180,7 +204,8 @@ private:
   kj::TreeMap<uintptr_t, CodeBlockInfo> codeMap;
   // Maps instructions to source code locations.
 
-  explicit IsolateBase(const V8System& system, v8::Isolate::CreateParams&& createParams);
+  explicit IsolateBase(const V8System& system, v8::Isolate::CreateParams&& createParams,
+                       CppHeapOptions cppHeapOptions);
   ~IsolateBase() noexcept(false);
   KJ_DISALLOW_COPY_AND_MOVE(IsolateBase);
 
@@ -277,8 +302,9 @@ public:
   template <typename MetaConfiguration>
   explicit Isolate(const V8System& system,
       MetaConfiguration&& configuration,
-      v8::Isolate::CreateParams createParams = {})
-      : IsolateBase(system, kj::mv(createParams)),
+      v8::Isolate::CreateParams createParams = {},
+      CppHeapOptions cppHeapOptions = {})
+      : IsolateBase(system, kj::mv(createParams), cppHeapOptions),
         wrapper(wrapperSpace.construct(ptr, kj::fwd<MetaConfiguration>(configuration))) {}
   // Construct an isolate that requires configuration. `configuration` is a value that all
   // individual wrappers' configurations must be able to be constructed from. For example, if all
@@ -288,8 +314,9 @@ public:
   // configuration types must declare constructors from `MetaConfiguration`.
 
   explicit Isolate(const V8System& system,
-      v8::Isolate::CreateParams createParams = {})
-      : Isolate(system, nullptr, kj::mv(createParams)) {}
+      v8::Isolate::CreateParams createParams = {},
+      CppHeapOptions cppHeapOptions = {})
+      : Isolate(system, nullptr, kj::mv(createParams), cppHeapOptions) {}
   // Use this constructor when no wrappers have any required configuration.
 
   ~Isolate() noexcept(false) { dropWrappers(kj::mv(wrapper)); }
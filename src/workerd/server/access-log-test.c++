@@ -0,0 +1,117 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#include "access-log.h"
+#include <kj/test.h>
+#include <string.h>
+
+namespace workerd::server {
+namespace {
+
+class FixedEntropySource final: public kj::EntropySource {
+public:
+  void generate(kj::ArrayPtr<kj::byte> buffer) override {
+    memset(buffer.begin(), 0x5a, buffer.size());
+  }
+};
+
+AccessLog::Entry makeEntry(kj::StringPtr url) {
+  return AccessLog::Entry {
+    .time = kj::UNIX_EPOCH + 1700000000123 * kj::MILLISECONDS,
+    .service = "hello",
+    .method = kj::HttpMethod::GET,
+    .url = url,
+    .status = 200,
+    .requestBytes = 3,
+    .responseBytes = 5,
+    .timeToFirstByte = 1500 * kj::MICROSECONDS,
+    .duration = 2 * kj::MILLISECONDS,
+    .clientIp = "127.0.0.1:1234"_kj,
+  };
+}
+
+KJ_TEST("AccessLog formats one JSON line per request") {
+  auto entry = makeEntry("/path?q=\"x\"");
+  KJ_EXPECT(AccessLog::format(entry) ==
+      "{\"time\":1700000000123,\"service\":\"hello\",\"method\":\"GET\","
+      "\"url\":\"/path?q=\\\"x\\\"\",\"status\":200,\"requestBytes\":3,\"responseBytes\":5,"
+      "\"ttfbUs\":1500,\"durationUs\":2000,\"clientIp\":\"127.0.0.1:1234\"}\n",
+      AccessLog::format(entry));
+
+  entry.status = 0;
+  entry.timeToFirstByte = nullptr;
+  entry.clientIp = nullptr;
+  KJ_EXPECT(AccessLog::format(entry) ==
+      "{\"time\":1700000000123,\"service\":\"hello\",\"method\":\"GET\","
+      "\"url\":\"/path?q=\\\"x\\\"\",\"status\":0,\"requestBytes\":3,\"responseBytes\":5,"
+      "\"ttfbUs\":null,\"durationUs\":2000}\n", AccessLog::format(entry));
+}
+
+KJ_TEST("AccessLog writes buffered lines when flushed and when destroyed") {
+  FixedEntropySource entropy;
+  auto file = kj::newInMemoryFile(kj::nullClock());
+
+  {
+    // A long interval keeps the writer thread out of the way until we flush.
+    AccessLog log(AccessLog::Options { .flushInterval = 1000 * kj::SECONDS },
+                  kj::newFileAppender(file->clone()), entropy);
+
+    log.log(makeEntry("/one"));
+    log.log(makeEntry("/two"));
+    log.flush();
+    auto text = file->readAllText();
+    KJ_EXPECT(strstr(text.cStr(), "\"url\":\"/one\"") != nullptr, text);
+    KJ_EXPECT(strstr(text.cStr(), "\"url\":\"/two\"") != nullptr, text);
+
+    log.log(makeEntry("/three"));
+  }
+
+  auto text = file->readAllText();
+  KJ_EXPECT(strstr(text.cStr(), "\"url\":\"/three\"") != nullptr, text);
+  size_t lines = 0;
+  for (char c: text) {
+    if (c == '\n') ++lines;
+  }
+  KJ_EXPECT(lines == 3, text);
+}
+
+KJ_TEST("AccessLog drops lines instead of growing without bound") {
+  FixedEntropySource entropy;
+  auto file = kj::newInMemoryFile(kj::nullClock());
+
+  {
+    AccessLog log(AccessLog::Options { .bufferSize = 2, .flushInterval = 1000 * kj::SECONDS },
+                  kj::newFileAppender(file->clone()), entropy);
+    for (uint i = 0; i < 5; i++) {
+      log.log(makeEntry(kj::str("/", i)));
+    }
+  }
+
+  auto text = file->readAllText();
+  KJ_EXPECT(text ==
+      kj::str(AccessLog::format(makeEntry("/0")), AccessLog::format(makeEntry("/1"))), text);
+}
+
+KJ_TEST("AccessLog sampling") {
+  FixedEntropySource entropy;
+  auto file = kj::newInMemoryFile(kj::nullClock());
+
+  AccessLog never(AccessLog::Options { .sampleRate = 0 },
+                  kj::newFileAppender(file->clone()), entropy);
+  AccessLog always(AccessLog::Options { .sampleRate = 1 },
+                   kj::newFileAppender(file->clone()), entropy);
+  AccessLog half(AccessLog::Options { .sampleRate = 0.5 },
+                 kj::newFileAppender(file->clone()), entropy);
+
+  uint sampled = 0;
+  for (uint i = 0; i < 1000; i++) {
+    KJ_EXPECT(!never.shouldSample());
+    KJ_EXPECT(always.shouldSample());
+    if (half.shouldSample()) ++sampled;
+  }
+  KJ_EXPECT(sampled > 400 && sampled < 600, sampled);
+}
+
+}  // namespace
+}  // namespace workerd::server
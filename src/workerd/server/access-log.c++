@@ -0,0 +1,112 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#include "access-log.h"
+#include <kj/debug.h>
+
+namespace workerd::server {
+
+AccessLog::AccessLog(Options optionsParam, kj::Own<const kj::AppendableFile> output,
+                     kj::EntropySource& entropySource)
+    : options(kj::mv(optionsParam)), output(kj::mv(output)), buffer(options.bufferSize),
+      sampleThreshold(sampleRateToThreshold(options.sampleRate)),
+      thread([this]() { run(); }) {
+  randomState = 0;
+  while (randomState == 0) {  // xorshift never leaves zero
+    entropySource.generate(kj::arrayPtr(&randomState, 1).asBytes());
+  }
+}
+
+AccessLog::~AccessLog() noexcept(false) {
+  state.lockExclusive()->shuttingDown = true;
+  // `thread`'s destructor joins, after the thread's final flush.
+}
+
+bool AccessLog::shouldSample() {
+  if (samplesNothing(sampleThreshold)) return false;
+  if (samplesEverything(sampleThreshold)) return true;
+
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 7;
+  randomState ^= randomState << 17;
+  return isSampled(sampleThreshold, randomState);
+}
+
+void AccessLog::log(const Entry& entry) {
+  auto line = format(entry);
+  if (!buffer.tryPush(line)) {
+    __atomic_add_fetch(&droppedEntries, 1, __ATOMIC_RELAXED);
+  }
+}
+
+void AccessLog::flush() {
+  auto lock = state.lockExclusive();
+  flush(*lock);
+}
+
+void AccessLog::flush(State& lockedState) {
+  // Write in chunks of at most one buffer's worth, so a flush racing with a burst of requests
+  // still finishes.
+  for (;;) {
+    kj::Vector<char> chunk;
+    for (uint i = 0; i < buffer.capacity(); i++) {
+      KJ_IF_MAYBE(line, buffer.tryPop()) {
+        chunk.addAll(*line);
+      } else {
+        break;
+      }
+    }
+    if (chunk.empty()) break;
+
+    try {
+      output->write(chunk.begin(), chunk.size());
+    } catch (kj::Exception& e) {
+      KJ_LOG(ERROR, "failed to write access log", e);
+    }
+  }
+
+  auto dropped = __atomic_load_n(&droppedEntries, __ATOMIC_RELAXED);
+  if (dropped != lockedState.reportedDrops) {
+    KJ_LOG(WARNING, "access log buffer was full; lines were dropped",
+           dropped - lockedState.reportedDrops);
+    lockedState.reportedDrops = dropped;
+  }
+}
+
+void AccessLog::run() {
+  auto lock = state.lockExclusive();
+  for (;;) {
+    lock.wait([](const State& s) { return s.shuttingDown; }, options.flushInterval);
+    flush(*lock);
+    if (lock->shuttingDown) break;
+  }
+}
+
+kj::String AccessLog::format(const Entry& entry) {
+  kj::Vector<char> out(256);
+  out.addAll(kj::str("{\"time\":", (entry.time - kj::UNIX_EPOCH) / kj::MILLISECONDS,
+                     ",\"service\":"));
+  appendJsonString(out, entry.service);
+  out.addAll(kj::str(",\"method\":\"", entry.method, "\",\"url\":"));
+  appendJsonString(out, entry.url);
+  out.addAll(kj::str(",\"status\":", entry.status,
+                     ",\"requestBytes\":", entry.requestBytes,
+                     ",\"responseBytes\":", entry.responseBytes,
+                     ",\"ttfbUs\":"));
+  KJ_IF_MAYBE(ttfb, entry.timeToFirstByte) {
+    out.addAll(kj::str(*ttfb / kj::MICROSECONDS));
+  } else {
+    out.addAll("null"_kj);
+  }
+  out.addAll(kj::str(",\"durationUs\":", entry.duration / kj::MICROSECONDS));
+  KJ_IF_MAYBE(ip, entry.clientIp) {
+    out.addAll(",\"clientIp\":"_kj);
+    appendJsonString(out, *ip);
+  }
+  out.addAll("}\n"_kj);
+  out.add('\0');
+  return kj::String(out.releaseAsArray());
+}
+
+}  // namespace workerd::server
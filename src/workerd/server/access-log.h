@@ -0,0 +1,108 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#pragma once
+// Native access log for HTTP sockets.
+//
+// Each sampled request is formatted as one line of JSON on the thread that served it and pushed
+// into a bounded lock-free ring buffer; if the buffer is full, the line is dropped rather than
+// waiting. A background thread drains the buffer and appends what it finds to the log file, so
+// the request path never touches the disk.
+
+#include <workerd/util/telemetry-util.h>
+#include <kj/compat/http.h>
+#include <kj/filesystem.h>
+#include <kj/mutex.h>
+#include <kj/thread.h>
+#include <kj/time.h>
+
+namespace workerd::server {
+
+class AccessLog {
+public:
+  struct Options {
+    double sampleRate = 1.0;
+    // Fraction of requests to log, from 0 to 1.
+
+    uint bufferSize = 8192;
+    // Maximum number of lines waiting to be written.
+
+    kj::Duration flushInterval = 1 * kj::SECONDS;
+  };
+
+  struct Entry {
+    kj::Date time;
+    // When the request arrived.
+
+    kj::StringPtr service;
+    kj::HttpMethod method;
+    kj::StringPtr url;
+
+    uint status;
+    // Zero if no response was sent.
+
+    uint64_t requestBytes;
+    uint64_t responseBytes;
+    // Body bytes only, not counting headers.
+
+    kj::Maybe<kj::Duration> timeToFirstByte;
+    // From arrival until the response headers were ready. Null if no response was sent.
+
+    kj::Duration duration;
+
+    kj::Maybe<kj::StringPtr> clientIp;
+  };
+
+  AccessLog(Options options, kj::Own<const kj::AppendableFile> output,
+            kj::EntropySource& entropySource);
+  ~AccessLog() noexcept(false);
+  // Writes out anything still buffered.
+  KJ_DISALLOW_COPY_AND_MOVE(AccessLog);
+
+  bool shouldSample();
+  // Makes the sampling decision for a new request. Cheap enough to call for every request, and
+  // should be called before doing any work to collect an `Entry`. Must only be called from one
+  // thread.
+
+  void log(const Entry& entry);
+  // Queues a line for `entry`. Never blocks.
+
+  void flush();
+  // Writes out everything buffered right now. Called periodically by the writer thread; may also
+  // be called from any other thread.
+
+  static kj::String format(const Entry& entry);
+  // Encodes `entry` as one line of JSON, including the trailing newline.
+
+private:
+  Options options;
+  kj::Own<const kj::AppendableFile> output;
+  StringRingBuffer buffer;
+
+  uint64_t sampleThreshold;
+  // Requests whose random 64-bit draw is below this are logged.
+
+  uint64_t randomState;
+  // xorshift64 state, seeded from the entropy source. Sampling decisions don't need
+  // cryptographic randomness, and this avoids a system call per request.
+
+  uint64_t droppedEntries = 0;
+
+  struct State {
+    bool shuttingDown = false;
+    uint64_t reportedDrops = 0;
+    // Value of `droppedEntries` when drops were last logged.
+  };
+
+  kj::MutexGuarded<State> state;
+  // Held while flushing, so that concurrent flushes don't interleave their writes.
+
+  kj::Thread thread;
+  // Must be declared last, so that it is joined before anything it uses is destroyed.
+
+  void run();
+  void flush(State& lockedState);
+};
+
+}  // namespace workerd::server
@@ -0,0 +1,39 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#include "cpu-sampler.h"
+#include <kj/test.h>
+
+namespace workerd::server {
+namespace {
+
+KJ_TEST("FoldedStacks aggregates identical stacks") {
+  FoldedStacks stacks;
+
+  auto frame = [](kj::StringPtr name, int line) {
+    return FoldedStacks::formatFrame(name, "worker.js", line);
+  };
+
+  auto handler = kj::arr(frame("fetch", 1), frame("render", 10));
+  auto other = kj::arr(frame("fetch", 1), frame("", 20));
+  auto gc = kj::arr(FoldedStacks::formatFrame("(garbage collector)", "", 0));
+
+  stacks.add(handler, 3);
+  stacks.add(other, 1);
+  stacks.add(handler, 2);
+  stacks.add(gc, 4);
+
+  KJ_EXPECT(stacks.getSampleCount() == 10);
+  KJ_EXPECT(stacks.toString() ==
+      "(garbage collector) 4\n"
+      "fetch worker.js:1;(anonymous) worker.js:20 1\n"
+      "fetch worker.js:1;render worker.js:10 5\n", stacks.toString());
+}
+
+KJ_TEST("FoldedStacks frames can't break the folded format") {
+  KJ_EXPECT(FoldedStacks::formatFrame("a;b", "file;\nname.js", 3) == "a,b file, name.js:3");
+}
+
+}  // namespace
+}  // namespace workerd::server
@@ -0,0 +1,192 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#include "cpu-sampler.h"
+#include "observers.h"
+#include <workerd/jsg/util.h>
+#include <v8-profiler.h>
+#include <kj/debug.h>
+#include <algorithm>
+
+namespace workerd::server {
+
+namespace {
+
+class CpuProfilerDisposer final: public kj::Disposer {
+public:
+  void disposeImpl(void* pointer) const override {
+    reinterpret_cast<v8::CpuProfiler*>(pointer)->Dispose();
+  }
+
+  static const CpuProfilerDisposer instance;
+};
+
+const CpuProfilerDisposer CpuProfilerDisposer::instance {};
+
+constexpr kj::StringPtr PROFILE_TITLE = "workerd continuous profile"_kj;
+
+void foldNode(const v8::CpuProfileNode& node, kj::Vector<kj::String>& path,
+              FoldedStacks& stacks) {
+  path.add(FoldedStacks::formatFrame(
+      node.GetFunctionNameStr(), node.GetScriptResourceNameStr(), node.GetLineNumber()));
+  if (node.GetHitCount() > 0) {
+    stacks.add(path.asPtr(), node.GetHitCount());
+  }
+  for (int i = 0; i < node.GetChildrenCount(); i++) {
+    foldNode(*node.GetChild(i), path, stacks);
+  }
+  path.removeLast();
+}
+
+}  // namespace
+
+void FoldedStacks::add(kj::ArrayPtr<const kj::String> stack, uint64_t count) {
+  counts.upsert(kj::strArray(stack, ";"), count, [](uint64_t& existing, uint64_t&& more) {
+    existing += more;
+  });
+  sampleCount += count;
+}
+
+void FoldedStacks::add(const v8::CpuProfile& profile) {
+  // The root node is V8's synthetic "(root)", which would only add noise to every stack.
+  auto& root = *profile.GetTopDownRoot();
+  kj::Vector<kj::String> path;
+  for (int i = 0; i < root.GetChildrenCount(); i++) {
+    foldNode(*root.GetChild(i), path, *this);
+  }
+}
+
+kj::String FoldedStacks::toString() const {
+  kj::Vector<const kj::HashMap<kj::String, uint64_t>::Entry*> entries(counts.size());
+  for (auto& entry: counts) {
+    entries.add(&entry);
+  }
+  std::sort(entries.begin(), entries.end(), [](auto a, auto b) {
+    return a->key.asPtr() < b->key.asPtr();
+  });
+
+  auto lines = KJ_MAP(entry, entries) { return kj::str(entry->key, ' ', entry->value, '\n'); };
+  return kj::strArray(lines, "");
+}
+
+kj::String FoldedStacks::formatFrame(
+    kj::StringPtr functionName, kj::StringPtr url, int lineNumber) {
+  kj::String result;
+  if (functionName.size() == 0) functionName = "(anonymous)"_kj;
+  if (url.size() == 0) {
+    result = kj::str(functionName);
+  } else {
+    result = kj::str(functionName, ' ', url, ':', lineNumber);
+  }
+
+  for (char& c: result) {
+    if (c == ';') {
+      c = ',';
+    } else if (c == '\n' || c == '\r') {
+      c = ' ';
+    }
+  }
+  return result;
+}
+
+// =======================================================================================
+
+CpuSampler::CpuSampler(Options options, kj::Own<const Worker> worker, kj::Timer& timer,
+                       kj::Own<const kj::File> output)
+    : options(kj::mv(options)), worker(kj::mv(worker)), timer(timer), output(kj::mv(output)),
+      tasks(*this) {}
+
+CpuSampler::~CpuSampler() noexcept(false) {
+  if (profiler != nullptr) {
+    Worker::Lock lock(*worker, Worker::Lock::TakeSynchronously(nullptr));
+    profiler = nullptr;
+  }
+}
+
+void CpuSampler::start() {
+  if (running) return;
+  running = true;
+
+  auto startGeneration = ++generation;
+  tasks.add(worker->takeAsyncLockWithoutRequest(nullptr)
+      .then([this, startGeneration](Worker::AsyncLock asyncLock) {
+    // If stop() was called while we waited for the lock, there is nothing to start.
+    if (startGeneration != generation || profiler != nullptr) return;
+
+    Worker::Lock lock(*worker, asyncLock);
+    auto isolate = lock.getIsolate();
+    v8::HandleScope handleScope(isolate);
+
+    auto newProfiler = kj::Own<v8::CpuProfiler>(
+        v8::CpuProfiler::New(isolate, v8::kDebugNaming, v8::kLazyLogging),
+        CpuProfilerDisposer::instance);
+    newProfiler->SetSamplingInterval(int(options.samplingInterval / kj::MICROSECONDS));
+    newProfiler->StartProfiling(jsg::v8Str(isolate, PROFILE_TITLE), v8::kLeafNodeLineNumbers);
+    profiler = kj::mv(newProfiler);
+  }).then([this, startGeneration]() {
+    return run(startGeneration);
+  }));
+}
+
+void CpuSampler::stop() {
+  if (!running) return;
+  running = false;
+  ++generation;
+  tasks.add(collect(false));
+}
+
+kj::Promise<void> CpuSampler::run(uint64_t runGeneration) {
+  return timer.afterDelay(options.writeInterval)
+      .then([this, runGeneration]() -> kj::Promise<void> {
+    if (runGeneration != generation) return kj::READY_NOW;
+    return collect(true).then([this, runGeneration]() {
+      return run(runGeneration);
+    });
+  });
+}
+
+kj::Promise<void> CpuSampler::collect(bool restart) {
+  return worker->takeAsyncLockWithoutRequest(nullptr)
+      .then([this, restart](Worker::AsyncLock asyncLock) {
+    KJ_IF_MAYBE(p, profiler) {
+      Worker::Lock lock(*worker, asyncLock);
+      auto isolate = lock.getIsolate();
+      v8::HandleScope handleScope(isolate);
+
+      auto title = jsg::v8Str(isolate, PROFILE_TITLE);
+      v8::CpuProfile* profile = (*p)->StopProfiling(title);
+      if (restart) {
+        // Start the next profile right away so that nothing is missed while we fold this one.
+        (*p)->StartProfiling(title, v8::kLeafNodeLineNumbers);
+      }
+      if (profile != nullptr) {
+        KJ_DEFER(profile->Delete());
+        stacks.add(*profile);
+      }
+      if (!restart) {
+        profiler = nullptr;
+      }
+    }
+
+    output->writeAll(stacks.toString());
+    ++writes;
+  });
+}
+
+void CpuSampler::write(PrometheusTextWriter& writer, kj::StringPtr service) const {
+  PrometheusTextWriter::Labels labels = {{"service", service}};
+  writer.addGauge("workerd_cpu_profiling_active", "Whether CPU profiling is running.",
+                  labels, running ? 1 : 0);
+  writer.addCounter("workerd_cpu_profile_samples_total",
+                    "CPU profile samples collected since the server started.",
+                    labels, stacks.getSampleCount());
+  writer.addCounter("workerd_cpu_profile_writes_total", "Times the CPU profile file was written.",
+                    labels, writes);
+}
+
+void CpuSampler::taskFailed(kj::Exception&& exception) {
+  KJ_LOG(ERROR, "CPU profiling failed", options.serviceName, exception);
+}
+
+}  // namespace workerd::server
@@ -0,0 +1,103 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#pragma once
+
+#include <workerd/io/worker.h>
+#include <kj/async.h>
+#include <kj/filesystem.h>
+#include <kj/map.h>
+#include <kj/timer.h>
+
+namespace v8 {
+  class CpuProfile;
+  class CpuProfiler;
+}
+
+namespace workerd::server {
+
+class PrometheusTextWriter;
+
+class FoldedStacks {
+  // Aggregates sampled call stacks in the "folded" format used by flamegraph tools: one line per
+  // distinct stack, frames from outermost to innermost separated by `;`, followed by a space and
+  // the number of samples in which that stack was seen.
+
+public:
+  void add(kj::ArrayPtr<const kj::String> stack, uint64_t count);
+  // Records `count` samples of `stack`, each element of which should come from formatFrame().
+
+  void add(const v8::CpuProfile& profile);
+  // Records every sample in `profile`.
+
+  uint64_t getSampleCount() const { return sampleCount; }
+
+  kj::String toString() const;
+  // Renders all stacks recorded so far, sorted so that the output is stable.
+
+  static kj::String formatFrame(kj::StringPtr functionName, kj::StringPtr url, int lineNumber);
+  // Formats a frame as "name url:line", or just "name" for frames without a script (such as
+  // "(garbage collector)"). Characters that would confuse the folded format are replaced.
+
+private:
+  kj::HashMap<kj::String, uint64_t> counts;
+  uint64_t sampleCount = 0;
+};
+
+class CpuSampler final: private kj::TaskSet::ErrorHandler {
+  // Continuously profiles one Worker using V8's sampling CPU profiler and periodically writes the
+  // aggregated samples to a file as folded stacks.
+  //
+  // V8 samples on its own thread, so the cost while running is only the sampling itself. Every
+  // `writeInterval`, the sampler briefly takes the isolate lock to swap in a fresh profile, folds
+  // the finished one into the running totals, and rewrites the output file.
+
+public:
+  struct Options {
+    kj::String serviceName;
+    kj::Duration samplingInterval = 1 * kj::MILLISECONDS;
+    kj::Duration writeInterval = 10 * kj::SECONDS;
+  };
+
+  CpuSampler(Options options, kj::Own<const Worker> worker, kj::Timer& timer,
+             kj::Own<const kj::File> output);
+  ~CpuSampler() noexcept(false);
+  KJ_DISALLOW_COPY_AND_MOVE(CpuSampler);
+
+  void start();
+  // Starts sampling, if not already started. Samples collected by a previous run are kept.
+
+  void stop();
+  // Stops sampling, if started, and writes out what was collected.
+
+  bool isRunning() const { return running; }
+
+  void write(PrometheusTextWriter& writer, kj::StringPtr service) const;
+
+private:
+  Options options;
+  kj::Own<const Worker> worker;
+  kj::Timer& timer;
+  kj::Own<const kj::File> output;
+
+  kj::Maybe<kj::Own<v8::CpuProfiler>> profiler;
+  // Only touched while holding the isolate lock.
+
+  FoldedStacks stacks;
+  bool running = false;
+  uint64_t generation = 0;
+  // Incremented on every start() and stop(), so that callbacks belonging to an earlier run know
+  // to do nothing.
+
+  uint64_t writes = 0;
+
+  kj::TaskSet tasks;
+
+  kj::Promise<void> run(uint64_t generation);
+  kj::Promise<void> collect(bool restart);
+
+  void taskFailed(kj::Exception&& exception) override;
+};
+
+}  // namespace workerd::server
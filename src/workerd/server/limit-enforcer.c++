@@ -0,0 +1,488 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#include "limit-enforcer.h"
+#include <workerd/io/actor-cache.h>
+#include <workerd/jsg/jsg.h>
+#include <v8-cppgc.h>
+#include <cppgc/heap-statistics.h>
+#include <kj/debug.h>
+#include <pthread.h>
+
+namespace workerd::server {
+
+namespace {
+
+constexpr size_t MIB = 1ull << 20;
+
+jsg::CppHeapOptions::Marking toMarking(config::Worker::Limits::CppgcMarking marking) {
+  switch (marking) {
+    case config::Worker::Limits::CppgcMarking::ATOMIC:
+      return jsg::CppHeapOptions::Marking::ATOMIC;
+    case config::Worker::Limits::CppgcMarking::INCREMENTAL:
+      return jsg::CppHeapOptions::Marking::INCREMENTAL;
+    case config::Worker::Limits::CppgcMarking::INCREMENTAL_AND_CONCURRENT:
+      return jsg::CppHeapOptions::Marking::INCREMENTAL_AND_CONCURRENT;
+  }
+  // Unknown value from a newer config schema; fall back to the safe default.
+  return jsg::CppHeapOptions::Marking::ATOMIC;
+}
+
+kj::Duration readCpuClock(clockid_t clock) {
+  struct timespec ts;
+  KJ_SYSCALL(clock_gettime(clock, &ts));
+  return ts.tv_sec * kj::SECONDS + ts.tv_nsec * kj::NANOSECONDS;
+}
+
+kj::Maybe<kj::Duration> millisOrNull(uint32_t ms) {
+  // Config uses zero to mean "unlimited".
+  if (ms == 0) return nullptr;
+  return ms * kj::MILLISECONDS;
+}
+
+}  // namespace
+
+WorkerdIsolateLimitEnforcer::WorkerdIsolateLimitEnforcer(config::Worker::Limits::Reader limits)
+    : heapLimit(limits.getHeapLimitMb() * MIB),
+      youngGenerationSize(limits.getYoungGenerationSizeMb() * MIB),
+      initialYoungGenerationSize(limits.getInitialYoungGenerationSizeMb() * MIB),
+      cppHeapOptions { .marking = toMarking(limits.getCppgcMarking()) },
+      storageListPrefetch(limits.getStorageListPrefetch()) {}
+
+v8::Isolate::CreateParams WorkerdIsolateLimitEnforcer::getCreateParams() {
+  v8::Isolate::CreateParams params;
+  if (heapLimit > 0) {
+    params.constraints.set_max_old_generation_size_in_bytes(heapLimit);
+  }
+  if (youngGenerationSize > 0) {
+    params.constraints.set_max_young_generation_size_in_bytes(youngGenerationSize);
+  }
+  if (initialYoungGenerationSize > 0) {
+    params.constraints.set_initial_young_generation_size_in_bytes(
+        youngGenerationSize > 0 ? kj::min(initialYoungGenerationSize, youngGenerationSize)
+                                : initialYoungGenerationSize);
+  }
+  return params;
+}
+
+jsg::CppHeapOptions WorkerdIsolateLimitEnforcer::getCppHeapOptions() {
+  return cppHeapOptions;
+}
+
+void WorkerdIsolateLimitEnforcer::customizeIsolate(v8::Isolate* isolate) {
+  this->isolate = isolate;
+
+  if (heapLimit > 0) {
+    isolate->AddNearHeapLimitCallback(&nearHeapLimit, this);
+
+    // Once garbage collection brings usage back down well below the configured limit, drop any
+    // headroom granted by nearHeapLimit() so the next episode is caught at the original limit.
+    isolate->AutomaticallyRestoreInitialHeapLimit(0.5);
+  }
+}
+
+void WorkerdIsolateLimitEnforcer::reportMetrics(IsolateObserver& isolateMetrics) const {
+  // Usually called as an isolate lock is released, but also once without the lock when the
+  // isolate is torn down. V8 can only be asked for statistics under the lock.
+  if (isolate == nullptr || !v8::Locker::IsLocked(isolate)) return;
+
+  auto now = kj::systemPreciseMonotonicClock().now();
+  if (now < nextHeapSample) return;
+  nextHeapSample = now + HEAP_SAMPLE_INTERVAL;
+
+  v8::HeapStatistics stats;
+  isolate->GetHeapStatistics(&stats);
+  IsolateObserver::HeapUsage usage {
+    .usedHeapSize = stats.used_heap_size(),
+    .totalHeapSize = stats.total_heap_size(),
+    .heapSizeLimit = stats.heap_size_limit(),
+    .externalMemory = stats.external_memory(),
+  };
+  auto cppHeap = isolate->GetCppHeap();
+  if (cppHeap != nullptr) {
+    usage.cppgcUsedSize = cppHeap->CollectStatistics(
+        cppgc::HeapStatistics::DetailLevel::kBrief).used_size_bytes;
+  }
+  isolateMetrics.reportHeapUsage(usage);
+}
+
+ActorCacheSharedLruOptions WorkerdIsolateLimitEnforcer::getActorCacheLruOptions() {
+  // TODO(someday): Make this configurable?
+  return {
+    .softLimit = 16 * (1ull << 20), // 16 MiB
+    .hardLimit = 128 * (1ull << 20), // 128 MiB
+    .staleTimeout = 30 * kj::SECONDS,
+    .dirtyListByteLimit = 8 * (1ull << 20), // 8 MiB
+    .maxKeysPerRpc = 128,
+
+    // For now, we use `neverFlush` to implement in-memory-only actors.
+    // See WorkerService::getActor().
+    .neverFlush = true,
+
+    // Should flushes ever go to storage, keep each RPC small enough to not hold up other traffic
+    // on the connection, and keep a few in flight so that a large flush isn't one round trip per
+    // batch.
+    .maxBytesPerRpc = MAX_BYTES_PER_FLUSH_RPC,
+    .maxFlushRpcsInFlight = MAX_FLUSH_RPCS_IN_FLIGHT,
+
+    .prefetchLimit = storageListPrefetch,
+  };
+}
+
+kj::Own<void> WorkerdIsolateLimitEnforcer::enterHeapLimitedJs(
+    kj::Maybe<kj::Exception>& error) const {
+  if (heapLimit == 0) return {};
+
+  return kj::heap(kj::defer([this, &error]() {
+    if (heapLimitExceeded) {
+      error = JSG_KJ_EXCEPTION(OVERLOADED, Error, "Worker exceeded its memory limit.");
+    }
+  }));
+}
+
+kj::Own<void> WorkerdIsolateLimitEnforcer::enterStartupJs(
+    jsg::Lock& lock, kj::Maybe<kj::Exception>& error) const {
+  return enterHeapLimitedJs(error);
+}
+
+kj::Own<void> WorkerdIsolateLimitEnforcer::enterDynamicImportJs(
+    jsg::Lock& lock, kj::Maybe<kj::Exception>& error) const {
+  return enterHeapLimitedJs(error);
+}
+
+kj::Own<void> WorkerdIsolateLimitEnforcer::enterLoggingJs(
+    jsg::Lock& lock, kj::Maybe<kj::Exception>& error) const {
+  return enterHeapLimitedJs(error);
+}
+
+kj::Own<void> WorkerdIsolateLimitEnforcer::enterInspectorJs(
+    jsg::Lock& lock, kj::Maybe<kj::Exception>& error) const {
+  return enterHeapLimitedJs(error);
+}
+
+bool WorkerdIsolateLimitEnforcer::exitJs(jsg::Lock& lock) const {
+  if (!heapLimitExceeded) return false;
+  heapLimitExceeded = false;
+
+  // The JavaScript that blew the limit has been unwound. Force a full collection to find out
+  // whether the garbage it left behind was the problem or whether the isolate is actually
+  // retaining too much.
+  lock.v8Isolate->LowMemoryNotification();
+
+  v8::HeapStatistics stats;
+  lock.v8Isolate->GetHeapStatistics(&stats);
+  if (stats.used_heap_size() < heapLimit) {
+    return false;
+  }
+
+  KJ_LOG(ERROR, "isolate condemned: heap still exceeds limit after garbage collection",
+      stats.used_heap_size(), heapLimit);
+  return true;
+}
+
+size_t WorkerdIsolateLimitEnforcer::nearHeapLimit(
+    void* data, size_t currentHeapLimit, size_t initialHeapLimit) {
+  // Called by V8, with the isolate lock held, when the heap is about to exceed its limit. The
+  // return value becomes the new limit; returning `currentHeapLimit` would crash the process.
+  auto& self = *reinterpret_cast<WorkerdIsolateLimitEnforcer*>(data);
+
+  if (!self.heapLimitExceeded) {
+    self.heapLimitExceeded = true;
+    v8::Isolate::GetCurrent()->TerminateExecution();
+  }
+
+  return currentHeapLimit + kj::max(currentHeapLimit / 4, MIN_HEAP_HEADROOM);
+}
+
+// =======================================================================================
+
+CpuWatchdog::CpuWatchdog(): thread([this]() { run(); }) {}
+
+CpuWatchdog::~CpuWatchdog() noexcept(false) {
+  state.lockExclusive()->shuttingDown = true;
+  // `thread`'s destructor joins.
+}
+
+kj::Own<void> CpuWatchdog::arm(const jsg::IsolateBase& isolate, kj::Duration budget) {
+  return armImpl(budget,
+      [&isolate]() { isolate.terminateExecution(); },
+      kj::Function<void()>([&isolate]() { isolate.cancelTerminateExecution(); }));
+}
+
+kj::Own<void> CpuWatchdog::arm(kj::Duration budget, kj::Function<void()> onExpired) {
+  return armImpl(budget, kj::mv(onExpired), nullptr);
+}
+
+kj::Own<void> CpuWatchdog::armImpl(kj::Duration budget, kj::Function<void()> onExpired,
+                                   kj::Maybe<kj::Function<void()>> onDisarmedAfterExpiry) {
+  clockid_t clock;
+  KJ_REQUIRE(pthread_getcpuclockid(pthread_self(), &clock) == 0);
+  auto deadline = readCpuClock(clock) + budget;
+
+  // The thread can't use up `budget` of CPU time any sooner than `budget` of wall time from now.
+  // If the watchdog thread will wake up before then anyway, it'll pick up the new entry on that
+  // pass, so there's no need to disturb it.
+  auto earliestExpiry = kj::systemPreciseMonotonicClock().now() + budget;
+
+  kj::uint id;
+  {
+    auto lock = state.lockExclusive();
+    id = lock->nextId++;
+    lock->entries.insert(id, Entry {
+      .clock = clock, .deadline = deadline, .onExpired = kj::mv(onExpired),
+      .onDisarmedAfterExpiry = kj::mv(onDisarmedAfterExpiry) });
+
+    bool wakeSooner = true;
+    KJ_IF_MAYBE(wakeTime, lock->wakeTime) {
+      wakeSooner = earliestExpiry < *wakeTime;
+    }
+    if (wakeSooner) {
+      ++lock->generation;
+      lock->wakeTime = earliestExpiry;
+    }
+  }
+
+  return kj::heap(kj::defer([this, id]() {
+    // The watchdog thread fires entries with the lock held, so once we hold it the entry either
+    // has already fired or never will.
+    kj::Maybe<kj::Function<void()>> onDisarmed;
+    {
+      auto lock = state.lockExclusive();
+      KJ_IF_MAYBE(entry, lock->entries.find(id)) {
+        if (entry->fired) onDisarmed = kj::mv(entry->onDisarmedAfterExpiry);
+      }
+      lock->entries.erase(id);
+    }
+    KJ_IF_MAYBE(f, onDisarmed) {
+      (*f)();
+    }
+  }));
+}
+
+void CpuWatchdog::run() {
+  auto lock = state.lockExclusive();
+  while (!lock->shuttingDown) {
+    // A thread can't burn more CPU time than wall time, so sleeping for the smallest remaining
+    // budget never oversleeps a deadline.
+    kj::Maybe<kj::Duration> timeout;
+    for (auto& entry: lock->entries) {
+      auto& e = entry.value;
+      if (e.fired) continue;
+
+      auto now = readCpuClock(e.clock);
+      if (now >= e.deadline) {
+        e.onExpired();
+        e.fired = true;
+      } else {
+        auto remaining = e.deadline - now;
+        KJ_IF_MAYBE(t, timeout) {
+          *t = kj::min(*t, remaining);
+        } else {
+          timeout = remaining;
+        }
+      }
+    }
+
+    KJ_IF_MAYBE(t, timeout) {
+      lock->wakeTime = kj::systemPreciseMonotonicClock().now() + *t;
+    } else {
+      lock->wakeTime = nullptr;
+    }
+
+    auto generation = lock->generation;
+    lock.wait([generation](const State& s) {
+      return s.generation != generation || s.shuttingDown;
+    }, timeout);
+  }
+}
+
+// =======================================================================================
+
+WorkerdLimitEnforcer::Limits::Limits(config::Worker::Reader conf, kj::StringPtr serviceName)
+    : cpuTime(millisOrNull(conf.getLimits().getCpuMs())),
+      wallTime(millisOrNull(conf.getLimits().getWallTimeMs())),
+      subrequests(conf.getLimits().getSubrequests() == 0
+          ? kj::Maybe<kj::uint>(nullptr) : conf.getLimits().getSubrequests()),
+      slowTurnWarning(millisOrNull(conf.getSlowTurnWarningMs())),
+      serviceName(kj::str(serviceName)) {}
+
+namespace {
+
+void logSlowTurn(v8::Isolate* isolate, void* data) {
+  // V8 interrupt callback, requested by the watchdog thread. Runs on the JavaScript thread in the
+  // middle of the slow turn, so the current stack is the culprit.
+  auto& limits = *reinterpret_cast<const WorkerdLimitEnforcer::Limits*>(data);
+
+  v8::HandleScope handleScope(isolate);
+  auto stackTrace = v8::StackTrace::CurrentStackTrace(isolate, 16);
+  kj::Vector<kj::String> frames(stackTrace->GetFrameCount());
+  for (int i = 0; i < stackTrace->GetFrameCount(); i++) {
+    auto frame = stackTrace->GetFrame(isolate, i);
+    auto func = frame->GetFunctionName();
+    auto url = frame->GetScriptNameOrSourceURL();
+    frames.add(kj::str("    at ", func.IsEmpty() ? kj::str("<anonymous>") : kj::str(func),
+                       " (", url.IsEmpty() ? kj::str("<unknown>") : kj::str(url), ':',
+                       frame->GetLineNumber(), ':', frame->GetColumn(), ')'));
+  }
+
+  KJ_LOG(WARNING, "JavaScript has been running without yielding to the event loop for longer "
+      "than slowTurnWarningMs, delaying every other request", limits.serviceName,
+      KJ_ASSERT_NONNULL(limits.slowTurnWarning), kj::strArray(frames, "\n"));
+}
+
+}  // namespace
+
+class WorkerdLimitEnforcer::JsScope {
+public:
+  JsScope(WorkerdLimitEnforcer& enforcer, jsg::Lock& lock)
+      : enforcer(enforcer), cpuStart(readCpuClock(CLOCK_THREAD_CPUTIME_ID)) {
+    KJ_IF_MAYBE(limit, enforcer.limits.cpuTime) {
+      auto remaining = *limit > enforcer.cpuUsed ? *limit - enforcer.cpuUsed : 0 * kj::NANOSECONDS;
+      watchdogRegistration = KJ_ASSERT_NONNULL(enforcer.watchdog)
+          .arm(jsg::IsolateBase::from(lock.v8Isolate), remaining);
+    }
+    KJ_IF_MAYBE(threshold, enforcer.limits.slowTurnWarning) {
+      // The limits outlive every request, so they're safe to hand to an interrupt that may only
+      // run after this scope is gone.
+      auto data = const_cast<Limits*>(&enforcer.limits);
+      slowTurnRegistration = KJ_ASSERT_NONNULL(enforcer.watchdog)
+          .arm(*threshold, [isolate = lock.v8Isolate, data]() {
+        isolate->RequestInterrupt(&logSlowTurn, data);
+      });
+    }
+  }
+
+  ~JsScope() noexcept(false) {
+    watchdogRegistration = nullptr;
+    slowTurnRegistration = nullptr;
+    // Thread CPU time, like the watchdog measures, so that a turn counts as slow exactly when the
+    // watchdog would have logged it.
+    auto cpuTime = readCpuClock(CLOCK_THREAD_CPUTIME_ID) - cpuStart;
+    if (enforcer.limits.cpuTime != nullptr) {
+      enforcer.cpuUsed += cpuTime;
+    }
+
+    enforcer.counters.jsTurns.record(cpuTime);
+    KJ_IF_MAYBE(threshold, enforcer.limits.slowTurnWarning) {
+      if (cpuTime >= *threshold) ++enforcer.counters.slowTurns;
+    }
+
+    enforcer.checkLimits();
+  }
+
+  KJ_DISALLOW_COPY_AND_MOVE(JsScope);
+
+private:
+  WorkerdLimitEnforcer& enforcer;
+  kj::Duration cpuStart;
+  kj::Own<void> watchdogRegistration;
+  kj::Own<void> slowTurnRegistration;
+};
+
+WorkerdLimitEnforcer::WorkerdLimitEnforcer(
+    const Limits& limits, Counters& counters,
+    const WorkerdIsolateLimitEnforcer& isolateLimitEnforcer,
+    kj::Timer& timer, kj::Maybe<CpuWatchdog&> watchdog)
+    : limits(limits), counters(counters), isolateLimitEnforcer(isolateLimitEnforcer),
+      timer(timer), watchdog(watchdog) {
+  KJ_REQUIRE((limits.cpuTime == nullptr && limits.slowTurnWarning == nullptr) ||
+             watchdog != nullptr);
+}
+
+kj::Own<void> WorkerdLimitEnforcer::enterJs(jsg::Lock& lock, IoContext& context) {
+  return kj::heap<JsScope>(*this, lock);
+}
+
+void WorkerdLimitEnforcer::topUpActor() {
+  if (exceeded == nullptr) {
+    cpuUsed = 0 * kj::NANOSECONDS;
+    subrequestCount = 0;
+    subrequestLimitReported = false;
+  }
+}
+
+void WorkerdLimitEnforcer::newSubrequest(bool isInHouse) {
+  if (isInHouse) return;
+
+  KJ_IF_MAYBE(limit, limits.subrequests) {
+    if (subrequestCount >= *limit) {
+      if (!subrequestLimitReported) {
+        subrequestLimitReported = true;
+        ++counters.exceededSubrequests;
+      }
+      JSG_FAIL_REQUIRE(Error, "Too many subrequests.");
+    }
+  }
+  ++subrequestCount;
+}
+
+kj::Promise<void> WorkerdLimitEnforcer::applyWallTimeLimit() {
+  KJ_IF_MAYBE(limit, limits.wallTime) {
+    // If the work finishes first, this promise is canceled and the counter is left alone.
+    return timer.afterDelay(*limit).then([&counters = counters]() {
+      ++counters.exceededWallTime;
+    });
+  } else {
+    return kj::NEVER_DONE;
+  }
+}
+
+kj::Promise<void> WorkerdLimitEnforcer::limitDrain() {
+  return applyWallTimeLimit();
+}
+
+kj::Promise<void> WorkerdLimitEnforcer::limitScheduled() {
+  return applyWallTimeLimit();
+}
+
+kj::Promise<void> WorkerdLimitEnforcer::onLimitsExceeded() {
+  KJ_IF_MAYBE(e, exceeded) {
+    return makeException(*e);
+  }
+
+  auto paf = kj::newPromiseAndFulfiller<void>();
+  exceededFulfillers.add(kj::mv(paf.fulfiller));
+  return kj::mv(paf.promise);
+}
+
+void WorkerdLimitEnforcer::requireLimitsNotExceeded() {
+  KJ_IF_MAYBE(e, exceeded) {
+    kj::throwFatalException(makeException(*e));
+  }
+}
+
+void WorkerdLimitEnforcer::checkLimits() {
+  if (exceeded != nullptr) return;
+
+  if (isolateLimitEnforcer.isHeapLimitExceeded()) {
+    // The isolate's heap limit terminated this request's JavaScript.
+    exceeded = EventOutcome::EXCEEDED_MEMORY;
+    ++counters.exceededMemory;
+  } else KJ_IF_MAYBE(limit, limits.cpuTime) {
+    if (cpuUsed > *limit) {
+      exceeded = EventOutcome::EXCEEDED_CPU;
+      ++counters.exceededCpu;
+    }
+  }
+
+  KJ_IF_MAYBE(e, exceeded) {
+    for (auto& fulfiller: exceededFulfillers) {
+      fulfiller->reject(makeException(*e));
+    }
+    exceededFulfillers.clear();
+  }
+}
+
+kj::Exception WorkerdLimitEnforcer::makeException(EventOutcome outcome) {
+  switch (outcome) {
+    case EventOutcome::EXCEEDED_CPU:
+      return JSG_KJ_EXCEPTION(OVERLOADED, Error, "Worker exceeded CPU time limit.");
+    case EventOutcome::EXCEEDED_MEMORY:
+      return JSG_KJ_EXCEPTION(OVERLOADED, Error, "Worker exceeded memory limit.");
+    default:
+      KJ_UNREACHABLE;
+  }
+}
+
+}  // namespace workerd::server
@@ -0,0 +1,226 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#pragma once
+
+#include <workerd/io/limit-enforcer.h>
+#include <workerd/jsg/setup.h>
+#include <workerd/server/workerd.capnp.h>
+#include <workerd/util/histogram.h>
+#include <kj/function.h>
+#include <kj/map.h>
+#include <kj/mutex.h>
+#include <kj/thread.h>
+#include <kj/time.h>
+#include <kj/timer.h>
+#include <kj/vector.h>
+#include <time.h>
+
+namespace workerd::server {
+
+class WorkerdIsolateLimitEnforcer final: public IsolateLimitEnforcer {
+  // IsolateLimitEnforcer used by workerd. Applies the heap sizing and GC tuning from a Worker's
+  // `limits` config, and enforces the heap limit by terminating JavaScript execution when V8
+  // reports that the heap is nearly full. With no limits configured, it enforces nothing.
+
+public:
+  explicit WorkerdIsolateLimitEnforcer(config::Worker::Limits::Reader limits);
+
+  v8::Isolate::CreateParams getCreateParams() override;
+  jsg::CppHeapOptions getCppHeapOptions() override;
+  void customizeIsolate(v8::Isolate* isolate) override;
+  ActorCacheSharedLruOptions getActorCacheLruOptions() override;
+  kj::Own<void> enterStartupJs(
+      jsg::Lock& lock, kj::Maybe<kj::Exception>& error) const override;
+  kj::Own<void> enterDynamicImportJs(
+      jsg::Lock& lock, kj::Maybe<kj::Exception>& error) const override;
+  kj::Own<void> enterLoggingJs(
+      jsg::Lock& lock, kj::Maybe<kj::Exception>& error) const override;
+  kj::Own<void> enterInspectorJs(
+      jsg::Lock& lock, kj::Maybe<kj::Exception>& error) const override;
+  void completedRequest(kj::StringPtr id) const override {}
+  bool exitJs(jsg::Lock& lock) const override;
+  void reportMetrics(IsolateObserver& isolateMetrics) const override;
+  // Samples heap usage, at most once per HEAP_SAMPLE_INTERVAL.
+
+  bool isHeapLimitExceeded() const { return heapLimitExceeded; }
+  // True if JavaScript execution has been terminated because the heap limit was reached, and
+  // exitJs() has not yet run to check whether garbage collection recovered the heap.
+
+  static constexpr size_t MIN_HEAP_HEADROOM = 8ull << 20;  // 8 MiB
+  // When the heap limit is hit, V8 must still be able to allocate while the terminated
+  // JavaScript unwinds, so we raise the limit by a quarter of its value, but at least this much.
+
+  static constexpr kj::Duration HEAP_SAMPLE_INTERVAL = 1 * kj::SECONDS;
+  // Collecting heap statistics walks every heap space, so it's not done on every lock release.
+
+  static constexpr size_t MAX_BYTES_PER_FLUSH_RPC = 1ull << 20;  // 1 MiB
+  static constexpr uint MAX_FLUSH_RPCS_IN_FLIGHT = 4;
+  // Durable Object storage flush batching; see ActorCacheSharedLruOptions.
+
+private:
+  size_t heapLimit;
+  size_t youngGenerationSize;
+  size_t initialYoungGenerationSize;
+  // In bytes. Zero means "use V8's default".
+
+  jsg::CppHeapOptions cppHeapOptions;
+
+  uint storageListPrefetch;
+
+  mutable bool heapLimitExceeded = false;
+  // Set by the near-heap-limit callback, cleared by exitJs(). Both only run while the isolate
+  // lock is held, hence `mutable` without synchronization.
+
+  v8::Isolate* isolate = nullptr;
+  // Set by customizeIsolate().
+
+  mutable kj::TimePoint nextHeapSample = kj::origin<kj::TimePoint>();
+  // Only touched with the isolate lock held.
+
+  kj::Own<void> enterHeapLimitedJs(kj::Maybe<kj::Exception>& error) const;
+
+  static size_t nearHeapLimit(void* data, size_t currentHeapLimit, size_t initialHeapLimit);
+};
+
+class CpuWatchdog {
+  // Background thread that acts -- usually by terminating JavaScript execution -- once the thread
+  // running JavaScript has used up a CPU-time budget. A request stuck in a loop never yields back
+  // to the event loop, so the check cannot happen on the thread running the JavaScript itself.
+  //
+  // One watchdog serves every isolate in the process.
+
+public:
+  CpuWatchdog();
+  ~CpuWatchdog() noexcept(false);
+  KJ_DISALLOW_COPY_AND_MOVE(CpuWatchdog);
+
+  kj::Own<void> arm(const jsg::IsolateBase& isolate, kj::Duration budget);
+  // Terminate execution in `isolate` if the calling thread consumes more than `budget` of CPU
+  // time before the returned object is dropped. If the termination was delivered, dropping the
+  // returned object cancels it, since it may have landed after the JavaScript it was aimed at had
+  // already returned.
+
+  kj::Own<void> arm(kj::Duration budget, kj::Function<void()> onExpired);
+  // Like the above, but calls `onExpired` instead. It runs on the watchdog thread with the
+  // watchdog's lock held, so it must be quick and thread-safe, like requesting a V8 interrupt.
+
+private:
+  struct Entry {
+    clockid_t clock;
+    kj::Duration deadline;
+    // In terms of `clock`.
+
+    kj::Function<void()> onExpired;
+    bool fired = false;
+
+    kj::Maybe<kj::Function<void()>> onDisarmedAfterExpiry;
+    // Called on the disarming thread, if `onExpired` ran before the entry was disarmed.
+  };
+
+  struct State {
+    kj::HashMap<kj::uint, Entry> entries;
+    kj::uint nextId = 0;
+
+    kj::uint generation = 0;
+    // Bumped when an entry is armed with a deadline the watchdog thread might otherwise sleep
+    // past, to wake it. Disarming doesn't bump it; the thread just finds the entry gone on its
+    // next pass.
+
+    kj::Maybe<kj::TimePoint> wakeTime;
+    // Monotonic time the watchdog thread will next wake up by itself, or null if it's waiting
+    // indefinitely.
+
+    bool shuttingDown = false;
+  };
+
+  kj::MutexGuarded<State> state;
+  kj::Thread thread;
+
+  kj::Own<void> armImpl(kj::Duration budget, kj::Function<void()> onExpired,
+                        kj::Maybe<kj::Function<void()>> onDisarmedAfterExpiry);
+
+  void run();
+};
+
+class WorkerdLimitEnforcer final: public LimitEnforcer {
+  // LimitEnforcer used by workerd for each request. Enforces the per-request limits from a
+  // Worker's `limits` config, and reports requests terminated by the isolate's heap limit.
+
+public:
+  struct Limits {
+    // Per-request limits parsed from a Worker's config, shared by all of its requests.
+
+    kj::Maybe<kj::Duration> cpuTime;
+    kj::Maybe<kj::Duration> wallTime;
+    kj::Maybe<kj::uint> subrequests;
+
+    kj::Maybe<kj::Duration> slowTurnWarning;
+    // Not a limit: JavaScript using this much CPU time without yielding is only logged, with its
+    // stack.
+    kj::String serviceName;
+    // Identifies the Worker in those logs.
+
+    Limits(config::Worker::Reader conf, kj::StringPtr serviceName);
+  };
+
+  struct Counters {
+    // Per-Worker counts of requests cut short by a limit, and timings of the stretches of
+    // JavaScript ("turns") run on their behalf. Only touched on the Worker's thread.
+
+    uint64_t exceededCpu = 0;
+    uint64_t exceededMemory = 0;
+    uint64_t exceededWallTime = 0;
+    uint64_t exceededSubrequests = 0;
+
+    DurationHistogram jsTurns;
+    // Thread CPU time of each entry into JavaScript. Nothing else runs on the thread meanwhile.
+    uint64_t slowTurns = 0;
+    // Turns that used more CPU time than `Limits::slowTurnWarning`.
+  };
+
+  WorkerdLimitEnforcer(const Limits& limits, Counters& counters,
+                       const WorkerdIsolateLimitEnforcer& isolateLimitEnforcer,
+                       kj::Timer& timer, kj::Maybe<CpuWatchdog&> watchdog);
+  // `watchdog` must be non-null if `limits.cpuTime` or `limits.slowTurnWarning` is.
+
+  kj::Own<void> enterJs(jsg::Lock& lock, IoContext& context) override;
+  void topUpActor() override;
+  void newSubrequest(bool isInHouse) override;
+  void newKvRequest(KvOpType op) override {}
+  void newAnalyticsEngineRequest() override {}
+  kj::Promise<void> limitDrain() override;
+  kj::Promise<void> limitScheduled() override;
+  size_t getBufferingLimit() override { return kj::maxValue; }
+  kj::Maybe<EventOutcome> getLimitsExceeded() override { return exceeded; }
+  kj::Promise<void> onLimitsExceeded() override;
+  void requireLimitsNotExceeded() override;
+  void reportMetrics(RequestObserver& requestMetrics) override {}
+
+private:
+  class JsScope;
+
+  const Limits& limits;
+  Counters& counters;
+  const WorkerdIsolateLimitEnforcer& isolateLimitEnforcer;
+  kj::Timer& timer;
+  kj::Maybe<CpuWatchdog&> watchdog;
+
+  kj::Duration cpuUsed = 0 * kj::NANOSECONDS;
+  kj::uint subrequestCount = 0;
+  bool subrequestLimitReported = false;
+  // Set once `counters.exceededSubrequests` has counted this request, so that a script retrying
+  // in a loop counts as one overflow.
+
+  kj::Maybe<EventOutcome> exceeded;
+  kj::Vector<kj::Own<kj::PromiseFulfiller<void>>> exceededFulfillers;
+
+  void checkLimits();
+  // Called on leaving JavaScript: records that a limit was exceeded if one was.
+
+  kj::Promise<void> applyWallTimeLimit();
+  static kj::Exception makeException(EventOutcome outcome);
+};
+
+}  // namespace workerd::server
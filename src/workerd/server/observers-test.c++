@@ -0,0 +1,190 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#include "observers.h"
+#include <kj/test.h>
+#include <string.h>
+
+namespace workerd::server {
+namespace {
+
+bool contains(kj::StringPtr haystack, kj::StringPtr needle) {
+  return strstr(haystack.cStr(), needle.cStr()) != nullptr;
+}
+
+KJ_TEST("PrometheusTextWriter groups samples by family") {
+  PrometheusTextWriter writer;
+  writer.addCounter("requests_total", "Requests.", {{"service", "a"}}, 3);
+  writer.addGauge("temperature", "Temperature.", {}, 1.5);
+  writer.addCounter("requests_total", "Requests.", {{"service", "b"}}, 4);
+
+  KJ_EXPECT(writer.finish() ==
+      "# HELP requests_total Requests.\n"
+      "# TYPE requests_total counter\n"
+      "requests_total{service=\"a\"} 3\n"
+      "requests_total{service=\"b\"} 4\n"
+      "# HELP temperature Temperature.\n"
+      "# TYPE temperature gauge\n"
+      "temperature 1.5\n");
+}
+
+KJ_TEST("PrometheusTextWriter escapes label values") {
+  PrometheusTextWriter writer;
+  writer.addCounter("c", "C.", {{"name", "a\"b\\c\nd"}}, 1);
+  KJ_EXPECT(writer.finish() ==
+      "# HELP c C.\n"
+      "# TYPE c counter\n"
+      "c{name=\"a\\\"b\\\\c\\nd\"} 1\n");
+}
+
+KJ_TEST("PrometheusTextWriter histograms are cumulative") {
+  DurationHistogram histogram;
+  histogram.record(500 * kj::NANOSECONDS);
+  histogram.record(3 * kj::MICROSECONDS);
+  histogram.record(3 * kj::MICROSECONDS);
+
+  PrometheusTextWriter writer;
+  writer.addHistogram("d_seconds", "D.", {{"service", "s"}}, histogram.snapshot());
+  auto text = writer.finish();
+
+  KJ_EXPECT(text.startsWith(
+      "# HELP d_seconds D.\n"
+      "# TYPE d_seconds histogram\n"
+      "d_seconds_bucket{service=\"s\",le=\"1e-06\"} 1\n"
+      "d_seconds_bucket{service=\"s\",le=\"2e-06\"} 1\n"
+      "d_seconds_bucket{service=\"s\",le=\"4e-06\"} 3\n"), text);
+  KJ_EXPECT(text.endsWith(
+      "d_seconds_bucket{service=\"s\",le=\"+Inf\"} 3\n"
+      "d_seconds_sum{service=\"s\"} 6.5e-06\n"
+      "d_seconds_count{service=\"s\"} 3\n"), text);
+}
+
+KJ_TEST("WorkerdRequestObserver aggregates into RequestMetrics") {
+  RequestMetrics metrics;
+  {
+    auto observer = kj::refcounted<WorkerdRequestObserver>(metrics);
+    observer->delivered();
+    observer->wrapSubrequestClient(nullptr);
+    observer->wrapSubrequestClient(nullptr);
+    observer->jsDone();
+  }
+  {
+    auto observer = kj::refcounted<WorkerdRequestObserver>(metrics);
+    observer->delivered();
+    observer->reportFailure(KJ_EXCEPTION(FAILED, "oops"));
+    observer->jsDone();
+  }
+  {
+    // Canceled before delivery; not counted.
+    auto observer = kj::refcounted<WorkerdRequestObserver>(metrics);
+  }
+
+  KJ_EXPECT(metrics.delivered.read() == 2);
+  KJ_EXPECT(metrics.failed.read() == 1);
+  KJ_EXPECT(metrics.subrequests.read() == 2);
+  KJ_EXPECT(metrics.duration.snapshot().count == 2);
+
+  PrometheusTextWriter writer;
+  metrics.write(writer, "svc", "default");
+  auto text = writer.finish();
+  KJ_EXPECT(contains(text,
+      "workerd_requests_total{service=\"svc\",entrypoint=\"default\"} 2\n"), text);
+  KJ_EXPECT(contains(text,
+      "workerd_request_failures_total{service=\"svc\",entrypoint=\"default\"} 1\n"), text);
+  KJ_EXPECT(contains(text,
+      "workerd_request_duration_seconds_count{service=\"svc\",entrypoint=\"default\"} 2\n"), text);
+}
+
+KJ_TEST("WorkerdActorObserver aggregates into ActorMetrics") {
+  ActorMetrics metrics;
+  auto observer = kj::refcounted<WorkerdActorObserver>(metrics);
+  observer->startRequest();
+  observer->addCachedStorageReadUnits(3);
+  observer->addStorageWriteUnits(2);
+  observer->addStorageWriteUnits(5);
+  observer->inputGateWaited(0 * kj::NANOSECONDS);
+  observer->outputGateWaited(3 * kj::MILLISECONDS);
+
+  PrometheusTextWriter writer;
+  metrics.write(writer, "svc", "Counter");
+  auto text = writer.finish();
+  KJ_EXPECT(contains(text,
+      "workerd_actor_requests_total{service=\"svc\",class=\"Counter\"} 1\n"), text);
+  KJ_EXPECT(contains(text,
+      "workerd_actor_storage_cached_read_units_total{service=\"svc\",class=\"Counter\"} 3\n"),
+      text);
+  KJ_EXPECT(contains(text,
+      "workerd_actor_storage_write_units_total{service=\"svc\",class=\"Counter\"} 7\n"), text);
+  KJ_EXPECT(contains(text,
+      "workerd_actor_input_gate_wait_seconds_count{service=\"svc\",class=\"Counter\"} 1\n"),
+      text);
+  KJ_EXPECT(contains(text,
+      "workerd_actor_output_gate_wait_seconds_count{service=\"svc\",class=\"Counter\"} 1\n"),
+      text);
+}
+
+KJ_TEST("WorkerdRequestObserver records queueing delay until the first lock") {
+  RequestMetrics metrics;
+  auto observer = kj::refcounted<WorkerdRequestObserver>(metrics);
+  auto start = kj::systemPreciseMonotonicClock().now();
+  observer->lockAcquired(start + 5 * kj::SECONDS);
+  observer->lockAcquired(start + 9 * kj::SECONDS);
+
+  auto snapshot = metrics.queueDelay.snapshot();
+  KJ_EXPECT(snapshot.count == 1);
+  KJ_EXPECT(snapshot.sum >= 5 * kj::SECONDS && snapshot.sum < 6 * kj::SECONDS);
+}
+
+KJ_TEST("WorkerdIsolateObserver reports heap usage and garbage collection pauses") {
+  auto observer = kj::atomicRefcounted<WorkerdIsolateObserver>(kj::str("svc"), nullptr);
+  observer->reportHeapUsage({
+    .usedHeapSize = 1000, .totalHeapSize = 2000, .heapSizeLimit = 4000,
+    .externalMemory = 300, .cppgcUsedSize = 50 });
+
+  {
+    auto timing = KJ_ASSERT_NONNULL(observer->tryCreateLockTiming(kj::Maybe<RequestObserver&>()));
+    timing->start();
+    timing->locked();
+    timing->gcPrologue();
+    timing->gcEpilogue();
+    timing->gcEpilogue();  // unmatched; ignored
+    timing->stop();
+  }
+  KJ_EXPECT(observer->getGcPauseHistogram().snapshot().count == 1);
+
+  PrometheusTextWriter writer;
+  observer->write(writer, "svc");
+  auto text = writer.finish();
+  KJ_EXPECT(contains(text, "workerd_isolate_heap_used_bytes{service=\"svc\"} 1000\n"), text);
+  KJ_EXPECT(contains(text, "workerd_isolate_external_memory_bytes{service=\"svc\"} 300\n"), text);
+  KJ_EXPECT(contains(text, "workerd_isolate_cppgc_used_bytes{service=\"svc\"} 50\n"), text);
+  KJ_EXPECT(contains(text, "workerd_isolate_gc_pause_seconds_count{service=\"svc\"} 1\n"), text);
+}
+
+KJ_TEST("EventLoopLagMonitor records how late timers fire") {
+  kj::EventLoop loop;
+  kj::WaitScope ws(loop);
+  kj::TimerImpl timer(kj::origin<kj::TimePoint>());
+
+  EventLoopLagMonitor monitor;
+  auto promise = monitor.run(timer, 100 * kj::MILLISECONDS).eagerlyEvaluate(nullptr);
+
+  // On time.
+  timer.advanceTo(timer.now() + 100 * kj::MILLISECONDS);
+  loop.run();
+  // The loop was busy for 300ms past the next deadline.
+  timer.advanceTo(timer.now() + 400 * kj::MILLISECONDS);
+  loop.run();
+
+  auto snapshot = monitor.getLagHistogram().snapshot();
+  KJ_EXPECT(snapshot.count == 2);
+  KJ_EXPECT(snapshot.sum == 300 * kj::MILLISECONDS);
+
+  PrometheusTextWriter writer;
+  monitor.write(writer);
+  KJ_EXPECT(contains(writer.finish(), "workerd_event_loop_lag_seconds_count 2\n"));
+}
+
+}  // namespace
+}  // namespace workerd::server
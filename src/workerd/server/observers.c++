@@ -0,0 +1,440 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#include "observers.h"
+#include <workerd/io/worker-interface.h>
+
+namespace workerd::server {
+
+namespace {
+
+kj::TimePoint now() { return kj::systemPreciseMonotonicClock().now(); }
+
+double toSeconds(kj::Duration d) {
+  return double(d / kj::NANOSECONDS) / 1e9;
+}
+
+kj::String escapeLabelValue(kj::StringPtr value) {
+  kj::Vector<char> result(value.size() + 1);
+  for (char c: value) {
+    switch (c) {
+      case '\\': result.addAll("\\\\"_kj); break;
+      case '"':  result.addAll("\\\""_kj); break;
+      case '\n': result.addAll("\\n"_kj); break;
+      default:   result.add(c); break;
+    }
+  }
+  result.add('\0');
+  return kj::String(result.releaseAsArray());
+}
+
+}  // namespace
+
+// =======================================================================================
+// PrometheusTextWriter
+
+PrometheusTextWriter::Family& PrometheusTextWriter::getFamily(
+    kj::StringPtr name, kj::StringPtr type, kj::StringPtr help) {
+  for (auto& family: families) {
+    if (family.name == name) {
+      KJ_REQUIRE(family.type == type, "metric family redeclared with a different type", name);
+      return family;
+    }
+  }
+  return families.add(Family { .name = kj::str(name), .type = type, .help = kj::str(help) });
+}
+
+kj::String PrometheusTextWriter::formatLabels(
+    Labels labels, kj::StringPtr extraName, kj::StringPtr extraValue) {
+  kj::Vector<kj::String> parts(labels.size() + 1);
+  for (auto& label: labels) {
+    parts.add(kj::str(label.first, "=\"", escapeLabelValue(label.second), '"'));
+  }
+  if (extraName != nullptr) {
+    parts.add(kj::str(extraName, "=\"", extraValue, '"'));
+  }
+  if (parts.empty()) return kj::str();
+  return kj::str('{', kj::strArray(parts, ","), '}');
+}
+
+void PrometheusTextWriter::addCounter(
+    kj::StringPtr name, kj::StringPtr help, Labels labels, uint64_t value) {
+  getFamily(name, "counter", help).samples.add(kj::str(name, formatLabels(labels), ' ', value));
+}
+
+void PrometheusTextWriter::addCounter(
+    kj::StringPtr name, kj::StringPtr help, Labels labels, kj::Duration value) {
+  getFamily(name, "counter", help).samples.add(
+      kj::str(name, formatLabels(labels), ' ', toSeconds(value)));
+}
+
+void PrometheusTextWriter::addGauge(
+    kj::StringPtr name, kj::StringPtr help, Labels labels, double value) {
+  getFamily(name, "gauge", help).samples.add(kj::str(name, formatLabels(labels), ' ', value));
+}
+
+void PrometheusTextWriter::addHistogram(kj::StringPtr name, kj::StringPtr help, Labels labels,
+                                        const DurationHistogram::Snapshot& snapshot) {
+  auto& family = getFamily(name, "histogram", help);
+
+  // Prometheus buckets are cumulative.
+  uint64_t cumulative = 0;
+  for (uint i = 0; i < DurationHistogram::BUCKET_COUNT - 1; i++) {
+    cumulative += snapshot.buckets[i];
+    auto le = kj::str(toSeconds(DurationHistogram::bucketUpperBound(i)));
+    family.samples.add(kj::str(name, "_bucket", formatLabels(labels, "le", le), ' ', cumulative));
+  }
+  family.samples.add(kj::str(name, "_bucket", formatLabels(labels, "le", "+Inf"), ' ',
+                             snapshot.count));
+  family.samples.add(kj::str(name, "_sum", formatLabels(labels), ' ', toSeconds(snapshot.sum)));
+  family.samples.add(kj::str(name, "_count", formatLabels(labels), ' ', snapshot.count));
+}
+
+kj::String PrometheusTextWriter::finish() {
+  kj::Vector<kj::String> lines;
+  for (auto& family: families) {
+    lines.add(kj::str("# HELP ", family.name, ' ', family.help));
+    lines.add(kj::str("# TYPE ", family.name, ' ', family.type));
+    for (auto& sample: family.samples) {
+      lines.add(kj::mv(sample));
+    }
+  }
+  families.clear();
+  lines.add(kj::str());  // trailing newline
+  return kj::strArray(lines, "\n");
+}
+
+// =======================================================================================
+// Requests
+
+WorkerdRequestObserver::WorkerdRequestObserver(
+    RequestMetrics& metrics, kj::Maybe<kj::Own<SpanObserver>> traceRoot)
+    : metrics(metrics), queuedSince(now()), requestSpan(kj::mv(traceRoot), "workerd_request") {}
+
+void WorkerdRequestObserver::lockAcquired(kj::TimePoint time) {
+  KJ_IF_MAYBE(t, queuedSince) {
+    metrics.queueDelay.record(time - *t);
+    queuedSince = nullptr;
+  }
+}
+
+void WorkerdRequestObserver::delivered() {
+  metrics.delivered.add();
+  deliveredTime = now();
+}
+
+void WorkerdRequestObserver::jsDone() {
+  KJ_IF_MAYBE(t, deliveredTime) {
+    metrics.duration.record(now() - *t);
+    deliveredTime = nullptr;
+  }
+}
+
+void WorkerdRequestObserver::reportFailure(const kj::Exception& e) {
+  metrics.failed.add();
+  if (requestSpan.isObserved()) {
+    requestSpan.setTag("error"_kj, true);
+    requestSpan.addLog(kj::systemPreciseCalendarClock().now(), "exception"_kj,
+                       kj::str(e.getDescription()));
+  }
+}
+
+kj::Own<WorkerInterface> WorkerdRequestObserver::wrapSubrequestClient(
+    kj::Own<WorkerInterface> client) {
+  metrics.subrequests.add();
+  return kj::mv(client);
+}
+
+void WorkerdRequestObserver::reportSubrequestTiming(const SubrequestTiming& timing) {
+  auto record = [](const DurationHistogram& histogram, kj::Maybe<kj::Duration> phase) {
+    KJ_IF_MAYBE(d, phase) {
+      histogram.record(*d);
+    }
+  };
+  record(metrics.subrequestDnsLookup, timing.dnsLookup);
+  record(metrics.subrequestConnect, timing.connect);
+  record(metrics.subrequestTlsHandshake, timing.tlsHandshake);
+  record(metrics.subrequestTimeToFirstByte, timing.timeToFirstByte);
+  record(metrics.subrequestBodyTransfer, timing.bodyTransfer);
+}
+
+void WorkerdRequestObserver::reportAllocations(const AllocationStats& stats) {
+  for (uint i = 0; i < ALLOCATION_CATEGORY_COUNT; i++) {
+    if (stats.counts[i] > 0) {
+      metrics.allocations[i].add(stats.counts[i]);
+      metrics.allocatedBytes[i].add(stats.bytes[i]);
+    }
+  }
+}
+
+void RequestMetrics::write(
+    PrometheusTextWriter& writer, kj::StringPtr service, kj::StringPtr entrypoint) const {
+  PrometheusTextWriter::Labels labels = {{"service", service}, {"entrypoint", entrypoint}};
+  writer.addCounter("workerd_requests_total", "Requests delivered to a Worker.",
+                    labels, delivered.read());
+  writer.addCounter("workerd_request_failures_total", "Requests that failed with an exception.",
+                    labels, failed.read());
+  writer.addCounter("workerd_subrequests_total", "Subrequests made while handling requests.",
+                    labels, subrequests.read());
+  writer.addHistogram("workerd_request_duration_seconds",
+                      "Time from delivering a request until its JavaScript finished.",
+                      labels, duration.snapshot());
+  writer.addHistogram("workerd_request_queue_delay_seconds",
+                      "Time from a request reaching a Worker until its JavaScript could first run.",
+                      labels, queueDelay.snapshot());
+
+  auto addPhase = [&](kj::StringPtr phase, const DurationHistogram& histogram) {
+    writer.addHistogram("workerd_subrequest_phase_duration_seconds",
+                        "Time outgoing subrequests spent in each phase.",
+                        {{"service", service}, {"entrypoint", entrypoint}, {"phase", phase}},
+                        histogram.snapshot());
+  };
+  addPhase("dns_lookup", subrequestDnsLookup);
+  addPhase("connect", subrequestConnect);
+  addPhase("tls_handshake", subrequestTlsHandshake);
+  addPhase("time_to_first_byte", subrequestTimeToFirstByte);
+  addPhase("body_transfer", subrequestBodyTransfer);
+
+  if (ALLOCATION_PROFILING_ENABLED) {
+    for (uint i = 0; i < ALLOCATION_CATEGORY_COUNT; i++) {
+      PrometheusTextWriter::Labels categoryLabels = {
+        {"service", service}, {"entrypoint", entrypoint},
+        {"category", allocationCategoryName(static_cast<AllocationCategory>(i))}};
+      writer.addCounter("workerd_request_allocations_total",
+                        "Heap allocations made while running requests.",
+                        categoryLabels, allocations[i].read());
+      writer.addCounter("workerd_request_allocated_bytes_total",
+                        "Bytes of heap allocated while running requests.",
+                        categoryLabels, allocatedBytes[i].read());
+    }
+  }
+}
+
+// =======================================================================================
+// Actors
+
+void ActorMetrics::write(
+    PrometheusTextWriter& writer, kj::StringPtr service, kj::StringPtr className) const {
+  PrometheusTextWriter::Labels labels = {{"service", service}, {"class", className}};
+  writer.addCounter("workerd_actor_requests_total", "Requests delivered to Durable Objects.",
+                    labels, requests.read());
+  writer.addCounter("workerd_actor_websockets_accepted_total",
+                    "WebSockets accepted by Durable Objects.",
+                    labels, webSocketsAccepted.read());
+  writer.addCounter("workerd_actor_websockets_closed_total",
+                    "WebSockets closed by Durable Objects.",
+                    labels, webSocketsClosed.read());
+  writer.addCounter("workerd_actor_websocket_messages_received_total",
+                    "WebSocket messages received by Durable Objects.",
+                    labels, webSocketMessagesReceived.read());
+  writer.addCounter("workerd_actor_websocket_messages_sent_total",
+                    "WebSocket messages sent by Durable Objects.",
+                    labels, webSocketMessagesSent.read());
+  writer.addCounter("workerd_actor_storage_cached_read_units_total",
+                    "Durable Object storage read units served from the in-memory cache.",
+                    labels, cachedStorageReadUnits.read());
+  writer.addCounter("workerd_actor_storage_uncached_read_units_total",
+                    "Durable Object storage read units served from the database.",
+                    labels, uncachedStorageReadUnits.read());
+  writer.addCounter("workerd_actor_storage_write_units_total",
+                    "Durable Object storage write units.",
+                    labels, storageWriteUnits.read());
+  writer.addCounter("workerd_actor_storage_deletes_total",
+                    "Durable Object storage keys deleted.",
+                    labels, storageDeletes.read());
+  writer.addHistogram("workerd_actor_input_gate_wait_seconds",
+                      "Time Durable Object events waited for the input gate.",
+                      labels, inputGateWait.snapshot());
+  writer.addHistogram("workerd_actor_output_gate_wait_seconds",
+                      "Time Durable Object outgoing messages waited for writes to be confirmed.",
+                      labels, outputGateWait.snapshot());
+}
+
+// =======================================================================================
+// Isolates
+
+class WorkerdIsolateObserver::LockTimingImpl final: public LockTiming {
+  // Created when a lock is requested; for async locks that is before waiting in line, so the
+  // recorded wait includes time spent queued behind other requests.
+  //
+  // One is needed for every lock taken, so rather than heap-allocating each, they're recycled
+  // through a small per-thread free list.
+
+public:
+  static kj::Own<LockTiming> get(kj::Own<const WorkerdIsolateObserver> observer,
+                                 kj::Maybe<WorkerdRequestObserver&> request) {
+    auto& freeList = FreeList::current();
+    LockTimingImpl* timing;
+    if (freeList.items.empty()) {
+      timing = new LockTimingImpl();
+    } else {
+      timing = freeList.items.back();
+      freeList.items.removeLast();
+    }
+    timing->observer = kj::mv(observer);
+    timing->request = request;
+    timing->requested = now();
+    return kj::Own<LockTiming>(timing, Recycler::instance);
+  }
+
+  void locked() override {
+    auto t = now();
+    lockedTime = t;
+    observer->lockWait.record(t - requested);
+    KJ_IF_MAYBE(r, request) {
+      r->lockAcquired(t);
+    }
+  }
+
+  void stop() override {
+    KJ_IF_MAYBE(t, lockedTime) {
+      observer->lockHold.record(now() - *t);
+    }
+  }
+
+  void gcPrologue() override {
+    gcStart = now();
+  }
+
+  void gcEpilogue() override {
+    KJ_IF_MAYBE(t, gcStart) {
+      auto pause = now() - *t;
+      gcStart = nullptr;
+      observer->gcPause.record(pause);
+      KJ_IF_MAYBE(warning, observer->gcPauseWarning) {
+        if (pause >= *warning) {
+          KJ_LOG(WARNING, "long garbage collection pause", observer->serviceName, pause);
+        }
+      }
+    }
+  }
+
+private:
+  kj::Own<const WorkerdIsolateObserver> observer;
+  kj::Maybe<WorkerdRequestObserver&> request;
+  // The request the lock is taken for, if any. It outlives the lock.
+  kj::TimePoint requested = kj::origin<kj::TimePoint>();
+  kj::Maybe<kj::TimePoint> lockedTime;
+  kj::Maybe<kj::TimePoint> gcStart;
+
+  LockTimingImpl() = default;
+
+  struct FreeList {
+    static constexpr size_t MAX_SIZE = 16;
+    // More than enough for the locks a thread has outstanding at once.
+
+    kj::Vector<LockTimingImpl*> items;
+
+    ~FreeList() noexcept(false) {
+      for (auto item: items) delete item;
+    }
+
+    static FreeList& current() {
+      static thread_local FreeList freeList;
+      return freeList;
+    }
+  };
+
+  class Recycler final: public kj::Disposer {
+  public:
+    static const Recycler instance;
+
+  protected:
+    void disposeImpl(void* pointer) const override {
+      // Returns the object to the free list of whichever thread drops it.
+      auto timing = static_cast<LockTimingImpl*>(pointer);
+      timing->observer = nullptr;
+      timing->request = nullptr;
+      timing->lockedTime = nullptr;
+      timing->gcStart = nullptr;
+
+      auto& freeList = FreeList::current();
+      if (freeList.items.size() < FreeList::MAX_SIZE) {
+        freeList.items.add(timing);
+      } else {
+        delete timing;
+      }
+    }
+  };
+};
+
+const WorkerdIsolateObserver::LockTimingImpl::Recycler
+    WorkerdIsolateObserver::LockTimingImpl::Recycler::instance;
+
+kj::Maybe<kj::Own<IsolateObserver::LockTiming>> WorkerdIsolateObserver::tryCreateLockTiming(
+    kj::OneOf<SpanParent, kj::Maybe<RequestObserver&>> parentOrRequest) const {
+  kj::Maybe<WorkerdRequestObserver&> request;
+  KJ_IF_MAYBE(r, parentOrRequest.tryGet<kj::Maybe<RequestObserver&>>()) {
+    KJ_IF_MAYBE(observer, *r) {
+      request = kj::dynamicDowncastIfAvailable<WorkerdRequestObserver>(*observer);
+    }
+  }
+  return LockTimingImpl::get(kj::atomicAddRef(*this), request);
+}
+
+void WorkerdIsolateObserver::reportHeapUsage(const HeapUsage& usage) {
+  __atomic_store_n(&heapUsage.usedHeapSize, usage.usedHeapSize, __ATOMIC_RELAXED);
+  __atomic_store_n(&heapUsage.totalHeapSize, usage.totalHeapSize, __ATOMIC_RELAXED);
+  __atomic_store_n(&heapUsage.heapSizeLimit, usage.heapSizeLimit, __ATOMIC_RELAXED);
+  __atomic_store_n(&heapUsage.externalMemory, usage.externalMemory, __ATOMIC_RELAXED);
+  __atomic_store_n(&heapUsage.cppgcUsedSize, usage.cppgcUsedSize, __ATOMIC_RELAXED);
+}
+
+IsolateObserver::HeapUsage WorkerdIsolateObserver::getHeapUsage() const {
+  return {
+    .usedHeapSize = __atomic_load_n(&heapUsage.usedHeapSize, __ATOMIC_RELAXED),
+    .totalHeapSize = __atomic_load_n(&heapUsage.totalHeapSize, __ATOMIC_RELAXED),
+    .heapSizeLimit = __atomic_load_n(&heapUsage.heapSizeLimit, __ATOMIC_RELAXED),
+    .externalMemory = __atomic_load_n(&heapUsage.externalMemory, __ATOMIC_RELAXED),
+    .cppgcUsedSize = __atomic_load_n(&heapUsage.cppgcUsedSize, __ATOMIC_RELAXED),
+  };
+}
+
+void WorkerdIsolateObserver::write(PrometheusTextWriter& writer, kj::StringPtr service) const {
+  PrometheusTextWriter::Labels labels = {{"service", service}};
+  writer.addHistogram("workerd_isolate_lock_wait_seconds",
+                      "Time from asking for a Worker's isolate lock to holding it.",
+                      labels, lockWait.snapshot());
+  writer.addHistogram("workerd_isolate_lock_hold_seconds",
+                      "Time a Worker's isolate lock was held per acquisition.",
+                      labels, lockHold.snapshot());
+  writer.addHistogram("workerd_isolate_gc_pause_seconds",
+                      "Garbage collection pauses while a Worker's isolate lock was held.",
+                      labels, gcPause.snapshot());
+
+  auto usage = getHeapUsage();
+  writer.addGauge("workerd_isolate_heap_used_bytes", "JavaScript heap in use.",
+                  labels, usage.usedHeapSize);
+  writer.addGauge("workerd_isolate_heap_total_bytes", "JavaScript heap reserved.",
+                  labels, usage.totalHeapSize);
+  writer.addGauge("workerd_isolate_heap_limit_bytes", "Maximum size of the JavaScript heap.",
+                  labels, usage.heapSizeLimit);
+  writer.addGauge("workerd_isolate_external_memory_bytes",
+                  "Memory held by JavaScript objects outside the heap, such as ArrayBuffers.",
+                  labels, usage.externalMemory);
+  writer.addGauge("workerd_isolate_cppgc_used_bytes",
+                  "C++ heap in use by objects wrapped for JavaScript.",
+                  labels, usage.cppgcUsedSize);
+}
+
+// =======================================================================================
+// Event loop
+
+kj::Promise<void> EventLoopLagMonitor::run(kj::Timer& timer, kj::Duration interval) {
+  auto deadline = timer.now() + interval;
+  return timer.atTime(deadline).then([this, &timer, interval, deadline]() {
+    // The timer's notion of "now" is updated when the event loop gets around to polling it, so
+    // it's late by however long the loop was busy with other work.
+    lag.record(timer.now() - deadline);
+    return run(timer, interval);
+  });
+}
+
+void EventLoopLagMonitor::write(PrometheusTextWriter& writer) const {
+  writer.addHistogram("workerd_event_loop_lag_seconds",
+                      "How late timers fired because the event loop was busy.",
+                      {}, lag.snapshot());
+}
+
+}  // namespace workerd::server
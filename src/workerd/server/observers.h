@@ -0,0 +1,221 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#pragma once
+// Observer implementations used by workerd. They aggregate into in-process counters and
+// histograms, which a `metrics` service renders in Prometheus text format.
+//
+// Counters and histograms are sharded by thread (see ShardedCounter), so the observers add next
+// to nothing to the request path and can be read from any thread while requests are running.
+
+#include <workerd/io/observer.h>
+#include <workerd/util/counter.h>
+#include <workerd/util/histogram.h>
+#include <kj/timer.h>
+#include <kj/vector.h>
+#include <initializer_list>
+#include <utility>
+
+namespace workerd::server {
+
+inline uint64_t readCounter(const uint64_t& counter) {
+  // Reads a plain counter that only one thread updates, from any thread.
+  return __atomic_load_n(&counter, __ATOMIC_RELAXED);
+}
+
+class PrometheusTextWriter {
+  // Builds a response body in the Prometheus text exposition format. Samples may be added in any
+  // order; they are grouped by metric family when rendered.
+
+public:
+  using Labels = std::initializer_list<std::pair<kj::StringPtr, kj::StringPtr>>;
+
+  void addCounter(kj::StringPtr name, kj::StringPtr help, Labels labels, uint64_t value);
+  void addCounter(kj::StringPtr name, kj::StringPtr help, Labels labels, kj::Duration value);
+  void addGauge(kj::StringPtr name, kj::StringPtr help, Labels labels, double value);
+  void addHistogram(kj::StringPtr name, kj::StringPtr help, Labels labels,
+                    const DurationHistogram::Snapshot& snapshot);
+  // Durations are reported in seconds, so `name` should end in `_seconds` (or `_seconds_total`,
+  // for a counter).
+
+  kj::String finish();
+
+private:
+  struct Family {
+    kj::String name;
+    kj::StringPtr type;
+    kj::String help;
+    kj::Vector<kj::String> samples;
+  };
+  kj::Vector<Family> families;
+
+  Family& getFamily(kj::StringPtr name, kj::StringPtr type, kj::StringPtr help);
+  static kj::String formatLabels(Labels labels, kj::StringPtr extraName = nullptr,
+                                 kj::StringPtr extraValue = nullptr);
+};
+
+struct RequestMetrics {
+  // Aggregated over all requests to one entrypoint of one Worker.
+
+  ShardedCounter delivered;
+  ShardedCounter failed;
+  ShardedCounter subrequests;
+  DurationHistogram duration;
+  // From delivery until no more JavaScript will run for the request.
+  DurationHistogram queueDelay;
+  // From the request being handed to the Worker until it first holds the isolate lock, i.e. time
+  // spent waiting behind other work before any of its JavaScript can run.
+  DurationHistogram subrequestDnsLookup;
+  DurationHistogram subrequestConnect;
+  DurationHistogram subrequestTlsHandshake;
+  DurationHistogram subrequestTimeToFirstByte;
+  DurationHistogram subrequestBodyTransfer;
+  // Phases of outgoing subrequests. Each only counts subrequests that went through that phase,
+  // e.g. connecting is skipped when a pooled connection is reused.
+  ShardedCounter allocations[ALLOCATION_CATEGORY_COUNT];
+  ShardedCounter allocatedBytes[ALLOCATION_CATEGORY_COUNT];
+  // Heap allocations made while running requests, by category. Only collected, and only
+  // exported, in builds with allocation profiling.
+
+  void write(PrometheusTextWriter& writer, kj::StringPtr service, kj::StringPtr entrypoint) const;
+};
+
+class WorkerdRequestObserver final: public RequestObserver {
+public:
+  explicit WorkerdRequestObserver(RequestMetrics& metrics,
+                                  kj::Maybe<kj::Own<SpanObserver>> traceRoot = nullptr);
+  // If `traceRoot` is non-null, the request is traced: it gets a root span covering the
+  // observer's lifetime, which subrequests and other spans descend from.
+
+  void delivered() override;
+  void jsDone() override;
+  void reportFailure(const kj::Exception& e) override;
+  kj::Own<WorkerInterface> wrapSubrequestClient(kj::Own<WorkerInterface> client) override;
+  SpanParent getSpan() override { return SpanParent(requestSpan); }
+  void reportAllocations(const AllocationStats& stats) override;
+  void reportSubrequestTiming(const SubrequestTiming& timing) override;
+
+  void lockAcquired(kj::TimePoint time);
+  // Called by the isolate observer whenever a lock is taken on behalf of this request. The first
+  // one ends the request's queueing delay.
+
+private:
+  RequestMetrics& metrics;
+  kj::Maybe<kj::TimePoint> queuedSince;
+  kj::Maybe<kj::TimePoint> deliveredTime;
+  SpanBuilder requestSpan;
+};
+
+struct ActorMetrics {
+  // Aggregated over all instances of one Durable Object class.
+
+  ShardedCounter requests;
+  ShardedCounter webSocketsAccepted;
+  ShardedCounter webSocketsClosed;
+  ShardedCounter webSocketMessagesReceived;
+  ShardedCounter webSocketMessagesSent;
+  ShardedCounter cachedStorageReadUnits;
+  ShardedCounter uncachedStorageReadUnits;
+  ShardedCounter storageWriteUnits;
+  ShardedCounter storageDeletes;
+  DurationHistogram inputGateWait;
+  // Time events waited to be delivered while storage operations held the input gate.
+  DurationHistogram outputGateWait;
+  // Time outgoing messages were held until preceding writes were confirmed.
+
+  void write(PrometheusTextWriter& writer, kj::StringPtr service, kj::StringPtr className) const;
+};
+
+class WorkerdActorObserver final: public ActorObserver {
+public:
+  explicit WorkerdActorObserver(ActorMetrics& metrics): metrics(metrics) {}
+
+  void startRequest() override { metrics.requests.add(); }
+  void webSocketAccepted() override { metrics.webSocketsAccepted.add(); }
+  void webSocketClosed() override { metrics.webSocketsClosed.add(); }
+  void receivedWebSocketMessage(size_t bytes) override {
+    metrics.webSocketMessagesReceived.add();
+  }
+  void sentWebSocketMessage(size_t bytes) override {
+    metrics.webSocketMessagesSent.add();
+  }
+  void addCachedStorageReadUnits(uint32_t units) override {
+    metrics.cachedStorageReadUnits.add(units);
+  }
+  void addUncachedStorageReadUnits(uint32_t units) override {
+    metrics.uncachedStorageReadUnits.add(units);
+  }
+  void addStorageWriteUnits(uint32_t units) override {
+    metrics.storageWriteUnits.add(units);
+  }
+  void addStorageDeletes(uint32_t count) override {
+    metrics.storageDeletes.add(count);
+  }
+  void inputGateWaited(kj::Duration waitTime) override { metrics.inputGateWait.record(waitTime); }
+  void outputGateWaited(kj::Duration waitTime) override {
+    metrics.outputGateWait.record(waitTime);
+  }
+
+private:
+  ActorMetrics& metrics;
+};
+
+class WorkerdIsolateObserver final: public IsolateObserver {
+public:
+  WorkerdIsolateObserver(kj::String serviceName, kj::Maybe<kj::Duration> gcPauseWarning)
+      : serviceName(kj::mv(serviceName)), gcPauseWarning(gcPauseWarning) {}
+  // Garbage collection pauses longer than `gcPauseWarning` are logged, naming `serviceName`.
+
+  kj::Maybe<kj::Own<LockTiming>> tryCreateLockTiming(
+      kj::OneOf<SpanParent, kj::Maybe<RequestObserver&>> parentOrRequest) const override;
+  void reportHeapUsage(const HeapUsage& usage) override;
+
+  const DurationHistogram& getLockWaitHistogram() const { return lockWait; }
+  // Time from asking for the isolate lock to holding it, including time queued behind other
+  // isolates on the same thread.
+
+  const DurationHistogram& getLockHoldHistogram() const { return lockHold; }
+  // Time the isolate lock was held, per acquisition.
+
+  const DurationHistogram& getGcPauseHistogram() const { return gcPause; }
+  // Garbage collection pauses that happened while the isolate lock was held.
+
+  HeapUsage getHeapUsage() const;
+  // The most recent sample reported by the limit enforcer.
+
+  void write(PrometheusTextWriter& writer, kj::StringPtr service) const;
+
+private:
+  kj::String serviceName;
+  kj::Maybe<kj::Duration> gcPauseWarning;
+
+  DurationHistogram lockWait;
+  DurationHistogram lockHold;
+  DurationHistogram gcPause;
+
+  HeapUsage heapUsage;
+  // Written under the isolate lock, but read by the metrics service from anywhere, so each field
+  // is accessed atomically.
+
+  class LockTimingImpl;
+};
+
+class EventLoopLagMonitor {
+  // Measures how late timers fire on the event loop. One event loop serves every Worker, so a long
+  // synchronous stretch of work -- typically JavaScript -- delays everything queued behind it,
+  // and that delay shows up here no matter which Worker caused it.
+
+public:
+  kj::Promise<void> run(kj::Timer& timer, kj::Duration interval);
+  // Wakes up every `interval` and records how far past its deadline it woke. Never resolves.
+
+  const DurationHistogram& getLagHistogram() const { return lag; }
+
+  void write(PrometheusTextWriter& writer) const;
+
+private:
+  DurationHistogram lag;
+};
+
+}  // namespace workerd::server
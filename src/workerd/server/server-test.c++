@@ -8,6 +8,7 @@
 #include <workerd/jsg/setup.h>
 #include <kj/async-queue.h>
 #include <regex>
+#include <unistd.h>
 
 namespace workerd::server {
 namespace {
@@ -530,6 +531,93 @@ KJ_TEST("Server: serve basic modular Worker") {
   conn.httpGet200("/", "Hello: http://foo/");
 }
 
+KJ_TEST("Server: heap limits and GC tuning") {
+  TestServer test(singleWorker(R"((
+    compatibilityDate = "2022-08-17",
+    modules = [
+      ( name = "main.js",
+        esModule =
+          `export default {
+          `  async fetch(request) {
+          `    let garbage = [];
+          `    for (let i = 0; i < 10000; i++) garbage.push({i, s: "x" + i});
+          `    return new Response("allocated " + garbage.length);
+          `  }
+          `}
+      )
+    ],
+    limits = (
+      heapLimitMb = 64,
+      youngGenerationSizeMb = 16,
+      initialYoungGenerationSizeMb = 16,
+      cppgcMarking = incremental
+    )
+  ))"_kj));
+
+  test.start();
+  auto conn = test.connect("test-addr");
+  conn.httpGet200("/", "allocated 10000");
+  conn.httpGet200("/", "allocated 10000");
+}
+
+KJ_TEST("Server: heap limit exceeded") {
+  TestServer test(R"((
+    services = [
+      ( name = "hello",
+        worker = (
+          compatibilityDate = "2022-08-17",
+          modules = [
+            ( name = "main.js",
+              esModule =
+                `export default {
+                `  async fetch(request, env) {
+                `    let result;
+                `    try {
+                `      await env.hog.fetch("http://hog/grow");
+                `      result = "heap limit not enforced";
+                `    } catch (err) {
+                `      result = err.message;
+                `    }
+                `    let after = await (await env.hog.fetch("http://hog/")).text();
+                `    return new Response(result + ", then " + after);
+                `  }
+                `}
+            )
+          ],
+          bindings = [(name = "hog", service = "hog")]
+        )
+      ),
+      ( name = "hog",
+        worker = (
+          compatibilityDate = "2022-08-17",
+          modules = [
+            ( name = "main.js",
+              esModule =
+                `export default {
+                `  async fetch(request) {
+                `    if (new URL(request.url).pathname == "/grow") {
+                `      let garbage = [];
+                `      for (;;) garbage.push(new Array(1024).fill(garbage.length + 0.5));
+                `    }
+                `    return new Response("still serving");
+                `  }
+                `}
+            )
+          ],
+          limits = (heapLimitMb = 32)
+        )
+      ),
+    ],
+    sockets = [
+      ( name = "main", address = "test-addr", service = "hello" ),
+    ]
+  ))"_kj);
+
+  test.start();
+  auto conn = test.connect("test-addr");
+  conn.httpGet200("/", "Worker exceeded memory limit., then still serving");
+}
+
 KJ_TEST("Server: serve modular Worker with imports") {
   TestServer test(singleWorker(R"((
     compatibilityDate = "2022-08-17",
@@ -1231,6 +1319,176 @@ KJ_TEST("Server: named entrypoints") {
   }
 }
 
+KJ_TEST("Server: subrequest limit") {
+  TestServer test(R"((
+    services = [
+      ( name = "hello",
+        worker = (
+          compatibilityDate = "2022-08-17",
+          modules = [
+            ( name = "main.js",
+              esModule =
+                `export default {
+                `  async fetch(request, env) {
+                `    let first = await (await env.other.fetch(request)).text();
+                `    try {
+                `      await env.other.fetch(request);
+                `      return new Response("second subrequest allowed");
+                `    } catch (err) {
+                `      return new Response(first + ", then " + err.message);
+                `    }
+                `  }
+                `}
+            )
+          ],
+          bindings = [(name = "other", service = "other")],
+          limits = (subrequests = 1, cpuMs = 1000)
+        )
+      ),
+      ( name = "other",
+        worker = (
+          compatibilityDate = "2022-08-17",
+          modules = [
+            ( name = "main.js",
+              esModule =
+                `export default {
+                `  async fetch(request, env) {
+                `    return new Response("ok");
+                `  }
+                `}
+            )
+          ]
+        )
+      ),
+    ],
+    sockets = [
+      ( name = "main", address = "test-addr", service = "hello" ),
+    ]
+  ))"_kj);
+
+  test.start();
+  auto conn = test.connect("test-addr");
+  conn.httpGet200("/", "ok, then Too many subrequests.");
+}
+
+KJ_TEST("Server: CPU limit") {
+  TestServer test(R"((
+    services = [
+      ( name = "hello",
+        worker = (
+          compatibilityDate = "2022-08-17",
+          modules = [
+            ( name = "main.js",
+              esModule =
+                `export default {
+                `  async fetch(request, env) {
+                `    let result;
+                `    try {
+                `      await env.spinner.fetch("http://spinner/spin");
+                `      result = "CPU limit not enforced";
+                `    } catch (err) {
+                `      result = err.message;
+                `    }
+                `    let after = await (await env.spinner.fetch("http://spinner/")).text();
+                `    return new Response(result + ", then " + after);
+                `  }
+                `}
+            )
+          ],
+          bindings = [(name = "spinner", service = "spinner")]
+        )
+      ),
+      ( name = "spinner",
+        worker = (
+          compatibilityDate = "2022-08-17",
+          modules = [
+            ( name = "main.js",
+              esModule =
+                `export default {
+                `  async fetch(request) {
+                `    if (new URL(request.url).pathname == "/spin") {
+                `      while (true) {}
+                `    }
+                `    return new Response("still serving");
+                `  }
+                `}
+            )
+          ],
+          limits = (cpuMs = 50)
+        )
+      ),
+    ],
+    sockets = [
+      ( name = "main", address = "test-addr", service = "hello" ),
+    ]
+  ))"_kj);
+
+  test.start();
+  auto conn = test.connect("test-addr");
+  conn.httpGet200("/", "Worker exceeded CPU time limit., then still serving");
+}
+
+KJ_TEST("Server: tail workers") {
+  TestServer test(R"((
+    services = [
+      ( name = "hello",
+        worker = (
+          compatibilityDate = "2022-08-17",
+          modules = [
+            ( name = "main.js",
+              esModule =
+                `export default {
+                `  async fetch(request, env) {
+                `    console.log("traced");
+                `    return new Response("ok");
+                `  }
+                `}
+            )
+          ],
+          tails = ["tail"],
+          tailBatching = (maxBatchSize = 1)
+        )
+      ),
+      ( name = "tail",
+        worker = (
+          compatibilityDate = "2022-08-17",
+          modules = [
+            ( name = "main.js",
+              esModule =
+                `export default {
+                `  async tail(events, env) {
+                `    let event = events[0];
+                `    await fetch("http://tail-sink/" + event.scriptName + "/" +
+                `                event.logs[0].message[0]);
+                `  }
+                `}
+            )
+          ]
+        )
+      ),
+    ],
+    sockets = [
+      ( name = "main", address = "test-addr", service = "hello" ),
+    ]
+  ))"_kj);
+
+  test.start();
+  auto conn = test.connect("test-addr");
+  conn.httpGet200("/", "ok");
+
+  // The trace is delivered after the response, once the request has completed.
+  auto subreq = test.receiveInternetSubrequest("tail-sink");
+  subreq.recv(R"(
+    GET /hello/traced HTTP/1.1
+    Host: tail-sink
+
+  )"_blockquote);
+  subreq.send(R"(
+    HTTP/1.1 204 No Content
+
+  )"_blockquote);
+}
+
 KJ_TEST("Server: invalid entrypoint") {
   TestServer test(R"((
     services = [
@@ -2431,6 +2689,265 @@ KJ_TEST("Server: disk service allow dotfiles") {
   KJ_EXPECT(test.root->openFile(kj::Path({"secret"}))->readAllText() == "this is super-secret");
 }
 
+KJ_TEST("Server: metrics service") {
+  TestServer test(R"((
+    services = [
+      ( name = "hello",
+        worker = (
+          compatibilityDate = "2022-08-17",
+          modules = [
+            ( name = "main.js",
+              esModule =
+                `export default {
+                `  async fetch(request, env) {
+                `    return new Response("Hello: " + request.url);
+                `  }
+                `}
+            )
+          ]
+        )
+      ),
+      ( name = "metrics", metrics = void ),
+    ],
+    sockets = [
+      ( name = "main", address = "test-addr", service = "hello" ),
+      ( name = "metrics", address = "metrics-addr", service = "metrics" ),
+    ]
+  ))"_kj);
+
+  test.start();
+  auto conn = test.connect("test-addr");
+  conn.httpGet200("/", "Hello: http://foo/");
+
+  auto metricsConn = test.connect("metrics-addr");
+  metricsConn.sendHttpGet("/metrics");
+  metricsConn.recvRegex(
+      "HTTP/1\\.1 200 OK\n"
+      "Content-Length: [0-9]+\n"
+      "Content-Type: text/plain; version=0\\.0\\.4\n"
+      "\n"
+      "# HELP workerd_event_loop_lag_seconds [\\s\\S]*"
+      "workerd_requests_total\\{service=\"hello\",entrypoint=\"default\"\\} 1\n[\\s\\S]*"
+      "workerd_request_queue_delay_seconds_count"
+          "\\{service=\"hello\",entrypoint=\"default\"\\} 1\n[\\s\\S]*"
+      "workerd_isolate_lock_wait_seconds_count\\{service=\"hello\"\\} [1-9][0-9]*\n[\\s\\S]*"
+      "workerd_isolate_heap_used_bytes\\{service=\"hello\"\\} [1-9][0-9.e+]*\n[\\s\\S]*"
+      "workerd_limit_exceeded_total\\{service=\"hello\",limit=\"cpu\"\\} 0\n[\\s\\S]*"
+      "workerd_js_turn_duration_seconds_count\\{service=\"hello\"\\} [1-9][0-9]*\n[\\s\\S]*"
+      "workerd_slow_js_turns_total\\{service=\"hello\"\\} 0\n[\\s\\S]*"
+      "workerd_actor_cache_hits_total\\{service=\"hello\"\\} 0\n[\\s\\S]*"
+      "workerd_actor_cache_lock_wait_seconds_total\\{service=\"hello\"\\} 0\n[\\s\\S]*"
+      "workerd_actor_cache_prefetch_hit_ratio\\{service=\"hello\"\\} 0\n[\\s\\S]*");
+
+  metricsConn.send(R"(
+    POST /metrics HTTP/1.1
+    Host: foo
+    Content-Length: 0
+
+  )"_blockquote);
+  metricsConn.recv(R"(
+    HTTP/1.1 405 Method Not Allowed
+    Content-Length: 18
+
+    Method Not Allowed)"_blockquote);
+}
+
+KJ_TEST("Server: subrequest timing metrics") {
+  TestServer test(R"((
+    services = [
+      ( name = "hello",
+        worker = (
+          compatibilityDate = "2022-08-17",
+          modules = [
+            ( name = "main.js",
+              esModule =
+                `export default {
+                `  async fetch(request, env) {
+                `    let resp = await env.backend.fetch("http://backend/");
+                `    return new Response("Hello " + await resp.text());
+                `  }
+                `}
+            )
+          ],
+          bindings = [(name = "backend", service = "backend")]
+        )
+      ),
+      ( name = "backend",
+        worker = (
+          compatibilityDate = "2022-08-17",
+          modules = [
+            ( name = "main.js",
+              esModule =
+                `export default {
+                `  async fetch(request, env) {
+                `    return new Response("World");
+                `  }
+                `}
+            )
+          ]
+        )
+      ),
+      ( name = "metrics", metrics = void ),
+    ],
+    sockets = [
+      ( name = "main", address = "test-addr", service = "hello" ),
+      ( name = "metrics", address = "metrics-addr", service = "metrics" ),
+    ]
+  ))"_kj);
+
+  test.start();
+  auto conn = test.connect("test-addr");
+  conn.httpGet200("/", "Hello World");
+
+  // A service binding has a response and a body, but never touches the network.
+  auto metricsConn = test.connect("metrics-addr");
+  metricsConn.sendHttpGet("/metrics");
+  metricsConn.recvRegex(
+      "HTTP/1\\.1 200 OK\n[\\s\\S]*"
+      "workerd_subrequest_phase_duration_seconds_count"
+          "\\{service=\"hello\",entrypoint=\"default\",phase=\"connect\"\\} 0\n[\\s\\S]*"
+      "workerd_subrequest_phase_duration_seconds_count"
+          "\\{service=\"hello\",entrypoint=\"default\",phase=\"time_to_first_byte\"\\} 1\n"
+          "[\\s\\S]*"
+      "workerd_subrequest_phase_duration_seconds_count"
+          "\\{service=\"hello\",entrypoint=\"default\",phase=\"body_transfer\"\\} 1\n"
+          "[\\s\\S]*");
+}
+
+KJ_TEST("Server: CPU profiling") {
+  TestServer test(R"((
+    services = [
+      ( name = "hello",
+        worker = (
+          compatibilityDate = "2022-08-17",
+          modules = [
+            ( name = "main.js",
+              esModule =
+                `export default {
+                `  async fetch(request, env) {
+                `    return new Response("Hello");
+                `  }
+                `}
+            )
+          ],
+          cpuProfiling = ( path = "profiles/hello.folded" )
+        )
+      ),
+      ( name = "metrics", metrics = void ),
+    ],
+    sockets = [
+      ( name = "main", address = "test-addr", service = "hello" ),
+      ( name = "metrics", address = "metrics-addr", service = "metrics" ),
+    ]
+  ))"_kj);
+
+  test.start();
+  auto metricsConn = test.connect("metrics-addr");
+  metricsConn.send(R"(
+    POST /cpu-profiling/start HTTP/1.1
+    Host: foo
+    Content-Length: 0
+
+  )"_blockquote);
+  metricsConn.recv(R"(
+    HTTP/1.1 200 OK
+    Content-Length: 6
+    Content-Type: text/plain
+
+    hello
+  )"_blockquote);
+
+  auto conn = test.connect("test-addr");
+  conn.httpGet200("/", "Hello");
+
+  metricsConn.sendHttpGet("/metrics");
+  metricsConn.recvRegex(
+      "HTTP/1\\.1 200 OK\n[\\s\\S]*"
+      "workerd_cpu_profiling_active\\{service=\"hello\"\\} 1\n[\\s\\S]*");
+
+  metricsConn.send(R"(
+    POST /cpu-profiling/stop HTTP/1.1
+    Host: foo
+    Content-Length: 0
+
+  )"_blockquote);
+  metricsConn.recv(R"(
+    HTTP/1.1 200 OK
+    Content-Length: 6
+    Content-Type: text/plain
+
+    hello
+  )"_blockquote);
+
+  // Stopping writes out whatever was collected.
+  test.loop.run();
+  metricsConn.sendHttpGet("/metrics");
+  metricsConn.recvRegex(
+      "HTTP/1\\.1 200 OK\n[\\s\\S]*"
+      "workerd_cpu_profiling_active\\{service=\"hello\"\\} 0\n[\\s\\S]*"
+      "workerd_cpu_profile_writes_total\\{service=\"hello\"\\} 1\n[\\s\\S]*");
+  KJ_EXPECT(test.cwd->exists(kj::Path({"profiles", "hello.folded"})));
+}
+
+KJ_TEST("Server: access log") {
+  TestServer test(R"((
+    services = [
+      ( name = "hello",
+        worker = (
+          compatibilityDate = "2022-08-17",
+          modules = [
+            ( name = "main.js",
+              esModule =
+                `export default {
+                `  async fetch(request, env) {
+                `    return new Response("Hello: " + await request.text());
+                `  }
+                `}
+            )
+          ]
+        )
+      ),
+    ],
+    sockets = [
+      ( name = "main",
+        address = "test-addr",
+        service = "hello",
+        accessLog = ( path = "logs/access.log", flushIntervalMs = 1 ) ),
+    ]
+  ))"_kj);
+
+  test.start();
+  auto conn = test.connect("test-addr");
+  conn.send(R"(
+    POST /greet HTTP/1.1
+    Host: foo
+    Content-Length: 5
+
+    world
+  )"_blockquote);
+  conn.recv(R"(
+    HTTP/1.1 200 OK
+    Content-Length: 12
+    Content-Type: text/plain;charset=UTF-8
+
+    Hello: world
+  )"_blockquote);
+
+  // The line is queued once the request completes, then written by a background thread.
+  test.loop.run();
+  auto file = test.cwd->openFile(kj::Path({"logs", "access.log"}));
+  kj::String text;
+  for (uint i = 0; i < 500; i++) {
+    text = file->readAllText();
+    if (text.size() > 0) break;
+    usleep(10000);
+  }
+  KJ_EXPECT(std::regex_match(text.cStr(), std::regex(
+      "\\{\"time\":\\d+,\"service\":\"hello\",\"method\":\"POST\",\"url\":\"/greet\","
+      "\"status\":200,\"requestBytes\":5,\"responseBytes\":12,"
+      "\"ttfbUs\":\\d+,\"durationUs\":\\d+\\}\n")), text);
+}
+
 // =======================================================================================
 // Test Cache API
 
@@ -3,6 +3,12 @@
 //     https://opensource.org/licenses/Apache-2.0
 
 #include "server.h"
+#include "access-log.h"
+#include "cpu-sampler.h"
+#include "limit-enforcer.h"
+#include "observers.h"
+#include "span-exporter.h"
+#include "tail-batcher.h"
 #include <kj/debug.h>
 #include <kj/compat/http.h>
 #include <kj/compat/tls.h>
@@ -13,13 +19,16 @@
 #include <workerd/io/worker-entrypoint.h>
 #include <workerd/io/compatibility-date.h>
 #include <workerd/io/io-context.h>
+#include <workerd/io/subrequest-timing.h>
 #include <workerd/io/worker.h>
+#include <workerd/util/telemetry-util.h>
 #include <time.h>
 #include <openssl/bio.h>
 #include <openssl/pem.h>
 #include <workerd/io/actor-cache.h>
 #include <workerd/io/actor-sqlite.h>
 #include <workerd/api/actor-state.h>
+#include <workerd/api/trace.h>
 #include "workerd-api.h"
 
 namespace workerd::server {
@@ -80,35 +89,6 @@ static kj::String httpTime(kj::Date date) {
   return kj::heapString(buf, n);
 }
 
-static kj::Vector<char> escapeJsonString(kj::StringPtr text) {
-  static const char HEXDIGITS[] = "0123456789abcdef";
-  kj::Vector<char> escaped(text.size() + 1);
-
-  for (char c: text) {
-    switch (c) {
-      case '\"': escaped.addAll(kj::StringPtr("\\\"")); break;
-      case '\\': escaped.addAll(kj::StringPtr("\\\\")); break;
-      case '\b': escaped.addAll(kj::StringPtr("\\b")); break;
-      case '\f': escaped.addAll(kj::StringPtr("\\f")); break;
-      case '\n': escaped.addAll(kj::StringPtr("\\n")); break;
-      case '\r': escaped.addAll(kj::StringPtr("\\r")); break;
-      case '\t': escaped.addAll(kj::StringPtr("\\t")); break;
-      default:
-        if (static_cast<uint8_t>(c) < 0x20) {
-          escaped.addAll(kj::StringPtr("\\u00"));
-          uint8_t c2 = c;
-          escaped.add(HEXDIGITS[c2 / 16]);
-          escaped.add(HEXDIGITS[c2 % 16]);
-        } else {
-          escaped.add(c);
-        }
-        break;
-    }
-  }
-
-  return escaped;
-}
-
 class EmptyReadOnlyActorStorageImpl final: public rpc::ActorStorage::Stage::Server {
   // An ActorStorage implementation which will always respond to reads as if the state is empty,
   // and will fail any writes.
@@ -174,6 +154,16 @@ struct Server::GlobalContext {
   ThreadContext threadContext;
   kj::HttpHeaderTable& headerTable;
 
+  kj::Maybe<kj::Own<CpuWatchdog>> cpuWatchdog;
+  // Created when the first Worker with a CPU limit or slow turn warning is configured.
+
+  CpuWatchdog& getCpuWatchdog() {
+    KJ_IF_MAYBE(w, cpuWatchdog) {
+      return **w;
+    }
+    return *cpuWatchdog.emplace(kj::heap<CpuWatchdog>());
+  }
+
   GlobalContext(Server& server, jsg::V8System& v8System,
                 kj::HttpHeaderTable::Builder& headerTableBuilder)
       : v8System(v8System),
@@ -629,7 +619,8 @@ kj::Own<Server::Service> Server::makeExternalService(
       // We have to construct the rewriter upfront before waiting on any promises, since the
       // HeaderTable::Builder is only available synchronously.
       auto rewriter = kj::heap<HttpRewriter>(conf.getHttp(), headerTableBuilder);
-      auto addr = kj::heap<PromisedNetworkAddress>(network.parseAddress(addrStr, 80));
+      auto addr = newTimedNetworkAddress(
+          kj::heap<PromisedNetworkAddress>(network.parseAddress(addrStr, 80)), NetworkLayer::TCP);
       return kj::heap<ExternalHttpService>(
           kj::mv(addr), kj::mv(rewriter), globalContext->headerTable, timer, entropySource);
     }
@@ -716,16 +707,18 @@ private:
 };
 
 kj::Own<Server::Service> Server::makeNetworkService(config::Network::Reader conf) {
-  auto restrictedNetwork = network.restrictPeers(
+  auto restrictedNetwork = newTimedNetwork(network.restrictPeers(
       KJ_MAP(a, conf.getAllow()) -> kj::StringPtr { return a; },
-      KJ_MAP(a, conf.getDeny() ) -> kj::StringPtr { return a; });
+      KJ_MAP(a, conf.getDeny() ) -> kj::StringPtr { return a; }), NetworkLayer::TCP);
 
   kj::Maybe<kj::Own<kj::Network>> tlsNetwork;
   kj::Maybe<kj::SecureNetworkWrapper&> tlsContext;
   if (conf.hasTlsOptions()) {
     auto ownedTlsContext = makeTlsContext(conf.getTlsOptions());
     tlsContext = ownedTlsContext;
-    tlsNetwork = ownedTlsContext->wrapNetwork(*restrictedNetwork).attach(kj::mv(ownedTlsContext));
+    tlsNetwork = newTimedNetwork(
+        ownedTlsContext->wrapNetwork(*restrictedNetwork).attach(kj::mv(ownedTlsContext)),
+        NetworkLayer::TLS);
   }
 
   return kj::heap<NetworkService>(globalContext->headerTable, timer, entropySource,
@@ -1148,8 +1141,7 @@ kj::Own<Server::InspectorService> Server::makeInspectorService(
 // =======================================================================================
 
 class Server::WorkerService final: public Service, private kj::TaskSet::ErrorHandler,
-                                   private IoChannelFactory, private TimerChannel,
-                                   private LimitEnforcer {
+                                   private IoChannelFactory, private TimerChannel {
 public:
   class ActorNamespace;
 
@@ -1159,7 +1151,10 @@ public:
     kj::Array<kj::Maybe<ActorNamespace&>> actor;  // null = configuration error
     kj::Maybe<Service&> cache;
     kj::Maybe<kj::Own<SqliteDatabase::Vfs>> actorStorage;
+    uint actorStorageShards = 0;  // zero = a database per actor
     AlarmScheduler& alarmScheduler;
+    kj::Maybe<kj::Own<SpanExporter::Sink>> spanSink;
+    kj::Array<Service*> tails;
   };
   using LinkCallback = kj::Function<LinkedIoChannels(WorkerService&)>;
 
@@ -1167,12 +1162,24 @@ public:
                 kj::Maybe<kj::HashSet<kj::String>> defaultEntrypointHandlers,
                 kj::HashMap<kj::String, kj::HashSet<kj::String>> namedEntrypointsParam,
                 const kj::HashMap<kj::String, ActorConfig>& actorClasses,
-                LinkCallback linkCallback)
+                LinkCallback linkCallback,
+                const WorkerdIsolateLimitEnforcer& isolateLimitEnforcer,
+                WorkerdLimitEnforcer::Limits limits,
+                kj::Maybe<CpuWatchdog&> cpuWatchdog,
+                kj::Maybe<kj::Own<SpanExporter>> spanExporter,
+                TailBatcher::Options tailOptions,
+                kj::Maybe<kj::Own<CpuSampler>> cpuSampler)
       : threadContext(threadContext),
         ioChannels(kj::mv(linkCallback)),
+        isolateLimitEnforcer(isolateLimitEnforcer),
+        requestLimits(kj::mv(limits)),
+        cpuWatchdog(cpuWatchdog),
+        spanExporter(kj::mv(spanExporter)),
         worker(kj::mv(worker)),
         defaultEntrypointHandlers(kj::mv(defaultEntrypointHandlers)),
-        waitUntilTasks(*this) {
+        waitUntilTasks(*this),
+        tailOptions(kj::mv(tailOptions)),
+        cpuSampler(kj::mv(cpuSampler)) {
     namedEntrypoints.reserve(namedEntrypointsParam.size());
     for (auto& ep: namedEntrypointsParam) {
       kj::StringPtr epPtr = ep.key;
@@ -1198,6 +1205,20 @@ public:
     LinkCallback callback = kj::mv(KJ_REQUIRE_NONNULL(
         ioChannels.tryGet<LinkCallback>(), "already called link()"));
     ioChannels = callback(*this);
+
+    KJ_IF_MAYBE(exporter, spanExporter) {
+      auto& channels = KJ_ASSERT_NONNULL(ioChannels.tryGet<LinkedIoChannels>());
+      KJ_IF_MAYBE(sink, channels.spanSink) {
+        waitUntilTasks.add((*exporter)->run(threadContext.getUnsafeTimer(), **sink));
+      }
+    }
+
+    if (KJ_ASSERT_NONNULL(ioChannels.tryGet<LinkedIoChannels>()).tails.size() > 0) {
+      tailBatcher = kj::heap<TailBatcher>(kj::mv(tailOptions), threadContext.getUnsafeTimer(),
+          [this](kj::Array<kj::Own<Trace>> traces) {
+        return deliverTraces(kj::mv(traces));
+      });
+    }
   }
 
   kj::Maybe<ActorNamespace&> getActorNamespace(kj::StringPtr name) {
@@ -1212,6 +1233,14 @@ public:
     return actorNamespaces;
   }
 
+  kj::Maybe<CpuSampler&> getCpuSampler() {
+    KJ_IF_MAYBE(s, cpuSampler) {
+      return **s;
+    } else {
+      return nullptr;
+    }
+  }
+
   kj::Own<WorkerInterface> startRequest(
       IoChannelFactory::SubrequestMetadata metadata) override {
     return startRequest(kj::mv(metadata), nullptr);
@@ -1228,21 +1257,102 @@ public:
   kj::Own<WorkerInterface> startRequest(
       IoChannelFactory::SubrequestMetadata metadata, kj::Maybe<kj::StringPtr> entrypointName,
       kj::Maybe<kj::Own<Worker::Actor>> actor = nullptr) {
+    kj::Maybe<kj::Own<SpanObserver>> traceRoot;
+    KJ_IF_MAYBE(exporter, spanExporter) {
+      traceRoot = (*exporter)->tryStartTrace();
+    }
+
+    kj::Maybe<kj::Own<WorkerTracer>> workerTracer;
+    KJ_IF_MAYBE(batcher, tailBatcher) {
+      workerTracer = (*batcher)->makeWorkerTracer();
+    }
+
     return WorkerEntrypoint::construct(
         threadContext,
         kj::atomicAddRef(*worker),
         entrypointName,
         kj::mv(actor),
-        kj::Own<LimitEnforcer>(this, kj::NullDisposer::instance),
+        kj::heap<WorkerdLimitEnforcer>(requestLimits, limitCounters, isolateLimitEnforcer,
+                                       threadContext.getUnsafeTimer(), cpuWatchdog),
         {},                        // ioContextDependency
         kj::Own<IoChannelFactory>(this, kj::NullDisposer::instance),
-        kj::refcounted<RequestObserver>(),  // default observer makes no observations
+        kj::refcounted<WorkerdRequestObserver>(getRequestMetrics(entrypointName),
+                                               kj::mv(traceRoot)),
         waitUntilTasks,
         true,                      // tunnelExceptions
-        nullptr,                   // workerTracer
+        kj::mv(workerTracer),
         kj::mv(metadata.cfBlobJson));
   }
 
+  void writeMetrics(PrometheusTextWriter& writer, kj::StringPtr serviceName) {
+    // Appends this Worker's metrics, labeled with `serviceName`, for the `metrics` service.
+
+    for (auto& entry: requestMetrics) {
+      entry.value->write(writer, serviceName, entry.key);
+    }
+    for (auto& entry: actorNamespaces) {
+      entry.value->writeMetrics(writer, serviceName);
+    }
+
+    kj::downcast<const WorkerdIsolateObserver>(worker->getIsolate().getMetrics())
+        .write(writer, serviceName);
+
+    auto writeExceeded = [&](kj::StringPtr limit, const uint64_t& counter) {
+      writer.addCounter("workerd_limit_exceeded_total", "Requests cut short by a limit.",
+                        {{"service", serviceName}, {"limit", limit}}, readCounter(counter));
+    };
+    writeExceeded("cpu", limitCounters.exceededCpu);
+    writeExceeded("memory", limitCounters.exceededMemory);
+    writeExceeded("wallTime", limitCounters.exceededWallTime);
+    writeExceeded("subrequests", limitCounters.exceededSubrequests);
+
+    writer.addHistogram("workerd_js_turn_duration_seconds",
+                        "CPU time spent running JavaScript per entry, during which nothing "
+                        "else on the thread can run.",
+                        {{"service", serviceName}}, limitCounters.jsTurns.snapshot());
+    writer.addCounter("workerd_slow_js_turns_total",
+                      "JavaScript turns which used more CPU time than slowTurnWarningMs.",
+                      {{"service", serviceName}}, readCounter(limitCounters.slowTurns));
+
+    auto cacheStats = worker->getIsolate().getActorCacheStats();
+    writer.addCounter("workerd_actor_cache_hits_total",
+                      "Durable Object storage reads served from the in-memory cache.",
+                      {{"service", serviceName}}, cacheStats.hits);
+    writer.addCounter("workerd_actor_cache_evictions_total",
+                      "Clean entries evicted from the Durable Object storage cache, to stay "
+                      "under its memory limit or because they went stale.",
+                      {{"service", serviceName}}, cacheStats.evictions);
+    writer.addCounter("workerd_actor_cache_lock_wait_seconds_total",
+                      "Estimated time spent waiting for the Durable Object storage cache's lock.",
+                      {{"service", serviceName}}, cacheStats.lockWait);
+    writer.addCounter("workerd_actor_cache_prefetches_total",
+                      "Pages of paginated Durable Object storage list()s read ahead into cache.",
+                      {{"service", serviceName}}, cacheStats.prefetches);
+    writer.addCounter("workerd_actor_cache_prefetch_hits_total",
+                      "Pages read ahead that were then served entirely from cache.",
+                      {{"service", serviceName}}, cacheStats.prefetchHits);
+    writer.addGauge("workerd_actor_cache_prefetch_hit_ratio",
+                    "Fraction of pages read ahead that were then served entirely from cache; zero "
+                    "until anything has been read ahead.",
+                    {{"service", serviceName}},
+                    cacheStats.prefetches == 0
+                        ? 0.0 : double(cacheStats.prefetchHits) / cacheStats.prefetches);
+    writer.addHistogram("workerd_actor_storage_flush_duration_seconds",
+                        "Time from scheduling a Durable Object storage flush until it completed. "
+                        "Writes that wait for confirmation hold the output gate for this long.",
+                        {{"service", serviceName}}, cacheStats.flushDuration);
+
+    KJ_IF_MAYBE(exporter, spanExporter) {
+      (*exporter)->write(writer, serviceName);
+    }
+    KJ_IF_MAYBE(batcher, tailBatcher) {
+      (*batcher)->write(writer, serviceName);
+    }
+    KJ_IF_MAYBE(sampler, cpuSampler) {
+      (*sampler)->write(writer, serviceName);
+    }
+  }
+
   class ActorNamespace final: private kj::TaskSet::ErrorHandler {
   public:
     ActorNamespace(WorkerService& service, kj::StringPtr className, const ActorConfig& config)
@@ -1250,6 +1360,10 @@ public:
 
     const ActorConfig& getConfig() { return config; }
 
+    void writeMetrics(PrometheusTextWriter& writer, kj::StringPtr serviceName) const {
+      metrics.write(writer, serviceName, className);
+    }
+
     kj::Own<WorkerInterface> getActor(Worker::Actor::Id id,
         IoChannelFactory::SubrequestMetadata metadata) {
       kj::String idStr;
@@ -1286,8 +1400,21 @@ public:
     kj::StringPtr className;
     const ActorConfig& config;
     kj::HashMap<kj::String, kj::Own<Worker::Actor>> actors;
+    kj::HashMap<uint, kj::Own<ActorSqliteShard>> shards;
+    // Opened as needed when `durableObjectStorageShards` is set. Actors hold references too.
+    ActorMetrics metrics;
     kj::TaskSet onBrokenTasks;
 
+    ActorSqliteShard& getShard(const SqliteDatabase::Vfs& vfs, kj::StringPtr uniqueKey,
+                               uint index) {
+      return *shards.findOrCreate(index, [&]() -> decltype(shards)::Entry {
+        auto db = kj::heap<SqliteDatabase>(vfs,
+            kj::Path({uniqueKey, kj::str("shard-", index, ".sqlite")}),
+            kj::WriteMode::CREATE | kj::WriteMode::MODIFY | kj::WriteMode::CREATE_PARENT);
+        return { index, kj::refcounted<ActorSqliteShard>(kj::mv(db)) };
+      });
+    }
+
     void taskFailed(kj::Exception&& exception) override {
       // Error from `actors.erase()`?
       KJ_LOG(ERROR, exception);
@@ -1368,12 +1495,20 @@ public:
                   .uniqueKey = d.uniqueKey, .actorId = id
                 });
 
+                if (channels.actorStorageShards > 0) {
+                  auto& shard = getShard(**as, d.uniqueKey,
+                      ActorSqliteShard::shardFor(id, channels.actorStorageShards));
+                  return kj::heap<ActorSqlite>(shard, id, outputGate,
+                      []() -> kj::Promise<void> { return kj::READY_NOW; },
+                      *sqliteHooks, sharedLru).attach(kj::mv(sqliteHooks), kj::addRef(shard));
+                }
+
                 auto db = kj::heap<SqliteDatabase>(**as,
                     kj::Path({d.uniqueKey, kj::str(id, ".sqlite")}),
                     kj::WriteMode::CREATE | kj::WriteMode::MODIFY | kj::WriteMode::CREATE_PARENT);
                 return kj::heap<ActorSqlite>(kj::mv(db), outputGate,
                     []() -> kj::Promise<void> { return kj::READY_NOW; },
-                    *sqliteHooks).attach(kj::mv(sqliteHooks));
+                    *sqliteHooks, sharedLru).attach(kj::mv(sqliteHooks));
               } else {
                 // Create an ActorCache backed by a fake, empty storage. Elsewhere, we configure
                 // ActorCache never to flush, so this effectively creates in-memory storage.
@@ -1397,7 +1532,7 @@ public:
           auto newActor = kj::refcounted<Worker::Actor>(
               *service.worker, nullptr, kj::str(id), true, kj::mv(makeActorCache),
               className, kj::mv(makeStorage), lock, kj::mv(loopback),
-              timerChannel, kj::refcounted<ActorObserver>(), nullptr, nullptr);
+              timerChannel, kj::refcounted<WorkerdActorObserver>(metrics), nullptr, nullptr);
 
           // If the actor becomes broken, remove it from the map, so a new one will be created
           // next time.
@@ -1446,12 +1581,49 @@ private:
   kj::OneOf<LinkCallback, LinkedIoChannels> ioChannels;
   // LinkedIoChannels owns the SqliteDatabase::Vfs, so make sure it is destroyed last.
 
+  const WorkerdIsolateLimitEnforcer& isolateLimitEnforcer;  // owned by `worker`'s isolate
+  WorkerdLimitEnforcer::Limits requestLimits;
+  WorkerdLimitEnforcer::Counters limitCounters;
+  kj::Maybe<CpuWatchdog&> cpuWatchdog;
+  // Shared by the WorkerdLimitEnforcers of all requests to this Worker.
+
+  kj::HashMap<kj::String, kj::Own<RequestMetrics>> requestMetrics;
+  // Keyed by entrypoint name, or "default". Owned indirectly since observers hold references.
+
+  kj::Maybe<kj::Own<SpanExporter>> spanExporter;
+  // Non-null if tracing is configured. Its flush loop runs in `waitUntilTasks`.
+
   kj::Own<const Worker> worker;
   kj::Maybe<kj::HashSet<kj::String>> defaultEntrypointHandlers;
   kj::HashMap<kj::String, EntrypointService> namedEntrypoints;
   kj::HashMap<kj::StringPtr, kj::Own<ActorNamespace>> actorNamespaces;
   kj::TaskSet waitUntilTasks;
 
+  TailBatcher::Options tailOptions;
+  kj::Maybe<kj::Own<TailBatcher>> tailBatcher;
+  // Non-null if this Worker has tail Workers. Created at link time.
+
+  kj::Maybe<kj::Own<CpuSampler>> cpuSampler;
+  // Non-null if `cpuProfiling` is configured, whether or not profiling is currently running.
+
+  kj::Promise<void> deliverTraces(kj::Array<kj::Own<Trace>> traces) {
+    auto& channels = KJ_ASSERT_NONNULL(ioChannels.tryGet<LinkedIoChannels>());
+    auto promises = KJ_MAP(tail, channels.tails) -> kj::Promise<void> {
+      auto worker = tail->startRequest({});
+      auto event = kj::heap<api::TraceCustomEventImpl>(
+          TailBatcher::TRACE_EVENT_TYPE, waitUntilTasks, mapAddRef(traces));
+      return worker->customEvent(kj::mv(event)).ignoreResult().attach(kj::mv(worker));
+    };
+    return kj::joinPromises(kj::mv(promises));
+  }
+
+  RequestMetrics& getRequestMetrics(kj::Maybe<kj::StringPtr> entrypointName) {
+    kj::StringPtr name = entrypointName.orDefault("default"_kj);
+    return *requestMetrics.findOrCreate(name, [&]() {
+      return decltype(requestMetrics)::Entry { kj::str(name), kj::heap<RequestMetrics>() };
+    });
+  }
+
   class ActorChannelImpl final: public IoChannelFactory::ActorChannel {
   public:
     ActorChannelImpl(ActorNamespace& ns, Worker::Actor::Id id)
@@ -1607,24 +1779,6 @@ private:
   kj::Promise<void> afterLimitTimeout(kj::Duration t) override {
     return threadContext.getUnsafeTimer().afterDelay(t);
   }
-
-  // ---------------------------------------------------------------------------
-  // implements LimitEnforcer
-  //
-  // No limits are enforced.
-
-  kj::Own<void> enterJs(jsg::Lock& lock, IoContext& context) override { return {}; }
-  void topUpActor() override {}
-  void newSubrequest(bool isInHouse) override {}
-  void newKvRequest(KvOpType op) override {}
-  void newAnalyticsEngineRequest() override {}
-  kj::Promise<void> limitDrain() override { return kj::NEVER_DONE; }
-  kj::Promise<void> limitScheduled() override { return kj::NEVER_DONE; }
-  size_t getBufferingLimit() override { return kj::maxValue; }
-  kj::Maybe<EventOutcome> getLimitsExceeded() override { return nullptr; }
-  kj::Promise<void> onLimitsExceeded() override { return kj::NEVER_DONE; }
-  void requireLimitsNotExceeded() override {}
-  void reportMetrics(RequestObserver& requestMetrics) override {}
 };
 
 struct FutureSubrequestChannel {
@@ -1943,52 +2097,18 @@ kj::Own<Server::Service> Server::makeWorker(kj::StringPtr name, config::Worker::
     errorReporter.addError(kj::str("Worker must specify compatibiltyDate."));
   }
 
-  class NullIsolateLimitEnforcer final: public IsolateLimitEnforcer {
-    // IsolateLimitEnforcer that enforces no limits.
-  public:
-    v8::Isolate::CreateParams getCreateParams() override { return {}; }
-    void customizeIsolate(v8::Isolate* isolate) override {}
-    ActorCacheSharedLruOptions getActorCacheLruOptions() override {
-      // TODO(someday): Make this configurable?
-      return {
-        .softLimit = 16 * (1ull << 20), // 16 MiB
-        .hardLimit = 128 * (1ull << 20), // 128 MiB
-        .staleTimeout = 30 * kj::SECONDS,
-        .dirtyListByteLimit = 8 * (1ull << 20), // 8 MiB
-        .maxKeysPerRpc = 128,
-
-        // For now, we use `neverFlush` to implement in-memory-only actors.
-        // See WorkerService::getActor().
-        .neverFlush = true
-      };
-    }
-    kj::Own<void> enterStartupJs(
-        jsg::Lock& lock, kj::Maybe<kj::Exception>& error) const override {
-      return {};
-    }
-    kj::Own<void> enterDynamicImportJs(
-        jsg::Lock& lock, kj::Maybe<kj::Exception>& error) const override {
-      return {};
-    }
-    kj::Own<void> enterLoggingJs(
-        jsg::Lock& lock, kj::Maybe<kj::Exception>& error) const override {
-      return {};
-    }
-    kj::Own<void> enterInspectorJs(
-        jsg::Lock& loc, kj::Maybe<kj::Exception>& error) const override {
-      return {};
-    }
-    void completedRequest(kj::StringPtr id) const override {}
-    bool exitJs(jsg::Lock& lock) const override { return false; }
-    void reportMetrics(IsolateObserver& isolateMetrics) const override {}
-  };
+  kj::Maybe<kj::Duration> gcPauseWarning;
+  if (conf.getGcPauseWarningMs() > 0) {
+    gcPauseWarning = conf.getGcPauseWarningMs() * kj::MILLISECONDS;
+  }
 
-  auto limitEnforcer = kj::heap<NullIsolateLimitEnforcer>();
+  auto limitEnforcer = kj::heap<WorkerdIsolateLimitEnforcer>(conf.getLimits());
+  auto& isolateLimitEnforcer = *limitEnforcer;
   auto api = kj::heap<WorkerdApiIsolate>(globalContext->v8System,
       featureFlags.asReader(), *limitEnforcer);
   auto isolate = kj::atomicRefcounted<Worker::Isolate>(
       kj::mv(api),
-      kj::atomicRefcounted<IsolateObserver>(),
+      kj::atomicRefcounted<WorkerdIsolateObserver>(kj::str(name), gcPauseWarning),
       name,
       kj::mv(limitEnforcer),
       // For workerd, if the inspector is enabled, it is always fully trusted.
@@ -1996,6 +2116,12 @@ kj::Own<Server::Service> Server::makeWorker(kj::StringPtr name, config::Worker::
           Worker::Isolate::InspectorPolicy::ALLOW_FULLY_TRUSTED :
           Worker::Isolate::InspectorPolicy::DISALLOW);
 
+  if (conf.getSchedulingWeight() == 0) {
+    errorReporter.addError(kj::str("schedulingWeight must be at least 1."));
+  } else {
+    isolate->setSchedulingWeight(conf.getSchedulingWeight());
+  }
+
   // If we are using the inspector, we need to register the Worker::Isolate
   // with the inspector service.
   KJ_IF_MAYBE(inspector, maybeInspectorService) {
@@ -2036,6 +2162,11 @@ kj::Own<Server::Service> Server::makeWorker(kj::StringPtr name, config::Worker::
     lock.validateHandlers(errorReporter);
   }
 
+  kj::Maybe<CpuWatchdog&> cpuWatchdog;
+  if (conf.getLimits().getCpuMs() > 0 || conf.getSlowTurnWarningMs() > 0) {
+    cpuWatchdog = globalContext->getCpuWatchdog();
+  }
+
   auto linkCallback =
       [this, name, conf, subrequestChannels = kj::mv(subrequestChannels),
        actorChannels = kj::mv(actorChannels)](WorkerService& workerService) mutable {
@@ -2102,6 +2233,12 @@ kj::Own<Server::Service> Server::makeWorker(kj::StringPtr name, config::Worker::
       }
     }
 
+    result.actorStorageShards = conf.getDurableObjectStorageShards();
+    if (result.actorStorageShards > 0 && !actorStorageConf.isLocalDisk()) {
+      reportConfigError(kj::str("service ", name, ": durableObjectStorageShards only applies "
+          "to localDisk storage."));
+    }
+
     kj::HashMap<kj::StringPtr, WorkerService::ActorNamespace&> durableNamespacesByUniqueKey;
     for(auto& [className, ns] : workerService.getActorNamespaces()) {
       KJ_IF_MAYBE(config, ns->getConfig().tryGet<Server::Durable>()) {
@@ -2114,17 +2251,230 @@ kj::Own<Server::Service> Server::makeWorker(kj::StringPtr name, config::Worker::
       }
     }
 
+    result.tails = KJ_MAP(tail, conf.getTails()) -> Service* {
+      if (tail.getName() == name) {
+        reportConfigError(kj::str("service ", name, ": a Worker cannot be its own tail Worker."));
+      }
+      return &lookupService(tail, kj::str("Worker \"", name, "\"'s tails"));
+    };
+
+    auto tracingConf = conf.getTracing();
+    auto exporterConf = tracingConf.getExporter();
+    switch (exporterConf.which()) {
+      case config::Worker::Tracing::Exporter::NONE:
+        break;
+      case config::Worker::Tracing::Exporter::SERVICE: {
+        Service& collector = lookupService(exporterConf.getService(),
+            kj::str("Worker \"", name, "\"'s tracing exporter"));
+        result.spanSink = kj::heap<HttpSpanSink>([&collector]() {
+          return collector.startRequest({});
+        }, globalContext->headerTable);
+        break;
+      }
+      case config::Worker::Tracing::Exporter::PATH: {
+        kj::StringPtr pathStr = exporterConf.getPath();
+        auto path = fs.getCurrentPath().evalNative(pathStr);
+        KJ_IF_MAYBE(file, fs.getRoot().tryAppendFile(kj::mv(path),
+            kj::WriteMode::CREATE | kj::WriteMode::MODIFY | kj::WriteMode::CREATE_PARENT)) {
+          result.spanSink = kj::heap<FileSpanSink>(kj::mv(*file));
+        } else {
+          reportConfigError(kj::str("service ", name, ": tracing exporter path could not be "
+              "opened for writing: ", pathStr));
+        }
+        break;
+      }
+    }
+
     return result;
   };
 
+  kj::Maybe<kj::Own<SpanExporter>> spanExporter;
+  auto tracingConf = conf.getTracing();
+  if (!tracingConf.getExporter().isNone()) {
+    if (!(tracingConf.getSampleRate() >= 0 && tracingConf.getSampleRate() <= 1)) {
+      errorReporter.addError(kj::str("tracing.sampleRate must be between 0 and 1."));
+    } else if (tracingConf.getBufferSize() == 0 || tracingConf.getMaxBatchSize() == 0 ||
+               tracingConf.getFlushIntervalMs() == 0) {
+      errorReporter.addError(kj::str(
+          "tracing.bufferSize, maxBatchSize and flushIntervalMs must be at least 1."));
+    } else {
+      spanExporter = kj::refcounted<SpanExporter>(SpanExporter::Options {
+        .serviceName = kj::str(name),
+        .sampleRate = tracingConf.getSampleRate(),
+        .bufferSize = tracingConf.getBufferSize(),
+        .maxBatchSize = tracingConf.getMaxBatchSize(),
+        .flushInterval = tracingConf.getFlushIntervalMs() * kj::MILLISECONDS,
+      }, entropySource);
+    }
+  }
+
+  auto tailBatchingConf = conf.getTailBatching();
+  if (tailBatchingConf.getMaxBatchSize() == 0 || tailBatchingConf.getMaxBatchDelayMs() == 0 ||
+      tailBatchingConf.getMaxPendingTraces() == 0) {
+    errorReporter.addError(kj::str(
+        "tailBatching.maxBatchSize, maxBatchDelayMs and maxPendingTraces must be at least 1."));
+  }
+  TailBatcher::Options tailOptions {
+    .scriptName = kj::str(name),
+    .maxBatchSize = kj::max(tailBatchingConf.getMaxBatchSize(), 1u),
+    .maxBatchDelay = kj::max(tailBatchingConf.getMaxBatchDelayMs(), 1u) * kj::MILLISECONDS,
+    .maxPendingTraces = kj::max(tailBatchingConf.getMaxPendingTraces(), 1u),
+  };
+
+  kj::Maybe<kj::Own<CpuSampler>> cpuSampler;
+  auto profilingConf = conf.getCpuProfiling();
+  if (profilingConf.hasPath()) {
+    kj::StringPtr pathStr = profilingConf.getPath();
+    if (profilingConf.getSamplingIntervalUs() == 0 || profilingConf.getWriteIntervalMs() == 0) {
+      errorReporter.addError(kj::str(
+          "cpuProfiling.samplingIntervalUs and writeIntervalMs must be at least 1."));
+    } else KJ_IF_MAYBE(file, fs.getRoot().tryOpenFile(fs.getCurrentPath().evalNative(pathStr),
+        kj::WriteMode::CREATE | kj::WriteMode::MODIFY | kj::WriteMode::CREATE_PARENT)) {
+      auto sampler = kj::heap<CpuSampler>(CpuSampler::Options {
+        .serviceName = kj::str(name),
+        .samplingInterval = profilingConf.getSamplingIntervalUs() * kj::MICROSECONDS,
+        .writeInterval = profilingConf.getWriteIntervalMs() * kj::MILLISECONDS,
+      }, kj::atomicAddRef(*worker), globalContext->threadContext.getUnsafeTimer(), kj::mv(*file));
+      if (profilingConf.getStartEnabled()) {
+        sampler->start();
+      }
+      cpuSampler = kj::mv(sampler);
+    } else {
+      errorReporter.addError(kj::str(
+          "cpuProfiling.path could not be opened for writing: ", pathStr));
+    }
+  }
+
   return kj::heap<WorkerService>(globalContext->threadContext, kj::mv(worker),
                                  kj::mv(errorReporter.defaultEntrypoint),
                                  kj::mv(errorReporter.namedEntrypoints), localActorConfigs,
-                                 kj::mv(linkCallback));
+                                 kj::mv(linkCallback), isolateLimitEnforcer,
+                                 WorkerdLimitEnforcer::Limits(conf, name),
+                                 cpuWatchdog, kj::mv(spanExporter), kj::mv(tailOptions),
+                                 kj::mv(cpuSampler));
 }
 
 // =======================================================================================
 
+class Server::MetricsService final: public Service, private WorkerInterface {
+  // Service used when the service is configured as a metrics service. Renders the metrics
+  // collected by every Worker's observers on each GET, and switches CPU profiling on and off on
+  // `POST /cpu-profiling/start` and `POST /cpu-profiling/stop`.
+
+public:
+  MetricsService(kj::HashMap<kj::String, kj::Own<Service>>& services,
+                 const kj::HttpHeaderTable& headerTable, kj::Timer& timer)
+      : services(services), headerTable(headerTable), timer(timer) {}
+
+  void link() override {
+    lagProbe = lagMonitor.run(timer, LAG_PROBE_INTERVAL).eagerlyEvaluate([](kj::Exception&& e) {
+      KJ_LOG(ERROR, "event loop lag monitor failed", e);
+    });
+  }
+
+  kj::Own<WorkerInterface> startRequest(IoChannelFactory::SubrequestMetadata metadata) override {
+    return { this, kj::NullDisposer::instance };
+  }
+
+  bool hasHandler(kj::StringPtr handlerName) override {
+    return handlerName == "fetch"_kj;
+  }
+
+private:
+  kj::HashMap<kj::String, kj::Own<Service>>& services;
+  const kj::HttpHeaderTable& headerTable;
+  kj::Timer& timer;
+
+  static constexpr kj::Duration LAG_PROBE_INTERVAL = 100 * kj::MILLISECONDS;
+  EventLoopLagMonitor lagMonitor;
+  kj::Maybe<kj::Promise<void>> lagProbe;
+
+  kj::Promise<void> request(
+      kj::HttpMethod method, kj::StringPtr urlStr, const kj::HttpHeaders& headers,
+      kj::AsyncInputStream& requestBody, kj::HttpService::Response& response) override {
+    if (method == kj::HttpMethod::POST) {
+      auto url = kj::Url::parse(urlStr, kj::Url::HTTP_REQUEST);
+      if (url.path.size() == 2 && url.path[0] == "cpu-profiling" &&
+          (url.path[1] == "start" || url.path[1] == "stop")) {
+        return toggleCpuProfiling(url.path[1] == "start", response);
+      }
+    }
+    if (method != kj::HttpMethod::GET && method != kj::HttpMethod::HEAD) {
+      return response.sendError(405, "Method Not Allowed", headerTable);
+    }
+
+    PrometheusTextWriter writer;
+    lagMonitor.write(writer);
+    for (auto& entry: services) {
+      KJ_IF_MAYBE(worker, kj::dynamicDowncastIfAvailable<WorkerService>(*entry.value)) {
+        worker->writeMetrics(writer, entry.key);
+      }
+    }
+    auto content = writer.finish();
+
+    kj::HttpHeaders responseHeaders(headerTable);
+    responseHeaders.set(kj::HttpHeaderId::CONTENT_TYPE, "text/plain; version=0.0.4");
+    auto out = response.send(200, "OK", responseHeaders, content.size());
+
+    if (method == kj::HttpMethod::HEAD) {
+      return kj::READY_NOW;
+    } else {
+      return out->write(content.begin(), content.size())
+          .attach(kj::mv(content), kj::mv(out));
+    }
+  }
+
+  kj::Promise<void> toggleCpuProfiling(bool start, kj::HttpService::Response& response) {
+    // Responds with the names of the affected Workers, one per line.
+
+    kj::Vector<kj::String> lines;
+    for (auto& entry: services) {
+      KJ_IF_MAYBE(worker, kj::dynamicDowncastIfAvailable<WorkerService>(*entry.value)) {
+        KJ_IF_MAYBE(sampler, worker->getCpuSampler()) {
+          if (start) {
+            sampler->start();
+          } else {
+            sampler->stop();
+          }
+          lines.add(kj::str(entry.key, '\n'));
+        }
+      }
+    }
+    auto content = kj::strArray(lines, "");
+
+    kj::HttpHeaders responseHeaders(headerTable);
+    responseHeaders.set(kj::HttpHeaderId::CONTENT_TYPE, "text/plain");
+    auto out = response.send(200, "OK", responseHeaders, content.size());
+    return out->write(content.begin(), content.size())
+        .attach(kj::mv(content), kj::mv(out));
+  }
+
+  kj::Promise<void> connect(kj::StringPtr host, const kj::HttpHeaders& headers,
+      kj::AsyncIoStream& connection, kj::HttpService::ConnectResponse& response,
+      kj::HttpConnectSettings settings) override {
+    throwUnsupported();
+  }
+  void prewarm(kj::StringPtr url) override {}
+  kj::Promise<ScheduledResult> runScheduled(kj::Date scheduledTime, kj::StringPtr cron) override {
+    throwUnsupported();
+  }
+  kj::Promise<AlarmResult> runAlarm(kj::Date scheduledTime) override {
+    throwUnsupported();
+  }
+  kj::Promise<CustomEvent::Result> customEvent(kj::Own<CustomEvent> event) override {
+    throwUnsupported();
+  }
+
+  [[noreturn]] void throwUnsupported() {
+    JSG_FAIL_REQUIRE(Error, "Metrics services don't support this event type.");
+  }
+};
+
+kj::Own<Server::Service> Server::makeMetricsService() {
+  return kj::heap<MetricsService>(services, globalContext->headerTable,
+                                  globalContext->threadContext.getUnsafeTimer());
+}
+
 kj::Own<Server::Service> Server::makeService(
     config::Service::Reader conf,
     kj::HttpHeaderTable::Builder& headerTableBuilder,
@@ -2148,6 +2498,9 @@ kj::Own<Server::Service> Server::makeService(
 
     case config::Service::DISK:
       return makeDiskDirectoryService(name, conf.getDisk(), headerTableBuilder);
+
+    case config::Service::METRICS:
+      return makeMetricsService();
   }
 
   reportConfigError(kj::str(
@@ -2199,16 +2552,18 @@ class Server::HttpListener final: public kj::Refcounted {
 public:
   HttpListener(Server& owner, kj::Own<kj::ConnectionReceiver> listener, Service& service,
                kj::StringPtr physicalProtocol, kj::Own<HttpRewriter> rewriter,
-               kj::HttpHeaderTable& headerTable, kj::Timer& timer)
+               kj::HttpHeaderTable& headerTable, kj::Timer& timer,
+               kj::Maybe<kj::Own<AccessLog>> accessLog, kj::StringPtr serviceName)
       : owner(owner), listener(kj::mv(listener)), service(service),
         headerTable(headerTable), timer(timer),
         physicalProtocol(physicalProtocol),
-        rewriter(kj::mv(rewriter)) {}
+        rewriter(kj::mv(rewriter)), accessLog(kj::mv(accessLog)), serviceName(serviceName) {}
 
   kj::Promise<void> run() {
     return listener->acceptAuthenticated()
         .then([this](kj::AuthenticatedStream stream) {
       kj::Maybe<kj::String> cfBlobJson;
+      kj::Maybe<kj::String> clientIp;
       if (!rewriter->hasCfBlobHeader()) {
         // Construct a cf blob describing the client identity.
 
@@ -2227,7 +2582,9 @@ public:
 
         KJ_IF_MAYBE(remote,
             kj::dynamicDowncastIfAvailable<kj::NetworkPeerIdentity>(*peerId)) {
-          cfBlobJson = kj::str("{\"clientIp\": \"", escapeJsonString(remote->toString()), "\"}");
+          auto address = remote->toString();
+          cfBlobJson = kj::str("{\"clientIp\": \"", escapeJsonString(address), "\"}");
+          clientIp = kj::mv(address);
         } else KJ_IF_MAYBE(local,
             kj::dynamicDowncastIfAvailable<kj::LocalPeerIdentity>(*peerId)) {
           auto creds = local->getCredentials();
@@ -2244,7 +2601,7 @@ public:
         }
       }
 
-      auto conn = kj::heap<Connection>(*this, kj::mv(cfBlobJson));
+      auto conn = kj::heap<Connection>(*this, kj::mv(cfBlobJson), kj::mv(clientIp));
 
       auto promise = kj::evalNow([&]() {
         return conn->listedHttp.httpServer.listenHttp(kj::mv(stream.stream))
@@ -2271,10 +2628,13 @@ private:
   kj::Timer& timer;
   kj::StringPtr physicalProtocol;
   kj::Own<HttpRewriter> rewriter;
+  kj::Maybe<kj::Own<AccessLog>> accessLog;
+  kj::StringPtr serviceName;
 
   struct Connection final: public kj::HttpService, public kj::HttpServerErrorHandler {
-    Connection(HttpListener& parent, kj::Maybe<kj::String> cfBlobJson)
-        : parent(parent), cfBlobJson(kj::mv(cfBlobJson)),
+    Connection(HttpListener& parent, kj::Maybe<kj::String> cfBlobJson,
+               kj::Maybe<kj::String> clientIp)
+        : parent(parent), cfBlobJson(kj::mv(cfBlobJson)), clientIp(kj::mv(clientIp)),
           listedHttp(parent.owner, parent.timer, parent.headerTable, *this, kj::HttpServerSettings {
             .errorHandler = *this,
             .webSocketCompressionMode = kj::HttpServerSettings::MANUAL_COMPRESSION
@@ -2282,6 +2642,8 @@ private:
 
     HttpListener& parent;
     kj::Maybe<kj::String> cfBlobJson;
+    kj::Maybe<kj::String> clientIp;
+    // The peer's address, if it's the one we put in the cf blob. Only used for the access log.
     ListedHttpServer listedHttp;
 
     class ResponseWrapper final: public kj::HttpService::Response {
@@ -2308,12 +2670,151 @@ private:
       HttpRewriter& rewriter;
     };
 
+    class CountingInputStream final: public kj::AsyncInputStream {
+    public:
+      CountingInputStream(kj::AsyncInputStream& inner, uint64_t& count)
+          : inner(inner), count(count) {}
+
+      kj::Promise<size_t> tryRead(void* buffer, size_t minBytes, size_t maxBytes) override {
+        return inner.tryRead(buffer, minBytes, maxBytes).then([this](size_t n) {
+          count += n;
+          return n;
+        });
+      }
+
+      kj::Maybe<uint64_t> tryGetLength() override {
+        return inner.tryGetLength();
+      }
+
+    private:
+      kj::AsyncInputStream& inner;
+      uint64_t& count;
+    };
+
+    class CountingOutputStream final: public kj::AsyncOutputStream {
+    public:
+      CountingOutputStream(kj::Own<kj::AsyncOutputStream> inner, uint64_t& count)
+          : inner(kj::mv(inner)), count(count) {}
+
+      kj::Promise<void> write(const void* buffer, size_t size) override {
+        count += size;
+        return inner->write(buffer, size);
+      }
+
+      kj::Promise<void> write(kj::ArrayPtr<const kj::ArrayPtr<const kj::byte>> pieces) override {
+        for (auto& piece: pieces) {
+          count += piece.size();
+        }
+        return inner->write(pieces);
+      }
+
+      kj::Maybe<kj::Promise<uint64_t>> tryPumpFrom(
+          kj::AsyncInputStream& input, uint64_t amount) override {
+        // Let the inner stream optimize the pump if it can; otherwise the caller falls back to
+        // write(), which counts.
+        KJ_IF_MAYBE(promise, inner->tryPumpFrom(input, amount)) {
+          return promise->then([this](uint64_t n) {
+            count += n;
+            return n;
+          });
+        } else {
+          return nullptr;
+        }
+      }
+
+      kj::Promise<void> whenWriteDisconnected() override {
+        return inner->whenWriteDisconnected();
+      }
+
+    private:
+      kj::Own<kj::AsyncOutputStream> inner;
+      uint64_t& count;
+    };
+
+    struct LogRecorder final: public kj::HttpService::Response {
+      // Collects what the access log needs to know about one request while it passes through.
+
+      LogRecorder(kj::Timer& timer, kj::AsyncInputStream& requestBody,
+                  kj::HttpService::Response& inner)
+          : timer(timer), inner(inner), body(requestBody, requestBytes),
+            start(timer.now()), time(kj::systemPreciseCalendarClock().now()) {}
+
+      kj::Timer& timer;
+      kj::HttpService::Response& inner;
+      uint64_t requestBytes = 0;
+      uint64_t responseBytes = 0;
+      CountingInputStream body;
+
+      kj::TimePoint start;
+      kj::Date time;
+      uint status = 0;
+      kj::Maybe<kj::Duration> timeToFirstByte;
+
+      kj::Own<kj::AsyncOutputStream> send(
+          uint statusCode, kj::StringPtr statusText, const kj::HttpHeaders& headers,
+          kj::Maybe<uint64_t> expectedBodySize = nullptr) override {
+        status = statusCode;
+        timeToFirstByte = timer.now() - start;
+        return kj::heap<CountingOutputStream>(
+            inner.send(statusCode, statusText, headers, expectedBodySize), responseBytes);
+      }
+
+      kj::Own<kj::WebSocket> acceptWebSocket(const kj::HttpHeaders& headers) override {
+        status = 101;
+        timeToFirstByte = timer.now() - start;
+        return inner.acceptWebSocket(headers);
+      }
+    };
+
     // ---------------------------------------------------------------------------
     // implements kj::HttpService
 
     kj::Promise<void> request(
         kj::HttpMethod method, kj::StringPtr url, const kj::HttpHeaders& headers,
         kj::AsyncInputStream& requestBody, kj::HttpService::Response& response) override {
+      KJ_IF_MAYBE(log, parent.accessLog) {
+        if ((*log)->shouldSample()) {
+          return loggedRequest(**log, method, url, headers, requestBody, response);
+        }
+      }
+      return forwardRequest(method, url, headers, requestBody, response);
+    }
+
+    kj::Promise<void> loggedRequest(
+        AccessLog& log, kj::HttpMethod method, kj::StringPtr url, const kj::HttpHeaders& headers,
+        kj::AsyncInputStream& requestBody, kj::HttpService::Response& response) {
+      auto logged = kj::heap<LogRecorder>(parent.timer, requestBody, response);
+      auto& state = *logged;
+
+      auto finish = [this, &log, &state, method, url](bool failed) {
+        // A failed request with no response yet gets a 500 from handleApplicationError().
+        uint status = state.status == 0 && failed ? 500 : state.status;
+        log.log(AccessLog::Entry {
+          .time = state.time,
+          .service = parent.serviceName,
+          .method = method,
+          .url = url,
+          .status = status,
+          .requestBytes = state.requestBytes,
+          .responseBytes = state.responseBytes,
+          .timeToFirstByte = state.timeToFirstByte,
+          .duration = parent.timer.now() - state.start,
+          .clientIp = clientIp.map([](const kj::String& s) -> kj::StringPtr { return s; }),
+        });
+      };
+
+      return forwardRequest(method, url, headers, state.body, state)
+          .then([finish]() {
+        finish(false);
+      }, [finish](kj::Exception&& e) {
+        finish(true);
+        kj::throwFatalException(kj::mv(e));
+      }).attach(kj::mv(logged));
+    }
+
+    kj::Promise<void> forwardRequest(
+        kj::HttpMethod method, kj::StringPtr url, const kj::HttpHeaders& headers,
+        kj::AsyncInputStream& requestBody, kj::HttpService::Response& response) {
       IoChannelFactory::SubrequestMetadata metadata;
       metadata.cfBlobJson = cfBlobJson.map([](kj::StringPtr s) { return kj::str(s); });
 
@@ -2356,10 +2857,12 @@ private:
 
 kj::Promise<void> Server::listenHttp(
     kj::Own<kj::ConnectionReceiver> listener, Service& service,
-    kj::StringPtr physicalProtocol, kj::Own<HttpRewriter> rewriter) {
+    kj::StringPtr physicalProtocol, kj::Own<HttpRewriter> rewriter,
+    kj::Maybe<kj::Own<AccessLog>> accessLog, kj::StringPtr serviceName) {
   auto obj = kj::refcounted<HttpListener>(*this, kj::mv(listener), service,
                                           physicalProtocol, kj::mv(rewriter),
-                                          globalContext->headerTable, timer);
+                                          globalContext->headerTable, timer,
+                                          kj::mv(accessLog), serviceName);
   return obj->run().attach(kj::mv(obj));
 }
 
@@ -2508,13 +3011,13 @@ void Server::startServices(jsg::V8System& v8System, config::Config::Reader confi
 
   // Make the default "internet" service if it's not there already.
   services.findOrCreate("internet"_kj, [&]() {
-    auto publicNetwork = network.restrictPeers({"public"_kj});
+    auto publicNetwork = newTimedNetwork(network.restrictPeers({"public"_kj}), NetworkLayer::TCP);
 
     kj::TlsContext::Options options;
     options.useSystemTrustStore = true;
 
     kj::Own<kj::TlsContext> tls = kj::heap<kj::TlsContext>(kj::mv(options));
-    auto tlsNetwork = tls->wrapNetwork(*publicNetwork);
+    auto tlsNetwork = newTimedNetwork(tls->wrapNetwork(*publicNetwork), NetworkLayer::TLS);
 
     auto service = kj::heap<NetworkService>(
         globalContext->headerTable, timer, entropySource,
@@ -2615,8 +3118,32 @@ kj::Promise<void> Server::listenOnSockets(config::Config::Reader config,
     // be available later.
     auto rewriter = kj::heap<HttpRewriter>(httpOptions, headerTableBuilder);
 
+    kj::Maybe<kj::Own<AccessLog>> accessLog;
+    auto accessLogConf = sock.getAccessLog();
+    if (accessLogConf.hasPath()) {
+      kj::StringPtr pathStr = accessLogConf.getPath();
+      if (!(accessLogConf.getSampleRate() >= 0 && accessLogConf.getSampleRate() <= 1)) {
+        reportConfigError(kj::str(
+            "Socket \"", name, "\": accessLog.sampleRate must be between 0 and 1."));
+      } else if (accessLogConf.getBufferSize() == 0 || accessLogConf.getFlushIntervalMs() == 0) {
+        reportConfigError(kj::str(
+            "Socket \"", name, "\": accessLog.bufferSize and flushIntervalMs must be at least 1."));
+      } else KJ_IF_MAYBE(file, fs.getRoot().tryAppendFile(fs.getCurrentPath().evalNative(pathStr),
+          kj::WriteMode::CREATE | kj::WriteMode::MODIFY | kj::WriteMode::CREATE_PARENT)) {
+        accessLog = kj::heap<AccessLog>(AccessLog::Options {
+          .sampleRate = accessLogConf.getSampleRate(),
+          .bufferSize = accessLogConf.getBufferSize(),
+          .flushInterval = accessLogConf.getFlushIntervalMs() * kj::MILLISECONDS,
+        }, kj::mv(*file), entropySource);
+      } else {
+        reportConfigError(kj::str(
+            "Socket \"", name, "\": access log could not be opened for writing: ", pathStr));
+      }
+    }
+
     tasks.add(listener
-        .then([this, &service, rewriter = kj::mv(rewriter), physicalProtocol, name]
+        .then([this, &service, rewriter = kj::mv(rewriter), physicalProtocol, name,
+               accessLog = kj::mv(accessLog), serviceName = sock.getService().getName()]
               (kj::Own<kj::ConnectionReceiver> listener) mutable {
       KJ_IF_MAYBE(stream, controlOverride) {
         auto message = kj::str("{\"event\":\"listen\",\"socket\":\"", name, "\",\"port\":", listener->getPort(), "}\n");
@@ -2626,7 +3153,8 @@ kj::Promise<void> Server::listenOnSockets(config::Config::Reader config,
           KJ_LOG(ERROR, e);
         }
       }
-      return listenHttp(kj::mv(listener), service, physicalProtocol, kj::mv(rewriter));
+      return listenHttp(kj::mv(listener), service, physicalProtocol, kj::mv(rewriter),
+                        kj::mv(accessLog), serviceName);
     }).exclusiveJoin(forkedDrainWhen.addBranch()));
   }
 
@@ -25,6 +25,8 @@ namespace workerd::server {
 
 using kj::uint;
 
+class AccessLog;
+
 class Server: private kj::TaskSet::ErrorHandler {
   // Implements the single-tenant Workers Runtime server / CLI.
   //
@@ -158,6 +160,7 @@ private:
       kj::HttpHeaderTable::Builder& headerTableBuilder);
   kj::Own<Service> makeWorker(kj::StringPtr name, config::Worker::Reader conf,
       capnp::List<config::Extension>::Reader extensions);
+  kj::Own<Service> makeMetricsService();
   kj::Own<Service> makeService(
       config::Service::Reader conf,
       kj::HttpHeaderTable::Builder& headerTableBuilder,
@@ -167,13 +170,15 @@ private:
   // Can only be called in the link stage.
 
   kj::Promise<void> listenHttp(kj::Own<kj::ConnectionReceiver> listener, Service& service,
-                               kj::StringPtr physicalProtocol, kj::Own<HttpRewriter> rewriter);
+                               kj::StringPtr physicalProtocol, kj::Own<HttpRewriter> rewriter,
+                               kj::Maybe<kj::Own<AccessLog>> accessLog, kj::StringPtr serviceName);
 
   class InvalidConfigService;
   class ExternalHttpService;
   class NetworkService;
   class DiskDirectoryService;
   class WorkerService;
+  class MetricsService;
   class WorkerEntrypointService;
   class HttpListener;
 
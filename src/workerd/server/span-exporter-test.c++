@@ -0,0 +1,154 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#include "span-exporter.h"
+#include "observers.h"
+#include <kj/test.h>
+#include <string.h>
+
+namespace workerd::server {
+namespace {
+
+bool contains(kj::StringPtr haystack, kj::StringPtr needle) {
+  return strstr(haystack.cStr(), needle.cStr()) != nullptr;
+}
+
+class CountingEntropySource final: public kj::EntropySource {
+  // Produces 1, 2, 3, ... as 64-bit IDs, so trace and span IDs are predictable.
+public:
+  void generate(kj::ArrayPtr<kj::byte> buffer) override {
+    KJ_ASSERT(buffer.size() == sizeof(uint64_t));
+    ++counter;
+    memcpy(buffer.begin(), &counter, sizeof(counter));
+  }
+
+private:
+  uint64_t counter = 0;
+};
+
+class RecordingSink final: public SpanExporter::Sink {
+public:
+  kj::Vector<kj::String> batches;
+  bool fail = false;
+
+  kj::Promise<void> send(kj::String body) override {
+    if (fail) return KJ_EXCEPTION(DISCONNECTED, "collector unavailable");
+    batches.add(kj::mv(body));
+    return kj::READY_NOW;
+  }
+};
+
+KJ_TEST("SpanExporter sampling") {
+  CountingEntropySource entropy;
+  auto never = kj::refcounted<SpanExporter>(
+      SpanExporter::Options { .serviceName = kj::str("svc"), .sampleRate = 0 }, entropy);
+  KJ_EXPECT(never->tryStartTrace() == nullptr);
+
+  auto always = kj::refcounted<SpanExporter>(
+      SpanExporter::Options { .serviceName = kj::str("svc"), .sampleRate = 1 }, entropy);
+  for (uint i = 0; i < 10; i++) {
+    KJ_EXPECT(always->tryStartTrace() != nullptr);
+  }
+}
+
+KJ_TEST("SpanExporter encodes spans as OTLP/JSON") {
+  kj::EventLoop loop;
+  kj::WaitScope ws(loop);
+
+  CountingEntropySource entropy;
+  auto exporter = kj::refcounted<SpanExporter>(
+      SpanExporter::Options { .serviceName = kj::str("my \"svc\"") }, entropy);
+
+  {
+    SpanBuilder root(exporter->tryStartTrace(), "request", kj::UNIX_EPOCH + 1 * kj::SECONDS);
+    {
+      auto child = root.newChild("fetch", kj::UNIX_EPOCH + 2 * kj::SECONDS);
+      child.setTag("url"_kj, kj::str("http://example.com/"));
+      child.setTag("status"_kj, int64_t(200));
+      child.addLog(kj::UNIX_EPOCH + 3 * kj::SECONDS, "retry"_kj, true);
+    }
+  }
+
+  RecordingSink sink;
+  exporter->flush(sink).wait(ws);
+  KJ_ASSERT(sink.batches.size() == 1);
+  auto& body = sink.batches[0];
+
+  KJ_EXPECT(body.startsWith(
+      "{\"resourceSpans\":[{\"resource\":{\"attributes\":[{\"key\":\"service.name\","
+      "\"value\":{\"stringValue\":\"my \\\"svc\\\"\"}}]},"
+      "\"scopeSpans\":[{\"scope\":{\"name\":\"workerd\"},\"spans\":["), body);
+
+  // Trace ID is draws 1 and 2, the root span ID is draw 3 and the child's is draw 4.
+  KJ_EXPECT(contains(body,
+      "{\"traceId\":\"00000000000000010000000000000002\",\"spanId\":\"0000000000000004\","
+      "\"parentSpanId\":\"0000000000000003\",\"name\":\"fetch\","
+      "\"startTimeUnixNano\":\"2000000000\","), body);
+  KJ_EXPECT(contains(body, "{\"key\":\"url\",\"value\":{\"stringValue\":\"http://example.com/\"}}"),
+            body);
+  KJ_EXPECT(contains(body, "{\"key\":\"status\",\"value\":{\"intValue\":\"200\"}}"), body);
+  KJ_EXPECT(contains(body,
+      "\"events\":[{\"timeUnixNano\":\"3000000000\",\"name\":\"retry\","
+      "\"attributes\":[{\"key\":\"retry\",\"value\":{\"boolValue\":true}}]}]"), body);
+  KJ_EXPECT(contains(body,
+      "{\"traceId\":\"00000000000000010000000000000002\",\"spanId\":\"0000000000000003\","
+      "\"name\":\"request\","), body);
+
+  // Nothing left to send.
+  exporter->flush(sink).wait(ws);
+  KJ_EXPECT(sink.batches.size() == 1);
+}
+
+KJ_TEST("SpanExporter drops spans instead of blocking") {
+  kj::EventLoop loop;
+  kj::WaitScope ws(loop);
+
+  CountingEntropySource entropy;
+  auto exporter = kj::refcounted<SpanExporter>(SpanExporter::Options {
+    .serviceName = kj::str("svc"), .bufferSize = 2, .maxBatchSize = 1 }, entropy);
+
+  for (uint i = 0; i < 5; i++) {
+    SpanBuilder span(exporter->tryStartTrace(), "request");
+  }
+
+  RecordingSink sink;
+  exporter->flush(sink).wait(ws);
+  KJ_EXPECT(sink.batches.size() == 2);
+
+  for (uint i = 0; i < 2; i++) {
+    SpanBuilder span(exporter->tryStartTrace(), "request");
+  }
+  sink.fail = true;
+  exporter->flush(sink).wait(ws);
+
+  PrometheusTextWriter writer;
+  exporter->write(writer, "svc");
+  auto text = writer.finish();
+  KJ_EXPECT(contains(text, "workerd_spans_reported_total{service=\"svc\"} 7\n"), text);
+  KJ_EXPECT(contains(text, "workerd_spans_exported_total{service=\"svc\"} 2\n"), text);
+  KJ_EXPECT(contains(text, "workerd_spans_dropped_total{service=\"svc\"} 5\n"), text);
+  KJ_EXPECT(contains(text, "workerd_span_export_failures_total{service=\"svc\"} 2\n"), text);
+}
+
+KJ_TEST("FileSpanSink appends batches as lines without blocking the event loop") {
+  kj::EventLoop loop;
+  kj::WaitScope ws(loop);
+
+  auto file = kj::newInMemoryFile(kj::nullClock());
+  {
+    FileSpanSink sink(kj::newFileAppender(file->clone()));
+    auto first = sink.send(kj::str("{\"a\":1}"));
+    auto second = sink.send(kj::str("{\"b\":2}"));
+    first.wait(ws);
+    second.wait(ws);
+    KJ_EXPECT(file->readAllText() == "{\"a\":1}\n{\"b\":2}\n");
+
+    // Not waited for: the destructor must still write it.
+    auto third = sink.send(kj::str("{\"c\":3}"));
+  }
+  KJ_EXPECT(file->readAllText() == "{\"a\":1}\n{\"b\":2}\n{\"c\":3}\n");
+}
+
+}  // namespace
+}  // namespace workerd::server
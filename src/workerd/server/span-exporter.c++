@@ -0,0 +1,288 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#include "span-exporter.h"
+#include "observers.h"
+#include <kj/debug.h>
+
+namespace workerd::server {
+
+namespace {
+
+void appendHexId(kj::Vector<char>& out, uint64_t id) {
+  static const char HEXDIGITS[] = "0123456789abcdef";
+  for (int shift = 60; shift >= 0; shift -= 4) {
+    out.add(HEXDIGITS[(id >> shift) & 0xf]);
+  }
+}
+
+void appendUnixNanos(kj::Vector<char>& out, kj::Date date) {
+  // OTLP/JSON encodes 64-bit integers as strings.
+  out.add('"');
+  out.addAll(kj::str((date - kj::UNIX_EPOCH) / kj::NANOSECONDS));
+  out.add('"');
+}
+
+void appendAttribute(kj::Vector<char>& out, kj::StringPtr key, const Span::TagValue& value) {
+  out.addAll("{\"key\":"_kj);
+  appendJsonString(out, key);
+  out.addAll(",\"value\":{"_kj);
+  KJ_SWITCH_ONEOF(value) {
+    KJ_CASE_ONEOF(b, bool) {
+      out.addAll(b ? "\"boolValue\":true"_kj : "\"boolValue\":false"_kj);
+    }
+    KJ_CASE_ONEOF(i, int64_t) {
+      out.addAll(kj::str("\"intValue\":\"", i, '"'));
+    }
+    KJ_CASE_ONEOF(d, double) {
+      out.addAll(kj::str("\"doubleValue\":", d));
+    }
+    KJ_CASE_ONEOF(s, kj::String) {
+      out.addAll("\"stringValue\":"_kj);
+      appendJsonString(out, s);
+    }
+  }
+  out.addAll("}}"_kj);
+}
+
+kj::String encodeSpan(const Span& span, uint64_t traceHigh, uint64_t traceLow,
+                      uint64_t spanId, uint64_t parentSpanId) {
+  // Encodes one OTLP/JSON `Span` message. Logs become span events named after their key.
+
+  kj::Vector<char> out(256);
+  out.addAll("{\"traceId\":\""_kj);
+  appendHexId(out, traceHigh);
+  appendHexId(out, traceLow);
+  out.addAll("\",\"spanId\":\""_kj);
+  appendHexId(out, spanId);
+  out.add('"');
+  if (parentSpanId != 0) {
+    out.addAll(",\"parentSpanId\":\""_kj);
+    appendHexId(out, parentSpanId);
+    out.add('"');
+  }
+  out.addAll(",\"name\":"_kj);
+  appendJsonString(out, span.operationName);
+  out.addAll(",\"startTimeUnixNano\":"_kj);
+  appendUnixNanos(out, span.startTime);
+  out.addAll(",\"endTimeUnixNano\":"_kj);
+  appendUnixNanos(out, span.endTime);
+
+  out.addAll(",\"attributes\":["_kj);
+  bool first = true;
+  for (auto& tag: span.tags) {
+    if (!first) out.add(',');
+    first = false;
+    appendAttribute(out, tag.key, tag.value);
+  }
+  out.add(']');
+
+  out.addAll(",\"events\":["_kj);
+  first = true;
+  for (auto& log: span.logs) {
+    if (!first) out.add(',');
+    first = false;
+    out.addAll("{\"timeUnixNano\":"_kj);
+    appendUnixNanos(out, log.timestamp);
+    out.addAll(",\"name\":"_kj);
+    appendJsonString(out, log.tag.key);
+    out.addAll(",\"attributes\":["_kj);
+    appendAttribute(out, log.tag.key, log.tag.value);
+    out.addAll("]}"_kj);
+  }
+  out.add(']');
+
+  if (span.droppedLogs > 0) {
+    out.addAll(kj::str(",\"droppedEventsCount\":", span.droppedLogs));
+  }
+  out.add('}');
+
+  out.add('\0');
+  return kj::String(out.releaseAsArray());
+}
+
+}  // namespace
+
+// =======================================================================================
+// SpanExporter
+
+class SpanExporter::ObserverImpl final: public SpanObserver {
+public:
+  ObserverImpl(kj::Own<SpanExporter> exporterParam,
+               uint64_t traceHigh, uint64_t traceLow, uint64_t parentSpanId)
+      : exporter(kj::mv(exporterParam)), traceHigh(traceHigh), traceLow(traceLow),
+        spanId(exporter->randomId()), parentSpanId(parentSpanId) {}
+
+  kj::Own<SpanObserver> newChild() override {
+    return kj::refcounted<ObserverImpl>(kj::addRef(*exporter), traceHigh, traceLow, spanId);
+  }
+
+  void report(const Span& span) override {
+    exporter->push(encodeSpan(span, traceHigh, traceLow, spanId, parentSpanId));
+  }
+
+private:
+  kj::Own<SpanExporter> exporter;
+  uint64_t traceHigh;
+  uint64_t traceLow;
+  uint64_t spanId;
+  uint64_t parentSpanId;  // zero for the root span
+};
+
+SpanExporter::SpanExporter(Options optionsParam, kj::EntropySource& entropySource)
+    : options(kj::mv(optionsParam)), entropySource(entropySource),
+      buffer(options.bufferSize),
+      sampleThreshold(sampleRateToThreshold(options.sampleRate)) {}
+
+uint64_t SpanExporter::randomId() {
+  uint64_t result = 0;
+  while (result == 0) {  // zero means "no ID" in OTLP
+    entropySource.generate(kj::arrayPtr(&result, 1).asBytes());
+  }
+  return result;
+}
+
+kj::Maybe<kj::Own<SpanObserver>> SpanExporter::tryStartTrace() {
+  if (samplesNothing(sampleThreshold)) return nullptr;
+  if (!samplesEverything(sampleThreshold) && !isSampled(sampleThreshold, randomId())) {
+    return nullptr;
+  }
+
+  sampledTraces.add();
+  uint64_t traceHigh = randomId();
+  uint64_t traceLow = randomId();
+  return kj::Own<SpanObserver>(
+      kj::refcounted<ObserverImpl>(kj::addRef(*this), traceHigh, traceLow, 0));
+}
+
+void SpanExporter::push(kj::String encodedSpan) {
+  reportedSpans.add();
+  if (!buffer.tryPush(encodedSpan)) {
+    droppedSpans.add();
+  }
+}
+
+kj::Maybe<SpanExporter::Batch> SpanExporter::takeBatch() {
+  kj::Vector<kj::String> spans;
+  while (spans.size() < options.maxBatchSize) {
+    KJ_IF_MAYBE(span, buffer.tryPop()) {
+      spans.add(kj::mv(*span));
+    } else {
+      break;
+    }
+  }
+  if (spans.empty()) return nullptr;
+
+  kj::Vector<char> serviceName;
+  appendJsonString(serviceName, options.serviceName);
+  auto body = kj::str(
+      "{\"resourceSpans\":[{\"resource\":{\"attributes\":["
+        "{\"key\":\"service.name\",\"value\":{\"stringValue\":", serviceName, "}}"
+      "]},\"scopeSpans\":[{\"scope\":{\"name\":\"workerd\"},\"spans\":[",
+      kj::strArray(spans, ","),
+      "]}]}]}");
+  return Batch { .body = kj::mv(body), .spanCount = static_cast<uint>(spans.size()) };
+}
+
+kj::Promise<void> SpanExporter::flush(Sink& sink) {
+  auto batch = KJ_UNWRAP_OR(takeBatch(), return kj::READY_NOW);
+  uint count = batch.spanCount;
+  return sink.send(kj::mv(batch.body)).then([this, count]() {
+    exportedSpans.add(count);
+  }, [this, count](kj::Exception&& e) {
+    KJ_LOG(WARNING, "failed to export trace spans", count, e);
+    failedExports.add();
+    droppedSpans.add(count);
+  }).then([this, &sink]() {
+    return flush(sink);
+  });
+}
+
+kj::Promise<void> SpanExporter::run(kj::Timer& timer, Sink& sink) {
+  return timer.afterDelay(options.flushInterval).then([this, &sink]() {
+    return flush(sink);
+  }).then([this, &timer, &sink]() {
+    return run(timer, sink);
+  });
+}
+
+void SpanExporter::write(PrometheusTextWriter& writer, kj::StringPtr service) const {
+  PrometheusTextWriter::Labels labels = {{"service", service}};
+  writer.addCounter("workerd_traces_sampled_total", "Requests chosen for tracing.",
+                    labels, sampledTraces.read());
+  writer.addCounter("workerd_spans_reported_total", "Finished spans from traced requests.",
+                    labels, reportedSpans.read());
+  writer.addCounter("workerd_spans_dropped_total",
+                    "Spans dropped because the export buffer was full or an export failed.",
+                    labels, droppedSpans.read());
+  writer.addCounter("workerd_spans_exported_total", "Spans delivered to the trace sink.",
+                    labels, exportedSpans.read());
+  writer.addCounter("workerd_span_export_failures_total", "Span batches that failed to export.",
+                    labels, failedExports.read());
+}
+
+// =======================================================================================
+// Sinks
+
+kj::Promise<void> HttpSpanSink::send(kj::String body) {
+  auto worker = startRequest();
+  auto client = kj::newHttpClient(*worker);
+
+  kj::HttpHeaders headers(headerTable);
+  headers.set(kj::HttpHeaderId::CONTENT_TYPE, "application/json");
+  auto request = client->request(
+      kj::HttpMethod::POST, "http://otlp/v1/traces", headers, body.size());
+
+  auto writePromise = request.body->write(body.begin(), body.size())
+      .attach(kj::mv(request.body), kj::mv(body));
+  return writePromise.then([response = kj::mv(request.response)]() mutable {
+    return kj::mv(response);
+  }).then([](kj::HttpClient::Response&& response) -> kj::Promise<void> {
+    auto& responseBody = *response.body;
+    if (response.statusCode < 200 || response.statusCode >= 300) {
+      KJ_FAIL_REQUIRE("trace collector rejected spans", response.statusCode,
+                      response.statusText);
+    }
+    return responseBody.readAllBytes().ignoreResult().attach(kj::mv(response.body));
+  }).attach(kj::mv(client), kj::mv(worker));
+}
+
+FileSpanSink::FileSpanSink(kj::Own<const kj::AppendableFile> file)
+    : file(kj::mv(file)), thread([this]() { run(); }) {}
+
+FileSpanSink::~FileSpanSink() noexcept(false) {
+  state.lockExclusive()->shuttingDown = true;
+  // `thread`'s destructor joins.
+}
+
+kj::Promise<void> FileSpanSink::send(kj::String body) {
+  auto paf = kj::newPromiseAndCrossThreadFulfiller<void>();
+  state.lockExclusive()->queue.add(Write {
+    .line = kj::str(body, '\n'), .fulfiller = kj::mv(paf.fulfiller) });
+  return kj::mv(paf.promise);
+}
+
+void FileSpanSink::run() {
+  for (;;) {
+    kj::Vector<Write> writes;
+    {
+      auto lock = state.lockExclusive();
+      lock.wait([](const State& s) { return !s.queue.empty() || s.shuttingDown; });
+      if (lock->queue.empty()) return;
+      writes = kj::mv(lock->queue);
+    }
+
+    for (auto& write: writes) {
+      KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() {
+        file->write(write.line.begin(), write.line.size());
+      })) {
+        write.fulfiller->reject(kj::mv(*exception));
+      } else {
+        write.fulfiller->fulfill();
+      }
+    }
+  }
+}
+
+}  // namespace workerd::server
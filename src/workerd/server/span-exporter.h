@@ -0,0 +1,143 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#pragma once
+// Exports trace spans in the OpenTelemetry OTLP/JSON format.
+//
+// Sampled requests get a root `SpanObserver` from a `SpanExporter`. Each finished span is encoded
+// and pushed into a bounded ring buffer; if the buffer is full, the span is dropped and counted
+// rather than waiting. A flush loop periodically drains the buffer in batches and hands each
+// batch to a `SpanExporter::Sink`, which delivers it to a collector service or appends it to a
+// file.
+
+#include <workerd/io/trace.h>
+#include <workerd/io/worker-interface.h>
+#include <workerd/util/counter.h>
+#include <workerd/util/telemetry-util.h>
+#include <kj/filesystem.h>
+#include <kj/function.h>
+#include <kj/mutex.h>
+#include <kj/thread.h>
+#include <kj/timer.h>
+
+namespace workerd::server {
+
+class PrometheusTextWriter;
+
+class SpanExporter final: public kj::Refcounted {
+public:
+  struct Options {
+    kj::String serviceName;
+    // Reported as the `service.name` resource attribute.
+
+    double sampleRate = 1.0;
+    // Fraction of requests to trace, from 0 to 1.
+
+    uint bufferSize = 4096;
+    // Maximum number of finished spans waiting to be exported.
+
+    uint maxBatchSize = 512;
+    // Maximum number of spans per export.
+
+    kj::Duration flushInterval = 1 * kj::SECONDS;
+  };
+
+  class Sink {
+    // Receives batches of spans, each a complete OTLP/JSON `ExportTraceServiceRequest`.
+  public:
+    virtual kj::Promise<void> send(kj::String body) = 0;
+  };
+
+  SpanExporter(Options options, kj::EntropySource& entropySource);
+
+  kj::Maybe<kj::Own<SpanObserver>> tryStartTrace();
+  // Makes the sampling decision for a new request. If it is to be traced, returns the observer for
+  // its root span, which starts a new trace.
+
+  kj::Promise<void> run(kj::Timer& timer, Sink& sink);
+  // Flushes buffered spans to `sink` every `flushInterval`, forever. Failed exports are logged,
+  // counted and dropped; they never end the loop.
+
+  kj::Promise<void> flush(Sink& sink);
+  // Exports everything buffered right now.
+
+  struct Batch {
+    kj::String body;
+    uint spanCount;
+  };
+
+  kj::Maybe<Batch> takeBatch();
+  // Removes up to `maxBatchSize` spans from the buffer and encodes them as one export request.
+  // Returns null if the buffer is empty.
+
+  void write(PrometheusTextWriter& writer, kj::StringPtr service) const;
+
+private:
+  Options options;
+  kj::EntropySource& entropySource;
+  StringRingBuffer buffer;
+  uint64_t sampleThreshold;
+  // Requests whose random 64-bit draw is below this are traced.
+
+  ShardedCounter sampledTraces;
+  ShardedCounter reportedSpans;
+  ShardedCounter droppedSpans;
+  ShardedCounter exportedSpans;
+  ShardedCounter failedExports;
+
+  uint64_t randomId();
+  void push(kj::String encodedSpan);
+
+  class ObserverImpl;
+};
+
+class HttpSpanSink final: public SpanExporter::Sink {
+  // POSTs each batch to `/v1/traces` on a service, as an OTLP/HTTP collector expects.
+
+public:
+  HttpSpanSink(kj::Function<kj::Own<WorkerInterface>()> startRequest,
+               const kj::HttpHeaderTable& headerTable)
+      : startRequest(kj::mv(startRequest)), headerTable(headerTable) {}
+
+  kj::Promise<void> send(kj::String body) override;
+
+private:
+  kj::Function<kj::Own<WorkerInterface>()> startRequest;
+  const kj::HttpHeaderTable& headerTable;
+};
+
+class FileSpanSink final: public SpanExporter::Sink {
+  // Appends each batch to a file as one line, the format of the OpenTelemetry file exporter.
+  //
+  // Writing to a file blocks, so the writes happen on a thread of the sink's own; send()'s promise
+  // resolves once the batch has been written. Batches still queued when the sink is destroyed are
+  // written before the destructor returns.
+
+public:
+  explicit FileSpanSink(kj::Own<const kj::AppendableFile> file);
+  ~FileSpanSink() noexcept(false);
+  KJ_DISALLOW_COPY_AND_MOVE(FileSpanSink);
+
+  kj::Promise<void> send(kj::String body) override;
+
+private:
+  struct Write {
+    kj::String line;
+    kj::Own<kj::CrossThreadPromiseFulfiller<void>> fulfiller;
+  };
+
+  struct State {
+    kj::Vector<Write> queue;
+    bool shuttingDown = false;
+  };
+
+  kj::Own<const kj::AppendableFile> file;
+  kj::MutexGuarded<State> state;
+  kj::Thread thread;
+  // Declared last, so it's joined before anything it uses is destroyed.
+
+  void run();
+};
+
+}  // namespace workerd::server
@@ -0,0 +1,118 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#include "tail-batcher.h"
+#include "observers.h"
+#include <kj/test.h>
+#include <string.h>
+
+namespace workerd::server {
+namespace {
+
+struct TailFixture {
+  kj::EventLoop loop;
+  kj::WaitScope ws;
+  kj::TimerImpl timer;
+
+  kj::Vector<kj::Array<kj::Own<Trace>>> batches;
+  kj::Maybe<kj::Own<kj::PromiseFulfiller<void>>> blockDelivery;
+
+  TailBatcher batcher;
+
+  TailFixture(uint maxBatchSize, uint maxPendingTraces)
+      : ws(loop), timer(kj::origin<kj::TimePoint>()),
+        batcher(TailBatcher::Options {
+          .scriptName = kj::str("traced"),
+          .maxBatchSize = maxBatchSize,
+          .maxBatchDelay = 100 * kj::MILLISECONDS,
+          .maxPendingTraces = maxPendingTraces,
+        }, timer, [this](kj::Array<kj::Own<Trace>> traces) -> kj::Promise<void> {
+          batches.add(kj::mv(traces));
+          auto paf = kj::newPromiseAndFulfiller<void>();
+          blockDelivery = kj::mv(paf.fulfiller);
+          return kj::mv(paf.promise);
+        }) {}
+
+  void finishRequest(kj::StringPtr message) {
+    auto tracer = batcher.makeWorkerTracer();
+    tracer->log(kj::UNIX_EPOCH, LogLevel::LOG, kj::str(message));
+    tracer = nullptr;
+    loop.run();
+  }
+
+  void advance(kj::Duration d) {
+    timer.advanceTo(timer.now() + d);
+    loop.run();
+  }
+
+  void completeDelivery() {
+    KJ_ASSERT_NONNULL(blockDelivery)->fulfill();
+    blockDelivery = nullptr;
+    loop.run();
+  }
+
+  kj::String metrics() {
+    PrometheusTextWriter writer;
+    batcher.write(writer, "traced");
+    return writer.finish();
+  }
+};
+
+bool contains(kj::StringPtr haystack, kj::StringPtr needle) {
+  return strstr(haystack.cStr(), needle.cStr()) != nullptr;
+}
+
+KJ_TEST("TailBatcher delivers full batches immediately and partial ones after a delay") {
+  TailFixture fixture(2, 100);
+
+  fixture.finishRequest("one");
+  KJ_EXPECT(fixture.batches.size() == 0);
+  fixture.finishRequest("two");
+  KJ_ASSERT(fixture.batches.size() == 1);
+  KJ_EXPECT(fixture.batches[0].size() == 2);
+  KJ_EXPECT(fixture.batches[0][0]->logs[0].message == "one");
+  KJ_EXPECT(KJ_ASSERT_NONNULL(fixture.batches[0][0]->scriptName) == "traced");
+  fixture.completeDelivery();
+
+  fixture.finishRequest("three");
+  fixture.advance(50 * kj::MILLISECONDS);
+  KJ_EXPECT(fixture.batches.size() == 1);
+  fixture.advance(50 * kj::MILLISECONDS);
+  KJ_ASSERT(fixture.batches.size() == 2);
+  KJ_EXPECT(fixture.batches[1].size() == 1);
+  KJ_EXPECT(fixture.batches[1][0]->logs[0].message == "three");
+  fixture.completeDelivery();
+
+  KJ_EXPECT(contains(fixture.metrics(),
+      "workerd_tail_traces_delivered_total{service=\"traced\"} 3\n"));
+}
+
+KJ_TEST("TailBatcher drops traces instead of queueing without bound") {
+  TailFixture fixture(1, 2);
+
+  // The first trace goes out right away, and its delivery hangs.
+  fixture.finishRequest("a");
+  KJ_ASSERT(fixture.batches.size() == 1);
+
+  // Two more can wait; the fourth is dropped.
+  fixture.finishRequest("b");
+  fixture.finishRequest("c");
+  fixture.finishRequest("d");
+  KJ_EXPECT(fixture.batches.size() == 1);
+
+  fixture.completeDelivery();
+  KJ_ASSERT(fixture.batches.size() == 2);
+  KJ_EXPECT(fixture.batches[1][0]->logs[0].message == "b");
+  fixture.completeDelivery();
+  KJ_ASSERT(fixture.batches.size() == 3);
+  KJ_EXPECT(fixture.batches[2][0]->logs[0].message == "c");
+  fixture.completeDelivery();
+
+  auto text = fixture.metrics();
+  KJ_EXPECT(contains(text, "workerd_tail_traces_delivered_total{service=\"traced\"} 3\n"), text);
+  KJ_EXPECT(contains(text, "workerd_tail_traces_dropped_total{service=\"traced\"} 1\n"), text);
+}
+
+}  // namespace
+}  // namespace workerd::server
@@ -0,0 +1,99 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#include "tail-batcher.h"
+#include "observers.h"
+#include <kj/debug.h>
+
+namespace workerd::server {
+
+TailBatcher::TailBatcher(Options options, kj::Timer& timer, Deliver deliver)
+    : options(kj::mv(options)), timer(timer), deliver(kj::mv(deliver)), tasks(*this) {}
+
+kj::Own<WorkerTracer> TailBatcher::makeWorkerTracer() {
+  auto pipeline = kj::refcounted<PipelineTracer>();
+  auto tracer = pipeline->makeWorkerTracer(PipelineLogLevel::FULL, nullptr,
+      kj::str(options.scriptName), nullptr, nullptr);
+
+  // The pipeline completes when the last reference to it -- held by `tracer` -- goes away.
+  tasks.add(pipeline->onComplete().then([this](kj::Array<kj::Own<Trace>> traces) {
+    add(kj::mv(traces));
+  }));
+
+  return tracer;
+}
+
+void TailBatcher::add(kj::Array<kj::Own<Trace>> traces) {
+  for (auto& trace: traces) {
+    if (pending.size() >= options.maxPendingTraces) {
+      droppedTraces.add();
+    } else {
+      pending.add(kj::mv(trace));
+    }
+  }
+  maybeSend();
+}
+
+void TailBatcher::maybeSend() {
+  if (pending.empty() || inFlight) return;
+
+  if (pending.size() >= options.maxBatchSize) {
+    sendBatch();
+  } else if (!timerArmed) {
+    timerArmed = true;
+    tasks.add(timer.afterDelay(options.maxBatchDelay)
+        .then([this, generation = batchGeneration]() {
+      timerArmed = false;
+      if (generation == batchGeneration && !inFlight && !pending.empty()) {
+        sendBatch();
+      } else {
+        // A full batch went out in the meantime; start the delay over for what's left.
+        maybeSend();
+      }
+    }));
+  }
+}
+
+void TailBatcher::sendBatch() {
+  size_t count = kj::min(pending.size(), size_t(options.maxBatchSize));
+  auto batch = kj::heapArrayBuilder<kj::Own<Trace>>(count);
+  for (size_t i = 0; i < count; i++) {
+    batch.add(kj::mv(pending[i]));
+  }
+  kj::Vector<kj::Own<Trace>> rest(pending.size() - count);
+  for (auto i: kj::range(count, pending.size())) {
+    rest.add(kj::mv(pending[i]));
+  }
+  pending = kj::mv(rest);
+
+  inFlight = true;
+  ++batchGeneration;
+  tasks.add(deliver(batch.finish()).then([this, count]() {
+    deliveredTraces.add(count);
+  }, [this, count](kj::Exception&& e) {
+    KJ_LOG(WARNING, "failed to deliver traces to tail workers", options.scriptName, e);
+    failedTraces.add(count);
+  }).then([this]() {
+    inFlight = false;
+    maybeSend();
+  }));
+}
+
+void TailBatcher::write(PrometheusTextWriter& writer, kj::StringPtr service) const {
+  PrometheusTextWriter::Labels labels = {{"service", service}};
+  writer.addCounter("workerd_tail_traces_delivered_total", "Traces delivered to tail Workers.",
+                    labels, deliveredTraces.read());
+  writer.addCounter("workerd_tail_traces_dropped_total",
+                    "Traces dropped because too many were waiting for delivery.",
+                    labels, droppedTraces.read());
+  writer.addCounter("workerd_tail_traces_failed_total",
+                    "Traces whose delivery to tail Workers failed.",
+                    labels, failedTraces.read());
+}
+
+void TailBatcher::taskFailed(kj::Exception&& exception) {
+  KJ_LOG(ERROR, exception);
+}
+
+}  // namespace workerd::server
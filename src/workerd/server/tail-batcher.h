@@ -0,0 +1,73 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#pragma once
+
+#include <workerd/io/trace.h>
+#include <workerd/util/counter.h>
+#include <kj/async.h>
+#include <kj/function.h>
+#include <kj/timer.h>
+
+namespace workerd::server {
+
+class PrometheusTextWriter;
+
+class TailBatcher final: private kj::TaskSet::ErrorHandler {
+  // Collects the traces of a Worker's requests and delivers them to its tail Workers in batches.
+  //
+  // Each request gets its own `WorkerTracer`; its trace is complete once the request is done,
+  // including `waitUntil()` tasks, so collection never delays a response. Completed traces are
+  // delivered once `maxBatchSize` of them are waiting or the oldest has waited `maxBatchDelay`.
+  // Only one batch is in flight at a time. While it is, traces accumulate, and once
+  // `maxPendingTraces` are waiting, further ones are dropped rather than queued.
+
+public:
+  static constexpr uint16_t TRACE_EVENT_TYPE = 2;
+  // Custom event type ID used for delivering traces.
+
+  struct Options {
+    kj::String scriptName;
+    uint maxBatchSize = 100;
+    kj::Duration maxBatchDelay = 1 * kj::SECONDS;
+    uint maxPendingTraces = 1000;
+  };
+
+  using Deliver = kj::Function<kj::Promise<void>(kj::Array<kj::Own<Trace>>)>;
+
+  TailBatcher(Options options, kj::Timer& timer, Deliver deliver);
+
+  kj::Own<WorkerTracer> makeWorkerTracer();
+  // Starts a trace for a new request.
+
+  void add(kj::Array<kj::Own<Trace>> traces);
+  // Queues completed traces for delivery. Called automatically for traces from
+  // `makeWorkerTracer()`.
+
+  void write(PrometheusTextWriter& writer, kj::StringPtr service) const;
+
+private:
+  Options options;
+  kj::Timer& timer;
+  Deliver deliver;
+
+  kj::Vector<kj::Own<Trace>> pending;
+  bool inFlight = false;
+  uint64_t batchGeneration = 0;
+  // Incremented whenever a batch is sent, so a stale delay timer knows not to send another.
+  bool timerArmed = false;
+
+  ShardedCounter deliveredTraces;
+  ShardedCounter droppedTraces;
+  ShardedCounter failedTraces;
+
+  kj::TaskSet tasks;
+
+  void maybeSend();
+  void sendBatch();
+
+  void taskFailed(kj::Exception&& exception) override;
+};
+
+}  // namespace workerd::server
@@ -104,7 +104,8 @@ struct WorkerdApiIsolate::Impl {
        CompatibilityFlags::Reader featuresParam,
        IsolateLimitEnforcer& limitEnforcer)
       : features(capnp::clone(featuresParam)),
-        jsgIsolate(v8System, Configuration(*this), limitEnforcer.getCreateParams()) {}
+        jsgIsolate(v8System, Configuration(*this), limitEnforcer.getCreateParams(),
+                   limitEnforcer.getCppHeapOptions()) {}
 
   static v8::Local<v8::String> compileTextGlobal(JsgWorkerdIsolate::Lock& lock,
       capnp::Text::Reader reader) {
@@ -0,0 +1,335 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+// Measures Durable Object storage operations below the JavaScript API: ActorCache get(), put()
+// and list() served from cache, ActorSqlite writes including their implicit transaction
+// commits, ActorSqlite reads with and without its read cache, and ActorSqlite multi-key reads
+// and writes, and activating SQLite-backed actors with a database each or in shared shards.
+// Reports operations per second and C++ heap allocations per operation, for the cache, the memory
+// it accounts per resident entry and the time spent waiting for its lock, and for activation, the
+// memory SQLite holds per open actor.
+
+#include "bench-allocations.h"
+#include <workerd/io/actor-cache.h>
+#include <workerd/io/actor-sqlite.h>
+#include <workerd/io/io-gate.h>
+#include <sqlite3.h>
+
+namespace workerd {
+namespace {
+
+constexpr uint KEY_COUNT = 1000;
+
+class EmptyStorage final: public rpc::ActorStorage::Stage::Server {
+  // Backing storage with nothing in it. ActorCache is configured never to flush, so nothing
+  // ever reaches it except the initial reads.
+public:
+  kj::Promise<void> get(GetContext context) override {
+    return kj::READY_NOW;
+  }
+  kj::Promise<void> getMultiple(GetMultipleContext context) override {
+    return context.getParams().getStream().endRequest(capnp::MessageSize {2, 0})
+        .send().ignoreResult();
+  }
+  kj::Promise<void> list(ListContext context) override {
+    return context.getParams().getStream().endRequest(capnp::MessageSize {2, 0})
+        .send().ignoreResult();
+  }
+};
+
+kj::String key(uint i) {
+  // Offset so that every key has the same number of digits, and so sorts numerically.
+  return kj::str("key", 10000 + i);
+}
+
+kj::Array<kj::String> allKeys() {
+  auto builder = kj::heapArrayBuilder<kj::String>(KEY_COUNT);
+  for (uint i = 0; i < KEY_COUNT; i++) {
+    builder.add(key(i));
+  }
+  return builder.finish();
+}
+
+kj::Array<const byte> value() {
+  return kj::heapArray<const byte>("a typical small value"_kj.asBytes());
+}
+
+struct CacheFixture {
+  kj::EventLoop loop;
+  kj::WaitScope ws;
+  ActorCache::SharedLru lru;
+  OutputGate gate;
+  ActorCache cache;
+
+  CacheFixture()
+      : ws(loop),
+        lru({
+          .softLimit = 64 << 20,
+          .hardLimit = 128 << 20,
+          .staleTimeout = 1000 * kj::SECONDS,
+          .dirtyListByteLimit = 64 << 20,
+          .maxKeysPerRpc = 128,
+          .neverFlush = true,
+        }),
+        cache(kj::heap<EmptyStorage>(), lru, gate) {}
+
+  void populate() {
+    // Listing everything once tells the cache that there is nothing else in storage, so that
+    // later reads never need to go to it.
+    auto listing = cache.list(kj::str(), nullptr, nullptr, {});
+    KJ_IF_MAYBE(promise, listing.tryGet<kj::Promise<ActorCache::GetResultList>>()) {
+      promise->wait(ws);
+    }
+    for (uint i = 0; i < KEY_COUNT; i++) {
+      cache.put(key(i), value(), {});
+    }
+    loop.run();
+  }
+};
+
+void cacheGet(benchmark::State& state) {
+  CacheFixture fixture;
+  fixture.populate();
+  auto keys = allKeys();
+  state.counters["bytes_per_entry"] = double(fixture.lru.currentSize()) / KEY_COUNT;
+  auto lockWaitBefore = fixture.lru.getStats().lockWait;
+
+  bench::AllocationCounter allocations;
+  uint i = 0;
+  for (auto _: state) {
+    auto result = fixture.cache.get(kj::str(keys[i++ % KEY_COUNT]), {});
+    KJ_ASSERT(result.is<kj::Maybe<ActorCache::Value>>());
+  }
+  allocations.report(state);
+  state.counters["lock_wait_ns"] = benchmark::Counter(
+      (fixture.lru.getStats().lockWait - lockWaitBefore) / kj::NANOSECONDS,
+      benchmark::Counter::kAvgIterations);
+  state.SetItemsProcessed(state.iterations());
+}
+
+void cachePut(benchmark::State& state) {
+  CacheFixture fixture;
+  fixture.populate();
+  auto keys = allKeys();
+
+  bench::AllocationCounter allocations;
+  uint i = 0;
+  for (auto _: state) {
+    benchmark::DoNotOptimize(fixture.cache.put(kj::str(keys[i++ % KEY_COUNT]), value(), {}));
+  }
+  fixture.loop.run();
+  allocations.report(state);
+  state.SetItemsProcessed(state.iterations());
+}
+
+void cacheList(benchmark::State& state) {
+  CacheFixture fixture;
+  fixture.populate();
+  uint limit = state.range(0);
+
+  bench::AllocationCounter allocations;
+  for (auto _: state) {
+    auto result = fixture.cache.list(key(0), key(KEY_COUNT - 1), limit, {});
+    KJ_ASSERT(result.is<ActorCache::GetResultList>());
+    KJ_ASSERT(result.get<ActorCache::GetResultList>().size() == limit);
+  }
+  allocations.report(state);
+  state.SetItemsProcessed(state.iterations() * limit);
+}
+
+struct SqliteFixture {
+  kj::EventLoop loop;
+  kj::WaitScope ws;
+  kj::Own<kj::Directory> dir;
+  SqliteDatabase::Vfs vfs;
+  OutputGate gate;
+  ActorCache::SharedLru lru;
+  ActorSqlite sqlite;
+
+  explicit SqliteFixture(bool readCache = false)
+      : ws(loop),
+        dir(kj::newInMemoryDirectory(kj::nullClock())),
+        vfs(*dir),
+        lru({
+          .softLimit = 64 << 20,
+          .hardLimit = 128 << 20,
+          .staleTimeout = 1000 * kj::SECONDS,
+          .dirtyListByteLimit = 64 << 20,
+          .maxKeysPerRpc = 128,
+        }),
+        sqlite(kj::heap<SqliteDatabase>(vfs, kj::Path({"bench.sqlite"}),
+                                        kj::WriteMode::CREATE | kj::WriteMode::MODIFY),
+               gate, []() -> kj::Promise<void> { return kj::READY_NOW; },
+               ActorSqlite::Hooks::DEFAULT,
+               readCache ? kj::Maybe<const ActorCache::SharedLru&>(lru) : nullptr) {}
+
+  void populate() {
+    for (uint i = 0; i < KEY_COUNT; i++) {
+      sqlite.put(key(i), value(), {});
+    }
+    loop.run();
+  }
+};
+
+kj::Array<kj::String> keyBatch(uint& next, uint count) {
+  // The next `count` keys, wrapping around.
+  auto builder = kj::heapArrayBuilder<kj::String>(count);
+  for (uint i = 0; i < count; i++) {
+    builder.add(key(next++ % KEY_COUNT));
+  }
+  return builder.finish();
+}
+
+void sqlitePut(benchmark::State& state) {
+  // Writes `state.range(0)` keys per event loop turn, so that they share one implicit
+  // transaction, then lets the transaction commit.
+  SqliteFixture fixture;
+  auto keys = allKeys();
+  uint perTurn = state.range(0);
+
+  bench::AllocationCounter allocations;
+  uint i = 0;
+  while (state.KeepRunningBatch(perTurn)) {
+    for (uint j = 0; j < perTurn; j++) {
+      benchmark::DoNotOptimize(fixture.sqlite.put(kj::str(keys[i++ % KEY_COUNT]), value(), {}));
+    }
+    fixture.loop.run();
+  }
+  allocations.report(state);
+  state.SetItemsProcessed(state.iterations());
+}
+
+void sqliteGet(benchmark::State& state) {
+  // Reads keys that all exist, over and over; state.range(0) enables the read cache.
+  SqliteFixture fixture(state.range(0));
+  fixture.populate();
+  auto keys = allKeys();
+
+  bench::AllocationCounter allocations;
+  uint i = 0;
+  for (auto _: state) {
+    auto result = fixture.sqlite.get(kj::str(keys[i++ % KEY_COUNT]), {});
+    KJ_ASSERT(result.get<kj::Maybe<ActorCacheOps::Value>>() != nullptr);
+  }
+  allocations.report(state);
+  state.SetItemsProcessed(state.iterations());
+}
+
+void sqliteGetMultiple(benchmark::State& state) {
+  // One get() of `state.range(0)` keys, all of which exist, per iteration.
+  SqliteFixture fixture;
+  fixture.populate();
+  uint batch = state.range(0);
+
+  bench::AllocationCounter allocations;
+  uint next = 0;
+  for (auto _: state) {
+    auto result = fixture.sqlite.get(keyBatch(next, batch), {});
+    KJ_ASSERT(result.get<ActorCacheOps::GetResultList>().size() == batch);
+  }
+  allocations.report(state);
+  state.SetItemsProcessed(state.iterations() * batch);
+}
+
+void sqlitePutMultiple(benchmark::State& state) {
+  // One put() of `state.range(0)` pairs per event loop turn, including the commit.
+  SqliteFixture fixture;
+  uint batch = state.range(0);
+
+  bench::AllocationCounter allocations;
+  uint next = 0;
+  for (auto _: state) {
+    auto keys = keyBatch(next, batch);
+    auto pairs = KJ_MAP(k, keys) {
+      return ActorCacheOps::KeyValuePair { kj::mv(k), value() };
+    };
+    benchmark::DoNotOptimize(fixture.sqlite.put(kj::mv(pairs), {}));
+    fixture.loop.run();
+  }
+  allocations.report(state);
+  state.SetItemsProcessed(state.iterations() * batch);
+}
+
+void sqliteDeleteMultiple(benchmark::State& state) {
+  // One delete() of `state.range(0)` keys per event loop turn, including the commit. The keys
+  // are put back outside the timed region, so allocations aren't reported.
+  SqliteFixture fixture;
+  fixture.populate();
+  uint batch = state.range(0);
+
+  uint next = 0;
+  for (auto _: state) {
+    uint first = next;
+    auto result = fixture.sqlite.delete_(keyBatch(next, batch), {});
+    KJ_ASSERT(result.get<uint>() == batch);
+    fixture.loop.run();
+
+    state.PauseTiming();
+    for (uint i = 0; i < batch; i++) {
+      fixture.sqlite.put(key((first + i) % KEY_COUNT), value(), {});
+    }
+    fixture.loop.run();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * batch);
+}
+
+void actorActivation(benchmark::State& state) {
+  // Opens storage for a new actor and writes one key, including the commit. With state.range(0)
+  // zero, each actor gets its own database file; otherwise actors are spread over that many
+  // shards. Actors are kept open, as they would be while active, so that the memory SQLite holds
+  // for them can be reported.
+  uint shardCount = state.range(0);
+  kj::EventLoop loop;
+  kj::WaitScope ws(loop);
+  auto dir = kj::newInMemoryDirectory(kj::nullClock());
+  SqliteDatabase::Vfs vfs(*dir);
+  OutputGate gate;
+  auto commitCallback = []() -> kj::Promise<void> { return kj::READY_NOW; };
+
+  kj::Vector<kj::Own<ActorSqliteShard>> shards;
+  for (uint i = 0; i < shardCount; i++) {
+    shards.add(kj::refcounted<ActorSqliteShard>(kj::heap<SqliteDatabase>(vfs,
+        kj::Path({kj::str("shard-", i, ".sqlite")}),
+        kj::WriteMode::CREATE | kj::WriteMode::MODIFY)));
+  }
+  kj::Vector<kj::Own<ActorSqlite>> actors;
+
+  auto sqliteMemoryBefore = sqlite3_memory_used();
+  bench::AllocationCounter allocations;
+  uint next = 0;
+  for (auto _: state) {
+    auto id = kj::str("actor", next++);
+    kj::Own<ActorSqlite> actor;
+    if (shardCount == 0) {
+      actor = kj::heap<ActorSqlite>(kj::heap<SqliteDatabase>(vfs,
+          kj::Path({kj::str(id, ".sqlite")}), kj::WriteMode::CREATE | kj::WriteMode::MODIFY),
+          gate, commitCallback);
+    } else {
+      actor = kj::heap<ActorSqlite>(*shards[ActorSqliteShard::shardFor(id, shardCount)], id,
+          gate, commitCallback);
+    }
+    actor->put(key(0), value(), {});
+    loop.run();
+    actors.add(kj::mv(actor));
+  }
+  allocations.report(state);
+  state.counters["sqlite_bytes_per_actor"] = benchmark::Counter(
+      double(sqlite3_memory_used() - sqliteMemoryBefore), benchmark::Counter::kAvgIterations);
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(cacheGet);
+BENCHMARK(cachePut);
+BENCHMARK(cacheList)->Arg(10)->Arg(100);
+BENCHMARK(sqlitePut)->Arg(1)->Arg(100);
+BENCHMARK(sqliteGet)->Arg(0)->Arg(1);
+BENCHMARK(sqliteGetMultiple)->Arg(1)->Arg(16)->Arg(128);
+BENCHMARK(sqlitePutMultiple)->Arg(1)->Arg(16)->Arg(128);
+BENCHMARK(sqliteDeleteMultiple)->Arg(1)->Arg(16)->Arg(128);
+// A fixed number of iterations, since every activated actor stays open.
+BENCHMARK(actorActivation)->Arg(0)->Arg(16)->Iterations(2000);
+
+}  // namespace
+}  // namespace workerd
@@ -0,0 +1,68 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#include "bench-allocations.h"
+#include <workerd/util/alloc-profiler.h>
+#include <stdlib.h>
+#include <new>
+
+#ifdef WORKERD_ALLOCATION_PROFILING
+
+// The allocation profiler already replaces the global allocation functions, and counts every
+// allocation.
+namespace workerd::bench {
+
+uint64_t allocationCount() {
+  return processAllocationCount();
+}
+
+}  // namespace workerd::bench
+
+#else  // WORKERD_ALLOCATION_PROFILING
+
+namespace workerd::bench {
+namespace {
+
+uint64_t allocations = 0;
+
+void* countedAlloc(size_t size) {
+  __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+  void* result = malloc(size == 0 ? 1 : size);
+  if (result == nullptr) throw std::bad_alloc();
+  return result;
+}
+
+}  // namespace
+
+uint64_t allocationCount() {
+  return __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+}
+
+}  // namespace workerd::bench
+
+void* operator new(size_t size) {
+  return workerd::bench::countedAlloc(size);
+}
+
+void* operator new[](size_t size) {
+  return workerd::bench::countedAlloc(size);
+}
+
+void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+  free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+  free(ptr);
+}
+
+#endif  // WORKERD_ALLOCATION_PROFILING
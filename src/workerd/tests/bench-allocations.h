@@ -0,0 +1,34 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#pragma once
+// Counts heap allocations made through `operator new`, so that benchmarks can report
+// allocations per operation alongside time. Linking this library replaces the global allocation
+// functions for the whole binary. V8's own heap is not counted, since it doesn't use them.
+
+#include <benchmark/benchmark.h>
+#include <stdint.h>
+
+namespace workerd::bench {
+
+uint64_t allocationCount();
+// Number of allocations made by any thread since the process started.
+
+class AllocationCounter {
+  // Reports the allocations made between construction and report() as the "allocs_per_op"
+  // counter, averaged over the benchmark's iterations.
+
+public:
+  AllocationCounter(): start(allocationCount()) {}
+
+  void report(benchmark::State& state) {
+    state.counters["allocs_per_op"] = benchmark::Counter(
+        double(allocationCount() - start), benchmark::Counter::kAvgIterations);
+  }
+
+private:
+  uint64_t start;
+};
+
+}  // namespace workerd::bench
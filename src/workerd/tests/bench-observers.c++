@@ -0,0 +1,90 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+// Measures what workerd's metrics observers add to each request, compared to the no-op
+// observers, by driving the observer calls made over a typical request's lifetime.
+
+#include <benchmark/benchmark.h>
+#include <workerd/server/observers.h>
+
+namespace workerd::server {
+namespace {
+
+template <typename MakeObserver>
+void requestLifecycle(benchmark::State& state, MakeObserver&& makeObserver) {
+  for (auto _: state) {
+    kj::Own<RequestObserver> observer = makeObserver();
+    observer->delivered();
+    benchmark::DoNotOptimize(observer->wrapSubrequestClient(nullptr));
+    observer->jsDone();
+  }
+}
+
+void requestNull(benchmark::State& state) {
+  requestLifecycle(state, []() { return kj::refcounted<RequestObserver>(); });
+}
+
+void requestWorkerd(benchmark::State& state) {
+  RequestMetrics metrics;
+  requestLifecycle(state, [&]() { return kj::refcounted<WorkerdRequestObserver>(metrics); });
+}
+
+void actorStorageOps(benchmark::State& state, ActorObserver& observer) {
+  for (auto _: state) {
+    observer.startRequest();
+    observer.addCachedStorageReadUnits(1);
+    observer.addStorageWriteUnits(1);
+    observer.endRequest();
+  }
+}
+
+void actorNull(benchmark::State& state) {
+  auto observer = kj::refcounted<ActorObserver>();
+  actorStorageOps(state, *observer);
+}
+
+void actorWorkerd(benchmark::State& state) {
+  ActorMetrics metrics;
+  auto observer = kj::refcounted<WorkerdActorObserver>(metrics);
+  actorStorageOps(state, *observer);
+}
+
+void histogramRecord(benchmark::State& state) {
+  DurationHistogram histogram;
+  int64_t i = 0;
+  for (auto _: state) {
+    histogram.record((i++ & 0xffff) * kj::MICROSECONDS);
+  }
+  benchmark::DoNotOptimize(histogram.snapshot().count);
+}
+
+void counterAdd(benchmark::State& state) {
+  // Run with several threads to see that shards keep them from contending.
+  static ShardedCounter counter;
+  for (auto _: state) {
+    counter.add();
+  }
+  benchmark::DoNotOptimize(counter.read());
+}
+
+void lockTiming(benchmark::State& state) {
+  auto observer = kj::atomicRefcounted<WorkerdIsolateObserver>(kj::str("bench"), nullptr);
+  for (auto _: state) {
+    auto timing = KJ_ASSERT_NONNULL(
+        observer->tryCreateLockTiming(kj::Maybe<RequestObserver&>(nullptr)));
+    timing->locked();
+    timing->stop();
+  }
+}
+
+BENCHMARK(requestNull);
+BENCHMARK(requestWorkerd);
+BENCHMARK(actorNull);
+BENCHMARK(actorWorkerd);
+BENCHMARK(histogramRecord);
+BENCHMARK(counterAdd)->Threads(1)->Threads(4);
+BENCHMARK(lockTiming);
+
+}  // namespace
+}  // namespace workerd::server
@@ -0,0 +1,103 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+// Measures the per-request path of a Worker in-process: a full round trip through a trivial
+// fetch handler, streaming response bodies out of the isolate, and the Web APIs nearly every
+// handler touches (Headers, URL, TextEncoder). Reports operations per second and C++ heap
+// allocations per operation.
+
+#include "bench-allocations.h"
+#include "test-fixture.h"
+
+namespace workerd {
+namespace {
+
+constexpr kj::StringPtr BODY_MODULE = R"SCRIPT(
+  export default {
+    fetch(request) {
+      const size = parseInt(new URL(request.url).searchParams.get("size"));
+      return new Response(new Uint8Array(size));
+    },
+  };
+)SCRIPT"_kj;
+
+void fetchRoundTrip(benchmark::State& state) {
+  TestFixture fixture;
+  bench::AllocationCounter allocations;
+  for (auto _: state) {
+    auto response = fixture.runRequest(kj::HttpMethod::GET, "http://www.example.com"_kj, ""_kj);
+    benchmark::DoNotOptimize(response.statusCode);
+  }
+  allocations.report(state);
+  state.SetItemsProcessed(state.iterations());
+}
+
+void responseBody(benchmark::State& state) {
+  TestFixture fixture({ .mainModuleSource = BODY_MODULE });
+  auto url = kj::str("http://www.example.com/?size=", state.range(0));
+  bench::AllocationCounter allocations;
+  for (auto _: state) {
+    auto response = fixture.runRequest(kj::HttpMethod::GET, url, ""_kj);
+    KJ_ASSERT(response.body.size() == size_t(state.range(0)));
+  }
+  allocations.report(state);
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+
+void callJs(benchmark::State& state, kj::StringPtr function) {
+  // `function` is the source of a JavaScript function taking no arguments, which is called once
+  // per iteration within a single request.
+  TestFixture fixture;
+  fixture.runInIoContext([&](const TestFixture::Environment& env) {
+    auto context = env.isolate->GetCurrentContext();
+    auto fn = env.compileAndRunScript(kj::str("(", function, ")")).As<v8::Function>();
+    auto receiver = v8::Undefined(env.isolate);
+
+    bench::AllocationCounter allocations;
+    for (auto _: state) {
+      v8::HandleScope scope(env.isolate);
+      benchmark::DoNotOptimize(jsg::check(fn->Call(context, receiver, 0, nullptr)));
+    }
+    allocations.report(state);
+  });
+  state.SetItemsProcessed(state.iterations());
+}
+
+void headers(benchmark::State& state) {
+  callJs(state, R"SCRIPT(function() {
+    const headers = new Headers({
+      "Content-Type": "application/json",
+      "Cache-Control": "no-store",
+    });
+    headers.set("X-Request-Id", "abc123");
+    headers.append("Vary", "Accept-Encoding");
+    headers.delete("Cache-Control");
+    return headers.get("content-type");
+  })SCRIPT"_kj);
+}
+
+void urlParse(benchmark::State& state) {
+  callJs(state, R"SCRIPT(function() {
+    const url = new URL("https://user@www.example.com:8080/a/b/c?x=1&y=two#frag");
+    return url.searchParams.get("y") + url.pathname;
+  })SCRIPT"_kj);
+}
+
+void textEncode(benchmark::State& state) {
+  callJs(state, R"SCRIPT(function() {
+    globalThis.encoder ??= new TextEncoder();
+    globalThis.text ??= "héllo wörld ".repeat(100);
+    return encoder.encode(text);
+  })SCRIPT"_kj);
+}
+
+BENCHMARK(fetchRoundTrip);
+BENCHMARK(responseBody)->Arg(1 << 10)->Arg(64 << 10)->Arg(1 << 20);
+BENCHMARK(headers);
+BENCHMARK(urlParse);
+BENCHMARK(textEncode);
+
+}  // namespace
+}  // namespace workerd
@@ -0,0 +1,58 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+// Compares structured cloning of binary values through jsg::Serializer's flat V8 wire format
+// against its out-of-band external buffer mode.
+
+#include <benchmark/benchmark.h>
+#include <workerd/jsg/jsg.h>
+#include <workerd/jsg/setup.h>
+#include <workerd/jsg/ser.h>
+
+namespace workerd::jsg {
+namespace {
+
+V8System v8System;
+
+struct BenchContext: public Object {
+  JSG_RESOURCE_TYPE(BenchContext) {}
+};
+JSG_DECLARE_ISOLATE_TYPE(BenchIsolate, BenchContext);
+
+constexpr size_t EXTERNAL_BUFFER_THRESHOLD = 512;
+
+void cloneBinary(benchmark::State& state, kj::Maybe<size_t> externalBufferThreshold) {
+  BenchIsolate isolate(v8System);
+  V8StackScope stackScope;
+  BenchIsolate::Lock lock(isolate, stackScope);
+  v8::HandleScope handleScope(lock.v8Isolate);
+  auto context = lock.newContext<BenchContext>().getHandle(lock.v8Isolate);
+  v8::Context::Scope contextScope(context);
+
+  size_t size = state.range(0);
+  auto buffer = v8::ArrayBuffer::New(lock.v8Isolate, size);
+  memset(buffer->Data(), 'x', size);
+  auto value = v8::Uint8Array::New(buffer, 0, size);
+
+  for (auto _: state) {
+    v8::HandleScope iterationScope(lock.v8Isolate);
+    benchmark::DoNotOptimize(
+        structuredClone(value, lock.v8Isolate, nullptr, externalBufferThreshold));
+  }
+  state.SetBytesProcessed(state.iterations() * size);
+}
+
+void BM_CloneFlat(benchmark::State& state) {
+  cloneBinary(state, nullptr);
+}
+
+void BM_CloneExternal(benchmark::State& state) {
+  cloneBinary(state, EXTERNAL_BUFFER_THRESHOLD);
+}
+
+BENCHMARK(BM_CloneFlat)->Arg(1 << 10)->Arg(100 << 10)->Arg(10 << 20);
+BENCHMARK(BM_CloneExternal)->Arg(1 << 10)->Arg(100 << 10)->Arg(10 << 20);
+
+}  // namespace
+}  // namespace workerd::jsg
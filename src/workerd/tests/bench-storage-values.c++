@@ -0,0 +1,99 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+// Measures the per-value cost of Durable Object storage put() and get() for small values, as
+// spent encoding and decoding them, under both storage value encodings and the hot value cache.
+
+#include <benchmark/benchmark.h>
+#include <workerd/api/actor-state.h>
+#include <workerd/jsg/jsg.h>
+#include <workerd/jsg/setup.h>
+
+namespace workerd::api {
+namespace {
+
+jsg::V8System v8System;
+
+struct BenchContext: public jsg::Object {
+  JSG_RESOURCE_TYPE(BenchContext) {}
+};
+JSG_DECLARE_ISOLATE_TYPE(BenchIsolate, BenchContext);
+
+enum class ValueKind { INT, STRING, OBJECT };
+
+v8::Local<v8::Value> makeValue(v8::Isolate* isolate, ValueKind kind) {
+  switch (kind) {
+    case ValueKind::INT:
+      return v8::Integer::New(isolate, 12345);
+    case ValueKind::STRING:
+      return jsg::v8Str(isolate, "a typical short configuration string value");
+    case ValueKind::OBJECT: {
+      auto context = isolate->GetCurrentContext();
+      auto obj = v8::Object::New(isolate);
+      jsg::check(obj->Set(context, jsg::v8Str(isolate, "count"), v8::Integer::New(isolate, 7)));
+      jsg::check(obj->Set(context, jsg::v8Str(isolate, "name"), jsg::v8Str(isolate, "counter")));
+      jsg::check(obj->Set(context, jsg::v8Str(isolate, "enabled"), v8::True(isolate)));
+      return obj;
+    }
+  }
+  KJ_UNREACHABLE;
+}
+
+enum class ReadMode { DESERIALIZE, CACHED };
+
+template <typename Func>
+void withContext(Func&& func) {
+  BenchIsolate isolate(v8System);
+  jsg::V8StackScope stackScope;
+  BenchIsolate::Lock lock(isolate, stackScope);
+  v8::HandleScope handleScope(lock.v8Isolate);
+  auto context = lock.newContext<BenchContext>().getHandle(lock.v8Isolate);
+  v8::Context::Scope contextScope(context);
+  func(lock.v8Isolate);
+}
+
+void put(benchmark::State& state, ValueKind kind, StorageValueEncoding encoding) {
+  withContext([&](v8::Isolate* isolate) {
+    auto value = makeValue(isolate, kind);
+    size_t bytes = 0;
+    for (auto _: state) {
+      auto buf = serializeV8Value(value, isolate, encoding);
+      bytes = buf.size();
+      benchmark::DoNotOptimize(buf.begin());
+    }
+    state.counters["bytes_per_value"] = bytes;
+  });
+}
+
+void get(benchmark::State& state, ValueKind kind, StorageValueEncoding encoding, ReadMode mode) {
+  withContext([&](v8::Isolate* isolate) {
+    auto buf = serializeV8Value(makeValue(isolate, kind), isolate, encoding);
+    auto cache = kj::refcounted<StorageValueCache>();
+    for (auto _: state) {
+      v8::HandleScope iterationScope(isolate);
+      if (mode == ReadMode::CACHED) {
+        benchmark::DoNotOptimize(cache->deserialize(isolate, "key"_kj, buf));
+      } else {
+        benchmark::DoNotOptimize(deserializeV8Value("key"_kj, buf, isolate));
+      }
+    }
+  });
+}
+
+#define BENCH_KIND(kind) \
+  BENCHMARK_CAPTURE(put, kind##_v8, ValueKind::kind, StorageValueEncoding::V8); \
+  BENCHMARK_CAPTURE(put, kind##_compact, ValueKind::kind, StorageValueEncoding::COMPACT); \
+  BENCHMARK_CAPTURE(get, kind##_v8, ValueKind::kind, StorageValueEncoding::V8, \
+                    ReadMode::DESERIALIZE); \
+  BENCHMARK_CAPTURE(get, kind##_compact, ValueKind::kind, StorageValueEncoding::COMPACT, \
+                    ReadMode::DESERIALIZE); \
+  BENCHMARK_CAPTURE(get, kind##_compact_cached, ValueKind::kind, \
+                    StorageValueEncoding::COMPACT, ReadMode::CACHED)
+
+BENCH_KIND(INT);
+BENCH_KIND(STRING);
+BENCH_KIND(OBJECT);
+
+}  // namespace
+}  // namespace workerd::api
@@ -132,6 +132,7 @@ struct MockLimitEnforcer final: public LimitEnforcer {
 
 struct MockIsolateLimitEnforcer final: public IsolateLimitEnforcer {
    v8::Isolate::CreateParams getCreateParams() override { return {}; }
+    jsg::CppHeapOptions getCppHeapOptions() override { return {}; }
     void customizeIsolate(v8::Isolate* isolate) override {}
     ActorCacheSharedLruOptions getActorCacheLruOptions() override {
       return {
@@ -195,7 +196,10 @@ struct MemoryOutputStream final: kj::AsyncOutputStream, public kj::Refcounted  {
   }
 
   kj::Promise<void> write(kj::ArrayPtr<const kj::ArrayPtr<const byte>> pieces) override {
-    KJ_FAIL_REQUIRE("NOT IMPLEMENTED");
+    for (auto& piece: pieces) {
+      content.addAll(piece);
+    }
+    return kj::READY_NOW;
   }
 
   kj::Promise<void> whenWriteDisconnected() override {
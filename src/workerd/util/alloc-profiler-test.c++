@@ -0,0 +1,63 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#include "alloc-profiler.h"
+#include <kj/test.h>
+
+namespace workerd {
+namespace {
+
+void* volatile sink;
+// Storing each allocation here keeps the compiler from eliding it.
+
+KJ_TEST("allocations are attributed to the innermost scopes") {
+  AllocationStats request;
+  AllocationStats other;
+  {
+    AllocationStatsScope statsScope(request);
+    auto a = kj::heap<uint64_t>(1);
+    sink = a.get();
+    {
+      AllocationCategoryScope categoryScope(AllocationCategory::HEADERS);
+      auto b = kj::heapArray<char>(100);
+      sink = b.begin();
+      {
+        AllocationStatsScope nested(other);
+        auto c = kj::heap<uint64_t>(3);
+        sink = c.get();
+      }
+      {
+        AllocationStatsScope none(nullptr);
+        auto d = kj::heap<uint64_t>(4);
+        sink = d.get();
+      }
+    }
+  }
+  auto outside = kj::heap<uint64_t>(5);
+  sink = outside.get();
+
+  auto headers = static_cast<uint>(AllocationCategory::HEADERS);
+  auto otherCategory = static_cast<uint>(AllocationCategory::OTHER);
+  if (ALLOCATION_PROFILING_ENABLED) {
+    KJ_EXPECT(request.counts[otherCategory] == 1);
+    KJ_EXPECT(request.bytes[otherCategory] == sizeof(uint64_t));
+    KJ_EXPECT(request.counts[headers] == 1);
+    KJ_EXPECT(request.bytes[headers] >= 100);
+    KJ_EXPECT(other.counts[headers] == 1);
+    KJ_EXPECT(processAllocationCount() > 0);
+  } else {
+    KJ_EXPECT(request.counts[otherCategory] == 0);
+    KJ_EXPECT(request.counts[headers] == 0);
+    KJ_EXPECT(other.counts[headers] == 0);
+    KJ_EXPECT(processAllocationCount() == 0);
+  }
+}
+
+KJ_TEST("allocation category names") {
+  KJ_EXPECT(allocationCategoryName(AllocationCategory::JSG_WRAPPER) == "jsg_wrapper");
+  KJ_EXPECT(allocationCategoryName(AllocationCategory::IO_OWNED_OBJECT) == "io_owned_object");
+}
+
+}  // namespace
+}  // namespace workerd
@@ -0,0 +1,107 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#include "alloc-profiler.h"
+#include <kj/debug.h>
+#include <stdlib.h>
+#include <new>
+
+namespace workerd {
+
+kj::StringPtr allocationCategoryName(AllocationCategory category) {
+  switch (category) {
+    case AllocationCategory::OTHER: return "other"_kj;
+    case AllocationCategory::HEADERS: return "headers"_kj;
+    case AllocationCategory::JSG_WRAPPER: return "jsg_wrapper"_kj;
+    case AllocationCategory::IO_OWNED_OBJECT: return "io_owned_object"_kj;
+    case AllocationCategory::PROMISE: return "promise"_kj;
+  }
+  KJ_UNREACHABLE;
+}
+
+#ifdef WORKERD_ALLOCATION_PROFILING
+
+namespace {
+
+thread_local AllocationStats* currentStats = nullptr;
+thread_local AllocationCategory currentCategory = AllocationCategory::OTHER;
+uint64_t processCount = 0;
+
+void* countedAlloc(size_t size) {
+  __atomic_add_fetch(&processCount, 1, __ATOMIC_RELAXED);
+  if (AllocationStats* stats = currentStats) {
+    // Stats are only written by the thread running the request, so plain increments suffice.
+    auto index = static_cast<uint>(currentCategory);
+    ++stats->counts[index];
+    stats->bytes[index] += size;
+  }
+
+  void* result = malloc(size == 0 ? 1 : size);
+  if (result == nullptr) throw std::bad_alloc();
+  return result;
+}
+
+}  // namespace
+
+AllocationStatsScope::AllocationStatsScope(kj::Maybe<AllocationStats&> stats)
+    : previous(currentStats) {
+  KJ_IF_MAYBE(s, stats) {
+    currentStats = s;
+  } else {
+    currentStats = nullptr;
+  }
+}
+
+AllocationStatsScope::~AllocationStatsScope() noexcept(false) {
+  currentStats = previous;
+}
+
+AllocationCategoryScope::AllocationCategoryScope(AllocationCategory category)
+    : previous(currentCategory) {
+  currentCategory = category;
+}
+
+AllocationCategoryScope::~AllocationCategoryScope() noexcept(false) {
+  currentCategory = previous;
+}
+
+uint64_t processAllocationCount() {
+  return __atomic_load_n(&processCount, __ATOMIC_RELAXED);
+}
+
+}  // namespace workerd
+
+void* operator new(size_t size) {
+  return workerd::countedAlloc(size);
+}
+
+void* operator new[](size_t size) {
+  return workerd::countedAlloc(size);
+}
+
+void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+  free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+  free(ptr);
+}
+
+#else  // WORKERD_ALLOCATION_PROFILING
+
+uint64_t processAllocationCount() {
+  return 0;
+}
+
+}  // namespace workerd
+
+#endif  // WORKERD_ALLOCATION_PROFILING
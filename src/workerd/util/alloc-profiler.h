@@ -0,0 +1,100 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#pragma once
+// Optional per-request allocation profiling.
+//
+// Building with `--//src/workerd/util:allocation_profiling` defines WORKERD_ALLOCATION_PROFILING
+// and replaces the global `operator new`. Every allocation made on a thread is then counted,
+// along with its size, against the request whose code that thread is running (see
+// `AllocationStatsScope`), in the category of the innermost `AllocationCategoryScope`.
+// Allocations made outside any scope are attributed to no request at all.
+//
+// In normal builds, the scopes are empty and compile to nothing, so hot paths can be annotated
+// without cost.
+
+#include <kj/common.h>
+#include <kj/string.h>
+#include <inttypes.h>
+
+namespace workerd {
+
+#ifdef WORKERD_ALLOCATION_PROFILING
+constexpr bool ALLOCATION_PROFILING_ENABLED = true;
+#else
+constexpr bool ALLOCATION_PROFILING_ENABLED = false;
+#endif
+
+enum class AllocationCategory: uint8_t {
+  OTHER,
+  // Anything not inside a more specific scope.
+
+  HEADERS,
+  // Copying header names and values into and out of the `Headers` API.
+
+  JSG_WRAPPER,
+  // C++ objects backing JavaScript API objects, created with `jsg::alloc()`, including whatever
+  // their constructors allocate.
+
+  IO_OWNED_OBJECT,
+  // Bookkeeping for objects handed to `IoContext::addObject()`.
+
+  PROMISE,
+  // Promise nodes and continuations bridging KJ and JavaScript promises in
+  // `IoContext::awaitIo()` and `awaitJs()`.
+};
+
+constexpr uint ALLOCATION_CATEGORY_COUNT = 5;
+
+kj::StringPtr allocationCategoryName(AllocationCategory category);
+// Lower-case name for metrics labels, e.g. "jsg_wrapper".
+
+struct AllocationStats {
+  uint64_t counts[ALLOCATION_CATEGORY_COUNT] = {};
+  uint64_t bytes[ALLOCATION_CATEGORY_COUNT] = {};
+};
+
+class AllocationStatsScope {
+  // Counts allocations made on this thread into `stats` for as long as this is on the stack. If
+  // `stats` is null, allocations are counted nowhere. Scopes nest; the innermost wins.
+
+public:
+#ifdef WORKERD_ALLOCATION_PROFILING
+  explicit AllocationStatsScope(kj::Maybe<AllocationStats&> stats);
+  ~AllocationStatsScope() noexcept(false);
+#else
+  explicit AllocationStatsScope(kj::Maybe<AllocationStats&>) {}
+#endif
+  KJ_DISALLOW_COPY_AND_MOVE(AllocationStatsScope);
+
+private:
+#ifdef WORKERD_ALLOCATION_PROFILING
+  AllocationStats* previous;
+#endif
+};
+
+class AllocationCategoryScope {
+  // Attributes allocations made on this thread to `category` for as long as this is on the
+  // stack. Scopes nest; the innermost wins.
+
+public:
+#ifdef WORKERD_ALLOCATION_PROFILING
+  explicit AllocationCategoryScope(AllocationCategory category);
+  ~AllocationCategoryScope() noexcept(false);
+#else
+  explicit AllocationCategoryScope(AllocationCategory) {}
+#endif
+  KJ_DISALLOW_COPY_AND_MOVE(AllocationCategoryScope);
+
+private:
+#ifdef WORKERD_ALLOCATION_PROFILING
+  AllocationCategory previous;
+#endif
+};
+
+uint64_t processAllocationCount();
+// Allocations made by any thread since the process started, whether or not inside a scope.
+// Always zero in normal builds.
+
+}  // namespace workerd
@@ -0,0 +1,33 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#include "counter.h"
+#include <kj/test.h>
+#include <kj/thread.h>
+#include <kj/vector.h>
+
+namespace workerd {
+namespace {
+
+KJ_TEST("ShardedCounter sums adds from every thread") {
+  ShardedCounter counter;
+  counter.add();
+  counter.add(4);
+  KJ_EXPECT(counter.read() == 5);
+
+  {
+    // More threads than shards, so some of them share one.
+    kj::Vector<kj::Own<kj::Thread>> threads;
+    for (uint i = 0; i < THREAD_SHARD_COUNT * 2; i++) {
+      threads.add(kj::heap<kj::Thread>([&counter]() {
+        for (uint j = 0; j < 1000; j++) counter.add();
+      }));
+    }
+  }
+
+  KJ_EXPECT(counter.read() == 5 + THREAD_SHARD_COUNT * 2 * 1000);
+}
+
+}  // namespace
+}  // namespace workerd
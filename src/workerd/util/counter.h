@@ -0,0 +1,53 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#pragma once
+
+#include <kj/common.h>
+#include <inttypes.h>
+
+namespace workerd {
+
+using kj::uint;
+
+constexpr uint THREAD_SHARD_COUNT = 8;
+// Number of per-thread slots in sharded statistics. Threads are assigned slots round-robin the
+// first time they record anything, so a slot is only shared once there are more threads than
+// this.
+
+inline uint currentThreadShard() {
+  static uint nextShard = 0;
+  static thread_local uint shard =
+      __atomic_fetch_add(&nextShard, 1, __ATOMIC_RELAXED) % THREAD_SHARD_COUNT;
+  return shard;
+}
+
+class ShardedCounter {
+  // Counter for statistics that may be updated from any thread. Each thread adds to its own
+  // cache line, so threads never contend over a counter; reading sums the shards. A read taken
+  // while other threads are adding is not a consistent snapshot, but never goes backwards.
+
+public:
+  void add(uint64_t n = 1) const {
+    // Still atomic, since a shard is shared by threads once there are more than
+    // THREAD_SHARD_COUNT of them, but uncontended in the common case.
+    __atomic_add_fetch(&shards[currentThreadShard()].value, n, __ATOMIC_RELAXED);
+  }
+
+  uint64_t read() const {
+    uint64_t result = 0;
+    for (auto& shard: shards) {
+      result += __atomic_load_n(&shard.value, __ATOMIC_RELAXED);
+    }
+    return result;
+  }
+
+private:
+  struct alignas(64) Shard {
+    uint64_t value = 0;
+  };
+  mutable Shard shards[THREAD_SHARD_COUNT];
+};
+
+}  // namespace workerd
@@ -0,0 +1,46 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#include "histogram.h"
+#include <kj/test.h>
+
+namespace workerd {
+namespace {
+
+KJ_TEST("DurationHistogram buckets") {
+  KJ_EXPECT(DurationHistogram::bucketFor(0 * kj::NANOSECONDS) == 0);
+  KJ_EXPECT(DurationHistogram::bucketFor(999 * kj::NANOSECONDS) == 0);
+  KJ_EXPECT(DurationHistogram::bucketFor(1 * kj::MICROSECONDS) == 1);
+  KJ_EXPECT(DurationHistogram::bucketFor(2 * kj::MICROSECONDS) == 2);
+  KJ_EXPECT(DurationHistogram::bucketFor(3 * kj::MICROSECONDS) == 2);
+  KJ_EXPECT(DurationHistogram::bucketFor(4 * kj::MICROSECONDS) == 3);
+  KJ_EXPECT(DurationHistogram::bucketFor(1 * kj::MILLISECONDS) == 10);
+  KJ_EXPECT(DurationHistogram::bucketFor(10000 * kj::SECONDS) ==
+            DurationHistogram::BUCKET_COUNT - 1);
+
+  for (uint i = 1; i < DurationHistogram::BUCKET_COUNT - 1; i++) {
+    auto bound = DurationHistogram::bucketUpperBound(i);
+    KJ_EXPECT(DurationHistogram::bucketFor(bound - 1 * kj::NANOSECONDS) == i, i);
+    KJ_EXPECT(DurationHistogram::bucketFor(bound) == i + 1, i);
+  }
+}
+
+KJ_TEST("DurationHistogram snapshot and percentiles") {
+  DurationHistogram histogram;
+  KJ_EXPECT(histogram.snapshot().count == 0);
+  KJ_EXPECT(histogram.snapshot().percentile(0.5) == 0 * kj::NANOSECONDS);
+
+  for (uint i = 0; i < 90; i++) histogram.record(3 * kj::MICROSECONDS);
+  for (uint i = 0; i < 10; i++) histogram.record(5 * kj::MILLISECONDS);
+
+  auto snapshot = histogram.snapshot();
+  KJ_EXPECT(snapshot.count == 100);
+  KJ_EXPECT(snapshot.sum == 90 * 3 * kj::MICROSECONDS + 10 * 5 * kj::MILLISECONDS);
+  KJ_EXPECT(snapshot.percentile(0.5) == 4 * kj::MICROSECONDS);
+  KJ_EXPECT(snapshot.percentile(0.9) == 4 * kj::MICROSECONDS);
+  KJ_EXPECT(snapshot.percentile(0.99) == 8192 * kj::MICROSECONDS);
+}
+
+}  // namespace
+}  // namespace workerd
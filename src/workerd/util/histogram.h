@@ -0,0 +1,83 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#pragma once
+
+#include "counter.h"
+#include <kj/time.h>
+
+namespace workerd {
+
+class DurationHistogram {
+  // Histogram of durations with power-of-two bucket boundaries, starting at one microsecond.
+  // Recording is a couple of relaxed atomic increments on the calling thread's own shard (see
+  // ShardedCounter), so it is cheap enough for hot paths and safe to share across threads.
+  // Snapshots taken while other threads record are not atomic as a whole, but each counter is.
+
+public:
+  static constexpr uint BUCKET_COUNT = 32;
+  // Bucket 0 counts samples under 1us. Bucket i, for 0 < i < BUCKET_COUNT - 1, counts samples in
+  // [2^(i-1), 2^i) microseconds. The last bucket counts everything larger, i.e. over ~18 minutes.
+
+  static kj::Duration bucketUpperBound(uint i) {
+    // Exclusive upper bound of bucket `i`. Meaningless for the last bucket, which is unbounded.
+    return (uint64_t(1) << i) * kj::MICROSECONDS;
+  }
+
+  static uint bucketFor(kj::Duration d) {
+    if (d < 1 * kj::MICROSECONDS) return 0;
+    uint64_t micros = d / kj::MICROSECONDS;
+    uint i = 64 - __builtin_clzll(micros);
+    return kj::min(i, BUCKET_COUNT - 1);
+  }
+
+  void record(kj::Duration d) const {
+    auto& shard = shards[currentThreadShard()];
+    __atomic_add_fetch(&shard.buckets[bucketFor(d)], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&shard.sumNanos, d / kj::NANOSECONDS, __ATOMIC_RELAXED);
+  }
+
+  struct Snapshot {
+    uint64_t buckets[BUCKET_COUNT] = {};
+    uint64_t count = 0;
+    kj::Duration sum = 0 * kj::NANOSECONDS;
+
+    kj::Duration percentile(double p) const {
+      // Upper bound of the bucket containing the `p`th percentile (0 < p <= 1). Returns zero if
+      // there are no samples.
+      if (count == 0) return 0 * kj::NANOSECONDS;
+      uint64_t target = kj::max(uint64_t(1), uint64_t(p * count + 0.5));
+      uint64_t seen = 0;
+      for (uint i = 0; i < BUCKET_COUNT; i++) {
+        seen += buckets[i];
+        if (seen >= target) return bucketUpperBound(i);
+      }
+      return bucketUpperBound(BUCKET_COUNT - 1);
+    }
+  };
+
+  Snapshot snapshot() const {
+    Snapshot result;
+    int64_t sumNanos = 0;
+    for (auto& shard: shards) {
+      for (uint i = 0; i < BUCKET_COUNT; i++) {
+        auto n = __atomic_load_n(&shard.buckets[i], __ATOMIC_RELAXED);
+        result.buckets[i] += n;
+        result.count += n;
+      }
+      sumNanos += __atomic_load_n(&shard.sumNanos, __ATOMIC_RELAXED);
+    }
+    result.sum = sumNanos * kj::NANOSECONDS;
+    return result;
+  }
+
+private:
+  struct alignas(64) Shard {
+    uint64_t buckets[BUCKET_COUNT] = {};
+    int64_t sumNanos = 0;
+  };
+  mutable Shard shards[THREAD_SHARD_COUNT];
+};
+
+}  // namespace workerd
@@ -4,6 +4,7 @@
 
 #include "sqlite-kv.h"
 #include <kj/test.h>
+#include <algorithm>
 
 namespace workerd {
 namespace {
@@ -91,5 +92,115 @@ KJ_TEST("SQLite-KV") {
   KJ_EXPECT(list(nullptr, nullptr, nullptr, F) == "");
 }
 
+KJ_TEST("SQLite-KV multi-key operations") {
+  auto dir = kj::newInMemoryDirectory(kj::nullClock());
+  SqliteDatabase::Vfs vfs(*dir);
+  SqliteDatabase db(vfs, kj::Path({"foo"}), kj::WriteMode::CREATE | kj::WriteMode::MODIFY);
+  SqliteKv kv(db);
+
+  struct Pair {
+    kj::String key;
+    kj::Array<byte> value;
+  };
+
+  // Enough keys to need several batches, with a partial batch at the end.
+  constexpr uint count = SqliteKv::BATCH_SIZE * 2 + 5;
+  kj::Vector<Pair> pairs;
+  kj::Vector<kj::String> allKeys;
+  for (uint i = 0; i < count; i++) {
+    pairs.add(Pair { kj::str("key", i), kj::heapArray(kj::str("value", i).asBytes()) });
+    allKeys.add(kj::str("key", i));
+  }
+  // The last value for a repeated key wins.
+  pairs.add(Pair { kj::str("key0"), kj::heapArray("overwritten"_kj.asBytes()) });
+  // Keys may contain NUL bytes.
+  pairs.add(Pair { kj::heapString("nul\0key", 7), kj::heapArray("x"_kj.asBytes()) });
+  kv.putMultiple(pairs);
+
+  auto get = [&](auto& keys) {
+    kj::Vector<kj::String> results;
+    kv.getMultiple(keys, [&](kj::StringPtr key, kj::ArrayPtr<const byte> value) {
+      results.add(kj::str(key, "=", value.asChars()));
+    });
+    std::sort(results.begin(), results.end(),
+        [](auto& a, auto& b) { return a < b; });
+    return results.releaseAsArray();
+  };
+
+  {
+    auto keys = kj::arr("key5"_kj, "missing"_kj, "key0"_kj, "key68"_kj);
+    KJ_EXPECT(kj::strArray(get(keys), ", ") == "key0=overwritten, key5=value5, key68=value68");
+  }
+  {
+    auto keys = kj::arr("key3"_kj);
+    KJ_EXPECT(kj::strArray(get(keys), ", ") == "key3=value3");
+  }
+  {
+    auto keys = kj::arr(kj::StringPtr("nul\0key", 7), "nul"_kj);
+    auto results = get(keys);
+    KJ_ASSERT(results.size() == 1);
+    KJ_EXPECT(results[0].size() == 9);
+  }
+
+  KJ_EXPECT(get(allKeys).size() == count);
+
+  {
+    auto keys = kj::arr("key0"_kj, "key0"_kj, "missing"_kj, "key1"_kj);
+    KJ_EXPECT(kv.deleteMultiple(keys) == 2);
+  }
+  KJ_EXPECT(kv.deleteMultiple(allKeys) == count - 2);
+  KJ_EXPECT(get(allKeys).size() == 0);
+}
+
+KJ_TEST("SQLite-KV views share a table without seeing each other's keys") {
+  auto dir = kj::newInMemoryDirectory(kj::nullClock());
+  SqliteDatabase::Vfs vfs(*dir);
+  SqliteDatabase db(vfs, kj::Path({"foo"}), kj::WriteMode::CREATE | kj::WriteMode::MODIFY);
+  SqliteKv shared(db);
+  SqliteKv a(shared, "a/");
+  SqliteKv b(shared, "b/");
+
+  a.put("foo", "1"_kj.asBytes());
+  a.put("bar", "2"_kj.asBytes());
+  b.put("foo", "3"_kj.asBytes());
+  b.put("qux", "4"_kj.asBytes());
+
+  auto list = [](SqliteKv& kv, auto&&... params) {
+    kj::Vector<kj::String> results;
+    kv.list(params..., [&](kj::StringPtr key, kj::ArrayPtr<const byte> value) {
+      results.add(kj::str(key, "=", value.asChars()));
+    });
+    return kj::strArray(results, ", ");
+  };
+
+  constexpr auto F = SqliteKv::FORWARD;
+  constexpr auto R = SqliteKv::REVERSE;
+
+  KJ_EXPECT(list(a, nullptr, nullptr, nullptr, F) == "bar=2, foo=1");
+  KJ_EXPECT(list(b, nullptr, nullptr, nullptr, R) == "qux=4, foo=3");
+  KJ_EXPECT(list(a, "c"_kj, nullptr, nullptr, F) == "foo=1");
+  KJ_EXPECT(list(b, nullptr, "g"_kj, 1u, F) == "foo=3");
+  KJ_EXPECT(list(shared, nullptr, nullptr, nullptr, F) == "a/bar=2, a/foo=1, b/foo=3, b/qux=4");
+
+  KJ_EXPECT(a.get("foo", [&](kj::ArrayPtr<const byte> value) {
+    KJ_EXPECT(kj::str(value.asChars()) == "1");
+  }));
+  KJ_EXPECT(!a.get("qux", [&](kj::ArrayPtr<const byte>) {}));
+
+  {
+    auto keys = kj::arr("foo"_kj, "qux"_kj);
+    kj::Vector<kj::String> results;
+    b.getMultiple(keys, [&](kj::StringPtr key, kj::ArrayPtr<const byte> value) {
+      results.add(kj::str(key, "=", value.asChars()));
+    });
+    std::sort(results.begin(), results.end(), [](auto& x, auto& y) { return x < y; });
+    KJ_EXPECT(kj::strArray(results, ", ") == "foo=3, qux=4");
+  }
+
+  KJ_EXPECT(!b.delete_("bar"));
+  KJ_EXPECT(b.deleteAll() == 2);
+  KJ_EXPECT(list(shared, nullptr, nullptr, nullptr, F) == "a/bar=2, a/foo=1");
+}
+
 }  // namespace
 }  // namespace workerd
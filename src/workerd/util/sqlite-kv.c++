@@ -3,10 +3,24 @@
 //     https://opensource.org/licenses/Apache-2.0
 
 #include "sqlite-kv.h"
+#include <kj/debug.h>
 
 namespace workerd {
 
-SqliteKv::SqliteKv(SqliteDatabase& db, bool): db(db) {}
+SqliteKv::SqliteKv(SqliteDatabase& db)
+    : ownStatements(kj::heap<Statements>(ensureInitialized(db))), stmts(*ownStatements) {}
+
+SqliteKv::SqliteKv(SqliteKv& shared, kj::StringPtr keyPrefix)
+    : stmts(shared.stmts), prefix(kj::str(keyPrefix)) {
+  KJ_REQUIRE(prefix.size() > 0 && shared.prefix.size() == 0,
+      "a view needs a prefix, and can't be made of another view");
+  KJ_REQUIRE(kj::byte(prefix.end()[-1]) != 0xff, "a view's prefix can't end with 0xff");
+
+  // The smallest key greater than every key with the prefix is the prefix with its last byte
+  // incremented.
+  prefixEnd = kj::str(prefix);
+  ++prefixEnd.end()[-1];
+}
 
 SqliteDatabase& SqliteKv::ensureInitialized(SqliteDatabase& db) {
   // TODO(sqlite): Do this automatically at a lower layer?
@@ -23,17 +37,32 @@ SqliteDatabase& SqliteKv::ensureInitialized(SqliteDatabase& db) {
 }
 
 void SqliteKv::put(KeyPtr key, ValuePtr value) {
-  stmtPut.run(key, value);
+  kj::String storage;
+  stmts.put.run(withPrefix(storage, key), value);
 }
 
 bool SqliteKv::delete_(KeyPtr key) {
-  auto query = stmtDelete.run(key);
+  kj::String storage;
+  auto query = stmts.delete_.run(withPrefix(storage, key));
   return query.changeCount() > 0;
 }
 
 uint SqliteKv::deleteAll() {
-  auto query = stmtDeleteAll.run();
-  return query.changeCount();
+  if (prefix.size() == 0) {
+    auto query = stmts.deleteAll.run();
+    return query.changeCount();
+  } else {
+    auto query = stmts.deleteRange.run(KeyPtr(prefix), KeyPtr(prefixEnd));
+    return query.changeCount();
+  }
+}
+
+kj::String SqliteKv::batchParams(kj::StringPtr param) {
+  auto params = kj::heapArrayBuilder<kj::StringPtr>(BATCH_SIZE);
+  for (uint i = 0; i < BATCH_SIZE; i++) {
+    params.add(param);
+  }
+  return kj::strArray(params.finish(), ", ");
 }
 
 }  // namespace workerd
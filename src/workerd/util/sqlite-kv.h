@@ -18,7 +18,14 @@ class SqliteKv {
   // obnoxious amount of string allocation.)
 
 public:
-  explicit SqliteKv(SqliteDatabase& db): SqliteKv(ensureInitialized(db), true) {}
+  explicit SqliteKv(SqliteDatabase& db);
+
+  SqliteKv(SqliteKv& shared, kj::StringPtr keyPrefix);
+  // A view of `shared`'s table containing only the keys that start with `keyPrefix`, which the
+  // view's methods add to and strip from keys. All views of a table share its prepared statements,
+  // so that one database can cheaply hold the data of many actors. `keyPrefix` must not be empty
+  // or end with a 0xff byte, and no view's prefix may be a prefix of another's. `shared` must
+  // outlive the view.
 
   typedef kj::StringPtr KeyPtr;
   typedef kj::ArrayPtr<const kj::byte> ValuePtr;
@@ -48,89 +55,145 @@ public:
   // Delete the key and return whether it was matched.
 
   uint deleteAll();
+  // Delete every key (in a view, every key with its prefix) and return how many there were.
+
+  static constexpr uint BATCH_SIZE = 32;
+  // The multi-key methods below run one prepared statement per BATCH_SIZE keys, with a `?` for
+  // each key. (The carray extension would allow one statement of any size, but only for
+  // NUL-terminated strings, and keys may contain NUL bytes.) Slots left over in the last batch are
+  // bound to NULL, which never matches a key, or for put, to a repeat of the last pair.
+
+  template <typename Keys, typename Func>
+  void getMultiple(const Keys& keys, Func&& callback);
+  // Like get() for each of `keys`, an array of anything convertible to KeyPtr. Calls the callback
+  // (with KeyPtr and ValuePtr parameters) once for each key that exists, in no particular order.
 
-  // TODO(perf): Should we provide multi-get, multi-put, and multi-delete? It's a bit tricky to
-  //   implement them as single SQL queries, while still using prepared statements. The c-array
-  //   extension might help here, though it can only support arrays of NUL-terminated strings, not
-  //   byte blobs or strings containing NUL bytes.
+  template <typename Pairs>
+  void putMultiple(const Pairs& pairs);
+  // Like put() for each of `pairs`, an array of structs with `key` and `value` members
+  // convertible to KeyPtr and ValuePtr. If a key appears more than once, the last value wins.
+
+  template <typename Keys>
+  uint deleteMultiple(const Keys& keys);
+  // Like delete_() for each of `keys`, returning the number of keys matched.
 
 private:
-  SqliteDatabase& db;
-
-  SqliteDatabase::Statement stmtGet = db.prepare(R"(
-    SELECT value FROM _cf_KV WHERE key = ?
-  )");
-  SqliteDatabase::Statement stmtPut = db.prepare(R"(
-    INSERT INTO _cf_KV VALUES(?, ?)
-      ON CONFLICT DO UPDATE SET value = excluded.value;
-  )");
-  SqliteDatabase::Statement stmtDelete = db.prepare(R"(
-    DELETE FROM _cf_KV WHERE key = ?
-  )");
-  SqliteDatabase::Statement stmtList = db.prepare(R"(
-    SELECT * FROM _cf_KV
-    WHERE key >= ?
-    ORDER BY key
-  )");
-  SqliteDatabase::Statement stmtListEnd = db.prepare(R"(
-    SELECT * FROM _cf_KV
-    WHERE key >= ? AND key < ?
-    ORDER BY key
-  )");
-  SqliteDatabase::Statement stmtListLimit = db.prepare(R"(
-    SELECT * FROM _cf_KV
-    WHERE key >= ?
-    ORDER BY key
-    LIMIT ?
-  )");
-  SqliteDatabase::Statement stmtListEndLimit = db.prepare(R"(
-    SELECT * FROM _cf_KV
-    WHERE key >= ? AND key < ?
-    ORDER BY key
-    LIMIT ?
-  )");
-  SqliteDatabase::Statement stmtListReverse = db.prepare(R"(
-    SELECT * FROM _cf_KV
-    WHERE key >= ?
-    ORDER BY key DESC
-  )");
-  SqliteDatabase::Statement stmtListEndReverse = db.prepare(R"(
-    SELECT * FROM _cf_KV
-    WHERE key >= ? AND key < ?
-    ORDER BY key DESC
-  )");
-  SqliteDatabase::Statement stmtListLimitReverse = db.prepare(R"(
-    SELECT * FROM _cf_KV
-    WHERE key >= ?
-    ORDER BY key DESC
-    LIMIT ?
-  )");
-  SqliteDatabase::Statement stmtListEndLimitReverse = db.prepare(R"(
-    SELECT * FROM _cf_KV
-    WHERE key >= ? AND key < ?
-    ORDER BY key DESC
-    LIMIT ?
-  )");
-  SqliteDatabase::Statement stmtDeleteAll = db.prepare(R"(
-    DELETE FROM _cf_KV
-  )");
-
-  SqliteDatabase& ensureInitialized(SqliteDatabase& db);
+  struct Statements {
+    explicit Statements(SqliteDatabase& db): db(db) {}
+
+    SqliteDatabase& db;
+
+    SqliteDatabase::Statement get = db.prepare(R"(
+      SELECT value FROM _cf_KV WHERE key = ?
+    )");
+    SqliteDatabase::Statement put = db.prepare(R"(
+      INSERT INTO _cf_KV VALUES(?, ?)
+        ON CONFLICT DO UPDATE SET value = excluded.value;
+    )");
+    SqliteDatabase::Statement delete_ = db.prepare(R"(
+      DELETE FROM _cf_KV WHERE key = ?
+    )");
+    SqliteDatabase::Statement list = db.prepare(R"(
+      SELECT * FROM _cf_KV
+      WHERE key >= ?
+      ORDER BY key
+    )");
+    SqliteDatabase::Statement listEnd = db.prepare(R"(
+      SELECT * FROM _cf_KV
+      WHERE key >= ? AND key < ?
+      ORDER BY key
+    )");
+    SqliteDatabase::Statement listLimit = db.prepare(R"(
+      SELECT * FROM _cf_KV
+      WHERE key >= ?
+      ORDER BY key
+      LIMIT ?
+    )");
+    SqliteDatabase::Statement listEndLimit = db.prepare(R"(
+      SELECT * FROM _cf_KV
+      WHERE key >= ? AND key < ?
+      ORDER BY key
+      LIMIT ?
+    )");
+    SqliteDatabase::Statement listReverse = db.prepare(R"(
+      SELECT * FROM _cf_KV
+      WHERE key >= ?
+      ORDER BY key DESC
+    )");
+    SqliteDatabase::Statement listEndReverse = db.prepare(R"(
+      SELECT * FROM _cf_KV
+      WHERE key >= ? AND key < ?
+      ORDER BY key DESC
+    )");
+    SqliteDatabase::Statement listLimitReverse = db.prepare(R"(
+      SELECT * FROM _cf_KV
+      WHERE key >= ?
+      ORDER BY key DESC
+      LIMIT ?
+    )");
+    SqliteDatabase::Statement listEndLimitReverse = db.prepare(R"(
+      SELECT * FROM _cf_KV
+      WHERE key >= ? AND key < ?
+      ORDER BY key DESC
+      LIMIT ?
+    )");
+    SqliteDatabase::Statement deleteAll = db.prepare(R"(
+      DELETE FROM _cf_KV
+    )");
+    SqliteDatabase::Statement deleteRange = db.prepare(R"(
+      DELETE FROM _cf_KV WHERE key >= ? AND key < ?
+    )");
+    SqliteDatabase::Statement getMultiple = db.prepare(SqliteDatabase::TRUSTED, kj::str(
+        "SELECT key, value FROM _cf_KV WHERE key IN (", batchParams("?"), ")"));
+    SqliteDatabase::Statement putMultiple = db.prepare(SqliteDatabase::TRUSTED, kj::str(
+        "INSERT INTO _cf_KV VALUES ", batchParams("(?, ?)"),
+        " ON CONFLICT DO UPDATE SET value = excluded.value"));
+    SqliteDatabase::Statement deleteMultiple = db.prepare(SqliteDatabase::TRUSTED, kj::str(
+        "DELETE FROM _cf_KV WHERE key IN (", batchParams("?"), ")"));
+  };
+
+  kj::Own<Statements> ownStatements;
+  // Null in a view.
+
+  Statements& stmts;
+
+  kj::String prefix;
+  // Empty unless this is a view.
+
+  kj::String prefixEnd;
+  // In a view, the first key after every key starting with `prefix`.
+
+  KeyPtr withPrefix(kj::String& storage, KeyPtr key) const;
+  // Returns `key` with the view's prefix prepended, using `storage` to hold it if this is a view.
+  // SQLite doesn't copy bound keys, so `storage` must outlive any query the result is bound to.
+
+  KeyPtr unprefixed(KeyPtr key) { return key.slice(prefix.size()); }
+  // Strips the view's prefix from a key found in the table.
+
+  static SqliteDatabase& ensureInitialized(SqliteDatabase& db);
   // Make sure the KV table is created, then return the same object.
 
-  SqliteKv(SqliteDatabase& db, bool);
+  static kj::String batchParams(kj::StringPtr param);
+  // Returns `param` repeated BATCH_SIZE times, separated by commas.
 };
 
 // =======================================================================================
 // inline implementation details
 //
-// We define these two methods as templates rather than ues kj::Function since they're not too
+// We define these methods as templates rather than ues kj::Function since they're not too
 // complicated and avoiding the virtual call is nice. Plus in list()'s case, the actual call sites
 // pass constants for `order` so the `order ==` branch can be eliminated.
 
+inline SqliteKv::KeyPtr SqliteKv::withPrefix(kj::String& storage, KeyPtr key) const {
+  if (prefix.size() == 0) return key;
+  storage = kj::str(prefix, key);
+  return storage;
+}
+
 template <typename Func>
 bool SqliteKv::get(KeyPtr key, Func&& callback) {
-  auto query = stmtGet.run(key);
+  kj::String storage;
+  auto query = stmts.get.run(withPrefix(storage, key));
 
   if (query.isDone()) {
     return false;
@@ -143,10 +206,20 @@ bool SqliteKv::get(KeyPtr key, Func&& callback) {
 template <typename Func>
 uint SqliteKv::list(KeyPtr begin, kj::Maybe<KeyPtr> end, kj::Maybe<uint> limit, Order order,
                     Func&& callback) {
+  kj::String beginStorage;
+  begin = withPrefix(beginStorage, begin);
+  kj::String endStorage;
+  KJ_IF_MAYBE(e, end) {
+    end = withPrefix(endStorage, *e);
+  } else if (prefix.size() > 0) {
+    // A view's keys all sort before `prefixEnd`.
+    end = KeyPtr(prefixEnd);
+  }
+
   auto iterate = [&](SqliteDatabase::Query&& query) {
     size_t count = 0;
     while (!query.isDone()) {
-      callback(query.getText(0), query.getBlob(1));
+      callback(unprefixed(query.getText(0)), query.getBlob(1));
       query.nextRow();
       ++count;
     }
@@ -156,32 +229,108 @@ uint SqliteKv::list(KeyPtr begin, kj::Maybe<KeyPtr> end, kj::Maybe<uint> limit,
   if (order == Order::FORWARD) {
     KJ_IF_MAYBE(e, end) {
       KJ_IF_MAYBE(l, limit) {
-        return iterate(stmtListEndLimit.run(begin, *e, (int64_t)*l));
+        return iterate(stmts.listEndLimit.run(begin, *e, (int64_t)*l));
       } else {
-        return iterate(stmtListEnd.run(begin, *e));
+        return iterate(stmts.listEnd.run(begin, *e));
       }
     } else {
       KJ_IF_MAYBE(l, limit) {
-        return iterate(stmtListLimit.run(begin, (int64_t)*l));
+        return iterate(stmts.listLimit.run(begin, (int64_t)*l));
       } else {
-        return iterate(stmtList.run(begin));
+        return iterate(stmts.list.run(begin));
       }
     }
   } else {
     KJ_IF_MAYBE(e, end) {
       KJ_IF_MAYBE(l, limit) {
-        return iterate(stmtListEndLimitReverse.run(begin, *e, (int64_t)*l));
+        return iterate(stmts.listEndLimitReverse.run(begin, *e, (int64_t)*l));
       } else {
-        return iterate(stmtListEndReverse.run(begin, *e));
+        return iterate(stmts.listEndReverse.run(begin, *e));
       }
     } else {
       KJ_IF_MAYBE(l, limit) {
-        return iterate(stmtListLimitReverse.run(begin, (int64_t)*l));
+        return iterate(stmts.listLimitReverse.run(begin, (int64_t)*l));
+      } else {
+        return iterate(stmts.listReverse.run(begin));
+      }
+    }
+  }
+}
+
+template <typename Keys, typename Func>
+void SqliteKv::getMultiple(const Keys& keys, Func&& callback) {
+  if (keys.size() == 1) {
+    // Not worth binding a whole batch.
+    KeyPtr key = keys[0];
+    get(key, [&](ValuePtr value) { callback(key, value); });
+    return;
+  }
+
+  SqliteDatabase::Query::ValuePtr bindings[BATCH_SIZE];
+  kj::String storage[BATCH_SIZE];
+  for (size_t start = 0; start < keys.size(); start += BATCH_SIZE) {
+    for (size_t i = 0; i < BATCH_SIZE; i++) {
+      if (start + i < keys.size()) {
+        bindings[i] = withPrefix(storage[i], keys[start + i]);
       } else {
-        return iterate(stmtListReverse.run(begin));
+        bindings[i] = nullptr;
       }
     }
+
+    auto query = stmts.getMultiple.run(
+        kj::ArrayPtr<const SqliteDatabase::Query::ValuePtr>(bindings, BATCH_SIZE));
+    while (!query.isDone()) {
+      callback(unprefixed(query.getText(0)), query.getBlob(1));
+      query.nextRow();
+    }
+  }
+}
+
+template <typename Pairs>
+void SqliteKv::putMultiple(const Pairs& pairs) {
+  if (pairs.size() == 1) {
+    put(pairs[0].key, pairs[0].value);
+    return;
+  }
+
+  SqliteDatabase::Query::ValuePtr bindings[BATCH_SIZE * 2];
+  kj::String storage[BATCH_SIZE];
+  for (size_t start = 0; start < pairs.size(); start += BATCH_SIZE) {
+    for (size_t i = 0; i < BATCH_SIZE; i++) {
+      // Re-inserting the last pair is harmless, and keeps it the last value for its key.
+      auto& pair = pairs[kj::min(start + i, pairs.size() - 1)];
+      bindings[i * 2] = withPrefix(storage[i], pair.key);
+      bindings[i * 2 + 1] = ValuePtr(pair.value);
+    }
+
+    stmts.putMultiple.run(
+        kj::ArrayPtr<const SqliteDatabase::Query::ValuePtr>(bindings, BATCH_SIZE * 2));
+  }
+}
+
+template <typename Keys>
+uint SqliteKv::deleteMultiple(const Keys& keys) {
+  if (keys.size() == 1) {
+    return delete_(keys[0]);
+  }
+
+  uint count = 0;
+  SqliteDatabase::Query::ValuePtr bindings[BATCH_SIZE];
+  kj::String storage[BATCH_SIZE];
+  for (size_t start = 0; start < keys.size(); start += BATCH_SIZE) {
+    for (size_t i = 0; i < BATCH_SIZE; i++) {
+      if (start + i < keys.size()) {
+        bindings[i] = withPrefix(storage[i], keys[start + i]);
+      } else {
+        bindings[i] = nullptr;
+      }
+    }
+
+    auto query = stmts.deleteMultiple.run(
+        kj::ArrayPtr<const SqliteDatabase::Query::ValuePtr>(bindings, BATCH_SIZE));
+    count += query.changeCount();
   }
+  return count;
 }
 
 }  // namespace workerd
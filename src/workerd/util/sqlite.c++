@@ -349,6 +349,12 @@ void SqliteDatabase::notifyWrite() {
   }
 }
 
+void SqliteDatabase::notifyRollback() {
+  KJ_IF_MAYBE(cb, onRollbackCallback) {
+    (*cb)();
+  }
+}
+
 kj::StringPtr SqliteDatabase::getCurrentQueryForDebug() {
   KJ_IF_MAYBE(s, currentStatement) {
     return sqlite3_normalized_sql(s);
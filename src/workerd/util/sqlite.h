@@ -85,6 +85,12 @@ public:
   // to be nested inside the automatic transaction, so we need to force an auto-transaction to
   // start before the SAVEPOINT.
 
+  void onRollback(kj::Function<void()> callback) { onRollbackCallback = kj::mv(callback); }
+  void notifyRollback();
+  // notifyRollback() invokes the onRollback() callback. Callers must call it after rolling back a
+  // transaction or savepoint, so that anything caching the database's contents can discard
+  // whatever the rollback may have undone.
+
   kj::StringPtr getCurrentQueryForDebug();
   // Get the currently-executing SQL query for debug purposes. The query is normalized to hide
   // any literal values that might contain sensitive information. This is intended to be safe for
@@ -100,6 +106,7 @@ private:
   // Set while a statement is executing.
 
   kj::Maybe<kj::Function<void()>> onWriteCallback;
+  kj::Maybe<kj::Function<void()>> onRollbackCallback;
 
   void close();
 
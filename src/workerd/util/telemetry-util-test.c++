@@ -0,0 +1,66 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#include "telemetry-util.h"
+#include <kj/test.h>
+
+namespace workerd {
+namespace {
+
+kj::String quoted(kj::StringPtr text) {
+  kj::Vector<char> out;
+  appendJsonString(out, text);
+  out.add('\0');
+  return kj::String(out.releaseAsArray());
+}
+
+KJ_TEST("appendJsonString escapes quotes, backslashes and control characters") {
+  KJ_EXPECT(quoted("plain") == "\"plain\"");
+  KJ_EXPECT(quoted("a\"b\\c") == "\"a\\\"b\\\\c\"");
+  KJ_EXPECT(quoted("\b\f\n\r\t") == "\"\\b\\f\\n\\r\\t\"");
+  KJ_EXPECT(quoted("\x01\x1f") == "\"\\u0001\\u001f\"");
+  KJ_EXPECT(quoted("caf\xc3\xa9") == "\"caf\xc3\xa9\"");
+
+  KJ_EXPECT(kj::str(escapeJsonString("say \"hi\"\n")) == "say \\\"hi\\\"\\n");
+}
+
+KJ_TEST("sampleRateToThreshold") {
+  KJ_EXPECT(samplesNothing(sampleRateToThreshold(0)));
+  KJ_EXPECT(samplesNothing(sampleRateToThreshold(-1)));
+  KJ_EXPECT(samplesNothing(sampleRateToThreshold(kj::nan())));
+  KJ_EXPECT(samplesEverything(sampleRateToThreshold(1)));
+  KJ_EXPECT(samplesEverything(sampleRateToThreshold(2)));
+
+  auto half = sampleRateToThreshold(0.5);
+  KJ_EXPECT(half == uint64_t(1) << 63);
+  KJ_EXPECT(isSampled(half, 0));
+  KJ_EXPECT(isSampled(half, half - 1));
+  KJ_EXPECT(!isSampled(half, half));
+  KJ_EXPECT(isSampled(sampleRateToThreshold(1), kj::maxValue));
+}
+
+KJ_TEST("StringRingBuffer is bounded and FIFO") {
+  StringRingBuffer buffer(3);
+  KJ_EXPECT(buffer.capacity() == 4);
+
+  for (uint i = 0; i < 4; i++) {
+    auto item = kj::str(i);
+    KJ_EXPECT(buffer.tryPush(item));
+  }
+  auto extra = kj::str("extra");
+  KJ_EXPECT(!buffer.tryPush(extra));
+  KJ_EXPECT(extra == "extra");
+
+  KJ_EXPECT(KJ_ASSERT_NONNULL(buffer.tryPop()) == "0");
+  auto again = kj::str("4");
+  KJ_EXPECT(buffer.tryPush(again));
+
+  for (uint i = 1; i <= 4; i++) {
+    KJ_EXPECT(KJ_ASSERT_NONNULL(buffer.tryPop()) == kj::str(i));
+  }
+  KJ_EXPECT(buffer.tryPop() == nullptr);
+}
+
+}  // namespace
+}  // namespace workerd
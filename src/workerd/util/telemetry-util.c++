@@ -0,0 +1,118 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#include "telemetry-util.h"
+
+namespace workerd {
+
+namespace {
+
+void appendEscaped(kj::Vector<char>& out, kj::StringPtr text) {
+  static const char HEXDIGITS[] = "0123456789abcdef";
+  for (char c: text) {
+    switch (c) {
+      case '\"': out.addAll("\\\""_kj); break;
+      case '\\': out.addAll("\\\\"_kj); break;
+      case '\b': out.addAll("\\b"_kj); break;
+      case '\f': out.addAll("\\f"_kj); break;
+      case '\n': out.addAll("\\n"_kj); break;
+      case '\r': out.addAll("\\r"_kj); break;
+      case '\t': out.addAll("\\t"_kj); break;
+      default:
+        if (static_cast<uint8_t>(c) < 0x20) {
+          out.addAll("\\u00"_kj);
+          out.add(HEXDIGITS[static_cast<uint8_t>(c) / 16]);
+          out.add(HEXDIGITS[static_cast<uint8_t>(c) % 16]);
+        } else {
+          out.add(c);
+        }
+        break;
+    }
+  }
+}
+
+}  // namespace
+
+void appendJsonString(kj::Vector<char>& out, kj::StringPtr text) {
+  out.add('"');
+  appendEscaped(out, text);
+  out.add('"');
+}
+
+kj::Vector<char> escapeJsonString(kj::StringPtr text) {
+  kj::Vector<char> escaped(text.size() + 1);
+  appendEscaped(escaped, text);
+  return escaped;
+}
+
+uint64_t sampleRateToThreshold(double sampleRate) {
+  double scaled = sampleRate * 18446744073709551616.0;  // 2^64
+  if (!(scaled > 0)) {
+    return 0;
+  } else if (scaled >= 18446744073709551615.0) {
+    return kj::maxValue;
+  } else {
+    return uint64_t(scaled);
+  }
+}
+
+// =======================================================================================
+// StringRingBuffer
+
+StringRingBuffer::StringRingBuffer(uint capacity) {
+  uint64_t size = 2;
+  while (size < capacity) size <<= 1;
+  mask = size - 1;
+  slots = kj::heapArray<Slot>(size);
+  for (uint64_t i = 0; i < size; i++) {
+    slots[i].sequence = i;
+  }
+}
+
+bool StringRingBuffer::tryPush(kj::String& item) {
+  uint64_t pos = __atomic_load_n(&pushPos, __ATOMIC_RELAXED);
+  for (;;) {
+    Slot& slot = slots[pos & mask];
+    uint64_t sequence = __atomic_load_n(&slot.sequence, __ATOMIC_ACQUIRE);
+    int64_t diff = int64_t(sequence - pos);
+    if (diff == 0) {
+      // The slot is free on this lap. Claim it; on failure `pos` is reloaded and we retry.
+      if (__atomic_compare_exchange_n(&pushPos, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        slot.value = kj::mv(item);
+        __atomic_store_n(&slot.sequence, pos + 1, __ATOMIC_RELEASE);
+        return true;
+      }
+    } else if (diff < 0) {
+      // The slot still holds a value from the previous lap: the buffer is full.
+      return false;
+    } else {
+      pos = __atomic_load_n(&pushPos, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+kj::Maybe<kj::String> StringRingBuffer::tryPop() {
+  uint64_t pos = __atomic_load_n(&popPos, __ATOMIC_RELAXED);
+  for (;;) {
+    Slot& slot = slots[pos & mask];
+    uint64_t sequence = __atomic_load_n(&slot.sequence, __ATOMIC_ACQUIRE);
+    int64_t diff = int64_t(sequence - (pos + 1));
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&popPos, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        kj::String result = kj::mv(slot.value);
+        __atomic_store_n(&slot.sequence, pos + mask + 1, __ATOMIC_RELEASE);
+        return kj::mv(result);
+      }
+    } else if (diff < 0) {
+      // Nothing has been pushed into this slot yet: the buffer is empty.
+      return nullptr;
+    } else {
+      pos = __atomic_load_n(&popPos, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+}  // namespace workerd
@@ -0,0 +1,66 @@
+// Copyright (c) 2017-2022 Cloudflare, Inc.
+// Licensed under the Apache 2.0 license found in the LICENSE file or at:
+//     https://opensource.org/licenses/Apache-2.0
+
+#pragma once
+// Building blocks shared by the native exporters for access logs and trace spans.
+
+#include <kj/string.h>
+#include <kj/vector.h>
+#include <inttypes.h>
+
+namespace workerd {
+
+using kj::uint;
+
+void appendJsonString(kj::Vector<char>& out, kj::StringPtr text);
+// Appends `text` to `out` as a quoted JSON string.
+
+kj::Vector<char> escapeJsonString(kj::StringPtr text);
+// Returns `text` escaped for use inside a JSON string, without the surrounding quotes.
+
+uint64_t sampleRateToThreshold(double sampleRate);
+// Converts a sampling rate, from 0 to 1, into a threshold for `isSampled()`. Rates at or below
+// zero (including NaN) never sample; rates at or above one always do.
+
+inline bool isSampled(uint64_t threshold, uint64_t randomDraw) {
+  // True if the event whose uniformly random 64-bit draw is `randomDraw` should be sampled.
+  return threshold == uint64_t(kj::maxValue) || randomDraw < threshold;
+}
+
+inline bool samplesNothing(uint64_t threshold) { return threshold == 0; }
+inline bool samplesEverything(uint64_t threshold) { return threshold == uint64_t(kj::maxValue); }
+// Let callers skip drawing a random number when the outcome is already known.
+
+class StringRingBuffer {
+  // Bounded multi-producer, multi-consumer queue of strings. Pushing and popping never block: a
+  // push into a full buffer fails and the caller drops the item.
+  //
+  // Each slot carries a sequence number recording which lap of the ring it is ready for, so
+  // producers and consumers only contend on their own position counter.
+
+public:
+  explicit StringRingBuffer(uint capacity);
+  // `capacity` is rounded up to a power of two.
+
+  bool tryPush(kj::String& item);
+  // Moves `item` into the buffer, unless it is full, in which case `item` is left untouched and
+  // false is returned.
+
+  kj::Maybe<kj::String> tryPop();
+
+  uint capacity() const { return mask + 1; }
+
+private:
+  struct Slot {
+    uint64_t sequence;
+    kj::String value;
+  };
+
+  kj::Array<Slot> slots;
+  uint64_t mask;
+  uint64_t pushPos = 0;
+  uint64_t popPos = 0;
+};
+
+}  // namespace workerd